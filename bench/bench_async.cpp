@@ -0,0 +1,232 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Compares the coroutine facade with a thread per client on an echo workload.
+ *
+ * Every client has a private pair of FIFOs to its own echo conversation and sends 64 byte
+ * requests one at a time, checking that each reply echoes its request. "coro" runs every client
+ * and every echo conversation as coroutines on the calling thread; "threads" gives each client
+ * and each echo conversation a thread that blocks in pipe_conn_send_msg()/pipe_conn_recv_msg().
+ * The rate is round trips per second over all clients, from the first request until the last
+ * conversation ended.
+ *
+ * usage - bench_async [round trips per run]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include <vector>
+
+#include "pipe_async.hpp"
+#include "pipe_handler.h"
+
+#define BENCH_ASYNC_NAME "/tmp/my_pipe_bench_async"
+#define MSG_SIZE 64
+#define IO_TIMEOUT 10
+#define THREAD_STACK (256 * 1024)
+
+struct client {
+    pipe_conn_t conn;           // client end, sends requests and receives echoes
+    pipe_conn_t echo;           // the echo conversation's end
+    int id;
+    long count;
+    long done;
+    long bad;
+};
+
+static void make_request(char *msg, int id, long i) {
+    memset(msg, 'x', MSG_SIZE);
+    snprintf(msg, MSG_SIZE, "%d:%ld", id, i);
+}
+
+static bool check_echo(const char *msg, const struct pipe_frame *reply, int len) {
+    return len == MSG_SIZE && memcmp(reply->payload, msg, MSG_SIZE) == 0;
+}
+
+static cpipe::task<> echo_coro(cpipe::scheduler &s, client *c) {
+    struct pipe_frame msg;
+
+    while (co_await cpipe::async_recv(s, &c->echo, &msg, pipe_deadline_from_timeout(IO_TIMEOUT)) >= 0 &&
+           msg.hdr.type != PIPE_MSG_BYE) {
+        if (co_await cpipe::async_send(s, &c->echo, msg.hdr.type, msg.payload, msg.hdr.len,
+                                       pipe_deadline_from_timeout(IO_TIMEOUT)) == -1) {
+            break;
+        }
+    }
+}
+
+static cpipe::task<> client_coro(cpipe::scheduler &s, client *c) {
+    char msg[MSG_SIZE];
+    struct pipe_frame reply;
+
+    for (long i = 0; i < c->count; i++) {
+        make_request(msg, c->id, i);
+        int len = co_await cpipe::async_request(s, &c->conn, PIPE_MSG_DATA, msg, MSG_SIZE, &reply,
+                                                pipe_deadline_from_timeout(IO_TIMEOUT));
+        if (len == -1) {
+            break;
+        }
+        c->bad += !check_echo(msg, &reply, len);
+        c->done++;
+    }
+    co_await cpipe::async_send(s, &c->conn, PIPE_MSG_BYE, NULL, 0, pipe_deadline_from_timeout(IO_TIMEOUT));
+}
+
+static void *echo_thread(void *arg) {
+    client *c = static_cast<client *>(arg);
+    struct pipe_frame msg;
+
+    while (pipe_conn_recv_msg(&c->echo, &msg, pipe_deadline_from_timeout(IO_TIMEOUT)) >= 0 && msg.hdr.type != PIPE_MSG_BYE) {
+        if (pipe_conn_send_msg(&c->echo, msg.hdr.type, msg.payload, msg.hdr.len, pipe_deadline_from_timeout(IO_TIMEOUT)) == -1) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void *client_thread(void *arg) {
+    client *c = static_cast<client *>(arg);
+    char msg[MSG_SIZE];
+    struct pipe_frame reply;
+
+    for (long i = 0; i < c->count; i++) {
+        make_request(msg, c->id, i);
+        if (pipe_conn_send_msg(&c->conn, PIPE_MSG_DATA, msg, MSG_SIZE, pipe_deadline_from_timeout(IO_TIMEOUT)) == -1) {
+            break;
+        }
+        int len = pipe_conn_recv_msg(&c->conn, &reply, pipe_deadline_from_timeout(IO_TIMEOUT));
+        if (len == -1) {
+            break;
+        }
+        c->bad += !check_echo(msg, &reply, len);
+        c->done++;
+    }
+    pipe_conn_send_msg(&c->conn, PIPE_MSG_BYE, NULL, 0, pipe_deadline_from_timeout(IO_TIMEOUT));
+    return NULL;
+}
+
+static void fifo_names(int i, char *up, char *down) {
+    snprintf(up, PIPE_NAME_MAX, "%s.%d.up", BENCH_ASYNC_NAME, i);
+    snprintf(down, PIPE_NAME_MAX, "%s.%d.down", BENCH_ASYNC_NAME, i);
+}
+
+static int open_clients(std::vector<client> &clients, long count) {
+    char up[PIPE_NAME_MAX], down[PIPE_NAME_MAX];
+
+    for (size_t i = 0; i < clients.size(); i++) {
+        fifo_names((int)i, up, down);
+        clients[i] = client{};
+        clients[i].id = (int)i;
+        clients[i].count = count / (long)clients.size();
+        if (pipe_conn_open(&clients[i].conn, up, down) == -1 || pipe_conn_open(&clients[i].echo, down, up) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int close_clients(std::vector<client> &clients, const char *mode, double secs) {
+    char up[PIPE_NAME_MAX], down[PIPE_NAME_MAX];
+    long done = 0, bad = 0, want = 0;
+
+    for (size_t i = 0; i < clients.size(); i++) {
+        done += clients[i].done;
+        bad += clients[i].bad;
+        want += clients[i].count;
+        pipe_conn_close(&clients[i].conn);
+        pipe_conn_close(&clients[i].echo);
+        fifo_names((int)i, up, down);
+        unlink(up);
+        unlink(down);
+    }
+    printf("bench=echo mode=%-7s clients=%-5zu %10.0f round trips/s done=%ld/%ld bad=%ld\n", mode, clients.size(),
+           done / secs, done, want, bad);
+    return done == want && bad == 0 ? 0 : -1;
+}
+
+static int bench_coro(size_t nclients, long count) {
+    std::vector<client> clients(nclients);
+    cpipe::scheduler s;
+    uint64_t t0;
+
+    if (open_clients(clients, count) == -1) {
+        return -1;
+    }
+    for (size_t i = 0; i < nclients; i++) {
+        s.spawn(echo_coro(s, &clients[i]));
+        s.spawn(client_coro(s, &clients[i]));
+    }
+    t0 = pipe_now_ns();
+    s.run();
+    return close_clients(clients, "coro", (pipe_now_ns() - t0) / 1e9);
+}
+
+static int bench_threads(size_t nclients, long count) {
+    std::vector<client> clients(nclients);
+    std::vector<pthread_t> tids;
+    pthread_attr_t attr;
+    uint64_t t0;
+
+    if (open_clients(clients, count) == -1) {
+        return -1;
+    }
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, THREAD_STACK);
+    t0 = pipe_now_ns();
+    for (size_t i = 0; i < nclients; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, &attr, echo_thread, &clients[i]) == 0) {
+            tids.push_back(tid);
+        }
+        if (pthread_create(&tid, &attr, client_thread, &clients[i]) == 0) {
+            tids.push_back(tid);
+        }
+    }
+    for (pthread_t tid : tids) {
+        pthread_join(tid, NULL);
+    }
+    pthread_attr_destroy(&attr);
+    return close_clients(clients, "threads", (pipe_now_ns() - t0) / 1e9);
+}
+
+int main(int argc, char *argv[]) {
+    static const size_t client_counts[] = { 1, 10, 100, 1000 };
+    long count = argc > 1 ? atol(argv[1]) : 200000;
+    int ret = 0;
+
+    signal(SIGPIPE, SIG_IGN);
+    printf("cpus=%ld\n", sysconf(_SC_NPROCESSORS_ONLN));
+    for (size_t n : client_counts) {
+        ret |= bench_coro(n, count);
+        ret |= bench_threads(n, count);
+    }
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,143 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Measures sender throughput with and without writev() batching.
+ *
+ * For each message size a reader thread drains the FIFO while the writer sends framed messages
+ * either one writev() per message or through a pipe_batch. The writer's write syscalls are taken
+ * from /proc/thread-self/io.
+ *
+ * usage - bench_batch [messages]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include "pipe_handler.h"
+#include "pipe_frame.h"
+#include "pipe_batch.h"
+#include "pipe_time.h"
+
+#define BENCH_PIPE_NAME "/tmp/my_pipe_bench_batch"
+
+struct reader_args {
+    int fd;
+    size_t expect;
+};
+
+static void *reader_thread(void *arg) {
+    struct reader_args *ra = arg;
+    static char buf[1 << 16];
+    size_t got = 0;
+
+    while (got < ra->expect) {
+        ssize_t n = read(ra->fd, buf, sizeof(buf));
+        if (n > 0) {
+            got += n;
+        } else {
+            wait_pipe(ra->fd, POLLIN, pipe_deadline_from_timeout(1));
+        }
+    }
+    return NULL;
+}
+
+static uint64_t thread_write_syscalls(void) {
+    char line[128];
+    uint64_t value = 0;
+    FILE *f = fopen("/proc/thread-self/io", "r");
+
+    if (f == NULL) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "syscw: %lu", &value) == 1) {
+            break;
+        }
+    }
+    fclose(f);
+    return value;
+}
+
+static void run(size_t size, int count, bool batched) {
+    struct reader_args ra;
+    struct pipe_frame_hdr hdr;
+    pipe_batch_t batch;
+    pthread_t tid;
+    int keepalive_fd, wfd;
+    char *payload = calloc(1, size);
+
+    ra.fd = open_pipe_persistent(BENCH_PIPE_NAME, &keepalive_fd);
+    ra.expect = (size_t)count * (PIPE_FRAME_HDR_SIZE + size);
+    wfd = open_pipe(BENCH_PIPE_NAME, false);
+    pthread_create(&tid, NULL, reader_thread, &ra);
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.len = size;
+    hdr.type = PIPE_MSG_DATA;
+    pipe_batch_init(&batch, wfd, true, 0, PIPE_NSEC_PER_MSEC);
+    batch.deadline = pipe_deadline_from_timeout(10);
+
+    uint64_t sys0 = thread_write_syscalls();
+    uint64_t t0 = pipe_now_ns();
+    for (int i = 0; i < count; i++) {
+        hdr.seq = i;
+        if (batched) {
+            pipe_batch_add(&batch, &hdr, payload);
+        } else {
+            pipe_frame_write(wfd, &hdr, payload, pipe_deadline_from_timeout(10));
+        }
+    }
+    pipe_batch_flush(&batch);
+    uint64_t sys1 = thread_write_syscalls();
+    pthread_join(tid, NULL);
+    uint64_t t1 = pipe_now_ns();
+
+    printf("size=%-5zu batching=%-3s msgs/s=%10.0f syscalls/msg=%.4f\n", size, batched ? "on" : "off",
+           count / ((t1 - t0) / 1e9), (double)(sys1 - sys0) / count);
+
+    close(wfd);
+    close(ra.fd);
+    close(keepalive_fd);
+    free(payload);
+}
+
+int main(int argc, char *argv[]) {
+    static const size_t sizes[] = { 16, 64, 256, 1024 };
+    int count = argc > 1 ? atoi(argv[1]) : 200000;
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        run(sizes[i], count, false);
+        run(sizes[i], count, true);
+    }
+    unlink(BENCH_PIPE_NAME);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,111 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Compares bulk transfer throughput of vmsplice()/splice() against plain write()/read().
+ *
+ * A writer thread sends PIPE_MSG_BULK frames from a page aligned buffer and the reader moves each
+ * payload into /dev/null, for payload sizes from 64 KiB to 64 MiB.
+ *
+ * usage - bench_bulk [total MiB per size]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "pipe_handler.h"
+#include "pipe_bulk.h"
+#include "pipe_time.h"
+
+#define BENCH_PIPE_NAME "/tmp/my_pipe_bench_bulk"
+
+struct writer_args {
+    int fd;
+    char *buf;
+    size_t size;
+    int reps;
+    int flags;
+};
+
+static void *writer_thread(void *arg) {
+    struct writer_args *wa = arg;
+
+    for (int i = 0; i < wa->reps; i++) {
+        if (pipe_bulk_send_frame(wa->fd, i, wa->buf, wa->size, wa->flags, pipe_deadline_from_timeout(10)) == -1) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void run(size_t size, size_t total, int flags) {
+    struct writer_args wa;
+    struct pipe_frame_hdr hdr;
+    pthread_t tid;
+    int keepalive_fd, devnull;
+    int rfd = open_pipe_persistent(BENCH_PIPE_NAME, &keepalive_fd);
+
+    devnull = open("/dev/null", O_WRONLY);
+    wa.fd = open_pipe(BENCH_PIPE_NAME, false);
+    wa.buf = pipe_bulk_alloc(size);
+    memset(wa.buf, 'x', size);
+    wa.size = size;
+    wa.reps = total / size ? total / size : 1;
+    wa.flags = flags;
+
+    uint64_t t0 = pipe_now_ns();
+    pthread_create(&tid, NULL, writer_thread, &wa);
+    for (int i = 0; i < wa.reps; i++) {
+        if (pipe_bulk_recv_frame(rfd, devnull, &hdr, flags, pipe_deadline_from_timeout(10)) == -1) {
+            break;
+        }
+    }
+    pthread_join(tid, NULL);
+    uint64_t t1 = pipe_now_ns();
+
+    printf("size=%-9zu mode=%-6s GB/s=%.2f\n", size, (flags & PIPE_BULK_COPY) ? "copy" : "splice",
+           (double)size * wa.reps / (t1 - t0));
+
+    pipe_bulk_free(wa.buf);
+    close(wa.fd);
+    close(rfd);
+    close(keepalive_fd);
+    close(devnull);
+}
+
+int main(int argc, char *argv[]) {
+    size_t total = (size_t)(argc > 1 ? atoi(argv[1]) : 256) << 20;
+
+    for (size_t size = 64 << 10; size <= (64 << 20); size *= 4) {
+        run(size, total, PIPE_BULK_COPY);
+        run(size, total, 0);
+    }
+    unlink(BENCH_PIPE_NAME);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,166 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Measures how a channel group scales with its number of shards.
+ *
+ * Sixteen writer threads, each with its own pipe_channel_writer, send 64 byte messages to an
+ * in-process channel group whose shards run the handler on their pinned reader thread. The rate
+ * is the aggregate number of messages handled per second, from the first send until the last
+ * message was handled. "rr" spreads messages round-robin, "key" hashes a per-message key.
+ *
+ * usage - bench_channel [messages per run]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "pipe_handler.h"
+#include "pipe_channel.h"
+#include "pipe_time.h"
+
+#define BENCH_CHANNEL_NAME "/tmp/my_pipe_bench_channel"
+#define BENCH_REPLY_NAME "/tmp/my_pipe_bench_channel.reply"
+#define WRITERS 16
+#define MSG_SIZE 64
+
+struct writer {
+    pthread_t tid;
+    int id;
+    int shards;
+    long count;
+    bool keyed;
+    long failed;
+};
+
+static atomic_long handled;
+
+static void handle_request(pipe_server_t *srv, const struct pipe_request *req, void *arg) {
+    (void)srv;
+    (void)req;
+    (void)arg;
+    atomic_fetch_add_explicit(&handled, 1, memory_order_relaxed);
+}
+
+static void *writer_main(void *arg) {
+    struct writer *w = arg;
+    pipe_channel_writer_t cw;
+    char reply[PIPE_NAME_MAX], msg[MSG_SIZE];
+    uint64_t key;
+
+    memset(msg, 'x', sizeof(msg));
+    snprintf(reply, sizeof(reply), "%s.%d", BENCH_REPLY_NAME, w->id);
+    if (pipe_channel_writer_open(&cw, BENCH_CHANNEL_NAME, reply, w->shards) == -1) {
+        w->failed = w->count;
+        return NULL;
+    }
+    for (long i = 0; i < w->count; i++) {
+        key = (uint64_t)w->id << 32 | (uint64_t)i;
+        if (pipe_channel_send(&cw, w->keyed ? &key : NULL, sizeof(key), PIPE_MSG_DATA, msg, sizeof(msg), pipe_deadline_from_timeout(10)) == -1) {
+            w->failed++;
+        }
+    }
+    pipe_channel_writer_close(&cw);
+    return NULL;
+}
+
+static void *channel_main(void *arg) {
+    pipe_channel_run(arg);
+    return NULL;
+}
+
+static int bench_channel(int shards, long count, bool keyed) {
+    pipe_channel_config_t cfg = {
+        .name = BENCH_CHANNEL_NAME,
+        .shards = shards,
+        .pin = true,
+        .server = { .workers = 0, .capacity = 1 << 20, .handler = handle_request },
+    };
+    struct writer writers[WRITERS];
+    pipe_channel_t ch;
+    pthread_t tid;
+    long failed = 0;
+    uint64_t t0, deadline;
+    double secs;
+
+    atomic_store(&handled, 0);
+    if (pipe_channel_init(&ch, &cfg) == -1 || pthread_create(&tid, NULL, channel_main, &ch) != 0) {
+        return -1;
+    }
+
+    t0 = pipe_now_ns();
+    for (int i = 0; i < WRITERS; i++) {
+        writers[i] = (struct writer){ .id = i, .shards = shards, .count = count / WRITERS, .keyed = keyed };
+        pthread_create(&writers[i].tid, NULL, writer_main, &writers[i]);
+    }
+    for (int i = 0; i < WRITERS; i++) {
+        pthread_join(writers[i].tid, NULL);
+        failed += writers[i].failed;
+    }
+    deadline = pipe_deadline_from_timeout(10);
+    while (atomic_load(&handled) < (count / WRITERS) * WRITERS - failed && pipe_now_ns() < deadline) {
+        usleep(100);
+    }
+    secs = (pipe_now_ns() - t0) / 1e9;
+
+    printf("bench=channel shards=%-2d mode=%-3s writers=%d %10.0f msgs/s handled=%ld failed=%ld\n", shards,
+           keyed ? "key" : "rr", WRITERS, atomic_load(&handled) / secs, atomic_load(&handled), failed);
+
+    pipe_channel_stop(&ch);
+    pthread_join(tid, NULL);
+    pipe_channel_destroy(&ch);
+    return failed > 0 ? -1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    static const int shard_counts[] = { 1, 2, 4, 8, 16 };
+    long count = argc > 1 ? atol(argv[1]) : 1000000;
+    char name[PIPE_NAME_MAX];
+    int ret = 0;
+
+    signal(SIGPIPE, SIG_IGN);
+    printf("cpus=%ld\n", sysconf(_SC_NPROCESSORS_ONLN));
+    for (size_t s = 0; s < sizeof(shard_counts) / sizeof(shard_counts[0]); s++) {
+        ret |= bench_channel(shard_counts[s], count, false);
+        ret |= bench_channel(shard_counts[s], count, true);
+    }
+    for (int i = 0; i < 16; i++) {
+        pipe_channel_shard_name(name, sizeof(name), BENCH_CHANNEL_NAME, i);
+        unlink(name);
+        for (int w = 0; w < WRITERS; w++) {
+            char reply[PIPE_NAME_MAX];
+            snprintf(reply, sizeof(reply), "%s.%d", BENCH_REPLY_NAME, w);
+            pipe_channel_shard_name(name, sizeof(name), reply, i);
+            unlink(name);
+        }
+    }
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,181 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Compares typed pipe_messages encoding with the text payloads the tools build today.
+ *
+ * A set of samples is encoded and decoded repeatedly, once as a space separated snprintf() line
+ * parsed back with strtoul()/strtod(), and once with pipe_msg_sample_encode()/_decode(). Each
+ * variant runs without and with the optional fields.
+ *
+ * usage - bench_codec [messages]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "pipe_messages.h"
+#include "pipe_time.h"
+
+#define NSAMPLES 1024
+#define SLOT_SIZE 256
+
+static const char *names[] = { "boiler", "intake-manifold", "rack-7/psu-2", "t" };
+
+static struct pipe_msg_sample samples[NSAMPLES];
+static char wire[NSAMPLES][SLOT_SIZE];
+static size_t wire_len[NSAMPLES];
+
+// checksum over decoded fields so neither decoder can be optimized away
+static uint64_t sink;
+
+static void make_samples(bool optional) {
+    for (int i = 0; i < NSAMPLES; i++) {
+        struct pipe_msg_sample *s = &samples[i];
+
+        memset(s, 0, sizeof(*s));
+        s->sensor = i * 7919u;
+        s->timestamp = pipe_now_ns() + i;
+        s->value = (i & 1) ? -i * 31 : i * 1009;
+        s->reading = i * 0.125 - 17.5;
+        s->name = pipe_bytes_str(names[i % 4]);
+        if (optional) {
+            s->present = PIPE_MSG_SAMPLE_HAS_FLAGS | PIPE_MSG_SAMPLE_HAS_OFFSET | PIPE_MSG_SAMPLE_HAS_NOTE;
+            s->flags = i & 0xff;
+            s->offset = -i;
+            s->note = pipe_bytes_str("recalibrated");
+        }
+    }
+}
+
+static size_t text_encode(const struct pipe_msg_sample *s, char *out, size_t cap) {
+    int n = snprintf(out, cap, "%" PRIu32 " %" PRIu64 " %" PRId32 " %.17g %.*s", s->sensor, s->timestamp, s->value,
+                     s->reading, (int)s->name.len, s->name.ptr);
+    if (s->present & PIPE_MSG_SAMPLE_HAS_FLAGS) {
+        n += snprintf(out + n, cap - n, " flags=%" PRIu32, s->flags);
+    }
+    if (s->present & PIPE_MSG_SAMPLE_HAS_OFFSET) {
+        n += snprintf(out + n, cap - n, " offset=%" PRId64, s->offset);
+    }
+    if (s->present & PIPE_MSG_SAMPLE_HAS_NOTE) {
+        n += snprintf(out + n, cap - n, " note=%.*s", (int)s->note.len, s->note.ptr);
+    }
+    return n;
+}
+
+// the usual hand-written parser: fixed positional fields followed by key=value options
+static int text_decode(const char *in, struct pipe_msg_sample *s) {
+    char *end;
+    const char *space;
+
+    s->sensor = strtoul(in, &end, 10);
+    s->timestamp = strtoull(end, &end, 10);
+    s->value = strtol(end, &end, 10);
+    s->reading = strtod(end, &end);
+    if (*end++ != ' ') {
+        return -1;
+    }
+    space = strchr(end, ' ');
+    s->name.ptr = end;
+    s->name.len = space ? (size_t)(space - end) : strlen(end);
+    s->present = 0;
+    while (space != NULL) {
+        const char *key = space + 1;
+        space = strchr(key, ' ');
+        if (strncmp(key, "flags=", 6) == 0) {
+            s->flags = strtoul(key + 6, NULL, 10);
+            s->present |= PIPE_MSG_SAMPLE_HAS_FLAGS;
+        } else if (strncmp(key, "offset=", 7) == 0) {
+            s->offset = strtoll(key + 7, NULL, 10);
+            s->present |= PIPE_MSG_SAMPLE_HAS_OFFSET;
+        } else if (strncmp(key, "note=", 5) == 0) {
+            s->note.ptr = key + 5;
+            s->note.len = space ? (size_t)(space - s->note.ptr) : strlen(s->note.ptr);
+            s->present |= PIPE_MSG_SAMPLE_HAS_NOTE;
+        }
+    }
+    return 0;
+}
+
+static void run(int count, bool typed, bool optional) {
+    size_t bytes = 0;
+    uint64_t t0, t1, t2;
+
+    make_samples(optional);
+
+    t0 = pipe_now_ns();
+    for (int i = 0; i < count; i++) {
+        int k = i & (NSAMPLES - 1);
+        if (typed) {
+            wire_len[k] = pipe_msg_sample_encode(&samples[k], wire[k], SLOT_SIZE);
+        } else {
+            wire_len[k] = text_encode(&samples[k], wire[k], SLOT_SIZE);
+        }
+    }
+    t1 = pipe_now_ns();
+    for (int i = 0; i < count; i++) {
+        int k = i & (NSAMPLES - 1);
+        if (typed) {
+            struct pipe_msg_sample_view v;
+            if (pipe_msg_sample_decode(&v, wire[k], wire_len[k]) == 0) {
+                sink += v.fixed->sensor + v.fixed->timestamp + v.fixed->value + (uint64_t)v.fixed->reading +
+                        v.name.len + v.present;
+                if (v.present & PIPE_MSG_SAMPLE_HAS_NOTE) {
+                    sink += v.flags + v.offset + v.note.len;
+                }
+            }
+        } else {
+            struct pipe_msg_sample s = { 0 };
+            if (text_decode(wire[k], &s) == 0) {
+                sink += s.sensor + s.timestamp + s.value + (uint64_t)s.reading + s.name.len + s.present;
+                if (s.present & PIPE_MSG_SAMPLE_HAS_NOTE) {
+                    sink += s.flags + s.offset + s.note.len;
+                }
+            }
+        }
+    }
+    t2 = pipe_now_ns();
+    for (int k = 0; k < NSAMPLES; k++) {
+        bytes += wire_len[k];
+    }
+
+    printf("codec=%-5s optional=%-3s encode=%6.1f ns/msg decode=%6.1f ns/msg bytes/msg=%5.1f\n",
+           typed ? "typed" : "text", optional ? "yes" : "no", (double)(t1 - t0) / count, (double)(t2 - t1) / count,
+           (double)bytes / NSAMPLES);
+}
+
+int main(int argc, char *argv[]) {
+    int count = argc > 1 ? atoi(argv[1]) : 2000000;
+
+    for (int optional = 0; optional <= 1; optional++) {
+        run(count, false, optional);
+        run(count, true, optional);
+    }
+    fprintf(stderr, "checksum %" PRIu64 "\n", sink);
+    return EXIT_SUCCESS;
+}
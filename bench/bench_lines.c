@@ -0,0 +1,206 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Measures how fast line mode turns a byte stream into records.
+ *
+ *   split  pipe_line_reader_feed() with one chunk per simulated read, scanning only
+ *   pipe   a writer thread filling an anonymous pipe and pipe_line_reader_fill() on the other end
+ *
+ * Each row runs once per scanner: scalar is the plain memchr() loop, sse2 and avx2 the vector
+ * scanners. The inputs are log lines of about 100 bytes and short lines of about 8 bytes, read in
+ * chunks from 4 KiB to 1 MiB.
+ *
+ * usage - bench_lines [megabytes per run]
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "pipe_handler.h"
+#include "pipe_lines.h"
+#include "pipe_time.h"
+
+#define INPUT_SIZE (8 * 1024 * 1024)
+
+static char logs[INPUT_SIZE], shorts[INPUT_SIZE];
+static size_t logs_len, shorts_len;
+static const char *impl_names[] = { "scalar", "sse2", "avx2" };
+
+struct count {
+    uint64_t records;
+    uint64_t bytes;
+};
+
+static size_t fill_lines(char *buf, bool short_lines) {
+    static const char *levels[] = { "INFO", "INFO", "INFO", "WARN", "DEBUG" };
+    static const char *paths[] = { "items", "orders", "users/profile", "health" };
+    uint64_t x = 88172645463325252ull;
+    size_t off = 0;
+    int n;
+
+    for (;;) {
+        x ^= x << 13, x ^= x >> 7, x ^= x << 17;
+        if (short_lines) {
+            n = snprintf(buf + off, INPUT_SIZE - off, "%u\n", (unsigned)(x % 10000000));
+        } else {
+            n = snprintf(buf + off, INPUT_SIZE - off,
+                         "2026-10-17T12:%02u:%02u.%03uZ %s worker-%u handled GET /api/v1/%s/%u status=200 bytes=%u\n",
+                         (unsigned)(x % 60), (unsigned)(x >> 8) % 60, (unsigned)(x >> 16) % 1000, levels[x % 5],
+                         (unsigned)(x >> 24) % 8, paths[(x >> 28) % 4], (unsigned)(x >> 32) % 100000,
+                         (unsigned)(x >> 40) % 65536);
+        }
+        if (n < 0 || (size_t)n >= INPUT_SIZE - off) {
+            return off;
+        }
+        off += n;
+    }
+}
+
+static void count_records(const struct pipe_bytes *records, size_t count, void *arg) {
+    struct count *c = arg;
+
+    c->records += count;
+    for (size_t i = 0; i < count; i++) {
+        c->bytes += records[i].len;
+    }
+}
+
+static void report(const char *bench, const char *data, size_t chunk, int impl, const struct count *c,
+                   size_t bytes, uint64_t ns) {
+    printf("bench=%-5s data=%-5s read=%-7zu impl=%-6s %8.1f Mrecords/s %7.0f MB/s\n", bench, data, chunk,
+           impl_names[impl], c->records / (ns / 1e3), bytes / (ns / 1e3));
+}
+
+static void bench_split(const char *name, const char *data, size_t len, size_t chunk, size_t total, int impl) {
+    pipe_line_reader_t reader;
+    struct count c = { 0, 0 };
+    size_t done = 0;
+    uint64_t t0;
+
+    if (pipe_line_reader_init(&reader, chunk, '\n', count_records, &c) == -1) {
+        exit(EXIT_FAILURE);
+    }
+    t0 = pipe_now_ns();
+    while (done < total) {
+        for (size_t off = 0; off < len; off += chunk) {
+            pipe_line_reader_feed(&reader, data + off, off + chunk <= len ? chunk : len - off);
+        }
+        done += len;
+    }
+    report("split", name, chunk, impl, &c, done, pipe_now_ns() - t0);
+    pipe_line_reader_free(&reader);
+}
+
+struct writer {
+    int fd;
+    const char *data;
+    size_t len;
+    size_t chunk;
+    size_t total;
+};
+
+static void *writer_main(void *arg) {
+    struct writer *w = arg;
+
+    for (size_t done = 0; done < w->total; done += w->len) {
+        for (size_t off = 0; off < w->len;) {
+            size_t want = off + w->chunk <= w->len ? w->chunk : w->len - off;
+            ssize_t n = write(w->fd, w->data + off, want);
+            if (n <= 0) {
+                return NULL;
+            }
+            off += n;
+        }
+    }
+    close(w->fd);
+    return NULL;
+}
+
+static void bench_pipe(const char *name, const char *data, size_t len, size_t chunk, size_t total, int impl) {
+    pipe_line_reader_t reader;
+    struct count c = { 0, 0 };
+    struct writer w = { .data = data, .len = len, .chunk = chunk, .total = total };
+    int fds[2];
+    size_t bytes = 0;
+    ssize_t n;
+    pthread_t tid;
+    uint64_t t0;
+
+    if (pipe(fds) == -1 || pipe_line_reader_init(&reader, chunk, '\n', count_records, &c) == -1) {
+        exit(EXIT_FAILURE);
+    }
+    fcntl(fds[1], F_SETPIPE_SZ, chunk > 65536 ? chunk : 65536);
+    w.fd = fds[1];
+    t0 = pipe_now_ns();
+    if (pthread_create(&tid, NULL, writer_main, &w) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    while ((n = pipe_line_reader_fill(&reader, fds[0])) > 0) {
+        bytes += n;
+    }
+    pthread_join(tid, NULL);
+    report("pipe", name, chunk, impl, &c, bytes, pipe_now_ns() - t0);
+    pipe_line_reader_free(&reader);
+    close(fds[0]);
+}
+
+int main(int argc, char *argv[]) {
+    static const size_t chunks[] = { 4096, 16384, 65536, 262144, 1048576 };
+    size_t total = (size_t)(argc > 1 ? atoi(argv[1]) : 256) << 20;
+    const struct {
+        const char *name;
+        const char *data;
+        size_t *len;
+    } inputs[] = { { "log", logs, &logs_len }, { "short", shorts, &shorts_len } };
+
+    logs_len = fill_lines(logs, false);
+    shorts_len = fill_lines(shorts, true);
+    for (size_t d = 0; d < sizeof(inputs) / sizeof(inputs[0]); d++) {
+        for (size_t s = 0; s < sizeof(chunks) / sizeof(chunks[0]); s++) {
+            for (int impl = PIPE_LINES_SCALAR; impl <= PIPE_LINES_AVX2; impl++) {
+                if (pipe_lines_set_impl(impl) == impl) {
+                    bench_split(inputs[d].name, inputs[d].data, *inputs[d].len, chunks[s], total, impl);
+                }
+            }
+        }
+    }
+    for (size_t d = 0; d < sizeof(inputs) / sizeof(inputs[0]); d++) {
+        for (size_t s = 0; s < sizeof(chunks) / sizeof(chunks[0]); s++) {
+            for (int impl = PIPE_LINES_SCALAR; impl <= PIPE_LINES_AVX2; impl++) {
+                if (pipe_lines_set_impl(impl) == impl) {
+                    bench_pipe(inputs[d].name, inputs[d].data, *inputs[d].len, chunks[s], total / 4, impl);
+                }
+            }
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,199 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Measures what per-connection compression costs and buys.
+ *
+ *   codec  pipe_lz_compress()/pipe_lz_decompress() alone, in MB/s of raw data, and the ratio
+ *   e2e    a pipe_rpc client sending to an in-process pipe_server with 64 requests in flight,
+ *          once plain and once with compression negotiated, in MB/s of raw payload
+ *
+ * Both run over log-like text, which compresses about 3:1, and over random bytes, which do not
+ * compress at all and show the cost of trying. The e2e rows locate the message size from which
+ * compression pays off on a local FIFO.
+ *
+ * usage - bench_lz [megabytes per run]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "pipe_handler.h"
+#include "pipe_lz.h"
+#include "pipe_rpc.h"
+#include "pipe_server.h"
+#include "pipe_time.h"
+
+#define BENCH_SERVER_NAME "/tmp/my_pipe_bench_lz"
+#define BENCH_REPLY_NAME "/tmp/my_pipe_bench_lz.reply"
+#define MAX_SIZE (256 * 1024)
+#define INFLIGHT 64
+
+static char text[MAX_SIZE], noise[MAX_SIZE];
+static size_t expect_len;
+static long bad;
+
+static void make_inputs(void) {
+    static const char *levels[] = { "INFO", "INFO", "INFO", "WARN", "DEBUG" };
+    static const char *paths[] = { "items", "orders", "users/profile", "health" };
+    uint64_t x = 88172645463325252ull;
+    size_t off = 0;
+
+    while (off < MAX_SIZE) {
+        x ^= x << 13, x ^= x >> 7, x ^= x << 17;
+        int n = snprintf(text + off, MAX_SIZE - off,
+                         "2026-10-17T12:%02u:%02u.%03uZ %s worker-%u handled GET /api/v1/%s/%u status=200 bytes=%u\n",
+                         (unsigned)(x % 60), (unsigned)(x >> 8) % 60, (unsigned)(x >> 16) % 1000, levels[x % 5],
+                         (unsigned)(x >> 24) % 8, paths[(x >> 28) % 4], (unsigned)(x >> 32) % 100000,
+                         (unsigned)(x >> 40) % 65536);
+        if (n < 0 || (size_t)n >= MAX_SIZE - off) {
+            break;
+        }
+        off += n;
+    }
+    memset(text + off, ' ', MAX_SIZE - off);
+
+    for (size_t i = 0; i < MAX_SIZE; i += sizeof(x)) {
+        x ^= x << 13, x ^= x >> 7, x ^= x << 17;
+        memcpy(noise + i, &x, sizeof(x));
+    }
+}
+
+static void bench_codec(const char *name, const char *data, size_t size, size_t total) {
+    static char packed[MAX_SIZE + MAX_SIZE / 255 + 16], restored[MAX_SIZE];
+    pipe_lz_ctx_t *ctx = pipe_lz_new(0);
+    long rounds = (long)(total / size) + 1;
+    size_t n = 0;
+    uint64_t t0, t1, t2;
+
+    t0 = pipe_now_ns();
+    for (long i = 0; i < rounds; i++) {
+        n = pipe_lz_compress(ctx, data, size, packed, sizeof(packed));
+    }
+    t1 = pipe_now_ns();
+    for (long i = 0; i < rounds; i++) {
+        if (pipe_lz_decompress(packed, n, restored, size) != (ssize_t)size) {
+            bad++;
+        }
+    }
+    t2 = pipe_now_ns();
+    if (memcmp(restored, data, size) != 0) {
+        bad++;
+    }
+
+    printf("bench=codec data=%-6s size=%-6zu ratio=%5.2f compress=%7.0f MB/s decompress=%7.0f MB/s\n", name, size,
+           (double)size / n, (double)rounds * size / ((t1 - t0) / 1e3), (double)rounds * size / ((t2 - t1) / 1e3));
+    pipe_lz_free(ctx);
+}
+
+static void handle_request(pipe_server_t *srv, const struct pipe_request *req, void *arg) {
+    (void)arg;
+    if (req->hdr.len != expect_len) {
+        bad++;
+    }
+    pipe_server_reply(srv, req, PIPE_MSG_ACK, "ACK", 3);
+}
+
+static void *server_main(void *arg) {
+    pipe_server_run(arg);
+    return NULL;
+}
+
+static void bench_e2e(const char *name, const char *data, size_t size, size_t total, bool compress) {
+    pipe_server_config_t cfg = {
+        .name = BENCH_SERVER_NAME,
+        .workers = 0,
+        .capacity = 1 << 20,
+        .compress_threshold = 1024,
+        .handler = handle_request,
+    };
+    pipe_server_t srv;
+    pipe_rpc_t rpc;
+    pthread_t tid;
+    long count = (long)(total / size) + 1, sent = 0;
+    uint64_t t0;
+    double secs;
+
+    expect_len = size;
+    if (pipe_server_init(&srv, &cfg) == -1 || pthread_create(&tid, NULL, server_main, &srv) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    if (pipe_rpc_open(&rpc, BENCH_SERVER_NAME, BENCH_REPLY_NAME, INFLIGHT) == -1 ||
+        (compress && pipe_conn_set_compression(&rpc.conn, 256) == -1)) {
+        exit(EXIT_FAILURE);
+    }
+    // one round trip first, so the handshake is done before the clock starts
+    pipe_rpc_call(&rpc, PIPE_MSG_DATA, data, size, pipe_deadline_from_timeout(10), NULL, NULL);
+    pipe_rpc_wait(&rpc, NULL, pipe_deadline_from_timeout(10));
+
+    t0 = pipe_now_ns();
+    while (sent < count && pipe_rpc_call(&rpc, PIPE_MSG_DATA, data, size, pipe_deadline_from_timeout(10), NULL, NULL) >= 0) {
+        sent++;
+    }
+    pipe_rpc_wait(&rpc, NULL, pipe_deadline_from_timeout(10));
+    secs = (pipe_now_ns() - t0) / 1e9;
+
+    printf("bench=e2e   data=%-6s size=%-6zu lz=%-3s negotiated=%-3s %8.1f MB/s %9.0f msgs/s\n", name, size,
+           compress ? "on" : "off", rpc.conn.peer_lz ? "yes" : "no", sent * (double)size / secs / 1e6, sent / secs);
+
+    pipe_rpc_close(&rpc);
+    pipe_server_stop(&srv);
+    pthread_join(tid, NULL);
+    pipe_server_destroy(&srv);
+}
+
+int main(int argc, char *argv[]) {
+    static const size_t sizes[] = { 256, 1024, 4096, 16384, 65536, 262144 };
+    size_t total = (size_t)(argc > 1 ? atoi(argv[1]) : 64) << 20;
+    const struct {
+        const char *name;
+        const char *data;
+    } inputs[] = { { "text", text }, { "random", noise } };
+
+    signal(SIGPIPE, SIG_IGN);
+    make_inputs();
+    for (size_t d = 0; d < sizeof(inputs) / sizeof(inputs[0]); d++) {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            bench_codec(inputs[d].name, inputs[d].data, sizes[s], total);
+        }
+    }
+    for (size_t d = 0; d < sizeof(inputs) / sizeof(inputs[0]); d++) {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            bench_e2e(inputs[d].name, inputs[d].data, sizes[s], total, false);
+            bench_e2e(inputs[d].name, inputs[d].data, sizes[s], total, true);
+        }
+    }
+    unlink(BENCH_SERVER_NAME);
+    if (bad > 0) {
+        fprintf(stderr, "%ld messages did not survive the round trip\n", bad);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,134 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Sweeps the FIFO capacity set with F_SETPIPE_SZ against throughput and writer stall time.
+ *
+ * The writer sends bursts of framed messages as fast as the pipe accepts them and records how
+ * long it waits for POLLOUT after EAGAIN. The reader drains the pipe with an adaptive frame
+ * reader and spends a little time per message, so it keeps up on average but not within a burst.
+ *
+ * usage - bench_pipesz [bursts]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include "pipe_handler.h"
+#include "pipe_frame.h"
+#include "pipe_time.h"
+
+#define BENCH_PIPE_NAME "/tmp/my_pipe_bench_pipesz"
+#define BURST_MESSAGES 256
+#define MESSAGE_SIZE 512
+#define WORK_NS 200
+
+struct reader_args {
+    int fd;
+    long expect;
+};
+
+static void *reader_thread(void *arg) {
+    struct reader_args *ra = arg;
+    pipe_frame_reader_t reader;
+    struct pipe_frame msg;
+    long got = 0;
+
+    pipe_frame_reader_init(&reader, 0);
+    while (got < ra->expect) {
+        if (pipe_frame_reader_fill(&reader, ra->fd) <= 0) {
+            wait_pipe(ra->fd, POLLIN, pipe_deadline_from_timeout(1));
+            continue;
+        }
+        while (pipe_frame_next(&reader, &msg) == 1) {
+            uint64_t until = pipe_now_ns() + WORK_NS;
+            while (pipe_now_ns() < until) {
+            }
+            got++;
+        }
+    }
+    pipe_frame_reader_free(&reader);
+    return NULL;
+}
+
+static void run(int capacity, int bursts) {
+    char frame[PIPE_FRAME_HDR_SIZE + MESSAGE_SIZE];
+    struct pipe_frame_hdr hdr;
+    struct reader_args ra;
+    pthread_t tid;
+    int keepalive_fd, wfd, actual;
+    uint64_t stall = 0;
+
+    ra.fd = open_pipe_persistent(BENCH_PIPE_NAME, &keepalive_fd);
+    ra.expect = (long)bursts * BURST_MESSAGES;
+    wfd = open_pipe(BENCH_PIPE_NAME, false);
+    actual = set_pipe_capacity(wfd, capacity);
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.len = MESSAGE_SIZE;
+    hdr.type = PIPE_MSG_DATA;
+    memset(frame, 0, sizeof(frame));
+    pipe_frame_encode(frame, sizeof(frame), &hdr, frame + PIPE_FRAME_HDR_SIZE);
+
+    pthread_create(&tid, NULL, reader_thread, &ra);
+    uint64_t t0 = pipe_now_ns();
+    for (int b = 0; b < bursts; b++) {
+        for (int i = 0; i < BURST_MESSAGES; i++) {
+            while (write(wfd, frame, sizeof(frame)) == -1) {
+                uint64_t s = pipe_now_ns();
+                wait_pipe(wfd, POLLOUT, pipe_deadline_from_timeout(1));
+                stall += pipe_now_ns() - s;
+            }
+        }
+        // idle gap between bursts, long enough for the reader to catch up
+        usleep(BURST_MESSAGES * WORK_NS / 1000 * 2);
+    }
+    pthread_join(tid, NULL);
+    uint64_t t1 = pipe_now_ns();
+
+    double bytes = (double)ra.expect * sizeof(frame);
+    printf("capacity=%-8d MB/s=%8.1f stall_ms=%8.2f stall_pct=%5.1f\n", actual,
+           bytes / ((t1 - t0) / 1e3), stall / 1e6, 100.0 * stall / (t1 - t0));
+
+    close(wfd);
+    close(ra.fd);
+    close(keepalive_fd);
+}
+
+int main(int argc, char *argv[]) {
+    int bursts = argc > 1 ? atoi(argv[1]) : 200;
+
+    printf("pipe-max-size=%d\n", get_pipe_max_capacity());
+    for (int capacity = 4096; capacity <= get_pipe_max_capacity(); capacity *= 4) {
+        run(capacity, bursts);
+    }
+    unlink(BENCH_PIPE_NAME);
+    return EXIT_SUCCESS;
+}
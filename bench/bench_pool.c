@@ -0,0 +1,209 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Counts how often message buffers reach the system allocator under sustained load.
+ *
+ *   handoff  one thread allocates buffers and passes them through a pipe_queue to another that
+ *            releases them, the path of a request from the reader to a worker
+ *   server   a pipe_rpc client keeping 64 requests in flight to an in-process pipe_server with
+ *            two workers
+ *
+ * Every row runs with the pool caching buffers and with caching off (PIPE_POOL=off), where each
+ * buffer is a malloc()/free() pair. "mallocs/msg" is the number of system allocations per
+ * message during the measured run, after one warm-up run. The handoff queue holds 1024 buffers,
+ * so with large buffers a drained queue overflows the 8 MiB depot of the size class and part of
+ * every burst still goes back to the system.
+ *
+ * usage - bench_pool [messages per run]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "pipe_handler.h"
+#include "pipe_pool.h"
+#include "pipe_queue.h"
+#include "pipe_rpc.h"
+#include "pipe_server.h"
+#include "pipe_time.h"
+
+#define BENCH_SERVER_NAME "/tmp/my_pipe_bench_pool"
+#define BENCH_REPLY_NAME "/tmp/my_pipe_bench_pool.reply"
+#define INFLIGHT 64
+#define MAX_SIZE (64 * 1024)
+
+static char payload[MAX_SIZE];
+static long bad;
+static size_t expect_len;
+
+struct handoff {
+    pipe_queue_t queue;
+    long count;
+    size_t size;
+};
+
+static void *handoff_consumer(void *arg) {
+    struct handoff *h = arg;
+    char *buf;
+
+    for (long i = 0; i < h->count; i++) {
+        buf = pipe_queue_pop(&h->queue);
+        if (buf[0] != 'x') {
+            bad++;
+        }
+        pipe_pool_put(buf);
+    }
+    return NULL;
+}
+
+static void run_handoff(struct handoff *h) {
+    pthread_t tid;
+
+    if (pthread_create(&tid, NULL, handoff_consumer, h) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    for (long i = 0; i < h->count; i++) {
+        // sizes vary around the nominal one like real payloads do
+        char *buf = pipe_pool_alloc(h->size - (size_t)(i & 7) * (h->size / 16));
+        if (buf == NULL) {
+            exit(EXIT_FAILURE);
+        }
+        buf[0] = 'x';
+        pipe_queue_push(&h->queue, buf, PIPE_DEADLINE_NEVER);
+    }
+    pthread_join(tid, NULL);
+}
+
+static void bench_handoff(size_t size, long count, bool pooled) {
+    struct handoff h = { .count = count, .size = size };
+    struct pipe_pool_stats before, after;
+    uint64_t t0;
+    double secs;
+
+    pipe_pool_set_enabled(pooled);
+    if (pipe_queue_init(&h.queue, 1024) == -1) {
+        exit(EXIT_FAILURE);
+    }
+    run_handoff(&h);
+    pipe_pool_get_stats(&before);
+    t0 = pipe_now_ns();
+    run_handoff(&h);
+    secs = (pipe_now_ns() - t0) / 1e9;
+    pipe_pool_get_stats(&after);
+    pipe_queue_destroy(&h.queue);
+
+    printf("bench=handoff size=%-6zu pool=%-3s %10.0f msgs/s mallocs/msg=%.4f\n", size, pooled ? "on" : "off",
+           count / secs, (double)(after.mallocs - before.mallocs) / count);
+}
+
+static void handle_request(pipe_server_t *srv, const struct pipe_request *req, void *arg) {
+    (void)arg;
+    if (req->hdr.len != expect_len || memcmp(req->payload, payload, req->hdr.len) != 0) {
+        bad++;
+    }
+    pipe_server_reply(srv, req, PIPE_MSG_ACK, "ACK", 3);
+}
+
+static void *server_main(void *arg) {
+    pipe_server_run(arg);
+    return NULL;
+}
+
+static double run_calls(pipe_rpc_t *rpc, size_t size, long count) {
+    uint64_t t0 = pipe_now_ns();
+    long sent = 0;
+
+    while (sent < count && pipe_rpc_call(rpc, PIPE_MSG_DATA, payload, size, pipe_deadline_from_timeout(10), NULL, NULL) >= 0) {
+        sent++;
+    }
+    pipe_rpc_wait(rpc, NULL, pipe_deadline_from_timeout(10));
+    if (sent < count) {
+        bad++;
+    }
+    return (pipe_now_ns() - t0) / 1e9;
+}
+
+static void bench_server(size_t size, long count, bool pooled) {
+    pipe_server_config_t cfg = {
+        .name = BENCH_SERVER_NAME,
+        .workers = 2,
+        .capacity = 1 << 20,
+        .handler = handle_request,
+    };
+    struct pipe_pool_stats before, after;
+    pipe_server_t srv;
+    pipe_rpc_t rpc;
+    pthread_t tid;
+    double secs;
+
+    pipe_pool_set_enabled(pooled);
+    expect_len = size;
+    if (pipe_server_init(&srv, &cfg) == -1 || pthread_create(&tid, NULL, server_main, &srv) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    if (pipe_rpc_open(&rpc, BENCH_SERVER_NAME, BENCH_REPLY_NAME, INFLIGHT) == -1) {
+        exit(EXIT_FAILURE);
+    }
+    run_calls(&rpc, size, count / 4);
+    pipe_pool_get_stats(&before);
+    secs = run_calls(&rpc, size, count);
+    pipe_pool_get_stats(&after);
+
+    printf("bench=server  size=%-6zu pool=%-3s %10.0f msgs/s mallocs/msg=%.4f\n", size, pooled ? "on" : "off",
+           count / secs, (double)(after.mallocs - before.mallocs) / count);
+
+    pipe_rpc_close(&rpc);
+    pipe_server_stop(&srv);
+    pthread_join(tid, NULL);
+    pipe_server_destroy(&srv);
+}
+
+int main(int argc, char *argv[]) {
+    static const size_t sizes[] = { 64, 1024, 16384, 65536 };
+    long count = argc > 1 ? atol(argv[1]) : 200000;
+
+    signal(SIGPIPE, SIG_IGN);
+    memset(payload, 'x', sizeof(payload));
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        bench_handoff(sizes[s], count * 10, false);
+        bench_handoff(sizes[s], count * 10, true);
+    }
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        bench_server(sizes[s], count, false);
+        bench_server(sizes[s], count, true);
+    }
+    unlink(BENCH_SERVER_NAME);
+    if (bad > 0) {
+        fprintf(stderr, "%ld messages were lost or damaged\n", bad);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,193 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Measures one producer feeding many consumers.
+ *
+ *   direct  the producer opens, writes and closes every consumer FIFO for every message like
+ *           send_data(), but waits for room instead of failing on a full FIFO
+ *   tee     the producer publishes once to an in-process pipe_broker that fans out with tee()
+ *   copy    the same broker forced onto read()/write()
+ *
+ * Subscribers use PIPE_PUBSUB_BLOCK, so every message reaches every consumer and the time is
+ * taken until the last consumer has its last message.
+ *
+ * usage - bench_pubsub [messages]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "pipe_handler.h"
+#include "pipe_pubsub.h"
+#include "pipe_time.h"
+
+#define BENCH_BROKER_NAME "/tmp/my_pipe_bench_broker"
+#define BENCH_DIRECT_NAME "/tmp/my_pipe_bench_direct"
+#define MAX_CONSUMERS 16
+
+struct consumer {
+    pthread_t tid;
+    int count;
+    size_t size;
+    long received;
+    bool in_order;
+    char name[64];
+};
+
+static atomic_int ready;
+
+static void *direct_consumer(void *arg) {
+    struct consumer *c = arg;
+    size_t expect = (size_t)c->count * c->size, got = 0;
+    static __thread char buf[1 << 16];
+    int keepalive_fd, fd = open_pipe_persistent(c->name, &keepalive_fd);
+
+    atomic_fetch_add(&ready, 1);
+    while (fd >= 0 && got < expect) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n > 0) {
+            got += n;
+        } else if (wait_pipe(fd, POLLIN, pipe_deadline_from_timeout(10)) <= 0) {
+            break;
+        }
+    }
+    c->received = got / c->size;
+    c->in_order = true;
+    close(fd);
+    close(keepalive_fd);
+    unlink(c->name);
+    return NULL;
+}
+
+static void *broker_consumer(void *arg) {
+    struct consumer *c = arg;
+    pipe_subscriber_t sub;
+    struct pipe_frame msg;
+
+    c->in_order = true;
+    if (pipe_subscriber_open(&sub, BENCH_BROKER_NAME, "bench", PIPE_PUBSUB_BLOCK, 0, pipe_deadline_from_timeout(5)) == -1) {
+        atomic_fetch_add(&ready, 1);
+        return NULL;
+    }
+    atomic_fetch_add(&ready, 1);
+    while (c->received < c->count && pipe_subscriber_recv(&sub, &msg, pipe_deadline_from_timeout(10)) >= 0) {
+        c->in_order &= msg.hdr.seq == (uint32_t)c->received && msg.hdr.len == c->size;
+        c->received++;
+    }
+    pipe_subscriber_close(&sub);
+    return NULL;
+}
+
+static void *broker_thread(void *arg) {
+    pipe_broker_run(arg);
+    return NULL;
+}
+
+static void run(const char *mode, int consumers, size_t size, int count) {
+    struct consumer cs[MAX_CONSUMERS];
+    pipe_broker_t broker;
+    pthread_t broker_tid;
+    pipe_publisher_t pub;
+    bool direct = strcmp(mode, "direct") == 0;
+    char *payload = calloc(1, size);
+    long received = 0;
+    bool in_order = true;
+
+    if (!direct) {
+        pipe_broker_config_t cfg = { .name = BENCH_BROKER_NAME, .copy = strcmp(mode, "copy") == 0 };
+        if (pipe_broker_init(&broker, &cfg) == -1) {
+            exit(EXIT_FAILURE);
+        }
+        pthread_create(&broker_tid, NULL, broker_thread, &broker);
+    }
+
+    atomic_store(&ready, 0);
+    for (int i = 0; i < consumers; i++) {
+        cs[i] = (struct consumer){ .count = count, .size = size };
+        snprintf(cs[i].name, sizeof(cs[i].name), "%s.%d", BENCH_DIRECT_NAME, i);
+        pthread_create(&cs[i].tid, NULL, direct ? direct_consumer : broker_consumer, &cs[i]);
+    }
+    while (atomic_load(&ready) < consumers) {
+        usleep(1000);
+    }
+
+    uint64_t t0 = pipe_now_ns();
+    if (direct) {
+        for (int n = 0; n < count; n++) {
+            for (int i = 0; i < consumers; i++) {
+                struct iovec iov = { .iov_base = payload, .iov_len = size };
+                int fd = open_pipe(cs[i].name, false);
+                writev_to_pipe(fd, &iov, 1, pipe_deadline_from_timeout(10));
+                close(fd);
+            }
+        }
+    } else if (pipe_publisher_open(&pub, BENCH_BROKER_NAME, "bench", pipe_deadline_from_timeout(5)) == 0) {
+        for (int n = 0; n < count; n++) {
+            pipe_publisher_send(&pub, payload, size, pipe_deadline_from_timeout(10));
+        }
+        pipe_publisher_close(&pub);
+    }
+    for (int i = 0; i < consumers; i++) {
+        pthread_join(cs[i].tid, NULL);
+        received += cs[i].received;
+        in_order &= cs[i].in_order;
+    }
+    uint64_t t1 = pipe_now_ns();
+
+    if (!direct) {
+        pipe_broker_stop(&broker);
+        pthread_join(broker_tid, NULL);
+        pipe_broker_destroy(&broker);
+    }
+    printf("mode=%-6s consumers=%-2d size=%-6zu msgs/s=%9.0f deliveries/s=%10.0f delivered=%ld/%ld%s\n", mode,
+           consumers, size, count / ((t1 - t0) / 1e9), received / ((t1 - t0) / 1e9), received,
+           (long)count * consumers, in_order ? "" : " OUT OF ORDER");
+    free(payload);
+}
+
+int main(int argc, char *argv[]) {
+    static const int fanouts[] = { 1, 4, 16 };
+    static const size_t sizes[] = { 1024, 16384 };
+    int count = argc > 1 ? atoi(argv[1]) : 20000;
+
+    signal(SIGPIPE, SIG_IGN);
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        for (size_t f = 0; f < sizeof(fanouts) / sizeof(fanouts[0]); f++) {
+            run("direct", fanouts[f], sizes[s], count);
+            run("tee", fanouts[f], sizes[s], count);
+            run("copy", fanouts[f], sizes[s], count);
+        }
+    }
+    unlink(BENCH_BROKER_NAME);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,191 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Compares the shared memory ring with a plain named pipe for the same message stream.
+ *
+ * Throughput sends a burst of messages as fast as the transport accepts them. Latency paces
+ * messages so the consumer goes idle between them, which is where the ring has to fall back to
+ * the doorbell, and measures one-way delay from a timestamp carried in the payload.
+ *
+ * usage - bench_shm [messages] [size]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <stdatomic.h>
+
+#include "pipe_handler.h"
+#include "pipe_frame.h"
+#include "pipe_shm.h"
+#include "pipe_time.h"
+
+#define BENCH_PIPE_NAME "/tmp/my_pipe_bench_shm"
+#define BENCH_BELL_NAME "/tmp/my_pipe_bench_shm_bell"
+#define BENCH_SHM_NAME "/my_pipe_bench_shm"
+#define RING_SIZE (1 << 20)
+#define LATENCY_MESSAGES 20000
+#define PACE_NS 50000
+
+struct bench {
+    bool shm;
+    long count;
+    size_t size;
+    uint64_t pace_ns;
+    uint64_t *lat;
+    int fd;
+    pipe_shm_t ring;
+    atomic_bool ready;
+};
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void *consumer_thread(void *arg) {
+    struct bench *b = arg;
+    pipe_frame_reader_t reader;
+    struct pipe_frame msg;
+    long got = 0;
+
+    atomic_store(&b->ready, true);
+    if (b->shm) {
+        while (got < b->count && pipe_shm_recv_msg(&b->ring, &msg, pipe_deadline_from_timeout(10)) >= 0) {
+            if (b->lat != NULL) {
+                uint64_t sent;
+                memcpy(&sent, msg.payload, sizeof(sent));
+                b->lat[got] = pipe_now_ns() - sent;
+            }
+            got++;
+        }
+        return NULL;
+    }
+
+    pipe_frame_reader_init(&reader, 0);
+    while (got < b->count) {
+        if (pipe_frame_reader_fill(&reader, b->fd) <= 0) {
+            wait_pipe(b->fd, POLLIN, pipe_deadline_from_timeout(10));
+            continue;
+        }
+        while (pipe_frame_next(&reader, &msg) == 1) {
+            if (b->lat != NULL) {
+                uint64_t sent;
+                memcpy(&sent, msg.payload, sizeof(sent));
+                b->lat[got] = pipe_now_ns() - sent;
+            }
+            got++;
+        }
+    }
+    pipe_frame_reader_free(&reader);
+    return NULL;
+}
+
+static double run(struct bench *b) {
+    int keepalive_fd = -1, wfd = -1;
+    pipe_shm_t producer;
+    pthread_t tid;
+    char *payload = calloc(1, b->size);
+    uint64_t start, next;
+
+    if (b->shm) {
+        if (pipe_shm_listen(&b->ring, BENCH_SHM_NAME, BENCH_BELL_NAME, RING_SIZE) == -1 ||
+            pipe_shm_connect(&producer, BENCH_SHM_NAME, BENCH_BELL_NAME, pipe_deadline_from_timeout(1)) == -1) {
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        b->fd = open_pipe_persistent(BENCH_PIPE_NAME, &keepalive_fd);
+        wfd = open_pipe_wait(BENCH_PIPE_NAME, pipe_deadline_from_timeout(1));
+        if (b->fd == -1 || wfd == -1) {
+            exit(EXIT_FAILURE);
+        }
+        set_pipe_capacity(b->fd, RING_SIZE);
+    }
+
+    pthread_create(&tid, NULL, consumer_thread, b);
+    while (!atomic_load(&b->ready)) {
+    }
+    start = next = pipe_now_ns();
+    for (long i = 0; i < b->count; i++) {
+        if (b->pace_ns) {
+            // sleep rather than spin so a consumer sharing the CPU still gets to run
+            struct timespec ts = { next / PIPE_NSEC_PER_SEC, next % PIPE_NSEC_PER_SEC };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+            next += b->pace_ns;
+        }
+        uint64_t now = pipe_now_ns();
+        memcpy(payload, &now, sizeof(now));
+        if (b->shm) {
+            pipe_shm_send(&producer, payload, b->size, pipe_deadline_from_timeout(10));
+        } else {
+            struct pipe_frame_hdr hdr = { .len = b->size, .type = PIPE_MSG_DATA, .seq = i };
+            pipe_frame_write(wfd, &hdr, payload, pipe_deadline_from_timeout(10));
+        }
+    }
+    pthread_join(tid, NULL);
+    double secs = (double)(pipe_now_ns() - start) / PIPE_NSEC_PER_SEC;
+
+    if (b->shm) {
+        pipe_shm_close(&producer);
+        pipe_shm_close(&b->ring);
+    } else {
+        close(wfd);
+        close(b->fd);
+        close(keepalive_fd);
+        unlink(BENCH_PIPE_NAME);
+    }
+    free(payload);
+    return secs;
+}
+
+int main(int argc, char *argv[]) {
+    long count = argc > 1 ? atol(argv[1]) : 1000000;
+    size_t size = argc > 2 ? (size_t)atol(argv[2]) : 64;
+
+    if (size < sizeof(uint64_t)) {
+        size = sizeof(uint64_t);
+    }
+    printf("%-6s %14s %10s %10s %10s\n", "mode", "msgs/s", "MB/s", "p50 us", "p99 us");
+    for (int shm = 0; shm <= 1; shm++) {
+        struct bench tput = { .shm = shm, .count = count, .size = size };
+        double secs = run(&tput);
+
+        uint64_t *lat = calloc(LATENCY_MESSAGES, sizeof(*lat));
+        struct bench paced = { .shm = shm, .count = LATENCY_MESSAGES, .size = size, .pace_ns = PACE_NS, .lat = lat };
+        run(&paced);
+        qsort(lat, LATENCY_MESSAGES, sizeof(*lat), cmp_u64);
+
+        printf("%-6s %14.0f %10.1f %10.1f %10.1f\n", shm ? "shm" : "fifo", count / secs,
+               count * (double)size / secs / 1e6, lat[LATENCY_MESSAGES / 2] / 1e3,
+               lat[LATENCY_MESSAGES * 99 / 100] / 1e3);
+        free(lat);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,192 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Measures the spool of a FIFO whose reader comes and goes.
+ *
+ *   spool   no reader: every message is appended to the memory-mapped log, latency per send
+ *   replay  a reader attaches and the drainer delivers the backlog, until pipe_spool_flush()
+ *   direct  the reader stays: messages go straight into the FIFO while it has room and only
+ *           spill into the spool while it is full
+ *   commit  pipe_spool_commit() after a burst, the price of making it durable right away
+ *
+ * Each message carries its index, and the reader checks that the stream arrives complete and in
+ * order.
+ *
+ * usage - bench_spool [messages]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#include "pipe_handler.h"
+#include "pipe_spool.h"
+#include "pipe_time.h"
+
+#define BENCH_FIFO_NAME "/tmp/my_pipe_bench_spool"
+#define BENCH_SPOOL_DIR "/tmp/my_pipe_bench_spool.d"
+
+struct reader {
+    pthread_t tid;
+    long count;
+    size_t size;
+    long received;
+    bool in_order;
+    atomic_bool ready;
+};
+
+static void *reader_main(void *arg) {
+    struct reader *r = arg;
+    char *msg = malloc(r->size);
+    size_t have = 0;
+    int fd = open(BENCH_FIFO_NAME, O_RDONLY | O_NONBLOCK);
+
+    r->in_order = true;
+    atomic_store(&r->ready, true);
+    while (fd >= 0 && msg != NULL && r->received < r->count) {
+        ssize_t n = read(fd, msg + have, r->size - have);
+        if (n > 0) {
+            have += n;
+            if (have == r->size) {
+                uint64_t index;
+                memcpy(&index, msg, sizeof(index));
+                r->in_order &= index == (uint64_t)r->received;
+                r->received++;
+                have = 0;
+            }
+        } else if (wait_pipe(fd, POLLIN, pipe_deadline_from_timeout(10)) <= 0) {
+            break;
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(msg);
+    return NULL;
+}
+
+static void start_reader(struct reader *r, long count, size_t size) {
+    memset(r, 0, sizeof(*r));
+    r->count = count;
+    r->size = size;
+    pthread_create(&r->tid, NULL, reader_main, r);
+    while (!atomic_load(&r->ready)) {
+        usleep(100);
+    }
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void send_all(pipe_spool_t *sp, const char *mode, long first, long count, size_t size, uint64_t *lat) {
+    char *msg = calloc(1, size);
+    uint64_t t0 = pipe_now_ns();
+
+    for (long i = 0; i < count; i++) {
+        uint64_t index = first + i, start = pipe_now_ns();
+        memcpy(msg, &index, sizeof(index));
+        if (pipe_spool_send(sp, msg, size) == -1) {
+            perror("pipe_spool_send");
+            exit(EXIT_FAILURE);
+        }
+        lat[i] = pipe_now_ns() - start;
+    }
+    double secs = (pipe_now_ns() - t0) / 1e9;
+    qsort(lat, count, sizeof(*lat), compare_u64);
+    printf("mode=%-6s size=%-5zu msgs/s=%9.0f MB/s=%7.1f p50=%6.2f us p99=%6.2f us max=%7.1f us\n", mode, size,
+           count / secs, count * (double)size / secs / 1e6, lat[count / 2] / 1e3, lat[count * 99 / 100] / 1e3,
+           lat[count - 1] / 1e3);
+    free(msg);
+}
+
+static void run(long count, size_t size) {
+    pipe_spool_config_t cfg = { .name = BENCH_FIFO_NAME, .dir = BENCH_SPOOL_DIR };
+    uint64_t *lat = malloc(count * sizeof(*lat)), t0;
+    struct reader r;
+    pipe_spool_t sp;
+
+    if (lat == NULL || pipe_spool_open(&sp, &cfg) == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    send_all(&sp, "spool", 0, count, size, lat);
+
+    t0 = pipe_now_ns();
+    start_reader(&r, 2 * count, size);
+    pipe_spool_flush(&sp, pipe_deadline_from_timeout(60));
+    double secs = (pipe_now_ns() - t0) / 1e9;
+    printf("mode=%-6s size=%-5zu msgs/s=%9.0f MB/s=%7.1f\n", "replay", size, count / secs,
+           count * (double)size / secs / 1e6);
+
+    send_all(&sp, "direct", count, count, size, lat);
+    pthread_join(r.tid, NULL);
+    if (r.received != 2 * count || !r.in_order) {
+        fprintf(stderr, "reader got %ld of %ld messages%s\n", r.received, 2 * count, r.in_order ? "" : " out of order");
+    }
+
+    // spool another burst without a reader and make it durable in one go
+    for (long i = 0; i < count / 10; i++) {
+        char msg[64] = { 0 };
+        pipe_spool_send(&sp, msg, sizeof(msg));
+    }
+    t0 = pipe_now_ns();
+    pipe_spool_commit(&sp);
+    printf("mode=%-6s size=%-5d msgs=%-9ld commit=%7.1f us\n", "commit", 64, count / 10, (pipe_now_ns() - t0) / 1e3);
+
+    pipe_spool_close(&sp);
+    // drop what the last burst left behind, the next run starts empty
+    pipe_spool_open(&sp, &cfg);
+    start_reader(&r, count / 10, 64);
+    pipe_spool_flush(&sp, pipe_deadline_from_timeout(60));
+    pthread_join(r.tid, NULL);
+    pipe_spool_close(&sp);
+    free(lat);
+}
+
+int main(int argc, char *argv[]) {
+    static const size_t sizes[] = { 64, 1024, 16384 };
+    long count = argc > 1 ? atol(argv[1]) : 200000;
+
+    signal(SIGPIPE, SIG_IGN);
+    mkfifo(BENCH_FIFO_NAME, 0666);
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        run(sizes[s] > 1024 ? count / 10 : count, sizes[s]);
+    }
+    rmdir(BENCH_SPOOL_DIR);
+    unlink(BENCH_FIFO_NAME);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,146 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Compares the timer wheel with scanning a table of deadlines, the way pipe_rpc used to expire
+ * requests. Each simulated event loop iteration advances a virtual clock by 100 us, completes
+ * 16 pending requests (cancel) and issues 16 new ones with deadlines 0.5 to 1.5 s out (arm), then
+ * fires what came due and asks for the next wake-up time. "ns/iter" is the cost of one iteration.
+ * The scan only walks the table once the earliest deadline it knows of is due, which is cheap while
+ * few requests are pending, but the more deadlines there are the closer together they fall, until
+ * every iteration walks every one of them. The wheel only pays for the timers it touches.
+ *
+ * usage - bench_timer [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pipe_time.h"
+#include "pipe_timer.h"
+
+#define CHURN 16
+#define STEP_NS (100 * 1000ULL)
+
+static long fired;
+
+static uint64_t next_deadline(uint64_t now, uint32_t *seed) {
+    *seed = *seed * 1103515245 + 12345;
+    return now + 500 * PIPE_NSEC_PER_MSEC + (*seed >> 8) % PIPE_NSEC_PER_SEC;
+}
+
+static void on_fire(struct pipe_timer *t, void *arg) {
+    fired++;
+    (void)t;
+    (void)arg;
+}
+
+static void bench_wheel(size_t pending, long iters) {
+    struct pipe_timer *timers = calloc(pending, sizeof(*timers));
+    pipe_timer_wheel_t w;
+    uint64_t now, wake = 0, t0;
+    uint32_t seed = 1;
+    double secs;
+
+    if (timers == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    pipe_timer_wheel_init(&w);
+    now = pipe_now_ns();
+    for (size_t i = 0; i < pending; i++) {
+        pipe_timer_arm(&w, &timers[i], next_deadline(now, &seed), on_fire, NULL);
+    }
+    fired = 0;
+    t0 = pipe_now_ns();
+    for (long i = 0; i < iters; i++) {
+        now += STEP_NS;
+        for (int j = 0; j < CHURN; j++) {
+            struct pipe_timer *t = &timers[(seed = seed * 1103515245 + 12345) % pending];
+            pipe_timer_cancel(&w, t);
+            pipe_timer_arm(&w, t, next_deadline(now, &seed), on_fire, NULL);
+        }
+        pipe_timer_expire(&w, now);
+        wake += pipe_timer_next(&w) - now;
+    }
+    secs = (pipe_now_ns() - t0) / 1e9;
+    printf("bench=wheel pending=%-7zu %10.0f ns/iter fired=%ld\n", pending, secs * 1e9 / iters, fired);
+    free(timers);
+    (void)wake;
+}
+
+static void bench_scan(size_t pending, long iters) {
+    uint64_t *deadlines = calloc(pending, sizeof(*deadlines));
+    uint64_t now, next_expiry = UINT64_MAX, t0;
+    uint32_t seed = 1;
+    double secs;
+
+    if (deadlines == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    now = pipe_now_ns();
+    for (size_t i = 0; i < pending; i++) {
+        deadlines[i] = next_deadline(now, &seed);
+    }
+    fired = 0;
+    t0 = pipe_now_ns();
+    for (long i = 0; i < iters; i++) {
+        now += STEP_NS;
+        for (int j = 0; j < CHURN; j++) {
+            uint64_t *d = &deadlines[(seed = seed * 1103515245 + 12345) % pending];
+            *d = next_deadline(now, &seed);
+            if (*d < next_expiry) {
+                next_expiry = *d;
+            }
+        }
+        // a deadline passed: walk the table, fire the due entries and find the next expiry
+        if (now >= next_expiry) {
+            next_expiry = UINT64_MAX;
+            for (size_t k = 0; k < pending; k++) {
+                if (deadlines[k] <= now) {
+                    fired++;
+                    deadlines[k] = UINT64_MAX;
+                }
+                if (deadlines[k] < next_expiry) {
+                    next_expiry = deadlines[k];
+                }
+            }
+        }
+    }
+    secs = (pipe_now_ns() - t0) / 1e9;
+    printf("bench=scan  pending=%-7zu %10.0f ns/iter fired=%ld\n", pending, secs * 1e9 / iters, fired);
+    free(deadlines);
+}
+
+int main(int argc, char *argv[]) {
+    static const size_t pendings[] = { 1000, 10000, 100000 };
+    long iters = argc > 1 ? atol(argv[1]) : 100000;
+
+    for (size_t i = 0; i < sizeof(pendings) / sizeof(pendings[0]); i++) {
+        bench_wheel(pendings[i], iters);
+        bench_scan(pendings[i], iters);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,281 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Compares the io_uring backend with the select()/read() path.
+ *
+ *   echo   round trips through read_from_pipe() under each backend; the echo thread's system
+ *          calls per message are select() + read() = 2 for PIPE_IO_SELECT and the counted
+ *          io_uring_enter() calls for PIPE_IO_URING
+ *   drain  a writer streams 4 KiB writes, the reader empties the pipe either with read() and
+ *          poll() or with linked READ_FIXED chains into registered buffers
+ *   writes 64 byte writes issued one write() at a time or queued and submitted in batches of
+ *          PIPE_URING_MAX_WRITES
+ *
+ * usage - bench_uring [round trips]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include "pipe_handler.h"
+#include "pipe_uring.h"
+#include "pipe_time.h"
+
+#define BENCH_PING_NAME "/tmp/my_pipe_bench_uring_ping"
+#define BENCH_PONG_NAME "/tmp/my_pipe_bench_uring_pong"
+#define MSG_SIZE 64
+#define DRAIN_BYTES (256u << 20)
+#define DRAIN_CHUNK 4096
+#define DRAIN_BUFS 16
+#define WRITE_MSGS 1000000
+
+struct channel {
+    int rfd;
+    int keepalive_fd;
+    int wfd;
+};
+
+struct echo_args {
+    struct channel *ping;
+    struct channel *pong;
+    int count;
+    uint64_t enters;
+};
+
+static void channel_open(struct channel *ch, const char *name) {
+    ch->rfd = open_pipe_persistent(name, &ch->keepalive_fd);
+    ch->wfd = open_pipe_wait(name, pipe_deadline_from_timeout(1));
+}
+
+static void channel_close(struct channel *ch, const char *name) {
+    close(ch->wfd);
+    close(ch->rfd);
+    close(ch->keepalive_fd);
+    unlink(name);
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void *echo_thread(void *arg) {
+    struct echo_args *ea = arg;
+    char buf[BLOCK_SIZE];
+    pipe_uring_t *u = pipe_io_get_backend() == PIPE_IO_URING ? pipe_uring_local() : NULL;
+    uint64_t enters0 = u != NULL ? u->enters : 0;
+
+    for (int i = 0; i < ea->count; i++) {
+        int n = read_from_pipe(ea->ping->rfd, buf, pipe_deadline_from_timeout(10));
+        if (n <= 0) {
+            break;
+        }
+        write_to_pipe(ea->pong->wfd, buf, n);
+    }
+    ea->enters = u != NULL ? u->enters - enters0 : 0;
+    return NULL;
+}
+
+static void run_echo(int backend, int count) {
+    struct channel ping, pong;
+    struct echo_args ea;
+    char buf[MSG_SIZE];
+    uint64_t *samples = calloc(count, sizeof(uint64_t));
+    pthread_t tid;
+
+    if (pipe_io_set_backend(backend) != backend) {
+        printf("echo   backend=uring  unavailable\n");
+        free(samples);
+        return;
+    }
+    channel_open(&ping, BENCH_PING_NAME);
+    channel_open(&pong, BENCH_PONG_NAME);
+    ea.ping = &ping;
+    ea.pong = &pong;
+    ea.count = count;
+    pthread_create(&tid, NULL, echo_thread, &ea);
+
+    memset(buf, 'x', sizeof(buf));
+    uint64_t t0 = pipe_now_ns();
+    for (int i = 0; i < count; i++) {
+        uint64_t start = pipe_now_ns();
+        write(ping.wfd, buf, sizeof(buf));
+        while (read(pong.rfd, buf, sizeof(buf)) <= 0) {
+            wait_pipe(pong.rfd, POLLIN, pipe_deadline_from_timeout(10));
+        }
+        samples[i] = pipe_now_ns() - start;
+    }
+    uint64_t t1 = pipe_now_ns();
+    pthread_join(tid, NULL);
+
+    qsort(samples, count, sizeof(uint64_t), cmp_u64);
+    printf("echo   backend=%-6s round trips/s=%9.0f p50=%6.1f us p99=%6.1f us syscalls/msg=%.2f\n",
+           backend == PIPE_IO_URING ? "uring" : "select", count / ((t1 - t0) / 1e9), samples[count / 2] / 1e3,
+           samples[(size_t)(count * 0.99)] / 1e3, backend == PIPE_IO_URING ? (double)ea.enters / count : 2.0);
+
+    channel_close(&ping, BENCH_PING_NAME);
+    channel_close(&pong, BENCH_PONG_NAME);
+    free(samples);
+}
+
+static void *drain_writer(void *arg) {
+    struct channel *ch = arg;
+    static char chunk[DRAIN_CHUNK];
+
+    for (size_t sent = 0; sent < DRAIN_BYTES;) {
+        ssize_t n = write(ch->wfd, chunk, sizeof(chunk));
+        if (n > 0) {
+            sent += n;
+        } else {
+            wait_pipe(ch->wfd, POLLOUT, pipe_deadline_from_timeout(10));
+        }
+    }
+    return NULL;
+}
+
+static void run_drain(bool uring) {
+    static char buf[DRAIN_BUFS * DRAIN_CHUNK];
+    size_t lens[DRAIN_BUFS];
+    struct channel ch;
+    pipe_uring_t u;
+    pthread_t tid;
+    uint64_t syscalls = 0;
+    size_t got = 0;
+
+    if (uring && (!pipe_uring_available() || pipe_uring_init(&u, 0) == -1 ||
+                  pipe_uring_register_buffers(&u, DRAIN_BUFS, DRAIN_CHUNK) == -1)) {
+        printf("drain  backend=uring  unavailable\n");
+        return;
+    }
+    channel_open(&ch, BENCH_PING_NAME);
+    pthread_create(&tid, NULL, drain_writer, &ch);
+
+    uint64_t t0 = pipe_now_ns();
+    while (got < DRAIN_BYTES) {
+        if (uring) {
+            ssize_t n = pipe_uring_read_fixed(&u, ch.rfd, lens, pipe_deadline_from_timeout(10));
+            if (n <= 0) {
+                break;
+            }
+            got += n;
+        } else {
+            ssize_t n = read(ch.rfd, buf, sizeof(buf));
+            syscalls++;
+            if (n > 0) {
+                got += n;
+            } else {
+                wait_pipe(ch.rfd, POLLIN, pipe_deadline_from_timeout(10));
+                syscalls++;
+            }
+        }
+    }
+    uint64_t t1 = pipe_now_ns();
+    pthread_join(tid, NULL);
+    if (uring) {
+        syscalls = u.enters;
+        pipe_uring_destroy(&u);
+    }
+
+    printf("drain  backend=%-6s MB/s=%8.0f syscalls/MiB=%.1f\n", uring ? "uring" : "read", got / ((t1 - t0) / 1e3),
+           (double)syscalls / (got >> 20));
+    channel_close(&ch, BENCH_PING_NAME);
+}
+
+static void *write_reader(void *arg) {
+    struct channel *ch = arg;
+    static char buf[1 << 16];
+    size_t got = 0;
+
+    while (got < (size_t)WRITE_MSGS * MSG_SIZE) {
+        ssize_t n = read(ch->rfd, buf, sizeof(buf));
+        if (n > 0) {
+            got += n;
+        } else {
+            wait_pipe(ch->rfd, POLLIN, pipe_deadline_from_timeout(10));
+        }
+    }
+    return NULL;
+}
+
+static void run_writes(bool uring) {
+    char msg[MSG_SIZE];
+    struct channel ch;
+    pipe_uring_t u;
+    pthread_t tid;
+    uint64_t syscalls = 0;
+
+    if (uring && (!pipe_uring_available() || pipe_uring_init(&u, 0) == -1)) {
+        printf("writes backend=uring  unavailable\n");
+        return;
+    }
+    memset(msg, 'x', sizeof(msg));
+    channel_open(&ch, BENCH_PING_NAME);
+    pthread_create(&tid, NULL, write_reader, &ch);
+
+    uint64_t t0 = pipe_now_ns();
+    for (int i = 0; i < WRITE_MSGS; i++) {
+        if (uring) {
+            pipe_uring_queue_write(&u, ch.wfd, msg, sizeof(msg));
+        } else {
+            while (write(ch.wfd, msg, sizeof(msg)) == -1) {
+                wait_pipe(ch.wfd, POLLOUT, pipe_deadline_from_timeout(10));
+                syscalls++;
+            }
+            syscalls++;
+        }
+    }
+    if (uring) {
+        pipe_uring_submit_writes(&u, pipe_deadline_from_timeout(10));
+        syscalls = u.enters;
+    }
+    pthread_join(tid, NULL);
+    uint64_t t1 = pipe_now_ns();
+    if (uring) {
+        pipe_uring_destroy(&u);
+    }
+
+    printf("writes backend=%-6s msgs/s=%10.0f syscalls/msg=%.3f\n", uring ? "uring" : "write",
+           WRITE_MSGS / ((t1 - t0) / 1e9), (double)syscalls / WRITE_MSGS);
+    channel_close(&ch, BENCH_PING_NAME);
+}
+
+int main(int argc, char *argv[]) {
+    int count = argc > 1 ? atoi(argv[1]) : 100000;
+
+    run_echo(PIPE_IO_SELECT, count);
+    run_echo(PIPE_IO_URING, count);
+    run_drain(false);
+    run_drain(true);
+    run_writes(false);
+    run_writes(true);
+    return EXIT_SUCCESS;
+}
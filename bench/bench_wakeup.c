@@ -0,0 +1,157 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Compares the wake-up latency of the legacy sleep-polling read loop against the epoll reactor.
+ *
+ * A writer thread sends timestamped messages with send_data() at irregular intervals, the reader
+ * records how long each message sat in the FIFO before it was read, and p50/p99/max are reported.
+ *
+ * usage - bench_wakeup [messages]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "pipe_handler.h"
+#include "pipe_reactor.h"
+#include "pipe_time.h"
+
+#define BENCH_PIPE_NAME "/tmp/my_pipe_bench_wakeup"
+
+struct bench_state {
+    int count;
+    int received;
+    uint64_t *samples;
+    pipe_reactor_t reactor;
+};
+
+static void *writer_thread(void *arg) {
+    struct bench_state *st = arg;
+    unsigned int seed = 42;
+
+    for (int i = 0; i < st->count; i++) {
+        // irregular gaps so that arrivals land at random phases of the poll interval
+        usleep(500 + rand_r(&seed) % 2500);
+        uint64_t now = pipe_now_ns();
+        send_data(BENCH_PIPE_NAME, (char *)&now, sizeof(now), pipe_deadline_from_timeout(1.0));
+    }
+    return NULL;
+}
+
+static void record(struct bench_state *st, const char *buf, ssize_t len) {
+    uint64_t now = pipe_now_ns();
+    for (ssize_t off = 0; off + (ssize_t)sizeof(uint64_t) <= len; off += sizeof(uint64_t)) {
+        uint64_t sent;
+        memcpy(&sent, buf + off, sizeof(sent));
+        if (st->received < st->count) {
+            st->samples[st->received++] = now - sent;
+        }
+    }
+}
+
+static void run_sleep_loop(struct bench_state *st) {
+    char buf[BLOCK_SIZE];
+    int fd = open_pipe(BENCH_PIPE_NAME, true);
+    pthread_t tid;
+
+    pthread_create(&tid, NULL, writer_thread, st);
+    while (st->received < st->count) {
+        ssize_t num_read = read(fd, buf, BLOCK_SIZE);
+        if (num_read == 0) {
+            usleep(10 * 1000);
+        } else if (num_read > 0) {
+            record(st, buf, num_read);
+        }
+    }
+    pthread_join(tid, NULL);
+    close(fd);
+}
+
+static void on_readable(int fd, uint32_t events, void *arg) {
+    struct bench_state *st = arg;
+    char buf[BLOCK_SIZE];
+    ssize_t num_read;
+
+    (void)events;
+    while ((num_read = read(fd, buf, BLOCK_SIZE)) > 0) {
+        record(st, buf, num_read);
+    }
+    if (st->received >= st->count) {
+        pipe_reactor_stop(&st->reactor);
+    }
+}
+
+static void run_reactor(struct bench_state *st) {
+    int keepalive_fd;
+    int fd = open_pipe_persistent(BENCH_PIPE_NAME, &keepalive_fd);
+    pthread_t tid;
+
+    pipe_reactor_init(&st->reactor);
+    pipe_reactor_add(&st->reactor, fd, PIPE_EV_IN, on_readable, st);
+    pthread_create(&tid, NULL, writer_thread, st);
+    pipe_reactor_run(&st->reactor);
+    pthread_join(tid, NULL);
+    pipe_reactor_destroy(&st->reactor);
+    close(fd);
+    close(keepalive_fd);
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void report(const char *name, struct bench_state *st) {
+    qsort(st->samples, st->received, sizeof(uint64_t), cmp_u64);
+    printf("%-8s n=%d p50=%.1fus p99=%.1fus max=%.1fus\n", name, st->received,
+           st->samples[st->received / 2] / 1000.0,
+           st->samples[(st->received * 99) / 100] / 1000.0,
+           st->samples[st->received - 1] / 1000.0);
+}
+
+int main(int argc, char *argv[]) {
+    struct bench_state st;
+
+    memset(&st, 0, sizeof(st));
+    st.count = argc > 1 ? atoi(argv[1]) : 500;
+    st.samples = calloc(st.count, sizeof(uint64_t));
+
+    run_sleep_loop(&st);
+    report("sleep", &st);
+
+    st.received = 0;
+    run_reactor(&st);
+    report("epoll", &st);
+
+    free(st.samples);
+    unlink(BENCH_PIPE_NAME);
+    return EXIT_SUCCESS;
+}
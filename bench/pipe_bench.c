@@ -0,0 +1,499 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Reproducible latency and throughput scenarios for the pipe library.
+ *
+ *   pingpong  round trips through a pair of named pipes, with a latency histogram
+ *   stream    one-way framed messages from a single writer
+ *   fanin     several writer threads into one pipe, each message atomic (at most PIPE_BUF)
+ *   sweep     stream repeated over a range of message sizes
+ *   all       every scenario above
+ *
+ * Results go to stdout as text, CSV or JSON so runs from different releases can be diffed.
+ *
+ * usage - pipe_bench [-s scenario] [-f text|csv|json] [-n messages] [-b bytes] [-w writers]
+ *                    [-c pipe-capacity] [-W warmup] [-z size,size,...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include "pipe_handler.h"
+#include "pipe_frame.h"
+#include "pipe_time.h"
+
+#ifndef PIPE_BENCH_VERSION
+#define PIPE_BENCH_VERSION "unknown"
+#endif
+#ifndef PIPE_BENCH_BUILD
+#define PIPE_BENCH_BUILD "unknown"
+#endif
+
+#define BENCH_PING_NAME "/tmp/my_pipe_bench_ping"
+#define BENCH_PONG_NAME "/tmp/my_pipe_bench_pong"
+#define HISTOGRAM_BUCKETS 64
+#define MAX_SWEEP_SIZES 32
+#define IO_TIMEOUT 10
+
+typedef struct bench_options {
+    const char *scenario;
+    const char *format;
+    long messages;
+    size_t size;
+    int writers;
+    int capacity;
+    long warmup;
+    size_t sizes[MAX_SWEEP_SIZES];
+    int nsizes;
+} bench_options_t;
+
+struct bench_result {
+    const char *scenario;
+    size_t size;
+    int writers;
+    long messages;
+    uint64_t elapsed_ns;
+    uint64_t *samples;  // sorted round-trip times, NULL for one-way scenarios
+    long nsamples;
+};
+
+struct channel {
+    const char *name;
+    int rfd;
+    int keepalive_fd;
+    int wfd;
+};
+
+struct stream_writer {
+    struct channel *ch;
+    long messages;
+    size_t size;
+    uint32_t src;
+};
+
+static bool first_result = true;
+
+static int channel_open(struct channel *ch, const char *name, int capacity) {
+    ch->name = name;
+    ch->rfd = open_pipe_persistent(name, &ch->keepalive_fd);
+    if (ch->rfd == -1) {
+        return -1;
+    }
+    ch->wfd = open_pipe_wait(name, pipe_deadline_from_timeout(1));
+    if (ch->wfd == -1) {
+        close(ch->rfd);
+        close(ch->keepalive_fd);
+        return -1;
+    }
+    if (capacity > 0) {
+        set_pipe_capacity(ch->wfd, capacity);
+    }
+    return 0;
+}
+
+static void channel_close(struct channel *ch) {
+    close(ch->wfd);
+    close(ch->rfd);
+    close(ch->keepalive_fd);
+    unlink(ch->name);
+}
+
+/**
+ * Blocks until the next complete frame is available, or IO_TIMEOUT passes.
+ *
+ * @return 1 with `msg` filled in, or -1 on error or timeout.
+ */
+static int recv_frame(pipe_frame_reader_t *r, int fd, struct pipe_frame *msg) {
+    uint64_t deadline = pipe_deadline_from_timeout(IO_TIMEOUT);
+    int ret;
+
+    while ((ret = pipe_frame_next(r, msg)) == 0) {
+        ssize_t n = pipe_frame_reader_fill(r, fd);
+        if (n == 0 || (n == -1 && errno != EAGAIN)) {
+            return -1;
+        }
+        if (n == -1 && wait_pipe(fd, POLLIN, deadline) <= 0) {
+            fprintf(stderr, "Timeout waiting for frame\n");
+            return -1;
+        }
+    }
+    return ret;
+}
+
+static int send_frame(int fd, uint32_t src, uint32_t seq, const char *payload, size_t size) {
+    struct pipe_frame_hdr hdr = { .len = size, .type = PIPE_MSG_DATA, .seq = seq, .src = src };
+    return pipe_frame_write(fd, &hdr, payload, pipe_deadline_from_timeout(IO_TIMEOUT)) == -1 ? -1 : 0;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(const struct bench_result *res, double p) {
+    long i = (long)(p * (res->nsamples - 1) + 0.5);
+    return res->samples[i];
+}
+
+/* ---- scenarios ---- */
+
+static void *echo_thread(void *arg) {
+    struct channel *ch = arg;  // ch[0] is ping, ch[1] is pong
+    pipe_frame_reader_t reader;
+    struct pipe_frame msg;
+
+    pipe_frame_reader_init(&reader, 0);
+    while (recv_frame(&reader, ch[0].rfd, &msg) == 1 && msg.hdr.type != PIPE_MSG_ACK) {
+        if (send_frame(ch[1].wfd, msg.hdr.src, msg.hdr.seq, msg.payload, msg.hdr.len) == -1) {
+            break;
+        }
+    }
+    pipe_frame_reader_free(&reader);
+    return NULL;
+}
+
+static int run_pingpong(const bench_options_t *opt, size_t size, struct bench_result *res) {
+    struct channel ch[2];
+    struct pipe_frame msg;
+    pipe_frame_reader_t reader;
+    pthread_t tid;
+    char *payload = calloc(1, size ? size : 1);
+    struct pipe_frame_hdr stop = { .type = PIPE_MSG_ACK };
+    int ret = 0;
+
+    if (channel_open(&ch[0], BENCH_PING_NAME, opt->capacity) == -1) {
+        free(payload);
+        return -1;
+    }
+    if (channel_open(&ch[1], BENCH_PONG_NAME, opt->capacity) == -1) {
+        channel_close(&ch[0]);
+        free(payload);
+        return -1;
+    }
+    res->samples = calloc(opt->messages, sizeof(*res->samples));
+    res->nsamples = opt->messages;
+
+    pipe_frame_reader_init(&reader, 0);
+    pthread_create(&tid, NULL, echo_thread, ch);
+    uint64_t start = 0;
+    for (long i = -opt->warmup; i < opt->messages; i++) {
+        if (i == 0) {
+            start = pipe_now_ns();
+        }
+        uint64_t t0 = pipe_now_ns();
+        if (send_frame(ch[0].wfd, 0, (uint32_t)i, payload, size) == -1 ||
+            recv_frame(&reader, ch[1].rfd, &msg) != 1) {
+            ret = -1;
+            break;
+        }
+        if (i >= 0) {
+            res->samples[i] = pipe_now_ns() - t0;
+        }
+    }
+    res->elapsed_ns = pipe_now_ns() - start;
+
+    pipe_frame_write(ch[0].wfd, &stop, NULL, pipe_deadline_from_timeout(IO_TIMEOUT));
+    pthread_join(tid, NULL);
+    pipe_frame_reader_free(&reader);
+    channel_close(&ch[0]);
+    channel_close(&ch[1]);
+    free(payload);
+    qsort(res->samples, res->nsamples, sizeof(*res->samples), cmp_u64);
+    return ret;
+}
+
+static void *writer_thread(void *arg) {
+    struct stream_writer *w = arg;
+    char *payload = calloc(1, w->size ? w->size : 1);
+
+    for (long i = 0; i < w->messages; i++) {
+        if (send_frame(w->ch->wfd, w->src, (uint32_t)i, payload, w->size) == -1) {
+            break;
+        }
+    }
+    free(payload);
+    return NULL;
+}
+
+/**
+ * Runs `writers` writer threads against one reader on the calling thread. With a single writer
+ * this is the streaming scenario.
+ */
+static int run_stream(const bench_options_t *opt, size_t size, int writers, struct bench_result *res) {
+    struct channel ch;
+    struct stream_writer *w = calloc(writers, sizeof(*w));
+    pthread_t *tids = calloc(writers, sizeof(*tids));
+    pipe_frame_reader_t reader;
+    struct pipe_frame msg;
+    long expect = 0, got = 0;
+    int ret = 0;
+
+    if (channel_open(&ch, BENCH_PING_NAME, opt->capacity) == -1) {
+        free(w);
+        free(tids);
+        return -1;
+    }
+    pipe_frame_reader_init(&reader, 0);
+
+    uint64_t start = pipe_now_ns();
+    for (int i = 0; i < writers; i++) {
+        w[i].ch = &ch;
+        w[i].size = size;
+        w[i].src = i + 1;
+        w[i].messages = opt->messages / writers + (i < opt->messages % writers);
+        expect += w[i].messages;
+        pthread_create(&tids[i], NULL, writer_thread, &w[i]);
+    }
+    while (got < expect) {
+        if (recv_frame(&reader, ch.rfd, &msg) != 1) {
+            ret = -1;
+            break;
+        }
+        got++;
+    }
+    res->elapsed_ns = pipe_now_ns() - start;
+
+    for (int i = 0; i < writers; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    pipe_frame_reader_free(&reader);
+    channel_close(&ch);
+    free(w);
+    free(tids);
+    return ret;
+}
+
+/* ---- output ---- */
+
+static void emit_header(const bench_options_t *opt) {
+    if (strcmp(opt->format, "csv") == 0) {
+        printf("version,build,scenario,size,writers,messages,seconds,msgs_per_sec,mb_per_sec,"
+               "min_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n");
+    } else if (strcmp(opt->format, "json") == 0) {
+        printf("{\n  \"benchmark\": \"pipe_bench\",\n  \"version\": \"%s\",\n  \"build\": \"%s\",\n"
+               "  \"pipe_buf\": %d,\n  \"results\": [", PIPE_BENCH_VERSION, PIPE_BENCH_BUILD, PIPE_BUF);
+    } else {
+        printf("pipe_bench %s (%s)\n", PIPE_BENCH_VERSION, PIPE_BENCH_BUILD);
+        printf("%-9s %8s %7s %10s %12s %10s %9s %9s %9s %9s\n", "scenario", "size", "writers",
+               "messages", "msgs/s", "MB/s", "p50 us", "p99 us", "p99.9 us", "max us");
+    }
+}
+
+static void emit_footer(const bench_options_t *opt) {
+    if (strcmp(opt->format, "json") == 0) {
+        printf("\n  ]\n}\n");
+    }
+}
+
+static void emit_result(const bench_options_t *opt, const struct bench_result *res) {
+    double secs = (double)res->elapsed_ns / PIPE_NSEC_PER_SEC;
+    double rate = res->messages / secs;
+    double mbps = rate * res->size / 1e6;
+    bool lat = res->samples != NULL && res->nsamples > 0;
+
+    if (strcmp(opt->format, "csv") == 0) {
+        printf("%s,%s,%s,%zu,%d,%ld,%.6f,%.0f,%.2f", PIPE_BENCH_VERSION, PIPE_BENCH_BUILD, res->scenario,
+               res->size, res->writers, res->messages, secs, rate, mbps);
+        if (lat) {
+            printf(",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n", res->samples[0], percentile(res, 0.5), percentile(res, 0.9),
+                   percentile(res, 0.99), percentile(res, 0.999), res->samples[res->nsamples - 1]);
+        } else {
+            printf(",,,,,,\n");
+        }
+    } else if (strcmp(opt->format, "json") == 0) {
+        printf("%s\n    {\"scenario\": \"%s\", \"size\": %zu, \"writers\": %d, \"messages\": %ld, "
+               "\"seconds\": %.6f, \"msgs_per_sec\": %.0f, \"mb_per_sec\": %.2f",
+               first_result ? "" : ",", res->scenario, res->size, res->writers, res->messages, secs, rate, mbps);
+        if (lat) {
+            uint64_t counts[HISTOGRAM_BUCKETS] = { 0 };
+            bool first = true;
+
+            printf(",\n     \"latency_ns\": {\"min\": %" PRIu64 ", \"p50\": %" PRIu64 ", \"p90\": %" PRIu64
+                   ", \"p99\": %" PRIu64 ", \"p999\": %" PRIu64 ", \"max\": %" PRIu64 "},\n     \"histogram\": [",
+                   res->samples[0], percentile(res, 0.5), percentile(res, 0.9), percentile(res, 0.99),
+                   percentile(res, 0.999), res->samples[res->nsamples - 1]);
+            // power of two buckets, bucket k holds samples below 2^k ns
+            for (long i = 0; i < res->nsamples; i++) {
+                int k = res->samples[i] ? 64 - __builtin_clzll(res->samples[i]) : 0;
+                counts[k < HISTOGRAM_BUCKETS ? k : HISTOGRAM_BUCKETS - 1]++;
+            }
+            for (int k = 0; k < HISTOGRAM_BUCKETS; k++) {
+                if (counts[k]) {
+                    printf("%s{\"lt_ns\": %llu, \"count\": %" PRIu64 "}", first ? "" : ", ", 1ULL << k, counts[k]);
+                    first = false;
+                }
+            }
+            printf("]");
+        }
+        printf("}");
+    } else {
+        printf("%-9s %8zu %7d %10ld %12.0f %10.1f", res->scenario, res->size, res->writers, res->messages,
+               rate, mbps);
+        if (lat) {
+            printf(" %9.1f %9.1f %9.1f %9.1f", percentile(res, 0.5) / 1e3, percentile(res, 0.99) / 1e3,
+                   percentile(res, 0.999) / 1e3, res->samples[res->nsamples - 1] / 1e3);
+        }
+        printf("\n");
+    }
+    first_result = false;
+    fflush(stdout);
+}
+
+static int report(const bench_options_t *opt, int ret, struct bench_result *res) {
+    if (ret == 0) {
+        emit_result(opt, res);
+    } else {
+        fprintf(stderr, "Error running scenario %s with %zu byte messages\n", res->scenario, res->size);
+    }
+    free(res->samples);
+    return ret;
+}
+
+static int scenario_pingpong(const bench_options_t *opt) {
+    struct bench_result res = { .scenario = "pingpong", .size = opt->size, .writers = 1, .messages = opt->messages };
+    return report(opt, run_pingpong(opt, opt->size, &res), &res);
+}
+
+static int scenario_stream(const bench_options_t *opt) {
+    struct bench_result res = { .scenario = "stream", .size = opt->size, .writers = 1, .messages = opt->messages };
+    return report(opt, run_stream(opt, opt->size, 1, &res), &res);
+}
+
+static int scenario_fanin(const bench_options_t *opt) {
+    // larger frames could interleave between writers, keep each one a single atomic write
+    size_t size = opt->size + PIPE_FRAME_HDR_SIZE > PIPE_BUF ? PIPE_BUF - PIPE_FRAME_HDR_SIZE : opt->size;
+    struct bench_result res = { .scenario = "fanin", .size = size, .writers = opt->writers, .messages = opt->messages };
+    return report(opt, run_stream(opt, size, opt->writers, &res), &res);
+}
+
+static int scenario_sweep(const bench_options_t *opt) {
+    int ret = 0;
+
+    for (int i = 0; i < opt->nsizes; i++) {
+        struct bench_result res = { .scenario = "sweep", .size = opt->sizes[i], .writers = 1, .messages = opt->messages };
+        ret |= report(opt, run_stream(opt, opt->sizes[i], 1, &res), &res);
+    }
+    return ret;
+}
+
+static const struct {
+    const char *name;
+    int (*run)(const bench_options_t *opt);
+} scenarios[] = {
+    { "pingpong", scenario_pingpong },
+    { "stream", scenario_stream },
+    { "fanin", scenario_fanin },
+    { "sweep", scenario_sweep },
+};
+
+static int parse_sizes(bench_options_t *opt, const char *list) {
+    char *copy = strdup(list), *save = NULL;
+
+    opt->nsizes = 0;
+    for (char *tok = strtok_r(copy, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+        if (opt->nsizes == MAX_SWEEP_SIZES) {
+            fprintf(stderr, "Error: at most %d sweep sizes\n", MAX_SWEEP_SIZES);
+            free(copy);
+            return -1;
+        }
+        opt->sizes[opt->nsizes++] = strtoul(tok, NULL, 0);
+    }
+    free(copy);
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage - %s [-s pingpong|stream|fanin|sweep|all] [-f text|csv|json] [-n messages]\n"
+            "          [-b bytes] [-w writers] [-c pipe-capacity] [-W warmup] [-z size,size,...]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    bench_options_t opt = {
+        .scenario = "all",
+        .format = "text",
+        .messages = 100000,
+        .size = 64,
+        .writers = 4,
+        .capacity = 0,
+        .warmup = 1000,
+    };
+    int c, ret = 0;
+    bool found = false;
+
+    parse_sizes(&opt, "16,64,256,1024,4096,16384,65536");
+    while ((c = getopt(argc, argv, "s:f:n:b:w:c:W:z:h")) != -1) {
+        switch (c) {
+        case 's': opt.scenario = optarg; break;
+        case 'f': opt.format = optarg; break;
+        case 'n': opt.messages = atol(optarg); break;
+        case 'b': opt.size = strtoul(optarg, NULL, 0); break;
+        case 'w': opt.writers = atoi(optarg); break;
+        case 'c': opt.capacity = atoi(optarg); break;
+        case 'W': opt.warmup = atol(optarg); break;
+        case 'z':
+            if (parse_sizes(&opt, optarg) == -1) {
+                return EXIT_FAILURE;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (opt.messages <= 0 || opt.writers <= 0 || opt.warmup < 0 ||
+        (strcmp(opt.format, "text") && strcmp(opt.format, "csv") && strcmp(opt.format, "json"))) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        found |= strcmp(opt.scenario, "all") == 0 || strcmp(opt.scenario, scenarios[i].name) == 0;
+    }
+    if (!found) {
+        fprintf(stderr, "Error: unknown scenario %s\n", opt.scenario);
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    emit_header(&opt);
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        if (strcmp(opt.scenario, "all") == 0 || strcmp(opt.scenario, scenarios[i].name) == 0) {
+            ret |= scenarios[i].run(&opt);
+        }
+    }
+    emit_footer(&opt);
+    return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,818 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PIPE_ASYNC_HPP
+#define PIPE_ASYNC_HPP
+
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <optional>
+#include <system_error>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+extern "C" {
+#include "pipe_conn.h"
+#include "pipe_frame.h"
+#include "pipe_handler.h"
+#include "pipe_log.h"
+#include "pipe_lz.h"
+#include "pipe_metrics.h"
+#include "pipe_reactor.h"
+#include "pipe_time.h"
+#include "pipe_timer.h"
+}
+
+/*
+ * C++20 coroutine facade over the pipe_handler library. A scheduler runs coroutines on the
+ * thread that calls scheduler::run(), on top of a pipe_reactor: a coroutine that would block on a
+ * pipe instead suspends until epoll reports the pipe ready or a timer on the reactor's wheel
+ * reports its deadline, so one thread serves any number of conversations.
+ *
+ *   cpipe::task<int> echo(cpipe::scheduler &s, pipe_conn_t *conn) {
+ *       struct pipe_frame msg;
+ *       while (co_await cpipe::async_recv(s, conn, &msg, PIPE_DEADLINE_NEVER) >= 0) {
+ *           co_await cpipe::async_send(s, conn, msg.hdr.type, msg.payload, msg.hdr.len, PIPE_DEADLINE_NEVER);
+ *       }
+ *       co_return 0;
+ *   }
+ *
+ * Operations report errors like the C functions they mirror, -1 with errno set. A connection
+ * carries one conversation at a time: one coroutine receiving and one sending. Nothing here is
+ * thread-safe; a scheduler and the connections it drives belong to one thread, and a connection is
+ * closed with close_conn() while its scheduler is in use.
+ */
+namespace cpipe {
+
+class scheduler;
+
+template <typename T = void>
+class task;
+
+namespace detail {
+
+void finish_detached(scheduler *owner, std::coroutine_handle<> h) noexcept;
+
+struct promise_base {
+    std::coroutine_handle<> continuation;
+    scheduler *owner = nullptr;     // set for a task started by scheduler::spawn()
+    std::exception_ptr error;
+
+    struct final_awaiter {
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        template <typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+            promise_base &p = h.promise();
+            if (p.continuation) {
+                return p.continuation;
+            }
+            if (p.owner != nullptr) {
+                finish_detached(p.owner, h);
+            }
+            return std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept {
+        }
+    };
+
+    std::suspend_always initial_suspend() const noexcept {
+        return {};
+    }
+
+    final_awaiter final_suspend() const noexcept {
+        return {};
+    }
+
+    void unhandled_exception() noexcept {
+        error = std::current_exception();
+    }
+};
+
+template <typename T>
+struct promise : promise_base {
+    std::optional<T> value;
+
+    task<T> get_return_object() noexcept;
+
+    void return_value(T v) {
+        value.emplace(std::move(v));
+    }
+};
+
+template <>
+struct promise<void> : promise_base {
+    task<void> get_return_object() noexcept;
+
+    void return_void() const noexcept {
+    }
+};
+
+} // namespace detail
+
+/**
+ * A lazily started coroutine returning `T`. It runs when awaited, and the awaiting coroutine
+ * resumes when it completes, without a trip through the scheduler. Top-level tasks are handed to
+ * scheduler::spawn().
+ */
+template <typename T>
+class task {
+public:
+    using promise_type = detail::promise<T>;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    explicit task(handle_type h) noexcept : h_(h) {
+    }
+
+    task(task &&other) noexcept : h_(std::exchange(other.h_, nullptr)) {
+    }
+
+    task &operator=(task &&other) noexcept {
+        if (this != &other) {
+            if (h_) {
+                h_.destroy();
+            }
+            h_ = std::exchange(other.h_, nullptr);
+        }
+        return *this;
+    }
+
+    task(const task &) = delete;
+    task &operator=(const task &) = delete;
+
+    ~task() {
+        if (h_) {
+            h_.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+        h_.promise().continuation = caller;
+        return h_;
+    }
+
+    T await_resume() {
+        if (h_.promise().error) {
+            std::rethrow_exception(h_.promise().error);
+        }
+        if constexpr (!std::is_void_v<T>) {
+            return std::move(*h_.promise().value);
+        }
+    }
+
+    /**
+     * Gives up ownership of the coroutine, see scheduler::spawn().
+     */
+    handle_type release() noexcept {
+        return std::exchange(h_, nullptr);
+    }
+
+private:
+    handle_type h_;
+};
+
+namespace detail {
+
+template <typename T>
+task<T> promise<T>::get_return_object() noexcept {
+    return task<T>(std::coroutine_handle<promise<T>>::from_promise(*this));
+}
+
+inline task<void> promise<void>::get_return_object() noexcept {
+    return task<void>(std::coroutine_handle<promise<void>>::from_promise(*this));
+}
+
+} // namespace detail
+
+/**
+ * Runs coroutines on one thread, driven by a pipe_reactor: epoll for pipe readiness and the
+ * reactor's timer wheel for deadlines. Resumed coroutines are queued and run in order, never from
+ * inside a reactor callback.
+ */
+class scheduler {
+public:
+    /**
+     * Waits for a pipe to become ready. Resumes with 1 when it is, 0 once `deadline` passed, or
+     * -1 with errno set if the pipe cannot be watched, like wait_pipe(), and with ECANCELED if
+     * forget() drops the pipe meanwhile.
+     *
+     * A pipe is registered with the reactor on its first wait and stays registered, edge
+     * triggered, until forget(); a wait only records the coroutine. Callers wait after a read or
+     * write failed with EAGAIN, so every edge that matters arrives while they wait, and a stale
+     * one costs a spurious wakeup at most.
+     */
+    class io_wait {
+    public:
+        io_wait(scheduler &s, int fd, uint32_t events, uint64_t deadline) noexcept
+            : s_(s), fd_(fd), events_(events), deadline_(deadline) {
+        }
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        bool await_suspend(std::coroutine_handle<> h) noexcept {
+            h_ = h;
+            if (s_.watch(fd_) == -1) {
+                result_ = -1;
+                err_ = errno;
+                return false;
+            }
+            io_wait *&slot = s_.watched_[fd_].waiters[direction()];
+            if (slot != nullptr) {
+                // one receiving and one sending coroutine per pipe
+                result_ = -1;
+                err_ = EBUSY;
+                return false;
+            }
+            slot = this;
+            pipe_reactor_timer_arm(&s_.reactor_, &timer_, deadline_, on_timeout, this);
+            return true;
+        }
+
+        int await_resume() const noexcept {
+            if (result_ == -1) {
+                errno = err_;
+            }
+            return result_;
+        }
+
+    private:
+        friend class scheduler;
+
+        int direction() const noexcept {
+            return (events_ & PIPE_EV_OUT) ? 1 : 0;
+        }
+
+        void wake(int result, int err) noexcept {
+            pipe_reactor_timer_cancel(&s_.reactor_, &timer_);
+            s_.watched_[fd_].waiters[direction()] = nullptr;
+            result_ = result;
+            err_ = err;
+            s_.ready_.push_back(h_);
+        }
+
+        static void on_timeout(struct pipe_timer *t, void *arg) {
+            io_wait *w = static_cast<io_wait *>(arg);
+
+            w->s_.watched_[w->fd_].waiters[w->direction()] = nullptr;
+            w->result_ = 0;
+            w->s_.ready_.push_back(w->h_);
+            (void)t;
+        }
+
+        scheduler &s_;
+        int fd_;
+        uint32_t events_;
+        uint64_t deadline_;
+        std::coroutine_handle<> h_;
+        struct pipe_timer timer_ = {};
+        int result_ = 0;
+        int err_ = 0;
+    };
+
+    /**
+     * Suspends until `deadline` passes.
+     */
+    class sleep {
+    public:
+        sleep(scheduler &s, uint64_t deadline) noexcept : s_(s), deadline_(deadline) {
+        }
+
+        bool await_ready() const noexcept {
+            return pipe_now_ns() >= deadline_;
+        }
+
+        void await_suspend(std::coroutine_handle<> h) noexcept {
+            h_ = h;
+            pipe_reactor_timer_arm(&s_.reactor_, &timer_, deadline_, on_timeout, this);
+        }
+
+        void await_resume() const noexcept {
+        }
+
+    private:
+        static void on_timeout(struct pipe_timer *t, void *arg) {
+            sleep *w = static_cast<sleep *>(arg);
+
+            w->s_.ready_.push_back(w->h_);
+            (void)t;
+        }
+
+        scheduler &s_;
+        uint64_t deadline_;
+        std::coroutine_handle<> h_;
+        struct pipe_timer timer_ = {};
+    };
+
+    /**
+     * Creates a scheduler with its own reactor.
+     *
+     * @throws std::system_error If the reactor cannot be created.
+     */
+    scheduler() {
+        if (pipe_reactor_init(&reactor_) == -1) {
+            throw std::system_error(errno, std::generic_category(), "pipe_reactor_init");
+        }
+    }
+
+    scheduler(const scheduler &) = delete;
+    scheduler &operator=(const scheduler &) = delete;
+
+    /**
+     * Destroys the tasks that did not finish and releases the reactor.
+     */
+    ~scheduler() {
+        for (void *addr : detached_) {
+            std::coroutine_handle<>::from_address(addr).destroy();
+        }
+        pipe_reactor_destroy(&reactor_);
+    }
+
+    /**
+     * Starts a top-level task. It first runs from run(), and its frame is freed when it completes.
+     * An exception escaping it terminates the program, as with std::thread.
+     *
+     * @param t The task.
+     */
+    void spawn(task<void> t) {
+        auto h = t.release();
+
+        h.promise().owner = this;
+        detached_.insert(h.address());
+        ready_.push_back(h);
+    }
+
+    /**
+     * Runs coroutines until every spawned task completed or stop() was called.
+     *
+     * @return 0 on success, or -1 if the reactor failed.
+     */
+    int run() {
+        while (!detached_.empty() && !pipe_reactor_stopped(&reactor_)) {
+            while (!ready_.empty()) {
+                std::coroutine_handle<> h = ready_.front();
+                ready_.pop_front();
+                h.resume();
+            }
+            if (detached_.empty() || pipe_reactor_stopped(&reactor_)) {
+                break;
+            }
+            if (pipe_reactor_run_once(&reactor_, -1) == -1) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    /**
+     * Makes run() return; like pipe_reactor_stop() this may be called from a signal handler.
+     */
+    void stop() noexcept {
+        pipe_reactor_stop(&reactor_);
+    }
+
+    /**
+     * Drops a descriptor from the reactor and resumes the coroutines waiting on it with -1 and
+     * errno ECANCELED. Call it before closing a descriptor this scheduler has waited on, since a
+     * new descriptor reusing the number would otherwise never be registered.
+     *
+     * @param fd The file descriptor; one that was never waited on is ignored.
+     */
+    void forget(int fd) noexcept {
+        if (fd < 0 || (size_t)fd >= watched_.size() || !watched_[fd].registered) {
+            return;
+        }
+        for (io_wait *w : watched_[fd].waiters) {
+            if (w != nullptr) {
+                w->wake(-1, ECANCELED);
+            }
+        }
+        pipe_reactor_del(&reactor_, fd);
+        watched_[fd] = fd_watch{};
+    }
+
+    /**
+     * Waits until `fd` is readable or `deadline` passes, see io_wait.
+     */
+    io_wait readable(int fd, uint64_t deadline) noexcept {
+        return io_wait(*this, fd, PIPE_EV_IN, deadline);
+    }
+
+    /**
+     * Waits until `fd` is writable or `deadline` passes, see io_wait.
+     */
+    io_wait writable(int fd, uint64_t deadline) noexcept {
+        return io_wait(*this, fd, PIPE_EV_OUT, deadline);
+    }
+
+    /**
+     * Waits until `deadline` passes.
+     */
+    sleep sleep_until(uint64_t deadline) noexcept {
+        return sleep(*this, deadline);
+    }
+
+    /**
+     * The reactor, for registering descriptors the facade does not cover.
+     */
+    pipe_reactor_t *reactor() noexcept {
+        return &reactor_;
+    }
+
+private:
+    friend void detail::finish_detached(scheduler *owner, std::coroutine_handle<> h) noexcept;
+
+    struct fd_watch {
+        bool registered = false;
+        io_wait *waiters[2] = {};   // waiting for PIPE_EV_IN, for PIPE_EV_OUT
+    };
+
+    int watch(int fd) noexcept {
+        if (fd < 0) {
+            errno = EBADF;
+            return -1;
+        }
+        if ((size_t)fd >= watched_.size()) {
+            watched_.resize(fd + 1);
+        }
+        if (!watched_[fd].registered) {
+            if (pipe_reactor_add(&reactor_, fd, PIPE_EV_IN | PIPE_EV_OUT | PIPE_EV_ET, on_ready, this) == -1) {
+                return -1;
+            }
+            watched_[fd].registered = true;
+        }
+        return 0;
+    }
+
+    static void on_ready(int fd, uint32_t events, void *arg) {
+        fd_watch &w = static_cast<scheduler *>(arg)->watched_[fd];
+
+        // a hang-up or error wakes both sides, the next read or write reports it
+        if (w.waiters[0] != nullptr && (events & (PIPE_EV_IN | PIPE_EV_HUP | PIPE_EV_ERR))) {
+            w.waiters[0]->wake(1, 0);
+        }
+        if (w.waiters[1] != nullptr && (events & (PIPE_EV_OUT | PIPE_EV_HUP | PIPE_EV_ERR))) {
+            w.waiters[1]->wake(1, 0);
+        }
+    }
+
+    pipe_reactor_t reactor_;
+    std::deque<std::coroutine_handle<>> ready_;
+    std::unordered_set<void *> detached_;      // spawned tasks that have not completed
+    std::vector<fd_watch> watched_;            // indexed by descriptor
+};
+
+namespace detail {
+
+inline void finish_detached(scheduler *owner, std::coroutine_handle<> h) noexcept {
+    auto p = std::coroutine_handle<promise<void>>::from_address(h.address());
+
+    if (p.promise().error) {
+        std::terminate();
+    }
+    owner->detached_.erase(h.address());
+    h.destroy();
+}
+
+} // namespace detail
+
+/**
+ * Writes one frame, suspending while the pipe is full. A frame of at most PIPE_BUF bytes is
+ * written by a single write(), so it stays whole on a FIFO shared with other writers.
+ */
+inline task<int> async_write_frame(scheduler &s, int fd, const struct pipe_frame_hdr *hdr, const char *payload, uint64_t deadline) {
+    struct iovec iov[2];
+    struct iovec *pos = iov;
+    int cnt = 2;
+
+    iov[0].iov_base = (void *)hdr;
+    iov[0].iov_len = PIPE_FRAME_HDR_SIZE;
+    iov[1].iov_base = (void *)payload;
+    iov[1].iov_len = hdr->len;
+    pipe_metrics_add(fd, PIPE_METRIC_MSGS_SENT, 1);
+
+    while (cnt > 0) {
+        ssize_t n = writev(fd, pos, cnt);
+
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                if (errno != EPIPE) {
+                    pipe_log(PIPE_LOG_ERROR, "Error writing to named pipe: %s\n", strerror(errno));
+                }
+                co_return -1;
+            }
+            pipe_metrics_add(fd, PIPE_METRIC_EAGAIN, 1);
+            int ret = co_await s.writable(fd, deadline);
+            if (ret == 0) {
+                pipe_log(PIPE_LOG_WARN, "Timeout waiting for named pipe to drain\n");
+                pipe_metrics_add(fd, PIPE_METRIC_TIMEOUTS, 1);
+                errno = ETIMEDOUT;
+            }
+            if (ret <= 0) {
+                co_return -1;
+            }
+            continue;
+        }
+
+        pipe_metrics_add(fd, PIPE_METRIC_WRITE_CALLS, 1);
+        pipe_metrics_add(fd, PIPE_METRIC_BYTES_SENT, n);
+        while (cnt > 0 && (size_t)n >= pos->iov_len) {
+            n -= pos->iov_len;
+            pos++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            pipe_metrics_add(fd, PIPE_METRIC_PARTIAL_WRITES, 1);
+            pos->iov_base = (char *)pos->iov_base + n;
+            pos->iov_len -= n;
+        }
+    }
+    co_return 0;
+}
+
+/**
+ * Opens the transmit side of a connection once the peer is reading, like pipe_conn_connect() but
+ * suspending instead of blocking: while there is no reader it waits on an inotify watch for the
+ * pipe to be opened, and a client connection's HELLO is written like any other frame.
+ *
+ * @param s The scheduler.
+ * @param conn The connection.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds.
+ * @return 0 on success, or -1 on error or timeout.
+ */
+inline task<int> async_connect(scheduler &s, pipe_conn_t *conn, uint64_t deadline) {
+    int fd, ifd = -1;
+
+    if (conn->tx_fd >= 0) {
+        co_return 0;
+    }
+    if (access(conn->tx_name, F_OK) == -1 && mkfifo(conn->tx_name, 0666) == -1 && errno != EEXIST) {
+        pipe_log(PIPE_LOG_ERROR, "Error creating named pipe: %s\n", strerror(errno));
+        co_return -1;
+    }
+
+    while ((fd = open(conn->tx_name, O_WRONLY | O_NONBLOCK | O_CLOEXEC)) == -1) {
+        if (errno != ENXIO) {
+            pipe_log(PIPE_LOG_ERROR, "Error opening named pipe for writing: %s\n", strerror(errno));
+            break;
+        }
+        if (ifd == -1) {
+            // retry after arming the watch so that a reader arriving in between is not missed
+            if ((ifd = pipe_watch_open(conn->tx_name)) == -1) {
+                co_return -1;
+            }
+            continue;
+        }
+        int ret = co_await s.readable(ifd, deadline);
+        if (ret == 0) {
+            pipe_log(PIPE_LOG_WARN, "Timeout waiting for pipe to open\n");
+            pipe_metrics_count(pipe_metrics_register(conn->tx_name), PIPE_METRIC_TIMEOUTS, 1);
+            errno = ETIMEDOUT;
+        }
+        if (ret <= 0) {
+            break;
+        }
+        pipe_metrics_count(pipe_metrics_register(conn->tx_name), PIPE_METRIC_OPEN_RETRIES, 1);
+        pipe_watch_drain(ifd);
+    }
+    if (ifd >= 0) {
+        int err = errno;
+        s.forget(ifd);
+        close(ifd);
+        errno = err;
+    }
+    if (fd == -1) {
+        co_return -1;
+    }
+
+    pipe_metrics_bind_name(fd, conn->tx_name);
+    conn->tx_fd = fd;
+    if (conn->shared) {
+        struct pipe_frame_hdr hdr;
+        char hello[PIPE_CONN_HELLO_MAX];
+
+        pipe_conn_hello(conn, &hdr, hello);
+        if (co_await async_write_frame(s, fd, &hdr, hello, deadline) == -1) {
+            int err = errno;
+            s.forget(fd);
+            close(fd);
+            conn->tx_fd = -1;
+            errno = err;
+            co_return -1;
+        }
+    }
+    co_return 0;
+}
+
+/**
+ * Sends one framed message, the coroutine counterpart of pipe_conn_send_msg(): it is framed,
+ * fragmented and compressed the same way, and reconnects once if the peer went away.
+ *
+ * @param s The scheduler.
+ * @param conn The connection.
+ * @param type The message type, e.g. PIPE_MSG_DATA.
+ * @param buf A pointer to the payload, which must stay in place until the send completes.
+ * @param buflen The length of the payload.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds.
+ * @return The number of payload bytes sent, or -1 on error or timeout.
+ */
+inline task<int> async_send(scheduler &s, pipe_conn_t *conn, uint16_t type, const void *buf, size_t buflen, uint64_t deadline) {
+    struct pipe_frame_hdr hdr;
+    const char *data = static_cast<const char *>(buf);
+    size_t len = buflen;
+    // fragments of a client connection fit in PIPE_BUF together with their header
+    const size_t fragment = conn->shared ? PIPE_BUF - PIPE_FRAME_HDR_SIZE : PIPE_FRAME_MAX_LEN;
+
+    if (buflen > PIPE_FRAME_MAX_LEN) {
+        pipe_log(PIPE_LOG_ERROR, "Message of %zu bytes exceeds the frame limit\n", buflen);
+        errno = EMSGSIZE;
+        co_return -1;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.type = type;
+    hdr.seq = conn->tx_seq++;
+    hdr.src = conn->src;
+
+    if (conn->peer_lz) {
+        const char *packed;
+        ssize_t n = pipe_lz_pack(conn->lz, buf, buflen, &packed);
+        if (n > 0) {
+            data = packed;
+            len = (size_t)n;
+            hdr.flags |= PIPE_FRAME_LZ;
+        }
+    }
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        size_t off = 0;
+        int ret = 0;
+
+        if (co_await async_connect(s, conn, deadline) == -1) {
+            co_return -1;
+        }
+        if (attempt > 0 && (hdr.flags & PIPE_FRAME_LZ)) {
+            // a new server has not accepted compression yet
+            data = static_cast<const char *>(buf);
+            len = buflen;
+            hdr.flags &= ~PIPE_FRAME_LZ;
+        }
+        do {
+            size_t chunk = len - off > fragment ? fragment : len - off;
+            hdr.len = (uint32_t)chunk;
+            hdr.flags = (hdr.flags & ~(PIPE_FRAME_MORE | PIPE_FRAME_FIRST)) | (off + chunk < len ? PIPE_FRAME_MORE : 0) |
+                        (off == 0 && chunk < len ? PIPE_FRAME_FIRST : 0);
+            ret = co_await async_write_frame(s, conn->tx_fd, &hdr, data + off, deadline);
+            off += chunk;
+        } while (ret == 0 && off < len);
+
+        if (ret == 0) {
+            co_return (int)buflen;
+        }
+        if (errno != EPIPE) {
+            co_return -1;
+        }
+        // the reader went away, the half written frame dies with the old pipe buffer
+        s.forget(conn->tx_fd);
+        close(conn->tx_fd);
+        conn->tx_fd = -1;
+    }
+
+    pipe_log(PIPE_LOG_ERROR, "Error writing to named pipe: %s\n", strerror(EPIPE));
+    errno = EPIPE;
+    co_return -1;
+}
+
+/**
+ * Receives one whole message, the coroutine counterpart of pipe_conn_recv_msg().
+ *
+ * @param s The scheduler.
+ * @param conn The connection.
+ * @param msg Receives the message; its payload points into the connection's buffer and stays valid until the next receive.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds.
+ * @return The payload length, or -1 on error or timeout.
+ */
+inline task<int> async_recv(scheduler &s, pipe_conn_t *conn, struct pipe_frame *msg, uint64_t deadline) {
+    while (true) {
+        struct pipe_frame frame;
+        int ret = pipe_frame_next(&conn->rx, &frame);
+
+        if (ret == 1) {
+            ret = pipe_conn_assemble(conn, &frame, msg);
+            if (ret == 1) {
+                co_return (int)msg->hdr.len;
+            }
+            if (ret == 0) {
+                continue;
+            }
+        }
+        if (ret == -1) {
+            co_return -1;
+        }
+
+        ssize_t n = pipe_frame_reader_fill(&conn->rx, conn->rx_fd);
+        if (n > 0) {
+            continue;
+        }
+        if (n == 0) {
+            errno = EPIPE;
+            co_return -1;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            co_return -1;
+        }
+
+        ret = co_await s.readable(conn->rx_fd, deadline);
+        if (ret == 0) {
+            pipe_log(PIPE_LOG_WARN, "Timeout waiting for data on named pipe\n");
+            pipe_metrics_add(conn->rx_fd, PIPE_METRIC_TIMEOUTS, 1);
+            errno = ETIMEDOUT;
+        }
+        if (ret <= 0) {
+            co_return -1;
+        }
+    }
+}
+
+/**
+ * Closes a connection driven by `s`, like pipe_conn_close(). Coroutines still waiting to send or
+ * receive on it resume with -1 and errno ECANCELED.
+ *
+ * @param s The scheduler.
+ * @param conn The connection.
+ */
+inline void close_conn(scheduler &s, pipe_conn_t *conn) {
+    s.forget(conn->tx_fd);
+    s.forget(conn->rx_fd);
+    pipe_conn_close(conn);
+}
+
+/**
+ * Sends a request and receives the reply to it, for a conversation of one request at a time.
+ *
+ * @param s The scheduler.
+ * @param conn The connection.
+ * @param type The message type, e.g. PIPE_MSG_DATA.
+ * @param buf A pointer to the payload.
+ * @param buflen The length of the payload.
+ * @param reply Receives the reply, see async_recv().
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds for the send and the reply.
+ * @return The payload length of the reply, or -1 on error or timeout.
+ */
+inline task<int> async_request(scheduler &s, pipe_conn_t *conn, uint16_t type, const void *buf, size_t buflen,
+                               struct pipe_frame *reply, uint64_t deadline) {
+    if (co_await async_send(s, conn, type, buf, buflen, deadline) == -1) {
+        co_return -1;
+    }
+    // not `co_return co_await`, which GCC 12 compiles into a coroutine that never starts
+    int len = co_await async_recv(s, conn, reply, deadline);
+    co_return len;
+}
+
+} // namespace cpipe
+
+#endif
@@ -0,0 +1,162 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+#include "pipe_handler.h"
+#include "pipe_batch.h"
+#include "pipe_time.h"
+
+#ifndef PIPE_BUF
+#define PIPE_BUF 4096
+#endif
+
+/**
+ * Initializes a batching sender on an already opened pipe.
+ *
+ * @param b The batch to initialize.
+ * @param fd The non-blocking write descriptor of the named pipe.
+ * @param shared Whether other writers may use the same pipe, which caps each writev() at PIPE_BUF.
+ * @param threshold The number of pending bytes that triggers a flush, PIPE_BUF if 0.
+ * @param max_delay_ns The longest a queued frame may wait before it is flushed, or UINT64_MAX to
+ *                     flush on size alone.
+ */
+void pipe_batch_init(pipe_batch_t *b, int fd, bool shared, size_t threshold, uint64_t max_delay_ns) {
+    memset(b, 0, sizeof(*b));
+    b->fd = fd;
+    b->shared = shared;
+    b->threshold = threshold ? threshold : PIPE_BUF;
+    if (shared && b->threshold > PIPE_BUF) {
+        b->threshold = PIPE_BUF;
+    }
+    b->max_delay_ns = max_delay_ns;
+    b->deadline = PIPE_DEADLINE_NEVER;
+}
+
+/**
+ * Queues one frame. The header is copied, the payload is referenced and must stay valid and
+ * unchanged until the batch is flushed.
+ *
+ * @param b The batch.
+ * @param hdr The frame header, `hdr->len` is the payload length.
+ * @param payload The payload bytes.
+ * @return 0 if the frame was queued (and possibly flushed), or -1 if a flush failed.
+ */
+int pipe_batch_add(pipe_batch_t *b, const struct pipe_frame_hdr *hdr, const void *payload) {
+    size_t size = PIPE_FRAME_HDR_SIZE + hdr->len;
+
+    // keep the frame out of a group it would push past the atomic limit
+    if (b->nframes == PIPE_BATCH_MAX_FRAMES || (b->shared && b->pending + size > PIPE_BUF)) {
+        if (pipe_batch_flush(b) == -1) {
+            return -1;
+        }
+    }
+
+    int i = b->nframes++;
+    b->hdrs[i] = *hdr;
+    b->iov[2 * i].iov_base = &b->hdrs[i];
+    b->iov[2 * i].iov_len = PIPE_FRAME_HDR_SIZE;
+    b->iov[2 * i + 1].iov_base = (void *)payload;
+    b->iov[2 * i + 1].iov_len = hdr->len;
+    if (b->pending == 0) {
+        b->first_ns = pipe_now_ns();
+    }
+    b->pending += size;
+
+    if (b->pending >= b->threshold || pipe_now_ns() - b->first_ns >= b->max_delay_ns) {
+        return pipe_batch_flush(b);
+    }
+    return 0;
+}
+
+/**
+ * Writes every queued frame. In shared mode frames are grouped so that no writev() exceeds PIPE_BUF.
+ *
+ * @param b The batch.
+ * @return 0 on success, or -1 on error. On error the queue is discarded.
+ */
+int pipe_batch_flush(pipe_batch_t *b) {
+    int start = 0, ret = 0;
+
+    while (start < b->nframes) {
+        int end = start;
+        size_t group = 0;
+
+        if (b->shared) {
+            do {
+                group += PIPE_FRAME_HDR_SIZE + b->hdrs[end].len;
+                end++;
+            } while (end < b->nframes && group + PIPE_FRAME_HDR_SIZE + b->hdrs[end].len <= PIPE_BUF);
+        } else {
+            end = b->nframes;
+        }
+
+        if (writev_to_pipe(b->fd, &b->iov[2 * start], 2 * (end - start), b->deadline) == -1) {
+            ret = -1;
+            break;
+        }
+        start = end;
+    }
+
+    b->nframes = 0;
+    b->pending = 0;
+    b->first_ns = 0;
+    return ret;
+}
+
+/**
+ * Flushes the batch if its oldest frame has waited `max_delay_ns`. Meant to be called from an
+ * event loop that sleeps at most `pipe_batch_timeout_ms()`.
+ *
+ * @param b The batch.
+ * @return 0 on success, or -1 if a flush failed.
+ */
+int pipe_batch_poll(pipe_batch_t *b) {
+    if (b->pending > 0 && pipe_now_ns() - b->first_ns >= b->max_delay_ns) {
+        return pipe_batch_flush(b);
+    }
+    return 0;
+}
+
+/**
+ * Returns how long an event loop may sleep before the batch must be flushed.
+ *
+ * @param b The batch.
+ * @return The number of milliseconds until the flush deadline, or -1 if nothing is queued or
+ *         the batch has no delay limit.
+ */
+int pipe_batch_timeout_ms(const pipe_batch_t *b) {
+    // the sum would wrap for a delay of UINT64_MAX and make the caller spin
+    if (b->pending == 0 || b->max_delay_ns >= PIPE_DEADLINE_NEVER - b->first_ns) {
+        return -1;
+    }
+    return pipe_ms_until(b->first_ns + b->max_delay_ns);
+}
@@ -0,0 +1,66 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PIPE_BATCH_H
+#define PIPE_BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "pipe_frame.h"
+
+#define PIPE_BATCH_MAX_FRAMES 256
+
+/**
+ * Sender-side coalescing of framed messages. Queued frames are flushed with writev() once
+ * `threshold` bytes are pending, `max_delay_ns` has passed since the oldest frame was queued,
+ * or the queue is full.
+ *
+ * When `shared` is set other processes may write to the same FIFO, so every writev() is kept at
+ * or below PIPE_BUF bytes and made of whole frames; the kernel then writes it atomically and
+ * frames from different writers never interleave. A frame larger than PIPE_BUF cannot be atomic
+ * and is written on its own.
+ */
+typedef struct pipe_batch {
+    int fd;
+    bool shared;
+    size_t threshold;
+    uint64_t max_delay_ns;
+    uint64_t deadline;      // absolute CLOCK_MONOTONIC deadline of every write, PIPE_DEADLINE_NEVER by default
+    uint64_t first_ns;
+    size_t pending;
+    int nframes;
+    struct pipe_frame_hdr hdrs[PIPE_BATCH_MAX_FRAMES];
+    struct iovec iov[2 * PIPE_BATCH_MAX_FRAMES];
+} pipe_batch_t;
+
+void pipe_batch_init(pipe_batch_t *b, int fd, bool shared, size_t threshold, uint64_t max_delay_ns);
+int pipe_batch_add(pipe_batch_t *b, const struct pipe_frame_hdr *hdr, const void *payload);
+int pipe_batch_flush(pipe_batch_t *b);
+int pipe_batch_poll(pipe_batch_t *b);
+int pipe_batch_timeout_ms(const pipe_batch_t *b);
+
+#endif
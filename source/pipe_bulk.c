@@ -0,0 +1,294 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+
+#include "pipe_handler.h"
+#include "pipe_bulk.h"
+#include "pipe_log.h"
+#include "pipe_time.h"
+
+#define BULK_BOUNCE_SIZE (64 * 1024)
+
+/**
+ * Allocates a page aligned buffer suitable for `pipe_bulk_send()`. The length is rounded up to
+ * a whole number of pages so that no other data shares the spliced pages.
+ *
+ * @param len The number of bytes needed.
+ * @return The buffer, or NULL on error.
+ * @throws If the allocation fails, an appropriate error message will be printed to stderr.
+ */
+void *pipe_bulk_alloc(size_t len) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    void *buf = NULL;
+    int ret;
+
+    len = (len + page - 1) & ~(page - 1);
+    if ((ret = posix_memalign(&buf, page, len ? len : page)) != 0) {
+        pipe_log(PIPE_LOG_ERROR, "Error allocating bulk buffer: %s\n", strerror(ret));
+        return NULL;
+    }
+    return buf;
+}
+
+/**
+ * Releases a buffer returned by `pipe_bulk_alloc()`.
+ *
+ * @param buf The buffer.
+ */
+void pipe_bulk_free(void *buf) {
+    free(buf);
+}
+
+static int wait_or_timeout(int fd, short events, uint64_t deadline) {
+    int ret = wait_pipe(fd, events, deadline);
+    if (ret == 0) {
+        pipe_log(PIPE_LOG_WARN, "Timeout waiting for bulk transfer on named pipe\n");
+        errno = ETIMEDOUT;
+    }
+    return ret > 0 ? 0 : -1;
+}
+
+/**
+ * Maps user pages into a pipe with vmsplice(), so the payload is never copied into the kernel.
+ *
+ * The pages are referenced, not copied: `buf` must not be modified or freed until the reader has
+ * consumed the data. Use page aligned buffers from `pipe_bulk_alloc()` so whole pages are handed over.
+ * Falls back to write() when vmsplice() is not supported on `pipe_fd` or PIPE_BULK_COPY is set.
+ *
+ * @param pipe_fd The non-blocking write descriptor of the named pipe.
+ * @param buf The data to send.
+ * @param len The number of bytes to send.
+ * @param flags PIPE_BULK_COPY to force the copying path.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds.
+ * @return The number of bytes sent, or -1 on error or timeout.
+ * @throws If an error occurs while writing, an appropriate error message will be printed to stderr.
+ */
+ssize_t pipe_bulk_send(int pipe_fd, const void *buf, size_t len, int flags, uint64_t deadline) {
+    size_t off = 0;
+
+    while (off < len && !(flags & PIPE_BULK_COPY)) {
+        struct iovec iov = { .iov_base = (char *)buf + off, .iov_len = len - off };
+        ssize_t n = vmsplice(pipe_fd, &iov, 1, SPLICE_F_NONBLOCK);
+        if (n > 0) {
+            off += n;
+        } else if (n == -1 && (errno == EAGAIN || errno == EINTR)) {
+            if (errno == EAGAIN && wait_or_timeout(pipe_fd, POLLOUT, deadline) == -1) {
+                return -1;
+            }
+        } else if (n == -1 && (errno == EINVAL || errno == ENOSYS || errno == EBADF)) {
+            break;
+        } else {
+            pipe_log(PIPE_LOG_ERROR, "Error in vmsplice(): %s\n", strerror(errno));
+            return -1;
+        }
+    }
+
+    if (off < len) {
+        struct iovec iov = { .iov_base = (char *)buf + off, .iov_len = len - off };
+        if (writev_to_pipe(pipe_fd, &iov, 1, deadline) == -1) {
+            return -1;
+        }
+    }
+    return (ssize_t)len;
+}
+
+static ssize_t copy_recv(int pipe_fd, int out_fd, size_t len, uint64_t deadline) {
+    static __thread char bounce[BULK_BOUNCE_SIZE];
+    size_t done = 0;
+
+    while (done < len) {
+        size_t want = len - done < sizeof(bounce) ? len - done : sizeof(bounce);
+        ssize_t n = read(pipe_fd, bounce, want);
+        if (n == 0) {
+            pipe_log(PIPE_LOG_ERROR, "Unexpected end of named pipe during bulk transfer\n");
+            errno = EPIPE;
+            return -1;
+        }
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN && wait_or_timeout(pipe_fd, POLLIN, deadline) == 0) {
+                continue;
+            }
+            if (errno != ETIMEDOUT) {
+                pipe_log(PIPE_LOG_ERROR, "Error reading from named pipe: %s\n", strerror(errno));
+            }
+            return -1;
+        }
+
+        for (ssize_t off = 0; off < n;) {
+            ssize_t w = write(out_fd, bounce + off, n - off);
+            if (w == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN && wait_or_timeout(out_fd, POLLOUT, deadline) == 0) {
+                    continue;
+                }
+                if (errno != ETIMEDOUT) {
+                    pipe_log(PIPE_LOG_ERROR, "Error writing bulk data: %s\n", strerror(errno));
+                }
+                return -1;
+            }
+            off += w;
+        }
+        done += n;
+    }
+    return (ssize_t)done;
+}
+
+/**
+ * Moves `len` bytes from a pipe straight into `out_fd` (a file, socket or another pipe) with
+ * splice(), so the payload never passes through a user space buffer. Falls back to read()/write()
+ * through a bounce buffer when `out_fd` does not support splice() or PIPE_BULK_COPY is set.
+ *
+ * @param pipe_fd The non-blocking read descriptor of the named pipe.
+ * @param out_fd The destination descriptor.
+ * @param len The number of bytes to move.
+ * @param flags PIPE_BULK_COPY to force the copying path.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds.
+ * @return The number of bytes moved, or -1 on error or timeout.
+ * @throws If an error occurs while splicing or copying, an appropriate error message will be printed to stderr.
+ */
+ssize_t pipe_bulk_recv(int pipe_fd, int out_fd, size_t len, int flags, uint64_t deadline) {
+    size_t done = 0;
+
+    while (done < len && !(flags & PIPE_BULK_COPY)) {
+        ssize_t n = splice(pipe_fd, NULL, out_fd, NULL, len - done, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0) {
+            done += n;
+        } else if (n == 0) {
+            pipe_log(PIPE_LOG_ERROR, "Unexpected end of named pipe during bulk transfer\n");
+            errno = EPIPE;
+            return -1;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN) {
+            // either the pipe is empty or the destination is full
+            int avail = 0;
+            ioctl(pipe_fd, FIONREAD, &avail);
+            if (wait_or_timeout(avail > 0 ? out_fd : pipe_fd, avail > 0 ? POLLOUT : POLLIN, deadline) == -1) {
+                return -1;
+            }
+        } else if (errno == EINVAL || errno == ENOSYS) {
+            break;
+        } else {
+            pipe_log(PIPE_LOG_ERROR, "Error in splice(): %s\n", strerror(errno));
+            return -1;
+        }
+    }
+
+    if (done < len) {
+        if (copy_recv(pipe_fd, out_fd, len - done, deadline) == -1) {
+            return -1;
+        }
+    }
+    return (ssize_t)len;
+}
+
+/**
+ * Sends a PIPE_MSG_BULK frame whose payload is transferred with `pipe_bulk_send()`. The pipe
+ * must not be shared with other writers, a bulk payload is never written atomically.
+ *
+ * @param pipe_fd The non-blocking write descriptor of the named pipe.
+ * @param seq The sequence number to put in the header.
+ * @param buf The payload.
+ * @param len The payload length.
+ * @param flags PIPE_BULK_COPY to force the copying path.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds.
+ * @return The payload length, or -1 on error or timeout.
+ */
+ssize_t pipe_bulk_send_frame(int pipe_fd, uint32_t seq, const void *buf, size_t len, int flags, uint64_t deadline) {
+    struct pipe_frame_hdr hdr;
+    struct iovec iov;
+
+    if (len > PIPE_FRAME_MAX_LEN) {
+        pipe_log(PIPE_LOG_ERROR, "Bulk payload of %zu bytes exceeds the frame limit\n", len);
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.len = (uint32_t)len;
+    hdr.type = PIPE_MSG_BULK;
+    hdr.seq = seq;
+    iov.iov_base = &hdr;
+    iov.iov_len = PIPE_FRAME_HDR_SIZE;
+    if (writev_to_pipe(pipe_fd, &iov, 1, deadline) == -1) {
+        return -1;
+    }
+    return pipe_bulk_send(pipe_fd, buf, len, flags, deadline);
+}
+
+/**
+ * Receives one frame header and splices its payload into `out_fd`. Exactly one header is read
+ * from the pipe so the payload is left in the kernel for splice().
+ *
+ * @param pipe_fd The non-blocking read descriptor of the named pipe.
+ * @param out_fd The destination descriptor for the payload.
+ * @param hdr Receives the frame header.
+ * @param flags PIPE_BULK_COPY to force the copying path.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds.
+ * @return The payload length, or -1 on error or timeout.
+ */
+ssize_t pipe_bulk_recv_frame(int pipe_fd, int out_fd, struct pipe_frame_hdr *hdr, int flags, uint64_t deadline) {
+    size_t got = 0;
+
+    while (got < PIPE_FRAME_HDR_SIZE) {
+        ssize_t n = read(pipe_fd, (char *)hdr + got, PIPE_FRAME_HDR_SIZE - got);
+        if (n > 0) {
+            got += n;
+        } else if (n == 0) {
+            errno = EPIPE;
+            return -1;
+        } else if (errno == EAGAIN) {
+            if (wait_or_timeout(pipe_fd, POLLIN, deadline) == -1) {
+                return -1;
+            }
+        } else if (errno != EINTR) {
+            pipe_log(PIPE_LOG_ERROR, "Error reading from named pipe: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+
+    if (hdr->len > PIPE_FRAME_MAX_LEN) {
+        pipe_log(PIPE_LOG_ERROR, "Invalid frame length %u on named pipe\n", hdr->len);
+        errno = EPROTO;
+        return -1;
+    }
+    return pipe_bulk_recv(pipe_fd, out_fd, hdr->len, flags, deadline);
+}
@@ -0,0 +1,46 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PIPE_BULK_H
+#define PIPE_BULK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "pipe_frame.h"
+
+#define PIPE_MSG_BULK 3
+
+// bypass vmsplice()/splice() and use the copying read()/write() path
+#define PIPE_BULK_COPY 0x1
+
+void *pipe_bulk_alloc(size_t len);
+void pipe_bulk_free(void *buf);
+ssize_t pipe_bulk_send(int pipe_fd, const void *buf, size_t len, int flags, uint64_t deadline);
+ssize_t pipe_bulk_recv(int pipe_fd, int out_fd, size_t len, int flags, uint64_t deadline);
+ssize_t pipe_bulk_send_frame(int pipe_fd, uint32_t seq, const void *buf, size_t len, int flags, uint64_t deadline);
+ssize_t pipe_bulk_recv_frame(int pipe_fd, int out_fd, struct pipe_frame_hdr *hdr, int flags, uint64_t deadline);
+
+#endif
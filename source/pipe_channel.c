@@ -0,0 +1,266 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "pipe_handler.h"
+#include "pipe_channel.h"
+#include "pipe_log.h"
+
+/**
+ * Formats the FIFO name of one shard of a channel group, "<name>.<shard>".
+ *
+ * @param out Receives the name.
+ * @param outlen The size of `out`.
+ * @param name The name of the channel group.
+ * @param shard The shard index.
+ * @return 0 on success, or -1 if the name does not fit.
+ */
+int pipe_channel_shard_name(char *out, size_t outlen, const char *name, int shard) {
+    int n = snprintf(out, outlen, "%s.%d", name, shard);
+
+    if (n < 0 || (size_t)n >= outlen) {
+        pipe_log(PIPE_LOG_ERROR, "Channel name is too long: %s\n", name);
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Initializes a channel group and opens the FIFO of every shard.
+ *
+ * @param ch The channel group to initialize.
+ * @param cfg The configuration, copied into the group. `cpus`, if set, must outlive the group.
+ * @return 0 on success, or -1 on error.
+ * @throws If a shard cannot be set up, an appropriate error message will be printed to stderr.
+ */
+int pipe_channel_init(pipe_channel_t *ch, const pipe_channel_config_t *cfg) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+    memset(ch, 0, sizeof(*ch));
+    if (cfg->shards < 1 || cfg->shards > PIPE_CHANNEL_MAX_SHARDS) {
+        pipe_log(PIPE_LOG_ERROR, "A channel group needs 1 to %d shards, not %d\n", PIPE_CHANNEL_MAX_SHARDS, cfg->shards);
+        errno = EINVAL;
+        return -1;
+    }
+    ch->cfg = *cfg;
+    ch->shard = calloc(cfg->shards, sizeof(*ch->shard));
+    if (ch->shard == NULL) {
+        pipe_log(PIPE_LOG_ERROR, "Error allocating channel shards: %s\n", strerror(errno));
+        return -1;
+    }
+
+    for (int i = 0; i < cfg->shards; i++) {
+        struct pipe_channel_shard *s = &ch->shard[i];
+        pipe_server_config_t scfg = cfg->server;
+
+        if (pipe_channel_shard_name(s->name, sizeof(s->name), cfg->name, i) == -1) {
+            pipe_channel_destroy(ch);
+            return -1;
+        }
+        scfg.name = s->name;
+        if (pipe_server_init(&s->srv, &scfg) == -1) {
+            pipe_channel_destroy(ch);
+            return -1;
+        }
+        s->cpu = cfg->cpus != NULL ? cfg->cpus[i] : (int)(i % (ncpu > 0 ? ncpu : 1));
+        ch->shards++;
+    }
+    return 0;
+}
+
+static void *shard_main(void *arg) {
+    struct pipe_channel_shard *s = arg;
+    cpu_set_t set;
+    int ret;
+
+    if (s->cpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET(s->cpu, &set);
+        if ((ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0) {
+            pipe_log(PIPE_LOG_WARN, "Cannot pin the reader of %s to CPU %d: %s\n", s->name, s->cpu, strerror(ret));
+        }
+    }
+    return (void *)(intptr_t)pipe_server_run(&s->srv);
+}
+
+/**
+ * Runs every shard on a thread of its own until `pipe_channel_stop()` is called, then joins them.
+ *
+ * @param ch The channel group.
+ * @return 0 when stopped, or -1 if a shard failed.
+ */
+int pipe_channel_run(pipe_channel_t *ch) {
+    int i, ret = 0;
+    void *status;
+
+    for (i = 0; i < ch->shards; i++) {
+        struct pipe_channel_shard *s = &ch->shard[i];
+
+        if (!ch->cfg.pin) {
+            s->cpu = -1;
+        }
+        if (pthread_create(&s->tid, NULL, shard_main, s) != 0) {
+            pipe_log(PIPE_LOG_ERROR, "Error starting the reader of %s\n", s->name);
+            pipe_channel_stop(ch);
+            ret = -1;
+            break;
+        }
+        s->running = true;
+    }
+
+    for (i = 0; i < ch->shards; i++) {
+        if (ch->shard[i].running) {
+            pthread_join(ch->shard[i].tid, &status);
+            ch->shard[i].running = false;
+            if ((intptr_t)status != 0) {
+                ret = -1;
+            }
+        }
+    }
+    return ret;
+}
+
+/**
+ * Asks every shard to stop. Safe to call from a signal handler and from a handler.
+ *
+ * @param ch The channel group.
+ */
+void pipe_channel_stop(pipe_channel_t *ch) {
+    for (int i = 0; i < ch->shards; i++) {
+        pipe_server_stop(&ch->shard[i].srv);
+    }
+}
+
+/**
+ * Releases a channel group that is not running.
+ *
+ * @param ch The channel group.
+ */
+void pipe_channel_destroy(pipe_channel_t *ch) {
+    for (int i = 0; i < ch->shards; i++) {
+        pipe_server_destroy(&ch->shard[i].srv);
+    }
+    free(ch->shard);
+    ch->shard = NULL;
+    ch->shards = 0;
+}
+
+/**
+ * Opens a client connection to every shard of a channel group. Shard i replies on
+ * "<reply_name>.<i>".
+ *
+ * @param w The writer to initialize.
+ * @param name The name of the channel group.
+ * @param reply_name The prefix of this writer's reply pipes, unique per writer.
+ * @param shards The number of shards of the group.
+ * @return 0 on success, or -1 on error.
+ */
+int pipe_channel_writer_open(pipe_channel_writer_t *w, const char *name, const char *reply_name, int shards) {
+    char server_name[PIPE_NAME_MAX], shard_reply[PIPE_NAME_MAX];
+
+    memset(w, 0, sizeof(*w));
+    if (shards < 1 || shards > PIPE_CHANNEL_MAX_SHARDS) {
+        errno = EINVAL;
+        return -1;
+    }
+    w->conns = calloc(shards, sizeof(*w->conns));
+    if (w->conns == NULL) {
+        pipe_log(PIPE_LOG_ERROR, "Error allocating channel connections: %s\n", strerror(errno));
+        return -1;
+    }
+    for (int i = 0; i < shards; i++) {
+        if (pipe_channel_shard_name(server_name, sizeof(server_name), name, i) == -1 ||
+            pipe_channel_shard_name(shard_reply, sizeof(shard_reply), reply_name, i) == -1 ||
+            pipe_conn_open_client(&w->conns[i], server_name, shard_reply) == -1) {
+            pipe_channel_writer_close(w);
+            return -1;
+        }
+        w->shards++;
+    }
+    return 0;
+}
+
+/**
+ * Chooses the shard for a message: the FNV-1a hash of the key modulo the shard count, or the
+ * next shard in turn when there is no key.
+ *
+ * @param w The writer.
+ * @param key The ordering key, or NULL.
+ * @param keylen The length of the key.
+ * @return The shard index.
+ */
+int pipe_channel_pick(pipe_channel_writer_t *w, const void *key, size_t keylen) {
+    const unsigned char *p = key;
+    uint32_t h = 2166136261u;
+
+    if (key == NULL) {
+        return (int)(w->next++ % (uint32_t)w->shards);
+    }
+    for (size_t i = 0; i < keylen; i++) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return (int)(h % (uint32_t)w->shards);
+}
+
+/**
+ * Sends a message to the shard chosen by `pipe_channel_pick()`.
+ *
+ * @param w The writer.
+ * @param key The ordering key, or NULL for round-robin.
+ * @param keylen The length of the key.
+ * @param type The message type, e.g. PIPE_MSG_DATA.
+ * @param buf A pointer to the payload.
+ * @param buflen The length of the payload.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds for room in the shard's pipe.
+ * @return The number of bytes sent, or -1 on error.
+ */
+int pipe_channel_send(pipe_channel_writer_t *w, const void *key, size_t keylen, uint16_t type, const void *buf, size_t buflen, uint64_t deadline) {
+    return pipe_conn_send_msg(&w->conns[pipe_channel_pick(w, key, keylen)], type, buf, buflen, deadline);
+}
+
+/**
+ * Closes the connection to every shard.
+ *
+ * @param w The writer.
+ */
+void pipe_channel_writer_close(pipe_channel_writer_t *w) {
+    for (int i = 0; i < w->shards; i++) {
+        pipe_conn_close(&w->conns[i]);
+    }
+    free(w->conns);
+    w->conns = NULL;
+    w->shards = 0;
+}
@@ -0,0 +1,90 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PIPE_CHANNEL_H
+#define PIPE_CHANNEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "pipe_conn.h"
+#include "pipe_server.h"
+
+#define PIPE_CHANNEL_MAX_SHARDS 64
+
+typedef struct pipe_channel_config {
+    const char *name;            // shard i is the FIFO "<name>.<i>"
+    int shards;
+    bool pin;                    // pin each shard's reader thread to a CPU
+    const int *cpus;             // CPU of each shard when pinning, NULL for shard i on CPU i
+    pipe_server_config_t server; // applied to every shard, `name` is ignored
+} pipe_channel_config_t;
+
+struct pipe_channel_shard {
+    pipe_server_t srv;
+    pthread_t tid;
+    int cpu;
+    bool running;
+    char name[PIPE_NAME_MAX];
+};
+
+/**
+ * A channel group: one logical request pipe spread over several FIFOs, so that writers do not
+ * all contend for one kernel pipe lock and each FIFO has its own reader. Every shard is a
+ * pipe_server running on its own thread, optionally pinned to a CPU; requests reach the handler
+ * of the shard they were written to. With `workers` 0 the handler runs on the shard's reader
+ * thread and requests of one shard are handled in the order they were written.
+ */
+typedef struct pipe_channel {
+    pipe_channel_config_t cfg;
+    int shards;
+    struct pipe_channel_shard *shard;
+} pipe_channel_t;
+
+/**
+ * The writing side of a channel group, one client connection per shard. A message with a key
+ * always goes to the same shard, so messages of one key keep their order; messages without a key
+ * are spread round-robin. Not thread-safe; give each writer thread its own.
+ */
+typedef struct pipe_channel_writer {
+    int shards;
+    uint32_t next;
+    pipe_conn_t *conns;
+} pipe_channel_writer_t;
+
+int pipe_channel_shard_name(char *out, size_t outlen, const char *name, int shard);
+
+int pipe_channel_init(pipe_channel_t *ch, const pipe_channel_config_t *cfg);
+int pipe_channel_run(pipe_channel_t *ch);
+void pipe_channel_stop(pipe_channel_t *ch);
+void pipe_channel_destroy(pipe_channel_t *ch);
+
+int pipe_channel_writer_open(pipe_channel_writer_t *w, const char *name, const char *reply_name, int shards);
+int pipe_channel_pick(pipe_channel_writer_t *w, const void *key, size_t keylen);
+int pipe_channel_send(pipe_channel_writer_t *w, const void *key, size_t keylen, uint16_t type, const void *buf, size_t buflen, uint64_t deadline);
+void pipe_channel_writer_close(pipe_channel_writer_t *w);
+
+#endif
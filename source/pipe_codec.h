@@ -0,0 +1,157 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PIPE_CODEC_H
+#define PIPE_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// frame type of messages encoded by the schema compiler, the payload starts with the schema id
+#define PIPE_MSG_TYPED 6
+
+// longest varint, a full 64-bit value
+#define PIPE_VARINT_MAX 10
+
+/**
+ * A string or byte field. Decoded values point into the receive buffer and are not
+ * NUL-terminated.
+ */
+struct pipe_bytes {
+    const char *ptr;
+    uint32_t len;
+};
+
+/**
+ * Wraps a NUL-terminated string for encoding.
+ */
+static inline struct pipe_bytes pipe_bytes_str(const char *s) {
+    struct pipe_bytes b = { s, (uint32_t)strlen(s) };
+    return b;
+}
+
+/**
+ * Returns the number of bytes pipe_varint_put() uses for `v`.
+ */
+static inline size_t pipe_varint_size(uint64_t v) {
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+
+/**
+ * Writes `v` as a little-endian base 128 varint and returns the number of bytes written, at most
+ * PIPE_VARINT_MAX.
+ */
+static inline size_t pipe_varint_put(uint8_t *out, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+/**
+ * Reads a varint at `*p` and advances `*p` past it.
+ *
+ * @return 0 on success, or -1 if the varint runs past `end` or is longer than PIPE_VARINT_MAX.
+ */
+static inline int pipe_varint_get(const uint8_t **p, const uint8_t *end, uint64_t *v) {
+    const uint8_t *q = *p;
+    uint64_t result = 0;
+
+    if (q < end && *q < 0x80) {
+        *v = *q;
+        *p = q + 1;
+        return 0;
+    }
+    for (int shift = 0; q < end && shift < 7 * PIPE_VARINT_MAX; shift += 7) {
+        uint8_t b = *q++;
+        result |= (uint64_t)(b & 0x7f) << shift;
+        if (b < 0x80) {
+            *v = result;
+            *p = q;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Maps signed values onto unsigned ones so that small magnitudes of either sign encode short.
+ */
+static inline uint64_t pipe_zigzag_encode(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t pipe_zigzag_decode(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/**
+ * Writes a length-prefixed byte field and returns the position after it.
+ */
+static inline uint8_t *pipe_codec_put_bytes(uint8_t *out, struct pipe_bytes b) {
+    out += pipe_varint_put(out, b.len);
+    memcpy(out, b.ptr, b.len);
+    return out + b.len;
+}
+
+/**
+ * Reads a length-prefixed byte field in place and advances `*p` past it.
+ *
+ * @return 0 on success, or -1 if the field runs past `end`.
+ */
+static inline int pipe_codec_get_bytes(const uint8_t **p, const uint8_t *end, struct pipe_bytes *b) {
+    uint64_t len;
+
+    if (pipe_varint_get(p, end, &len) == -1 || len > (uint64_t)(end - *p)) {
+        return -1;
+    }
+    b->ptr = (const char *)*p;
+    b->len = (uint32_t)len;
+    *p += len;
+    return 0;
+}
+
+/**
+ * Returns the schema id of an encoded message, or -1 if `len` is too short to hold one.
+ */
+static inline int pipe_codec_msg_id(const void *buf, size_t len) {
+    uint16_t id;
+
+    if (len < sizeof(id)) {
+        return -1;
+    }
+    memcpy(&id, buf, sizeof(id));
+    return id;
+}
+
+#endif
@@ -0,0 +1,465 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <limits.h>
+
+#include "pipe_handler.h"
+#include "pipe_conn.h"
+#include "pipe_log.h"
+#include "pipe_metrics.h"
+#include "pipe_time.h"
+
+#ifndef PIPE_BUF
+#define PIPE_BUF 4096
+#endif
+
+#define FRAGMENT_SIZE (PIPE_BUF - PIPE_FRAME_HDR_SIZE)
+
+/**
+ * Opens a persistent connection. The receive FIFO is opened immediately, the transmit FIFO is
+ * connected by `pipe_conn_connect()` or lazily on the first `pipe_conn_send()`, since the peer may
+ * not be reading yet.
+ *
+ * @param conn The connection to initialize.
+ * @param tx_name The name of the named pipe to send on.
+ * @param rx_name The name of the named pipe to receive on.
+ * @return 0 on success, or -1 on error.
+ * @throws If an error occurs while creating or opening the receive pipe, an appropriate error message will be printed to stderr.
+ */
+int pipe_conn_open(pipe_conn_t *conn, const char *tx_name, const char *rx_name) {
+    memset(conn, 0, sizeof(*conn));
+    conn->tx_fd = conn->rx_fd = conn->rx_keepalive_fd = -1;
+    snprintf(conn->tx_name, PIPE_NAME_MAX, "%s", tx_name);
+    snprintf(conn->rx_name, PIPE_NAME_MAX, "%s", rx_name);
+
+    if (pipe_frame_reader_init(&conn->rx, 0) == -1) {
+        return -1;
+    }
+
+    conn->rx_fd = open_pipe_persistent(rx_name, &conn->rx_keepalive_fd);
+    if (conn->rx_fd == -1) {
+        pipe_frame_reader_free(&conn->rx);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Opens a client connection to a multi-client server. `reply_name` must be private to this
+ * connection; it is created, registered with the server and removed again by `pipe_conn_close()`.
+ *
+ * @param conn The connection to initialize.
+ * @param server_name The name of the server's shared request pipe.
+ * @param reply_name The name of this client's private reply pipe.
+ * @return 0 on success, or -1 on error.
+ */
+int pipe_conn_open_client(pipe_conn_t *conn, const char *server_name, const char *reply_name) {
+    static uint32_t next_id = 0;
+
+    if (strlen(reply_name) >= PIPE_NAME_MAX || strlen(reply_name) + 1 > FRAGMENT_SIZE) {
+        pipe_log(PIPE_LOG_ERROR, "Reply pipe name is too long: %s\n", reply_name);
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (pipe_conn_open(conn, server_name, reply_name) == -1) {
+        return -1;
+    }
+    conn->shared = true;
+    // keyed by PID, the low byte tells apart several connections of one process
+    conn->src = ((uint32_t)getpid() << 8) | (__atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED) & 0xff);
+    return 0;
+}
+
+/**
+ * Points the transmit side of a connection at another pipe, e.g. the reply pipe a client announced.
+ *
+ * @param conn The connection.
+ * @param tx_name The name of the new named pipe to send on.
+ * @return 0 on success, or -1 if the name is too long.
+ */
+int pipe_conn_set_peer(pipe_conn_t *conn, const char *tx_name) {
+    if (strlen(tx_name) >= PIPE_NAME_MAX) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (conn->tx_fd >= 0 && strcmp(conn->tx_name, tx_name) != 0) {
+        close(conn->tx_fd);
+        conn->tx_fd = -1;
+    }
+    snprintf(conn->tx_name, PIPE_NAME_MAX, "%s", tx_name);
+    return 0;
+}
+
+/**
+ * Enables compression of large messages on a client connection. It is offered to the server when
+ * the connection connects, so this must be called before the first send; messages are compressed
+ * only once the server has accepted. Point-to-point connections have no handshake and never compress.
+ *
+ * @param conn The connection.
+ * @param threshold The smallest message worth compressing, 0 turns compression off.
+ * @return 0 on success, or -1 on error.
+ */
+int pipe_conn_set_compression(pipe_conn_t *conn, size_t threshold) {
+    if (threshold == 0) {
+        pipe_lz_free(conn->lz);
+        conn->lz = NULL;
+        conn->peer_lz = false;
+        return 0;
+    }
+    if (conn->lz == NULL && (conn->lz = pipe_lz_new(threshold)) == NULL) {
+        return -1;
+    }
+    conn->lz->threshold = threshold;
+    return 0;
+}
+
+/**
+ * Builds the PIPE_MSG_HELLO a client connection announces its reply pipe with, offering
+ * compression and reporting the reliable window as configured. The server has not accepted
+ * compression on the new pipe yet, so the connection stops compressing until it answers.
+ *
+ * @param conn The client connection.
+ * @param hdr Receives the frame header.
+ * @param buf Receives the payload, PIPE_CONN_HELLO_MAX bytes.
+ */
+void pipe_conn_hello(pipe_conn_t *conn, struct pipe_frame_hdr *hdr, char *buf) {
+    size_t len = strlen(conn->rx_name) + 1;
+
+    memcpy(buf, conn->rx_name, len);
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->type = PIPE_MSG_HELLO;
+    hdr->flags = conn->lz != NULL ? PIPE_FRAME_LZ : 0;
+    hdr->src = conn->src;
+    if (conn->reliable) {
+        memcpy(buf + len, &conn->tx_unacked, sizeof(uint32_t));
+        len += sizeof(uint32_t);
+        hdr->flags |= PIPE_FRAME_REL;
+    }
+    hdr->len = (uint32_t)len;
+    conn->peer_lz = false;
+}
+
+/**
+ * Connects the transmit side of a connection, waiting until the peer opens its end or `deadline` passes.
+ * A client connection then announces its reply pipe with PIPE_MSG_HELLO.
+ *
+ * @param conn The connection.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds.
+ * @return 0 on success, or -1 on error or timeout.
+ */
+int pipe_conn_connect(pipe_conn_t *conn, uint64_t deadline) {
+    struct pipe_frame_hdr hdr;
+
+    if (conn->tx_fd >= 0) {
+        return 0;
+    }
+    conn->tx_fd = open_pipe_wait(conn->tx_name, deadline);
+    if (conn->tx_fd == -1) {
+        return -1;
+    }
+
+    if (conn->shared) {
+        char hello[PIPE_CONN_HELLO_MAX];
+
+        pipe_conn_hello(conn, &hdr, hello);
+        if (pipe_frame_write(conn->tx_fd, &hdr, hello, deadline) == -1) {
+            close(conn->tx_fd);
+            conn->tx_fd = -1;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Writes one message as a single frame, or as PIPE_BUF sized fragments on a shared pipe.
+ */
+static int write_message(pipe_conn_t *conn, struct pipe_frame_hdr *hdr, const char *buf, size_t buflen, uint64_t deadline) {
+    size_t off = 0;
+
+    if (!conn->shared) {
+        hdr->len = (uint32_t)buflen;
+        return pipe_frame_write(conn->tx_fd, hdr, buf, deadline) >= 0 ? 0 : -1;
+    }
+
+    do {
+        size_t chunk = buflen - off > FRAGMENT_SIZE ? FRAGMENT_SIZE : buflen - off;
+        hdr->len = (uint32_t)chunk;
+        hdr->flags = (hdr->flags & ~(PIPE_FRAME_MORE | PIPE_FRAME_FIRST)) | (off + chunk < buflen ? PIPE_FRAME_MORE : 0) |
+                     (off == 0 && chunk < buflen ? PIPE_FRAME_FIRST : 0);
+        if (pipe_frame_write(conn->tx_fd, hdr, buf + off, deadline) == -1) {
+            return -1;
+        }
+        off += chunk;
+    } while (off < buflen);
+    return 0;
+}
+
+/**
+ * Sends one framed message on a connection, waiting until `deadline` for the peer and for
+ * pipe capacity. Messages of any size are accepted; on a client connection they are fragmented.
+ *
+ * If the peer closed its end the write fails with EPIPE; the connection then reconnects once and
+ * resends the whole frame. Callers should ignore SIGPIPE to get this behaviour instead of being terminated.
+ *
+ * @param conn The connection.
+ * @param type The message type, e.g. PIPE_MSG_DATA.
+ * @param buf A pointer to the payload.
+ * @param buflen The length of the payload.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds.
+ * @return The number of payload bytes sent, or -1 on error or timeout.
+ * @throws If an error occurs while connecting or writing, an appropriate error message will be printed to stderr.
+ */
+int pipe_conn_send_msg(pipe_conn_t *conn, uint16_t type, const void *buf, size_t buflen, uint64_t deadline) {
+    return pipe_conn_send_seq(conn, type, 0, conn->tx_seq++, buf, buflen, deadline);
+}
+
+/**
+ * Sends one framed message with a sequence number and flags chosen by the caller, e.g. to resend
+ * a message under its original seq. See pipe_conn_send_msg().
+ *
+ * @param conn The connection.
+ * @param type The message type, e.g. PIPE_MSG_DATA.
+ * @param flags Frame flags to set on every fragment, e.g. PIPE_FRAME_REL.
+ * @param seq The sequence number of the message.
+ * @param buf A pointer to the payload.
+ * @param buflen The length of the payload.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds.
+ * @return The number of payload bytes sent, or -1 on error or timeout.
+ */
+int pipe_conn_send_seq(pipe_conn_t *conn, uint16_t type, uint16_t flags, uint32_t seq, const void *buf, size_t buflen, uint64_t deadline) {
+    struct pipe_frame_hdr hdr;
+    const char *data = buf;
+    size_t len = buflen;
+
+    if (buflen > PIPE_FRAME_MAX_LEN) {
+        pipe_log(PIPE_LOG_ERROR, "Message of %zu bytes exceeds the frame limit\n", buflen);
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.type = type;
+    hdr.flags = flags & ~(PIPE_FRAME_MORE | PIPE_FRAME_FIRST);
+    hdr.seq = seq;
+    hdr.src = conn->src;
+
+    if (conn->peer_lz) {
+        const char *packed;
+        ssize_t n = pipe_lz_pack(conn->lz, buf, buflen, &packed);
+        if (n > 0) {
+            data = packed;
+            len = (size_t)n;
+            hdr.flags |= PIPE_FRAME_LZ;
+        }
+    }
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (pipe_conn_connect(conn, deadline) == -1) {
+            return -1;
+        }
+        if (attempt > 0 && (hdr.flags & PIPE_FRAME_LZ)) {
+            // a new server has not accepted compression yet
+            data = buf;
+            len = buflen;
+            hdr.flags &= ~PIPE_FRAME_LZ;
+        }
+        if (write_message(conn, &hdr, data, len, deadline) == 0) {
+            return (int)buflen;
+        }
+        if (errno != EPIPE) {
+            return -1;
+        }
+        // the reader went away, the half written frame dies with the old pipe buffer
+        close(conn->tx_fd);
+        conn->tx_fd = -1;
+    }
+
+    pipe_log(PIPE_LOG_ERROR, "Error writing to named pipe: %s\n", strerror(EPIPE));
+    errno = EPIPE;
+    return -1;
+}
+
+/**
+ * Feeds one frame read from a connection into its receive path: fragments are joined, compressed
+ * messages restored and a server's HELLO taken note of. For callers that read frames themselves.
+ *
+ * @param conn The connection.
+ * @param frame The frame.
+ * @param msg Receives the message once it is complete; its payload stays valid until the next frame is fed.
+ * @return 1 if a message is complete, 0 if more frames are needed or the frame was consumed, or -1 on error.
+ */
+int pipe_conn_assemble(pipe_conn_t *conn, const struct pipe_frame *frame, struct pipe_frame *msg) {
+    int ret;
+
+    if (conn->shared && frame->hdr.type == PIPE_MSG_HELLO) {
+        conn->peer_lz = conn->lz != NULL && (frame->hdr.flags & PIPE_FRAME_LZ);
+        pipe_log(PIPE_LOG_DEBUG, "Server %s compression\n", conn->peer_lz ? "accepted" : "declined");
+        return 0;
+    }
+
+    ret = pipe_frame_assemble(&conn->rx_assembler, frame, msg);
+    if (ret != 1) {
+        return ret;
+    }
+    pipe_metrics_add(conn->rx_fd, PIPE_METRIC_MSGS_RECV, 1);
+
+    if (msg->hdr.flags & PIPE_FRAME_LZ) {
+        ssize_t len = conn->lz != NULL ? pipe_lz_unpack(conn->lz, msg->payload, msg->hdr.len, &msg->payload) : -1;
+        if (len == -1) {
+            // the framing is intact, only this message is lost
+            pipe_log(PIPE_LOG_WARN, "Dropping compressed message %u that cannot be restored\n", msg->hdr.seq);
+            return 0;
+        }
+        msg->hdr.len = (uint32_t)len;
+        msg->hdr.flags &= ~PIPE_FRAME_LZ;
+    }
+    return 1;
+}
+
+/**
+ * Receives one whole message from a connection without copying it, waiting until `deadline`.
+ *
+ * @param conn The connection.
+ * @param msg Receives the message; its payload points into the connection's buffer and stays valid until the next receive.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds.
+ * @return The payload length, or -1 on error or timeout.
+ * @throws If an error occurs while waiting or reading, an appropriate error message will be printed to stderr.
+ */
+int pipe_conn_recv_msg(pipe_conn_t *conn, struct pipe_frame *msg, uint64_t deadline) {
+    while (1) {
+        struct pipe_frame frame;
+        int ret = pipe_frame_next(&conn->rx, &frame);
+        if (ret == 1) {
+            ret = pipe_conn_assemble(conn, &frame, msg);
+            if (ret == 1) {
+                return (int)msg->hdr.len;
+            }
+            if (ret == 0) {
+                continue;
+            }
+        }
+        if (ret == -1) {
+            return -1;
+        }
+
+        if (pipe_frame_reader_fill(&conn->rx, conn->rx_fd) > 0) {
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            return -1;
+        }
+
+        ret = wait_pipe(conn->rx_fd, POLLIN, deadline);
+        if (ret == 0) {
+            pipe_log(PIPE_LOG_WARN, "Timeout waiting for data on named pipe\n");
+            pipe_metrics_add(conn->rx_fd, PIPE_METRIC_TIMEOUTS, 1);
+            errno = ETIMEDOUT;
+        }
+        if (ret <= 0) {
+            return -1;
+        }
+    }
+}
+
+/**
+ * Sends data on a connection as a single PIPE_MSG_DATA message.
+ *
+ * @param conn The connection.
+ * @param buf A pointer to the data to be sent.
+ * @param buflen The length of the data to be sent.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds.
+ * @return The number of bytes sent, or -1 on error or timeout.
+ */
+int pipe_conn_send(pipe_conn_t *conn, const char *buf, size_t buflen, uint64_t deadline) {
+    return pipe_conn_send_msg(conn, PIPE_MSG_DATA, buf, buflen, deadline);
+}
+
+/**
+ * Receives one message from a connection into a caller supplied buffer.
+ *
+ * @param conn The connection.
+ * @param buf A buffer to store the message.
+ * @param buflen The size of `buf`.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds.
+ * @return The message length, or -1 on error, on timeout, or if the message does not fit (errno EMSGSIZE).
+ */
+int pipe_conn_recv(pipe_conn_t *conn, char *buf, size_t buflen, uint64_t deadline) {
+    struct pipe_frame msg;
+    int len = pipe_conn_recv_msg(conn, &msg, deadline);
+
+    if (len < 0) {
+        return -1;
+    }
+    if ((size_t)len > buflen) {
+        pipe_log(PIPE_LOG_ERROR, "Message of %d bytes does not fit in %zu byte buffer\n", len, buflen);
+        errno = EMSGSIZE;
+        return -1;
+    }
+    memcpy(buf, msg.payload, len);
+    return len;
+}
+
+/**
+ * Closes both pipes of a connection. A client connection says PIPE_MSG_BYE to the server and
+ * removes its reply pipe.
+ *
+ * @param conn The connection.
+ */
+void pipe_conn_close(pipe_conn_t *conn) {
+    if (conn->tx_fd >= 0) {
+        if (conn->shared) {
+            struct pipe_frame_hdr hdr;
+            memset(&hdr, 0, sizeof(hdr));
+            hdr.type = PIPE_MSG_BYE;
+            hdr.src = conn->src;
+            pipe_frame_write(conn->tx_fd, &hdr, NULL, pipe_deadline_from_timeout(0.1));
+        }
+        close(conn->tx_fd);
+    }
+    if (conn->rx_fd >= 0) {
+        close(conn->rx_fd);
+    }
+    if (conn->rx_keepalive_fd >= 0) {
+        close(conn->rx_keepalive_fd);
+    }
+    if (conn->shared) {
+        unlink(conn->rx_name);
+    }
+    conn->tx_fd = conn->rx_fd = conn->rx_keepalive_fd = -1;
+    pipe_frame_reader_free(&conn->rx);
+    pipe_frame_assembler_free(&conn->rx_assembler);
+    pipe_lz_free(conn->lz);
+    conn->lz = NULL;
+    conn->peer_lz = false;
+}
@@ -0,0 +1,84 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PIPE_CONN_H
+#define PIPE_CONN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pipe_frame.h"
+#include "pipe_lz.h"
+
+#define PIPE_NAME_MAX 256
+#define PIPE_CONN_HELLO_MAX (PIPE_NAME_MAX + sizeof(uint32_t))  // reply pipe name and reliable window
+
+/**
+ * A persistent session over a pair of named pipes: `tx_name` is written to, `rx_name` is read from.
+ * Both FIFOs stay open for the lifetime of the connection instead of being reopened per message,
+ * and every message is framed so that message boundaries survive the byte stream.
+ *
+ * A client connection (`shared`) talks to a server whose request FIFO is shared with other
+ * clients. It receives on a private reply FIFO, announces it with PIPE_MSG_HELLO whenever the
+ * transmit side connects, tags every frame with its `src` id and splits messages into frames of
+ * at most PIPE_BUF bytes so that they are written atomically.
+ *
+ * A client connection with compression enabled offers it in its HELLO; once the server answers
+ * with a HELLO of its own that accepts it, messages of at least the threshold are compressed.
+ * A `reliable` connection also tells the server the oldest seq it still waits to have
+ * acknowledged, `tx_unacked`, so that a restarted server knows where duplicates end.
+ */
+typedef struct pipe_conn {
+    int tx_fd;
+    int rx_fd;
+    int rx_keepalive_fd;
+    bool shared;
+    uint32_t src;
+    uint32_t tx_seq;
+    pipe_frame_reader_t rx;
+    pipe_frame_assembler_t rx_assembler;
+    pipe_lz_ctx_t *lz;
+    bool peer_lz;
+    bool reliable;
+    uint32_t tx_unacked;
+    char tx_name[PIPE_NAME_MAX];
+    char rx_name[PIPE_NAME_MAX];
+} pipe_conn_t;
+
+int pipe_conn_open(pipe_conn_t *conn, const char *tx_name, const char *rx_name);
+int pipe_conn_open_client(pipe_conn_t *conn, const char *server_name, const char *reply_name);
+int pipe_conn_set_peer(pipe_conn_t *conn, const char *tx_name);
+int pipe_conn_set_compression(pipe_conn_t *conn, size_t threshold);
+int pipe_conn_connect(pipe_conn_t *conn, uint64_t deadline);
+void pipe_conn_hello(pipe_conn_t *conn, struct pipe_frame_hdr *hdr, char *buf);
+int pipe_conn_send(pipe_conn_t *conn, const char *buf, size_t buflen, uint64_t deadline);
+int pipe_conn_recv(pipe_conn_t *conn, char *buf, size_t buflen, uint64_t deadline);
+int pipe_conn_send_msg(pipe_conn_t *conn, uint16_t type, const void *buf, size_t buflen, uint64_t deadline);
+int pipe_conn_send_seq(pipe_conn_t *conn, uint16_t type, uint16_t flags, uint32_t seq, const void *buf, size_t buflen, uint64_t deadline);
+int pipe_conn_recv_msg(pipe_conn_t *conn, struct pipe_frame *msg, uint64_t deadline);
+int pipe_conn_assemble(pipe_conn_t *conn, const struct pipe_frame *frame, struct pipe_frame *msg);
+void pipe_conn_close(pipe_conn_t *conn);
+
+#endif
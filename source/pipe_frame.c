@@ -0,0 +1,375 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+#include "pipe_handler.h"
+#include "pipe_frame.h"
+#include "pipe_log.h"
+#include "pipe_metrics.h"
+#include "pipe_pool.h"
+
+/**
+ * Initializes a frame reader.
+ *
+ * @param r The reader to initialize.
+ * @param initial_cap The initial buffer capacity, BLOCK_SIZE if 0.
+ * @return 0 on success, or -1 on error.
+ * @throws If the buffer cannot be allocated, an appropriate error message will be printed to stderr.
+ */
+int pipe_frame_reader_init(pipe_frame_reader_t *r, size_t initial_cap) {
+    memset(r, 0, sizeof(*r));
+    r->buf = pipe_pool_alloc(initial_cap ? initial_cap : BLOCK_SIZE);
+    if (r->buf == NULL) {
+        return -1;
+    }
+    r->cap = pipe_pool_cap(r->buf);
+    return 0;
+}
+
+/**
+ * Releases the buffer of a frame reader.
+ *
+ * @param r The reader.
+ */
+void pipe_frame_reader_free(pipe_frame_reader_t *r) {
+    pipe_pool_put(r->buf);
+    memset(r, 0, sizeof(*r));
+}
+
+/**
+ * Returns the number of bytes the frame at the head of the buffer needs in total, or just the
+ * header size while the header itself is incomplete.
+ */
+static size_t pending_frame_size(const pipe_frame_reader_t *r) {
+    struct pipe_frame_hdr hdr;
+
+    if (r->tail - r->head < PIPE_FRAME_HDR_SIZE) {
+        return PIPE_FRAME_HDR_SIZE;
+    }
+    memcpy(&hdr, r->buf + r->head, PIPE_FRAME_HDR_SIZE);
+    if (hdr.len > PIPE_FRAME_MAX_LEN) {
+        return PIPE_FRAME_HDR_SIZE;
+    }
+    return PIPE_FRAME_HDR_SIZE + hdr.len;
+}
+
+/**
+ * Makes room for at least `want` more bytes after `tail`. The unconsumed bytes are moved to the
+ * front of the buffer only when the free tail is too small, and the buffer only grows when a single
+ * frame does not fit, so in the common case data is read straight into its final position.
+ *
+ * The buffer comes from the pool, and a consumer may hold a reference to it to keep payloads
+ * without copying them (see pipe_server). Such a buffer is never moved within or reused: the
+ * unconsumed bytes continue in a fresh one instead.
+ */
+static int reserve(pipe_frame_reader_t *r, size_t want) {
+    size_t used = r->tail - r->head;
+    char *buf;
+
+    if (r->cap - r->tail >= want) {
+        return 0;
+    }
+    if (r->buf != NULL && pipe_pool_shared(r->buf)) {
+        if ((buf = pipe_pool_alloc(used + (want > r->cap ? want : r->cap))) == NULL) {
+            return -1;
+        }
+        memcpy(buf, r->buf + r->head, used);
+        pipe_pool_put(r->buf);
+        r->buf = buf;
+        r->cap = pipe_pool_cap(buf);
+        r->head = 0;
+        r->tail = used;
+        return 0;
+    }
+    if (r->head > 0) {
+        memmove(r->buf, r->buf + r->head, used);
+        r->head = 0;
+        r->tail = used;
+        if (r->cap - r->tail >= want) {
+            return 0;
+        }
+    }
+
+    size_t cap = r->cap ? r->cap : BLOCK_SIZE;
+    while (cap - used < want) {
+        cap *= 2;
+    }
+    if ((buf = pipe_pool_grow(r->buf, used, cap)) == NULL) {
+        return -1;
+    }
+    r->buf = buf;
+    r->cap = pipe_pool_cap(buf);
+    return 0;
+}
+
+/**
+ * Starts over at the front of an empty buffer, unless a consumer still references its contents.
+ */
+static void rewind_empty(pipe_frame_reader_t *r) {
+    if (r->head == r->tail && r->buf != NULL && !pipe_pool_shared(r->buf)) {
+        r->head = r->tail = 0;
+    }
+}
+
+/**
+ * Performs a single read() from `fd` directly into the reader's buffer. When the previous read
+ * filled the buffer, the buffer is grown to the backlog reported by FIONREAD first, so a busy pipe
+ * is drained with few large reads while an idle one costs no extra ioctl().
+ *
+ * @param r The reader.
+ * @param fd The file descriptor to read from.
+ * @return The number of bytes read, 0 on end of file, or -1 on error with errno set (EAGAIN when nothing is available).
+ * @throws If an error other than EAGAIN/EINTR occurs while reading, an appropriate error message will be printed to stderr.
+ */
+ssize_t pipe_frame_reader_fill(pipe_frame_reader_t *r, int fd) {
+    size_t need = pending_frame_size(r);
+    size_t have = r->tail - r->head;
+    size_t want = need > have ? need - have : 0;
+    ssize_t n;
+
+    rewind_empty(r);
+    if (want < BLOCK_SIZE) {
+        want = BLOCK_SIZE;
+    }
+    if (r->filled) {
+        // the previous read was cut short by our buffer, size this one to the whole backlog
+        int backlog = get_pipe_backlog(fd);
+        if (backlog > 0 && (size_t)backlog > want) {
+            want = backlog;
+        }
+    }
+    if (reserve(r, want) == -1) {
+        return -1;
+    }
+
+    do {
+        n = read(fd, r->buf + r->tail, r->cap - r->tail);
+        pipe_metrics_add(fd, PIPE_METRIC_READ_CALLS, 1);
+    } while (n == -1 && errno == EINTR);
+    r->filled = n > 0 && (size_t)n == r->cap - r->tail;
+
+    if (n == -1) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            pipe_log(PIPE_LOG_ERROR, "Error reading from named pipe: %s\n", strerror(errno));
+        } else {
+            pipe_metrics_add(fd, PIPE_METRIC_EAGAIN, 1);
+        }
+        return -1;
+    }
+    r->tail += n;
+    pipe_metrics_add(fd, PIPE_METRIC_BYTES_RECV, n);
+    return n;
+}
+
+/**
+ * Appends bytes that were received by other means to the reader.
+ *
+ * @param r The reader.
+ * @param data The bytes to append.
+ * @param len The number of bytes.
+ * @return 0 on success, or -1 on error.
+ */
+int pipe_frame_reader_feed(pipe_frame_reader_t *r, const char *data, size_t len) {
+    rewind_empty(r);
+    if (reserve(r, len) == -1) {
+        return -1;
+    }
+    memcpy(r->buf + r->tail, data, len);
+    r->tail += len;
+    return 0;
+}
+
+/**
+ * Throws away everything buffered. After pipe_frame_next() found a corrupt header the frame
+ * boundaries are lost, and this is how a reader shared by many writers gets back in step: frames
+ * written from now on start on a boundary again.
+ *
+ * @param r The reader.
+ * @return The number of bytes discarded.
+ */
+size_t pipe_frame_reader_discard(pipe_frame_reader_t *r) {
+    size_t n = r->tail - r->head;
+
+    r->head = r->tail = 0;
+    return n;
+}
+
+/**
+ * Extracts the next complete frame from the reader without copying its payload.
+ *
+ * @param r The reader.
+ * @param frame Receives the header and a pointer to the payload inside the reader's buffer.
+ * @return 1 if a frame was extracted, 0 if more data is needed, or -1 if the stream is corrupt.
+ * @throws If the stream is corrupt, an appropriate error message will be printed to stderr.
+ */
+int pipe_frame_next(pipe_frame_reader_t *r, struct pipe_frame *frame) {
+    size_t have = r->tail - r->head;
+
+    if (have < PIPE_FRAME_HDR_SIZE) {
+        return 0;
+    }
+    memcpy(&frame->hdr, r->buf + r->head, PIPE_FRAME_HDR_SIZE);
+    if (frame->hdr.len > PIPE_FRAME_MAX_LEN) {
+        pipe_log(PIPE_LOG_ERROR, "Invalid frame length %u on named pipe\n", frame->hdr.len);
+        errno = EPROTO;
+        return -1;
+    }
+    if (have < PIPE_FRAME_HDR_SIZE + frame->hdr.len) {
+        return 0;
+    }
+
+    frame->payload = r->buf + r->head + PIPE_FRAME_HDR_SIZE;
+    r->head += PIPE_FRAME_HDR_SIZE + frame->hdr.len;
+    return 1;
+}
+
+/**
+ * Feeds one frame to an assembler. Unfragmented messages are passed through without a copy, only
+ * fragments are gathered in the assembler's buffer. A sender that gave up half way through a
+ * message, e.g. on a deadline, leaves fragments behind; they are discarded once a frame of
+ * another seq or a new PIPE_FRAME_FIRST fragment arrives, instead of being joined onto it.
+ *
+ * @param a The assembler.
+ * @param frame The frame just received.
+ * @param msg Receives the whole message once the last fragment has arrived.
+ * @return 1 if `msg` holds a complete message, 0 if more fragments are needed, or -1 on error.
+ * @throws If the buffer cannot be grown, an appropriate error message will be printed to stderr.
+ */
+int pipe_frame_assemble(pipe_frame_assembler_t *a, const struct pipe_frame *frame, struct pipe_frame *msg) {
+    if (a->partial && (frame->hdr.seq != a->seq || (frame->hdr.flags & PIPE_FRAME_FIRST))) {
+        pipe_log(PIPE_LOG_WARN, "Discarding %zu bytes of incomplete message %u from %u\n", a->len, a->seq,
+                 frame->hdr.src);
+        a->len = 0;
+        a->partial = false;
+    }
+    if (!(frame->hdr.flags & PIPE_FRAME_MORE) && !a->partial) {
+        *msg = *frame;
+        return 1;
+    }
+
+    if (a->len + frame->hdr.len > PIPE_FRAME_MAX_LEN) {
+        pipe_log(PIPE_LOG_ERROR, "Fragmented message exceeds the frame limit\n");
+        a->len = 0;
+        a->partial = false;
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (!a->partial && a->buf != NULL && pipe_pool_shared(a->buf)) {
+        // the previous message is still referenced by a consumer, gather this one elsewhere
+        pipe_pool_put(a->buf);
+        a->buf = NULL;
+        a->cap = 0;
+    }
+    if (a->len + frame->hdr.len > a->cap) {
+        size_t cap = a->cap ? a->cap : BLOCK_SIZE;
+        while (cap < a->len + frame->hdr.len) {
+            cap *= 2;
+        }
+        char *buf = pipe_pool_grow(a->buf, a->len, cap);
+        if (buf == NULL) {
+            a->len = 0;
+            a->partial = false;
+            return -1;
+        }
+        a->buf = buf;
+        a->cap = pipe_pool_cap(buf);
+    }
+    memcpy(a->buf + a->len, frame->payload, frame->hdr.len);
+    a->len += frame->hdr.len;
+
+    if (frame->hdr.flags & PIPE_FRAME_MORE) {
+        a->seq = frame->hdr.seq;
+        a->partial = true;
+        return 0;
+    }
+
+    msg->hdr = frame->hdr;
+    msg->hdr.len = (uint32_t)a->len;
+    msg->payload = a->buf;
+    // the message stays valid until the next fragment arrives
+    a->len = 0;
+    a->partial = false;
+    return 1;
+}
+
+/**
+ * Releases the buffer of an assembler.
+ *
+ * @param a The assembler.
+ */
+void pipe_frame_assembler_free(pipe_frame_assembler_t *a) {
+    pipe_pool_put(a->buf);
+    memset(a, 0, sizeof(*a));
+}
+
+/**
+ * Serializes a frame into a contiguous buffer.
+ *
+ * @param out The destination buffer.
+ * @param outlen The size of `out`.
+ * @param hdr The frame header, `hdr->len` is the payload length.
+ * @param payload The payload bytes.
+ * @return The number of bytes written to `out`, or 0 if it is too small.
+ */
+size_t pipe_frame_encode(char *out, size_t outlen, const struct pipe_frame_hdr *hdr, const void *payload) {
+    size_t total = PIPE_FRAME_HDR_SIZE + hdr->len;
+
+    if (outlen < total) {
+        return 0;
+    }
+    memcpy(out, hdr, PIPE_FRAME_HDR_SIZE);
+    if (hdr->len > 0) {
+        memcpy(out + PIPE_FRAME_HDR_SIZE, payload, hdr->len);
+    }
+    return total;
+}
+
+/**
+ * Writes one frame to a named pipe with writev(), so the payload is never copied in user space.
+ * Partial writes are completed until `deadline` passes.
+ *
+ * @param fd The file descriptor of the named pipe.
+ * @param hdr The frame header, `hdr->len` is the payload length.
+ * @param payload The payload bytes.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds.
+ * @return The number of bytes written including the header, or -1 on error.
+ */
+ssize_t pipe_frame_write(int fd, const struct pipe_frame_hdr *hdr, const void *payload, uint64_t deadline) {
+    struct iovec iov[2];
+
+    pipe_metrics_add(fd, PIPE_METRIC_MSGS_SENT, 1);
+
+    iov[0].iov_base = (void *)hdr;
+    iov[0].iov_len = PIPE_FRAME_HDR_SIZE;
+    iov[1].iov_base = (void *)payload;
+    iov[1].iov_len = hdr->len;
+    return writev_to_pipe(fd, iov, 2, deadline);
+}
@@ -0,0 +1,112 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PIPE_FRAME_H
+#define PIPE_FRAME_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// message types
+#define PIPE_MSG_DATA  1
+#define PIPE_MSG_ACK   2
+#define PIPE_MSG_HELLO 4
+#define PIPE_MSG_BYE   5
+
+// frame flags
+#define PIPE_FRAME_MORE 0x1  // the message continues in the next frame from the same sender
+#define PIPE_FRAME_LZ   0x2  // the message is packed by pipe_lz_pack(), set on every fragment; on
+                             // PIPE_MSG_HELLO it offers or accepts compression
+#define PIPE_FRAME_REL  0x4  // the message is delivered at least once, see pipe_reliable.h; on
+                             // PIPE_MSG_HELLO the reply name is followed by the first unacknowledged seq
+#define PIPE_FRAME_FIRST 0x8 // the first of several PIPE_FRAME_MORE fragments; whatever the sender left
+                             // of an earlier attempt, e.g. a retransmit of the same seq, is discarded
+
+// upper bound on a single payload, anything larger is treated as a corrupt stream
+#define PIPE_FRAME_MAX_LEN (1u << 30)
+
+/**
+ * Wire header that precedes every message. Both ends live on the same host, so fields are in
+ * native byte order. `src` identifies the sender when several writers share one FIFO.
+ */
+struct pipe_frame_hdr {
+    uint32_t len;
+    uint16_t type;
+    uint16_t flags;
+    uint32_t seq;
+    uint32_t src;
+};
+
+#define PIPE_FRAME_HDR_SIZE sizeof(struct pipe_frame_hdr)
+
+/**
+ * A decoded message. `payload` points into the reader's buffer and stays valid until the next
+ * call that adds data to the reader.
+ */
+struct pipe_frame {
+    struct pipe_frame_hdr hdr;
+    char *payload;
+};
+
+/**
+ * Streaming reassembly buffer that turns arbitrary byte chunks into whole frames. `filled` records
+ * that the last read used all the free space, a hint that more data is backlogged in the pipe.
+ * `buf` is a pipe_pool buffer; taking a reference to it keeps the payloads read so far intact.
+ */
+typedef struct pipe_frame_reader {
+    char *buf;
+    size_t cap;
+    size_t head;
+    size_t tail;
+    bool filled;
+} pipe_frame_reader_t;
+
+/**
+ * Joins the fragments of a message that was split into several PIPE_FRAME_MORE frames. `partial`
+ * is set while the fragments of message `seq` are being gathered.
+ */
+typedef struct pipe_frame_assembler {
+    char *buf;
+    size_t len;
+    size_t cap;
+    uint32_t seq;
+    bool partial;
+} pipe_frame_assembler_t;
+
+int pipe_frame_reader_init(pipe_frame_reader_t *r, size_t initial_cap);
+void pipe_frame_reader_free(pipe_frame_reader_t *r);
+ssize_t pipe_frame_reader_fill(pipe_frame_reader_t *r, int fd);
+int pipe_frame_reader_feed(pipe_frame_reader_t *r, const char *data, size_t len);
+size_t pipe_frame_reader_discard(pipe_frame_reader_t *r);
+int pipe_frame_next(pipe_frame_reader_t *r, struct pipe_frame *frame);
+
+int pipe_frame_assemble(pipe_frame_assembler_t *a, const struct pipe_frame *frame, struct pipe_frame *msg);
+void pipe_frame_assembler_free(pipe_frame_assembler_t *a);
+
+size_t pipe_frame_encode(char *out, size_t outlen, const struct pipe_frame_hdr *hdr, const void *payload);
+ssize_t pipe_frame_write(int fd, const struct pipe_frame_hdr *hdr, const void *payload, uint64_t deadline);
+
+#endif
@@ -22,6 +22,8 @@
  * SOFTWARE.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -29,12 +31,59 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <sys/select.h>
+#include <sys/uio.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <errno.h>
-#include <math.h>
+#include <limits.h>
+#include <stdatomic.h>
 
 #include "pipe_handler.h"
+#include "pipe_log.h"
+#include "pipe_metrics.h"
+#include "pipe_uring.h"
+#include "pipe_time.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+static atomic_int io_backend = PIPE_IO_SELECT;
+
+__attribute__((constructor)) static void read_backend_from_env(void) {
+    const char *env = getenv("PIPE_IO_BACKEND");
+
+    if (env != NULL && strcmp(env, "uring") == 0) {
+        pipe_io_set_backend(PIPE_IO_URING);
+    }
+}
+
+/**
+ * Selects how read_from_pipe() waits for and reads data. PIPE_IO_URING submits the wait and the
+ * read as one io_uring chain, one system call per message instead of poll() plus read(). It
+ * falls back to PIPE_IO_SELECT when the kernel or a seccomp policy does not allow io_uring. The
+ * PIPE_IO_BACKEND environment variable (select or uring) sets the initial backend.
+ *
+ * @param backend PIPE_IO_SELECT or PIPE_IO_URING.
+ * @return The backend now in effect.
+ */
+int pipe_io_set_backend(int backend) {
+    if (backend == PIPE_IO_URING && !pipe_uring_available()) {
+        pipe_log(PIPE_LOG_INFO, "io_uring is not available, using poll()\n");
+        backend = PIPE_IO_SELECT;
+    }
+    atomic_store(&io_backend, backend);
+    return backend;
+}
+
+/**
+ * Returns the backend used by read_from_pipe(), see pipe_io_set_backend().
+ */
+int pipe_io_get_backend(void) {
+    return atomic_load_explicit(&io_backend, memory_order_relaxed);
+}
 
 /**
  * Opens a named pipe with the given name and returns a file descriptor.
@@ -53,28 +102,138 @@ int open_pipe(const char *name, bool isRead) {
     int fd;
     if (access(name, F_OK) == -1) {
         if (mkfifo(name, 0666) == -1) {
-            fprintf(stderr, "Error creating named pipe: %s\n", strerror(errno));
+            pipe_log(PIPE_LOG_ERROR, "Error creating named pipe: %s\n", strerror(errno));
             return -1;
         }
     }
 
     if (isRead) {
         if ((fd = open(name, O_RDONLY | O_NONBLOCK)) == -1) {
-            fprintf(stderr, "Error opening named pipe for reading: %s\n", strerror(errno));
+            pipe_log(PIPE_LOG_ERROR, "Error opening named pipe for reading: %s\n", strerror(errno));
             return -1;
         }
+        pipe_metrics_bind_name(fd, name);
     } else {
         if ((fd = open(name, O_WRONLY | O_NONBLOCK)) == -1) {
             if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                fprintf(stderr, "Error opening named pipe for writing: %s\n", strerror(errno));
+                // ENXIO only means nobody is reading yet, open_pipe_wait() waits for a reader instead
+                pipe_log(errno == ENXIO ? PIPE_LOG_DEBUG : PIPE_LOG_ERROR, "Error opening named pipe for writing: %s\n",
+                         strerror(errno));
                 return -1;
             }
+        } else {
+            pipe_metrics_bind_name(fd, name);
         }
     }
     
     return fd;
 }
 
+/**
+ * Opens a named pipe for reading and keeps a write end open on the same pipe.
+ *
+ * A FIFO whose last writer goes away reports EOF (and EPOLLHUP) to its reader until a new writer
+ * connects, which makes an event loop spin. Holding our own idle write end means the reader never
+ * observes EOF, so writers can come and go without the reader having to reopen the pipe.
+ *
+ * @param name The name of the named pipe.
+ * @param keepalive_fd Receives the descriptor of the idle write end, which the caller must close after the read end.
+ * @return The file descriptor of the read end, or -1 on error.
+ * @throws If an error occurs while creating or opening the named pipe, an appropriate error message will be printed to stderr.
+ */
+int open_pipe_persistent(const char *name, int *keepalive_fd) {
+    int fd = open_pipe(name, true);
+    if (fd == -1) {
+        return -1;
+    }
+
+    // we are a reader now, so a non-blocking open for writing cannot fail with ENXIO
+    *keepalive_fd = open_pipe(name, false);
+    if (*keepalive_fd == -1) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * Returns the largest capacity an unprivileged process may give a pipe, from /proc/sys/fs/pipe-max-size.
+ *
+ * @return The limit in bytes, or the kernel default of 1 MiB if it cannot be read.
+ */
+int get_pipe_max_capacity(void) {
+    static int max_capacity = 0;
+    FILE *f;
+    int value;
+
+    if (max_capacity > 0) {
+        return max_capacity;
+    }
+    value = 1 << 20;
+    if ((f = fopen("/proc/sys/fs/pipe-max-size", "r")) != NULL) {
+        if (fscanf(f, "%d", &value) != 1) {
+            value = 1 << 20;
+        }
+        fclose(f);
+    }
+    max_capacity = value;
+    return max_capacity;
+}
+
+/**
+ * Returns the capacity of the pipe behind a file descriptor.
+ *
+ * @param fd The file descriptor of the named pipe.
+ * @return The capacity in bytes, or -1 on error.
+ * @throws If fcntl() fails, an appropriate error message will be printed to stderr.
+ */
+int get_pipe_capacity(int fd) {
+    int size = fcntl(fd, F_GETPIPE_SZ);
+    if (size == -1) {
+        pipe_log(PIPE_LOG_ERROR, "Error getting pipe size: %s\n", strerror(errno));
+    }
+    return size;
+}
+
+/**
+ * Resizes the pipe behind a file descriptor. The request is clamped to pipe-max-size, and the
+ * kernel rounds it up to a power-of-two number of pages. Shrinking fails with EBUSY while more
+ * data than the new size is buffered.
+ *
+ * @param fd The file descriptor of the named pipe, either end.
+ * @param capacity The requested capacity in bytes.
+ * @return The capacity actually set, or -1 on error.
+ * @throws If fcntl() fails, an appropriate error message will be printed to stderr.
+ */
+int set_pipe_capacity(int fd, int capacity) {
+    int max_capacity = get_pipe_max_capacity();
+    int size;
+
+    if (capacity > max_capacity) {
+        capacity = max_capacity;
+    }
+    size = fcntl(fd, F_SETPIPE_SZ, capacity);
+    if (size == -1) {
+        pipe_log(PIPE_LOG_ERROR, "Error setting pipe size to %d: %s\n", capacity, strerror(errno));
+    }
+    return size;
+}
+
+/**
+ * Returns the number of bytes currently buffered in a pipe, as reported by FIONREAD.
+ *
+ * @param fd The file descriptor of the named pipe.
+ * @return The backlog in bytes, or -1 on error.
+ */
+int get_pipe_backlog(int fd) {
+    int avail;
+    if (ioctl(fd, FIONREAD, &avail) == -1) {
+        return -1;
+    }
+    return avail;
+}
+
 /**
  * Writes data to a named pipe with the given file descriptor.
  *
@@ -86,81 +245,321 @@ int open_pipe(const char *name, bool isRead) {
  */
 int write_to_pipe(int fd, char *data, size_t datalen) {
     int bytes_written = write(fd, data, datalen);
+    pipe_metrics_add(fd, PIPE_METRIC_WRITE_CALLS, 1);
     if (bytes_written == -1) {
-        fprintf(stderr, "Error writing to named pipe: %s\n", strerror(errno));
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            pipe_metrics_add(fd, PIPE_METRIC_EAGAIN, 1);
+        }
+        pipe_log(PIPE_LOG_ERROR, "Error writing to named pipe: %s\n", strerror(errno));
         return -1;
     }
+    if ((size_t)bytes_written < datalen) {
+        pipe_metrics_add(fd, PIPE_METRIC_PARTIAL_WRITES, 1);
+    }
+    pipe_metrics_add(fd, PIPE_METRIC_MSGS_SENT, 1);
+    pipe_metrics_add(fd, PIPE_METRIC_BYTES_SENT, bytes_written);
     return bytes_written;
 }
 
 /**
- * Reads data from a named pipe with the given file descriptor, waiting up to `timeout` seconds for data to arrive.
+ * Waits until a file descriptor reports one of `events`, or until `deadline` passes.
+ *
+ * @param fd The file descriptor of the named pipe.
+ * @param events The poll() events to wait for, e.g. POLLIN or POLLOUT.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds.
+ * @return 1 if the descriptor is ready, 0 on timeout, or -1 on error.
+ * @throws If poll() fails, an appropriate error message will be printed to stderr.
+ */
+int wait_pipe(int fd, short events, uint64_t deadline) {
+    struct pollfd pfd = { .fd = fd, .events = events };
+    int ret;
+
+    do {
+        ret = poll(&pfd, 1, pipe_ms_until(deadline));
+    } while (ret == -1 && errno == EINTR);
+
+    if (ret == -1) {
+        pipe_log(PIPE_LOG_ERROR, "Error in poll(): %s\n", strerror(errno));
+    }
+    return ret;
+}
+
+/**
+ * Writes a vector of buffers to a non-blocking named pipe, completing partial writes and waiting
+ * for capacity until `deadline` passes. The entries of `iov` are advanced as data is written.
+ *
+ * @param fd The file descriptor of the named pipe.
+ * @param iov The buffers to write.
+ * @param iovcnt The number of entries in `iov`.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds.
+ * @return The number of bytes written, or -1 on error or timeout with errno set.
+ * @throws If an error other than EPIPE occurs while writing, an appropriate error message will be printed to stderr.
+ */
+ssize_t writev_to_pipe(int fd, struct iovec *iov, int iovcnt, uint64_t deadline) {
+    ssize_t total = 0;
+
+    while (iovcnt > 0) {
+        if (iov->iov_len == 0) {
+            iov++;
+            iovcnt--;
+            continue;
+        }
+
+        ssize_t n = writev(fd, iov, iovcnt > IOV_MAX ? IOV_MAX : iovcnt);
+        pipe_metrics_add(fd, PIPE_METRIC_WRITE_CALLS, 1);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                pipe_metrics_add(fd, PIPE_METRIC_EAGAIN, 1);
+                int ret = wait_pipe(fd, POLLOUT, deadline);
+                if (ret == 0) {
+                    pipe_log(PIPE_LOG_WARN, "Timeout waiting for named pipe to drain\n");
+                    pipe_metrics_add(fd, PIPE_METRIC_TIMEOUTS, 1);
+                    errno = ETIMEDOUT;
+                }
+                if (ret <= 0) {
+                    return -1;
+                }
+                continue;
+            }
+            if (errno != EPIPE) {
+                pipe_log(PIPE_LOG_ERROR, "Error writing to named pipe: %s\n", strerror(errno));
+            }
+            return -1;
+        }
+
+        total += n;
+        pipe_metrics_add(fd, PIPE_METRIC_BYTES_SENT, n);
+        while (n > 0) {
+            if ((size_t)n >= iov->iov_len) {
+                n -= iov->iov_len;
+                iov->iov_len = 0;
+                iov++;
+                iovcnt--;
+            } else {
+                iov->iov_base = (char *)iov->iov_base + n;
+                iov->iov_len -= n;
+                n = 0;
+                pipe_metrics_add(fd, PIPE_METRIC_PARTIAL_WRITES, 1);
+            }
+        }
+    }
+
+    return total;
+}
+
+/**
+ * Watches a named pipe for opens, so that a writer waiting for a reader can sleep on the returned
+ * descriptor instead of retrying on a fixed interval. It becomes readable once somebody opens the
+ * pipe; the caller drains it with `pipe_watch_drain()` and retries its open.
+ *
+ * @param name The name of the named pipe.
+ * @return The non-blocking inotify descriptor, or -1 on error.
+ * @throws If inotify cannot be set up, an appropriate error message will be printed to stderr.
+ */
+int pipe_watch_open(const char *name) {
+    int ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (ifd == -1) {
+        pipe_log(PIPE_LOG_ERROR, "Error creating inotify instance: %s\n", strerror(errno));
+        return -1;
+    }
+    if (inotify_add_watch(ifd, name, IN_OPEN) == -1) {
+        pipe_log(PIPE_LOG_ERROR, "Error watching named pipe: %s\n", strerror(errno));
+        close(ifd);
+        return -1;
+    }
+    return ifd;
+}
+
+/**
+ * Discards the events queued on a descriptor from `pipe_watch_open()`.
+ *
+ * @param ifd The inotify descriptor.
+ */
+void pipe_watch_drain(int ifd) {
+    char events[4096];
+
+    while (read(ifd, events, sizeof(events)) > 0) {
+    }
+}
+
+/**
+ * Opens a named pipe for writing, blocking until a reader appears or `deadline` passes.
+ *
+ * A non-blocking open of a FIFO without a reader fails with ENXIO and there is no descriptor to
+ * poll on. inotify does report IN_OPEN on the FIFO inode though, so we sleep on that instead of
+ * retrying on a fixed interval.
+ *
+ * @param name The name of the named pipe.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds.
+ * @return The non-blocking write descriptor, or -1 on error or timeout.
+ * @throws If an error occurs while creating, watching or opening the named pipe, an appropriate error message will be printed to stderr.
+ */
+int open_pipe_wait(const char *name, uint64_t deadline) {
+    int fd, ifd;
+
+    if (access(name, F_OK) == -1 && mkfifo(name, 0666) == -1 && errno != EEXIST) {
+        pipe_log(PIPE_LOG_ERROR, "Error creating named pipe: %s\n", strerror(errno));
+        return -1;
+    }
+
+    fd = open(name, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd >= 0 || errno != ENXIO) {
+        if (fd == -1) {
+            pipe_log(PIPE_LOG_ERROR, "Error opening named pipe for writing: %s\n", strerror(errno));
+        } else {
+            pipe_metrics_bind_name(fd, name);
+        }
+        return fd;
+    }
+
+    ifd = pipe_watch_open(name);
+    if (ifd == -1) {
+        return -1;
+    }
+
+    while (1) {
+        // retry after arming the watch so that a reader arriving in between is not missed
+        fd = open(name, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+        if (fd >= 0 || errno != ENXIO) {
+            if (fd == -1) {
+                pipe_log(PIPE_LOG_ERROR, "Error opening named pipe for writing: %s\n", strerror(errno));
+            }
+            break;
+        }
+        if (wait_pipe(ifd, POLLIN, deadline) <= 0) {
+            pipe_log(PIPE_LOG_WARN, "Timeout waiting for pipe to open\n");
+            pipe_metrics_count(pipe_metrics_register(name), PIPE_METRIC_TIMEOUTS, 1);
+            errno = ETIMEDOUT;
+            break;
+        }
+        pipe_metrics_count(pipe_metrics_register(name), PIPE_METRIC_OPEN_RETRIES, 1);
+        pipe_watch_drain(ifd);
+    }
+
+    close(ifd);
+    if (fd >= 0) {
+        pipe_metrics_bind_name(fd, name);
+    }
+    return fd;
+}
+
+/**
+ * Opens the write end of a named pipe that a peer created and is reading, such as the reply pipe
+ * a client announces. The name comes from the peer, so unlike `open_pipe_wait()` this never
+ * creates anything and never waits, and it only accepts a FIFO that is owned by our effective uid
+ * and is not reached through a symlink. A peer cannot point us at a regular file, a device or
+ * another user's pipe. A FIFO gives no way to learn the uid of its writer, so a peer running as
+ * another user is refused. The descriptor is not bound to a metrics id: peers choose names of
+ * their own, so the caller binds it to the role the pipe plays with pipe_metrics_bind_name().
+ *
+ * @param name The name of the named pipe.
+ * @return The non-blocking write descriptor, or -1 with errno set to ENXIO if nobody reads the
+ *         pipe yet, EPERM if it is not an acceptable FIFO, or another error.
+ * @throws If the pipe is refused or cannot be opened, an appropriate error message will be printed to stderr.
+ */
+int open_peer_pipe(const char *name) {
+    struct stat link, st;
+    int fd;
+
+    if (lstat(name, &link) == -1) {
+        pipe_log(PIPE_LOG_WARN, "Error looking up peer pipe %s: %s\n", name, strerror(errno));
+        return -1;
+    }
+    if (!S_ISFIFO(link.st_mode) || link.st_uid != geteuid()) {
+        pipe_log(PIPE_LOG_WARN, "Refusing %s, it is not a named pipe owned by uid %d\n", name, (int)geteuid());
+        errno = EPERM;
+        return -1;
+    }
+    fd = open(name, O_WRONLY | O_NONBLOCK | O_NOFOLLOW | O_NOCTTY | O_CLOEXEC);
+    if (fd == -1) {
+        if (errno != ENXIO) {
+            pipe_log(PIPE_LOG_WARN, "Error opening peer pipe %s: %s\n", name, strerror(errno));
+        }
+        return -1;
+    }
+    // the name may have been replaced between the two looks
+    if (fstat(fd, &st) == -1 || st.st_dev != link.st_dev || st.st_ino != link.st_ino) {
+        pipe_log(PIPE_LOG_WARN, "Refusing %s, it changed while it was opened\n", name);
+        close(fd);
+        errno = EPERM;
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Reads data from a named pipe with the given file descriptor, waiting until `deadline` for data to arrive.
+ * The backend chosen by pipe_io_set_backend() does the waiting.
  *
  * @param fd The file descriptor of the named pipe.
  * @param buf A buffer to store the data read from the named pipe.
- * @param timeout The maximum number of seconds to wait for data to arrive.
+ * @param deadline When to stop waiting for data to arrive, see pipe_deadline_from_timeout().
  * @return The number of bytes read from the named pipe, or -1 on error.
  * @throws If an error occurs while reading from the named pipe, an appropriate error message will be printed to stderr.
  */
-int read_from_pipe(int fd, char* buf, double timeout) {
+int read_from_pipe(int fd, char* buf, uint64_t deadline) {
     int bytes_read, retval;
-    double i, f;
-    fd_set rfds;
-    struct timeval tv;
-
-    FD_ZERO(&rfds);
-    FD_SET(fd, &rfds);
+    pipe_uring_t *u;
 
-    // parse the timeout
-    f = modf(timeout, &i);
-
-    tv.tv_sec = (int)i;
-    tv.tv_usec = (int)(f * 1000000);
+    if (pipe_io_get_backend() == PIPE_IO_URING && (u = pipe_uring_local()) != NULL) {
+        bytes_read = (int)pipe_uring_read(u, fd, buf, BLOCK_SIZE, deadline);
+        if (bytes_read == -1) {
+            if (errno == ETIMEDOUT) {
+                pipe_log(PIPE_LOG_WARN, "Timeout waiting for data on named pipe\n");
+                pipe_metrics_add(fd, PIPE_METRIC_TIMEOUTS, 1);
+            }
+            return -1;
+        }
+        pipe_metrics_add(fd, PIPE_METRIC_READ_CALLS, 1);
+        pipe_metrics_add(fd, PIPE_METRIC_MSGS_RECV, 1);
+        pipe_metrics_add(fd, PIPE_METRIC_BYTES_RECV, bytes_read);
+        return bytes_read;
+    }
 
-    retval = select(fd + 1, &rfds, NULL, NULL, &tv);
+    // poll() has no FD_SETSIZE limit, unlike select()
+    retval = wait_pipe(fd, POLLIN, deadline);
 
     if (retval == -1) {
-        fprintf(stderr, "Error in select(): %s\n", strerror(errno));
         return -1;
     }
     else if (retval == 0) {
-        fprintf(stderr, "Timeout waiting for data on named pipe\n");
+        pipe_log(PIPE_LOG_WARN, "Timeout waiting for data on named pipe\n");
+        pipe_metrics_add(fd, PIPE_METRIC_TIMEOUTS, 1);
         return -1;
     }
     else {
-        if ((bytes_read = read(fd, buf, BLOCK_SIZE)) == -1) {
-            fprintf(stderr, "Error reading from named pipe: %s\n", strerror(errno));
+        bytes_read = read(fd, buf, BLOCK_SIZE);
+        pipe_metrics_add(fd, PIPE_METRIC_READ_CALLS, 1);
+        if (bytes_read == -1) {
+            pipe_log(PIPE_LOG_ERROR, "Error reading from named pipe: %s\n", strerror(errno));
             return -1;
         }
+        pipe_metrics_add(fd, PIPE_METRIC_MSGS_RECV, 1);
+        pipe_metrics_add(fd, PIPE_METRIC_BYTES_RECV, bytes_read);
         return bytes_read;
     }
 }
 
 /**
- * Writes data to a named pipe with the given name, waiting up to `timeout` seconds for the pipe to become available.
+ * Writes data to a named pipe with the given name, waiting until `deadline` for the pipe to become available.
  *
  * @param pipe_name The name of the named pipe to write to.
  * @param buf A pointer to the data to be written.
  * @param buflen The length of the data to be written.
- * @param timeout The maximum number of seconds to wait for the named pipe to become available.
+ * @param deadline When to stop waiting for the named pipe to become available, see pipe_deadline_from_timeout().
  * @return The number of bytes written to the named pipe, or -1 on error.
  * @throws If an error occurs while opening the named pipe, waiting for the pipe to become available, or writing to the named pipe, an appropriate error message will be printed to stderr.
  */
-int send_data(const char *pipe_name, char *buf, int buflen, double timeout) {
+int send_data(const char *pipe_name, char *buf, int buflen, uint64_t deadline) {
     int fd, bytes_written;
-    int timeout_ms = (int)(timeout * 1000);
-    // wait until the pipe is opened
-    while ((timeout_ms) > 0) {
-        fd = open_pipe(pipe_name, false);
-        if (fd >= 0) {
-            break;
-        }
-        // sleep for 10 ms
-        timeout_ms -= 10;
-        usleep(10000); 
-    }
+
+    // woken by inotify as soon as a reader opens the pipe; retries and timeouts are counted there
+    fd = open_pipe_wait(pipe_name, deadline);
     if (fd < 0) {
-        fprintf(stderr, "Timeout waiting for pipe to open\n");
         return -1;
     }
 
@@ -171,21 +570,21 @@ int send_data(const char *pipe_name, char *buf, int buflen, double timeout) {
 }
 
 /**
- * Reads data from a named pipe with the given name, waiting up to `timeout` seconds for data to be available.
+ * Reads data from a named pipe with the given name, waiting until `deadline` for data to be available.
  *
  * @param pipe_name The name of the named pipe to read from.
  * @param buf A pointer to the buffer where the data will be stored.
- * @param timeout The maximum number of seconds to wait for data to be available on the named pipe.
+ * @param deadline When to stop waiting for data to be available on the named pipe, see pipe_deadline_from_timeout().
  * @return The number of bytes read from the named pipe, or -1 on error.
  * @throws If an error occurs while opening the named pipe, waiting for data to be available on the pipe, or reading from the named pipe, an appropriate error message will be printed to stderr.
  */
-int read_data(const char *pipe_name, char *buf, double timeout) {
+int read_data(const char *pipe_name, char *buf, uint64_t deadline) {
     int fd, bytes_read;
     fd = open_pipe(pipe_name, true);
     if (fd == -1) {
         return -1;
     }
-    bytes_read = read_from_pipe(fd, buf, timeout);
+    bytes_read = read_from_pipe(fd, buf, deadline);
     close(fd);
 
     return bytes_read;
@@ -26,16 +26,36 @@
 #define PIPE_HANDLER_H
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 #define PIPE_SET_NAME "/tmp/my_pipe_set"
 #define PIPE_GET_NAME "/tmp/my_pipe_get"
 
 #define BLOCK_SIZE 4096
 
+// I/O backends of read_from_pipe()
+#define PIPE_IO_SELECT 0   // poll() and read(), named after the select() it once used
+#define PIPE_IO_URING  1
+
 int open_pipe(const char *name, bool isRead);
+int open_pipe_persistent(const char *name, int *keepalive_fd);
+int open_pipe_wait(const char *name, uint64_t deadline);
+int open_peer_pipe(const char *name);
+int pipe_watch_open(const char *name);
+void pipe_watch_drain(int ifd);
+int get_pipe_max_capacity(void);
+int get_pipe_capacity(int fd);
+int set_pipe_capacity(int fd, int capacity);
+int get_pipe_backlog(int fd);
 int write_to_pipe(int fd, char *data, size_t datalen);
-int read_from_pipe(int fd, char* buf, double timeout);
-int send_data(const char *pipe_name, char *buf, int buflen, double timeout);
-int read_data(const char *pipe_name, char *buf, double timeout);
+int wait_pipe(int fd, short events, uint64_t deadline);
+ssize_t writev_to_pipe(int fd, struct iovec *iov, int iovcnt, uint64_t deadline);
+int read_from_pipe(int fd, char* buf, uint64_t deadline);
+int send_data(const char *pipe_name, char *buf, int buflen, uint64_t deadline);
+int read_data(const char *pipe_name, char *buf, uint64_t deadline);
+int pipe_io_set_backend(int backend);
+int pipe_io_get_backend(void);
 
 #endif
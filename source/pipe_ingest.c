@@ -0,0 +1,244 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pipe_ingest.h"
+#include "pipe_log.h"
+#include "pipe_time.h"
+
+/**
+ * Opens a record source. A regular file is mapped read-only; anything else, such as a pipe or a
+ * terminal on stdin, is read into a buffer as records are consumed.
+ *
+ * @param in The source to initialize.
+ * @param path The file to read, or "-" for stdin.
+ * @param delim The byte that terminates a record, usually '\n'.
+ * @param max_chunk The largest batch handed out at once, PIPE_INGEST_CHUNK if 0. A single record
+ *                  longer than this is still handed out whole.
+ * @return 0 on success, or -1 on error.
+ * @throws If the file cannot be opened or the buffer allocated, an appropriate error message will be printed to stderr.
+ */
+int pipe_ingest_open(pipe_ingest_t *in, const char *path, char delim, size_t max_chunk) {
+    struct stat st;
+
+    memset(in, 0, sizeof(*in));
+    in->delim = delim;
+    in->max_chunk = max_chunk ? max_chunk : PIPE_INGEST_CHUNK;
+    in->fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY | O_CLOEXEC);
+    if (in->fd == -1) {
+        pipe_log(PIPE_LOG_ERROR, "Error opening %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if (fstat(in->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, in->fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            in->data = map;
+            in->cap = in->len = st.st_size;
+            in->mapped = true;
+            in->eof = true;
+            return 0;
+        }
+        pipe_log(PIPE_LOG_DEBUG, "Cannot map %s, reading it instead: %s\n", path, strerror(errno));
+    }
+
+    in->cap = in->max_chunk > PIPE_INGEST_READ_SIZE ? in->max_chunk : PIPE_INGEST_READ_SIZE;
+    in->data = malloc(in->cap);
+    if (in->data == NULL) {
+        pipe_log(PIPE_LOG_ERROR, "Error allocating ingest buffer: %s\n", strerror(errno));
+        pipe_ingest_close(in);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Reads more input behind the records not handed out yet, moving them to the front of the buffer
+ * first and growing it if a single record fills it.
+ */
+static int refill(pipe_ingest_t *in) {
+    ssize_t n;
+
+    if (in->pos > 0) {
+        memmove(in->data, in->data + in->pos, in->len - in->pos);
+        in->len -= in->pos;
+        in->pos = 0;
+    }
+    if (in->len == in->cap) {
+        char *data = realloc(in->data, in->cap * 2);
+        if (data == NULL) {
+            pipe_log(PIPE_LOG_ERROR, "Error growing ingest buffer: %s\n", strerror(errno));
+            return -1;
+        }
+        in->data = data;
+        in->cap *= 2;
+    }
+
+    do {
+        n = read(in->fd, in->data + in->len, in->cap - in->len);
+    } while (n == -1 && errno == EINTR);
+    if (n == -1) {
+        pipe_log(PIPE_LOG_ERROR, "Error reading input: %s\n", strerror(errno));
+        return -1;
+    }
+    in->eof = n == 0;
+    in->len += n;
+    return 0;
+}
+
+/**
+ * Hands out the next batch of whole records, at most `max_chunk` bytes unless the first record
+ * alone is longer. A final record without a delimiter is handed out once the input ends.
+ *
+ * The batch points into the mapping, valid until pipe_ingest_close(), or for streamed input into
+ * the read buffer, valid until the next call.
+ *
+ * @param in The source.
+ * @param max_records The most records to put in the batch, 0 for no limit.
+ * @param chunk Receives a pointer to the batch.
+ * @param records Receives the number of records in the batch.
+ * @return The length of the batch in bytes, 0 at the end of the input, or -1 on error.
+ */
+ssize_t pipe_ingest_next(pipe_ingest_t *in, size_t max_records, const char **chunk, size_t *records) {
+    while (1) {
+        const char *p = in->data + in->pos;
+        size_t avail = in->len - in->pos;
+        size_t want = avail < in->max_chunk ? avail : in->max_chunk;
+        size_t end = 0, n = 0;
+
+        while (max_records == 0 || n < max_records) {
+            const char *q = memchr(p + end, in->delim, want - end);
+            if (q == NULL) {
+                break;
+            }
+            end = q - p + 1;
+            n++;
+        }
+        if (n == 0 && avail > 0) {
+            const char *q = memchr(p + want, in->delim, avail - want);
+            if (q != NULL) {
+                // a record longer than a batch goes on its own
+                end = q - p + 1;
+                n = 1;
+            } else if (in->eof) {
+                end = avail;
+                n = 1;
+            }
+        }
+        if (n > 0) {
+            *chunk = p;
+            *records = n;
+            in->pos += end;
+            in->records += n;
+            in->bytes += end;
+            return (ssize_t)end;
+        }
+        if (in->eof) {
+            return 0;
+        }
+        if (refill(in) == -1) {
+            return -1;
+        }
+    }
+}
+
+/**
+ * Unmaps or frees the input and closes it, unless it is stdin.
+ *
+ * @param in The source.
+ */
+void pipe_ingest_close(pipe_ingest_t *in) {
+    if (in->mapped) {
+        munmap(in->data, in->cap);
+    } else {
+        free(in->data);
+    }
+    if (in->fd > STDIN_FILENO) {
+        close(in->fd);
+    }
+    in->data = NULL;
+    in->fd = -1;
+}
+
+/**
+ * Initializes a rate limiter.
+ *
+ * @param r The limiter.
+ * @param per_sec The sustained rate in records per second, 0 for no limit.
+ */
+void pipe_rate_init(pipe_rate_t *r, double per_sec) {
+    r->per_sec = per_sec > 0 ? per_sec : 0;
+    r->burst = r->per_sec / 100 > 1 ? r->per_sec / 100 : 1;
+    r->tokens = r->burst;
+    r->last_ns = pipe_now_ns();
+}
+
+/**
+ * Returns how many records may be sent at once without exceeding the burst, 0 for no limit.
+ *
+ * @param r The limiter.
+ */
+size_t pipe_rate_burst(const pipe_rate_t *r) {
+    return r->per_sec > 0 ? (size_t)r->burst : 0;
+}
+
+/**
+ * Accounts for `n` records, sleeping first if they would exceed the rate. Records beyond the
+ * tokens available are paid for by sleeping, so the long-run rate holds for any batch size.
+ *
+ * @param r The limiter.
+ * @param n The number of records about to be sent.
+ */
+void pipe_rate_wait(pipe_rate_t *r, size_t n) {
+    uint64_t now;
+
+    if (r->per_sec == 0) {
+        return;
+    }
+    now = pipe_now_ns();
+    r->tokens += (now - r->last_ns) * r->per_sec / PIPE_NSEC_PER_SEC;
+    if (r->tokens > r->burst) {
+        r->tokens = r->burst;
+    }
+    r->last_ns = now;
+    r->tokens -= n;
+    if (r->tokens < 0) {
+        // the debt is repaid by the time spent asleep, which the next call credits
+        uint64_t ns = (uint64_t)(-r->tokens / r->per_sec * PIPE_NSEC_PER_SEC);
+        struct timespec ts = { .tv_sec = ns / PIPE_NSEC_PER_SEC, .tv_nsec = ns % PIPE_NSEC_PER_SEC };
+        nanosleep(&ts, NULL);
+    }
+}
@@ -0,0 +1,75 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PIPE_INGEST_H
+#define PIPE_INGEST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define PIPE_INGEST_CHUNK (64 * 1024)           // default size of a batch of records
+#define PIPE_INGEST_READ_SIZE (1024 * 1024)     // read() size for input that cannot be mapped
+
+/**
+ * Source of delimiter-terminated records for bulk producers. A regular file is mapped and handed
+ * out in place; stdin and other streams are read into a buffer in large blocks. Records come out
+ * in batches of whole records, each a contiguous view that still ends in its delimiter, so the
+ * concatenated batches reproduce the input byte for byte.
+ */
+typedef struct pipe_ingest {
+    int fd;
+    bool mapped;
+    bool eof;
+    char delim;
+    char *data;
+    size_t cap;                 // size of the mapping or of the read buffer
+    size_t pos;                 // start of the first record not handed out
+    size_t len;                 // valid bytes in `data`
+    size_t max_chunk;
+    uint64_t records;
+    uint64_t bytes;
+} pipe_ingest_t;
+
+/**
+ * Token bucket that paces a producer to `per_sec` records per second, with bursts of up to
+ * 10 ms worth of records.
+ */
+typedef struct pipe_rate {
+    double per_sec;
+    double tokens;
+    double burst;
+    uint64_t last_ns;
+} pipe_rate_t;
+
+int pipe_ingest_open(pipe_ingest_t *in, const char *path, char delim, size_t max_chunk);
+ssize_t pipe_ingest_next(pipe_ingest_t *in, size_t max_records, const char **chunk, size_t *records);
+void pipe_ingest_close(pipe_ingest_t *in);
+
+void pipe_rate_init(pipe_rate_t *r, double per_sec);
+size_t pipe_rate_burst(const pipe_rate_t *r);
+void pipe_rate_wait(pipe_rate_t *r, size_t n);
+
+#endif
@@ -0,0 +1,398 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PIPE_LINES_X86 1
+#endif
+
+#include "pipe_handler.h"
+#include "pipe_lines.h"
+#include "pipe_log.h"
+#include "pipe_metrics.h"
+
+/*
+ * A splitter scans [p, end) for delimiters and emits the records that end in them, the first of
+ * which starts at `rec` (at or before `p`). It stops after `max` records and stores the start of
+ * the first record it did not emit in `*rest`. Unless it stopped early, nothing before `end` holds
+ * another delimiter.
+ */
+typedef size_t (*split_fn)(const char *rec, const char *p, const char *end, char delim,
+                           struct pipe_bytes *out, size_t max, const char **rest);
+
+/**
+ * The memchr() loop the vector splitters are measured against, and the tail of both.
+ */
+static size_t split_scalar(const char *rec, const char *p, const char *end, char delim,
+                           struct pipe_bytes *out, size_t max, const char **rest) {
+    size_t n = 0;
+    const char *hit;
+
+    while (n < max && (hit = memchr(p, delim, end - p)) != NULL) {
+        out[n].ptr = rec;
+        out[n].len = (uint32_t)(hit - rec);
+        n++;
+        rec = p = hit + 1;
+    }
+    *rest = rec;
+    return n;
+}
+
+/**
+ * Emits one record per set bit of `mask`, bit i standing for p[i]. Returns the new record count;
+ * it equals `max` when the batch filled up, in which case `*rec` is the first record left out.
+ */
+static inline size_t emit_mask(uint64_t mask, const char *p, const char **rec,
+                               struct pipe_bytes *out, size_t n, size_t max) {
+    while (mask != 0) {
+        const char *hit = p + __builtin_ctzll(mask);
+
+        out[n].ptr = *rec;
+        out[n].len = (uint32_t)(hit - *rec);
+        *rec = hit + 1;
+        if (++n == max) {
+            break;
+        }
+        mask &= mask - 1;
+    }
+    return n;
+}
+
+#ifdef PIPE_LINES_X86
+/**
+ * Compares 64 bytes per iteration as four 16 byte vectors, which every x86-64 processor has.
+ */
+__attribute__((target("sse2")))
+static size_t split_sse2(const char *rec, const char *p, const char *end, char delim,
+                         struct pipe_bytes *out, size_t max, const char **rest) {
+    const __m128i d = _mm_set1_epi8(delim);
+    size_t n = 0;
+
+    while (end - p >= 64) {
+        uint64_t m0 = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), d));
+        uint64_t m1 = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 16)), d));
+        uint64_t m2 = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 32)), d));
+        uint64_t m3 = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 48)), d));
+        uint64_t mask = m0 | m1 << 16 | m2 << 32 | m3 << 48;
+
+        if (mask != 0 && (n = emit_mask(mask, p, &rec, out, n, max)) == max) {
+            *rest = rec;
+            return n;
+        }
+        p += 64;
+    }
+    return n + split_scalar(rec, p, end, delim, out + n, max - n, rest);
+}
+
+/**
+ * Compares 64 bytes per iteration as two 32 byte vectors.
+ */
+__attribute__((target("avx2")))
+static size_t split_avx2(const char *rec, const char *p, const char *end, char delim,
+                         struct pipe_bytes *out, size_t max, const char **rest) {
+    const __m256i d = _mm256_set1_epi8(delim);
+    size_t n = 0;
+
+    while (end - p >= 64) {
+        uint64_t lo = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), d));
+        uint64_t hi = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 32)), d));
+        uint64_t mask = lo | hi << 32;
+
+        if (mask != 0 && (n = emit_mask(mask, p, &rec, out, n, max)) == max) {
+            *rest = rec;
+            return n;
+        }
+        p += 64;
+    }
+    return n + split_scalar(rec, p, end, delim, out + n, max - n, rest);
+}
+#endif
+
+static atomic_int lines_impl = PIPE_LINES_SCALAR;
+
+static int impl_supported(int impl) {
+#ifdef PIPE_LINES_X86
+    __builtin_cpu_init();
+    switch (impl) {
+    case PIPE_LINES_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case PIPE_LINES_AVX2:
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+    return impl == PIPE_LINES_SCALAR;
+}
+
+__attribute__((constructor)) static void pick_impl(void) {
+    const char *env = getenv("PIPE_LINES_IMPL");
+    int impl = PIPE_LINES_AVX2;
+
+    if (env != NULL && strcmp(env, "scalar") == 0) {
+        impl = PIPE_LINES_SCALAR;
+    } else if (env != NULL && strcmp(env, "sse2") == 0) {
+        impl = PIPE_LINES_SSE2;
+    }
+    while (!impl_supported(impl)) {
+        impl--;
+    }
+    atomic_store(&lines_impl, impl);
+}
+
+/**
+ * Selects the delimiter scanner. The fastest one the processor supports is chosen at load time;
+ * the PIPE_LINES_IMPL environment variable (scalar, sse2 or avx2) caps that choice.
+ *
+ * @param impl PIPE_LINES_SCALAR, PIPE_LINES_SSE2 or PIPE_LINES_AVX2.
+ * @return The scanner now in effect, which is `impl` or the best supported one below it.
+ */
+int pipe_lines_set_impl(int impl) {
+    if (impl < PIPE_LINES_SCALAR || impl > PIPE_LINES_AVX2) {
+        impl = PIPE_LINES_AVX2;
+    }
+    while (!impl_supported(impl)) {
+        impl--;
+    }
+    atomic_store(&lines_impl, impl);
+    return impl;
+}
+
+/**
+ * Returns the scanner in use, see pipe_lines_set_impl().
+ */
+int pipe_lines_get_impl(void) {
+    return atomic_load_explicit(&lines_impl, memory_order_relaxed);
+}
+
+static split_fn current_split(void) {
+#ifdef PIPE_LINES_X86
+    switch (pipe_lines_get_impl()) {
+    case PIPE_LINES_AVX2:
+        return split_avx2;
+    case PIPE_LINES_SSE2:
+        return split_sse2;
+    }
+#endif
+    return split_scalar;
+}
+
+/**
+ * Splits a buffer into delimiter-terminated records without copying them.
+ *
+ * @param buf The bytes to split, less than 4 GiB per record.
+ * @param len The number of bytes.
+ * @param delim The byte that ends a record. It is not part of the record.
+ * @param out Receives up to `max` records pointing into `buf`.
+ * @param max The capacity of `out`.
+ * @param consumed Receives the number of bytes the returned records cover, delimiters included.
+ * @return The number of records stored in `out`.
+ */
+size_t pipe_lines_split(const char *buf, size_t len, char delim, struct pipe_bytes *out, size_t max, size_t *consumed) {
+    const char *rest;
+    size_t n = current_split()(buf, buf, buf + len, delim, out, max, &rest);
+
+    *consumed = rest - buf;
+    return n;
+}
+
+/**
+ * Initializes a line reader.
+ *
+ * @param r The reader to initialize.
+ * @param initial_cap The buffer capacity and so the largest single read, BLOCK_SIZE if 0.
+ * @param delim The byte that ends a record, usually '\n'.
+ * @param fn Called with each batch of complete records.
+ * @param arg Passed to `fn`.
+ * @return 0 on success, or -1 on error.
+ * @throws If the buffer cannot be allocated, an appropriate error message will be printed to stderr.
+ */
+int pipe_line_reader_init(pipe_line_reader_t *r, size_t initial_cap, char delim, pipe_lines_fn fn, void *arg) {
+    memset(r, 0, sizeof(*r));
+    r->cap = initial_cap ? initial_cap : BLOCK_SIZE;
+    r->max_record = PIPE_LINES_MAX_RECORD;
+    r->delim = delim;
+    r->fn = fn;
+    r->arg = arg;
+    r->buf = malloc(r->cap);
+    if (r->buf == NULL) {
+        pipe_log(PIPE_LOG_ERROR, "Error allocating line buffer: %s\n", strerror(errno));
+        r->cap = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Releases the buffer of a line reader. A trailing record without delimiter is dropped, see
+ * pipe_line_reader_flush().
+ *
+ * @param r The reader.
+ */
+void pipe_line_reader_free(pipe_line_reader_t *r) {
+    free(r->buf);
+    memset(r, 0, sizeof(*r));
+}
+
+/**
+ * Hands every complete record in the buffer to the callback, PIPE_LINES_BATCH at a time. A
+ * partial record that reached max_record is delivered as it is so the buffer stays bounded.
+ * Returns the number of records delivered.
+ */
+static size_t dispatch(pipe_line_reader_t *r) {
+    split_fn split = current_split();
+    size_t total = 0, n;
+    const char *rest;
+
+    do {
+        n = split(r->buf + r->head, r->buf + r->scan, r->buf + r->tail, r->delim, r->batch, PIPE_LINES_BATCH, &rest);
+        r->head = rest - r->buf;
+        r->scan = n == PIPE_LINES_BATCH ? r->head : r->tail;
+        if (n > 0) {
+            r->fn(r->batch, n, r->arg);
+            total += n;
+        }
+    } while (n == PIPE_LINES_BATCH);
+
+    if (r->tail - r->head >= r->max_record) {
+        pipe_log(PIPE_LOG_WARN, "Record longer than %zu bytes, delivering it in pieces\n", r->max_record);
+        r->batch[0].ptr = r->buf + r->head;
+        r->batch[0].len = (uint32_t)(r->tail - r->head);
+        r->head = r->scan = r->tail;
+        r->fn(r->batch, 1, r->arg);
+        total++;
+    }
+    r->records += total;
+    return total;
+}
+
+/**
+ * Moves the partial record to the front of the buffer and grows the buffer until `want` more
+ * bytes fit. The partial record is usually a fraction of a line, so the move is cheap and every
+ * read() can use the whole buffer.
+ */
+static int reserve(pipe_line_reader_t *r, size_t want) {
+    size_t used = r->tail - r->head;
+
+    if (r->head > 0) {
+        memmove(r->buf, r->buf + r->head, used);
+        r->scan -= r->head;
+        r->head = 0;
+        r->tail = used;
+    }
+    if (r->cap - r->tail >= want) {
+        return 0;
+    }
+
+    size_t cap = r->cap ? r->cap : BLOCK_SIZE;
+    while (cap - used < want) {
+        cap *= 2;
+    }
+    char *buf = realloc(r->buf, cap);
+    if (buf == NULL) {
+        pipe_log(PIPE_LOG_ERROR, "Error growing line buffer: %s\n", strerror(errno));
+        return -1;
+    }
+    r->buf = buf;
+    r->cap = cap;
+    return 0;
+}
+
+/**
+ * Performs a single read() from `fd` into the reader's buffer and delivers the complete records
+ * it finished. The buffer only grows while a single record does not fit.
+ *
+ * @param r The reader.
+ * @param fd The file descriptor to read from.
+ * @return The number of bytes read, 0 on end of file, or -1 on error with errno set (EAGAIN when nothing is available).
+ * @throws If an error other than EAGAIN/EINTR occurs while reading, an appropriate error message will be printed to stderr.
+ */
+ssize_t pipe_line_reader_fill(pipe_line_reader_t *r, int fd) {
+    ssize_t n;
+
+    if (reserve(r, r->head == 0 && r->tail == r->cap ? r->cap : 1) == -1) {
+        return -1;
+    }
+
+    do {
+        n = read(fd, r->buf + r->tail, r->cap - r->tail);
+        pipe_metrics_add(fd, PIPE_METRIC_READ_CALLS, 1);
+    } while (n == -1 && errno == EINTR);
+
+    if (n == -1) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            pipe_log(PIPE_LOG_ERROR, "Error reading from named pipe: %s\n", strerror(errno));
+        } else {
+            pipe_metrics_add(fd, PIPE_METRIC_EAGAIN, 1);
+        }
+        return -1;
+    }
+    r->tail += n;
+    pipe_metrics_add(fd, PIPE_METRIC_BYTES_RECV, n);
+    pipe_metrics_add(fd, PIPE_METRIC_MSGS_RECV, dispatch(r));
+    return n;
+}
+
+/**
+ * Appends bytes that were received by other means and delivers the complete records they finish.
+ *
+ * @param r The reader.
+ * @param data The bytes to append.
+ * @param len The number of bytes.
+ * @return 0 on success, or -1 on error.
+ */
+int pipe_line_reader_feed(pipe_line_reader_t *r, const char *data, size_t len) {
+    if (reserve(r, len) == -1) {
+        return -1;
+    }
+    memcpy(r->buf + r->tail, data, len);
+    r->tail += len;
+    dispatch(r);
+    return 0;
+}
+
+/**
+ * Delivers the bytes after the last delimiter as a final record, for a stream that ended without
+ * one.
+ *
+ * @param r The reader.
+ * @return 1 if a record was delivered, or 0 if there was nothing left.
+ */
+int pipe_line_reader_flush(pipe_line_reader_t *r) {
+    if (r->head == r->tail) {
+        return 0;
+    }
+    r->batch[0].ptr = r->buf + r->head;
+    r->batch[0].len = (uint32_t)(r->tail - r->head);
+    r->head = r->scan = r->tail;
+    r->fn(r->batch, 1, r->arg);
+    r->records++;
+    return 1;
+}
@@ -0,0 +1,78 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PIPE_LINES_H
+#define PIPE_LINES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "pipe_codec.h"
+
+#define PIPE_LINES_SCALAR 0
+#define PIPE_LINES_SSE2 1
+#define PIPE_LINES_AVX2 2
+
+#define PIPE_LINES_BATCH 256                        // records handed to the callback at most at once
+#define PIPE_LINES_MAX_RECORD (16 * 1024 * 1024)    // longer records are delivered in pieces
+
+/**
+ * Receives a batch of complete records, without their delimiters. The records point into the
+ * reader's buffer and are only valid until the callback returns.
+ */
+typedef void (*pipe_lines_fn)(const struct pipe_bytes *records, size_t count, void *arg);
+
+/**
+ * Splits a byte stream into delimiter-terminated records, for writers that send plain lines
+ * rather than frames. Every read() lands in one buffer that is scanned for delimiters many bytes
+ * at a time, and the records found are handed to the callback in batches as views into that
+ * buffer. Only the trailing partial record is moved before the next read, and it is not scanned
+ * again.
+ */
+typedef struct pipe_line_reader {
+    char *buf;
+    size_t cap;
+    size_t head;                // start of the first record not yet delivered
+    size_t scan;                // bytes before this offset hold no delimiter after `head`
+    size_t tail;
+    size_t max_record;
+    char delim;
+    pipe_lines_fn fn;
+    void *arg;
+    uint64_t records;
+    struct pipe_bytes batch[PIPE_LINES_BATCH];
+} pipe_line_reader_t;
+
+int pipe_lines_set_impl(int impl);
+int pipe_lines_get_impl(void);
+size_t pipe_lines_split(const char *buf, size_t len, char delim, struct pipe_bytes *out, size_t max, size_t *consumed);
+
+int pipe_line_reader_init(pipe_line_reader_t *r, size_t initial_cap, char delim, pipe_lines_fn fn, void *arg);
+void pipe_line_reader_free(pipe_line_reader_t *r);
+ssize_t pipe_line_reader_fill(pipe_line_reader_t *r, int fd);
+int pipe_line_reader_feed(pipe_line_reader_t *r, const char *data, size_t len);
+int pipe_line_reader_flush(pipe_line_reader_t *r);
+
+#endif
@@ -0,0 +1,371 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+
+#include "pipe_log.h"
+
+#define LOG_LINE_MAX 1024
+
+int pipe_log_threshold = PIPE_LOG_WARN;
+
+/**
+ * Until pipe_log_start() is called every message is a single write() to stderr, the way errors
+ * always were reported. Once started, messages are copied into a ring of slots and a flusher
+ * thread writes whatever accumulated with one writev(), so a burst of log lines costs a handful of
+ * syscalls. Producers claim a slot with one CAS, as in pipe_queue, and never take a lock; only
+ * waking an idle flusher does. A full ring drops messages instead of stalling the caller.
+ * Warnings and errors always go to stderr, only the informational levels follow `fd`.
+ */
+struct log_slot {
+    atomic_size_t seq;
+    int level;
+    size_t len;
+    char line[LOG_LINE_MAX];
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    atomic_bool async;
+    atomic_bool idle;           // the flusher sleeps on `cond`
+    atomic_int writers;         // producers inside the ring, pipe_log_stop() waits for them
+    bool stop;
+    bool registered;
+    int fd;
+    struct log_slot *slots;
+    size_t mask;
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) size_t tail;   // only moved by the flusher
+    atomic_uint_least64_t dropped;
+    uint64_t reported;
+} logger = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .fd = STDERR_FILENO,
+};
+
+__attribute__((constructor)) static void read_level_from_env(void) {
+    static const char *names[] = { "off", "error", "warn", "info", "debug" };
+    const char *env = getenv("PIPE_LOG_LEVEL");
+
+    if (env == NULL) {
+        return;
+    }
+    for (int i = 0; i <= PIPE_LOG_DEBUG; i++) {
+        if (strcasecmp(env, names[i]) == 0) {
+            pipe_log_set_level(i);
+            return;
+        }
+    }
+    if (env[0] >= '0' && env[0] <= '4' && env[1] == '\0') {
+        pipe_log_set_level(env[0] - '0');
+    }
+}
+
+static void write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+static void writev_all(int fd, struct iovec *iov, int cnt) {
+    while (cnt > 0) {
+        ssize_t n = writev(fd, iov, cnt);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return;
+        }
+        while (cnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+/**
+ * Sets the most verbose level that is still logged. The PIPE_LOG_LEVEL environment variable
+ * (off, error, warn, info or debug) sets the initial level, which defaults to warn.
+ *
+ * @param level The new threshold.
+ */
+void pipe_log_set_level(enum pipe_log_level level) {
+    __atomic_store_n(&pipe_log_threshold, level, __ATOMIC_RELAXED);
+}
+
+static bool ring_put(int level, const char *line, size_t len) {
+    size_t pos = atomic_load_explicit(&logger.head, memory_order_relaxed);
+
+    while (1) {
+        struct log_slot *slot = &logger.slots[pos & logger.mask];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&logger.head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                slot->level = level;
+                slot->len = len;
+                memcpy(slot->line, line, len);
+                // sequentially consistent, so that the flusher either sees it or is seen idle
+                atomic_store(&slot->seq, pos + 1);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = atomic_load_explicit(&logger.head, memory_order_relaxed);
+        }
+    }
+}
+
+static bool ring_ready(void) {
+    return atomic_load(&logger.slots[logger.tail & logger.mask].seq) == logger.tail + 1;
+}
+
+/**
+ * Formats and logs one message. Use the pipe_log() macro, which skips disabled levels cheaply.
+ *
+ * @param level The level of the message.
+ * @param fmt The printf() format.
+ */
+void pipe_log_write(enum pipe_log_level level, const char *fmt, ...) {
+    char line[LOG_LINE_MAX];
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (len < 0) {
+        return;
+    }
+    if ((size_t)len >= sizeof(line)) {
+        len = sizeof(line) - 1;
+        line[len - 1] = '\n';
+    }
+
+    if (!atomic_load_explicit(&logger.async, memory_order_acquire)) {
+        write_all(level <= PIPE_LOG_WARN ? STDERR_FILENO : logger.fd, line, len);
+        return;
+    }
+
+    // announce ourselves before looking again, so that pipe_log_stop() cannot free the ring under us
+    atomic_fetch_add(&logger.writers, 1);
+    if (!atomic_load(&logger.async)) {
+        atomic_fetch_sub(&logger.writers, 1);
+        write_all(level <= PIPE_LOG_WARN ? STDERR_FILENO : logger.fd, line, len);
+        return;
+    }
+    if (!ring_put(level, line, len)) {
+        atomic_fetch_add_explicit(&logger.dropped, 1, memory_order_relaxed);
+    } else if (atomic_load(&logger.idle) && atomic_exchange(&logger.idle, false)) {
+        pthread_mutex_lock(&logger.lock);
+        pthread_cond_signal(&logger.cond);
+        pthread_mutex_unlock(&logger.lock);
+    }
+    atomic_fetch_sub(&logger.writers, 1);
+}
+
+/**
+ * Writes the consecutive ready slots from `tail` on, one writev() per run of slots bound for the
+ * same descriptor, and releases them to the producers.
+ *
+ * @return The number of messages written.
+ */
+static size_t drain(void) {
+    struct iovec iov[64];
+    size_t pos = logger.tail, n = 0;
+    int cnt = 0, fd = -1;
+
+    while (1) {
+        struct log_slot *slot = &logger.slots[pos & logger.mask];
+        bool ready = atomic_load_explicit(&slot->seq, memory_order_acquire) == pos + 1;
+        int slot_fd = ready && slot->level > PIPE_LOG_WARN ? logger.fd : STDERR_FILENO;
+
+        if (cnt > 0 && (!ready || slot_fd != fd || cnt == (int)(sizeof(iov) / sizeof(iov[0])))) {
+            writev_all(fd, iov, cnt);
+            for (; logger.tail != pos; logger.tail++) {
+                atomic_store_explicit(&logger.slots[logger.tail & logger.mask].seq, logger.tail + logger.mask + 1,
+                                      memory_order_release);
+            }
+            cnt = 0;
+        }
+        if (!ready) {
+            break;
+        }
+        fd = slot_fd;
+        iov[cnt].iov_base = slot->line;
+        iov[cnt].iov_len = slot->len;
+        cnt++;
+        n++;
+        pos++;
+    }
+
+    uint64_t dropped = atomic_load_explicit(&logger.dropped, memory_order_relaxed);
+    if (dropped != logger.reported) {
+        char note[64];
+        int len = snprintf(note, sizeof(note), "%" PRIu64 " log messages dropped\n", dropped - logger.reported);
+        write_all(STDERR_FILENO, note, len);
+        logger.reported = dropped;
+    }
+    return n;
+}
+
+static void *flush_thread(void *arg) {
+    (void)arg;
+    while (1) {
+        if (drain() > 0) {
+            continue;
+        }
+        pthread_mutex_lock(&logger.lock);
+        atomic_store(&logger.idle, true);
+        while (atomic_load(&logger.idle) && !ring_ready() && !logger.stop) {
+            pthread_cond_wait(&logger.cond, &logger.lock);
+        }
+        atomic_store(&logger.idle, false);
+        bool done = logger.stop && !ring_ready();
+        pthread_mutex_unlock(&logger.lock);
+        if (done) {
+            drain();
+            break;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Switches to asynchronous logging to `fd` through a ring of `size` bytes. The ring is flushed
+ * at exit, or earlier by pipe_log_stop().
+ *
+ * @param fd The file descriptor for info and debug messages, e.g. STDOUT_FILENO; warnings and errors go to stderr.
+ * @param size The size of the ring in bytes, which holds one message per LOG_LINE_MAX bytes; 0 selects 256 KiB.
+ * @return 0 on success, or -1 on error or if logging is already asynchronous.
+ * @throws If the flusher thread cannot be started, an appropriate error message will be printed to stderr.
+ */
+int pipe_log_start(int fd, size_t size) {
+    size_t n = 2;
+
+    pthread_mutex_lock(&logger.lock);
+    if (atomic_load(&logger.async)) {
+        pthread_mutex_unlock(&logger.lock);
+        return -1;
+    }
+    while (n * 2 * sizeof(struct log_slot) <= (size ? size : 1 << 18)) {
+        n *= 2;
+    }
+    logger.slots = calloc(n, sizeof(*logger.slots));
+    if (logger.slots == NULL) {
+        pthread_mutex_unlock(&logger.lock);
+        fprintf(stderr, "Error allocating log buffer: %s\n", strerror(errno));
+        return -1;
+    }
+    for (size_t i = 0; i < n; i++) {
+        atomic_init(&logger.slots[i].seq, i);
+    }
+    logger.mask = n - 1;
+    logger.fd = fd;
+    atomic_store(&logger.head, 0);
+    logger.tail = 0;
+    logger.stop = false;
+    atomic_store(&logger.idle, false);
+    if ((errno = pthread_create(&logger.thread, NULL, flush_thread, NULL)) != 0) {
+        free(logger.slots);
+        logger.slots = NULL;
+        pthread_mutex_unlock(&logger.lock);
+        fprintf(stderr, "Error starting log thread: %s\n", strerror(errno));
+        return -1;
+    }
+    atomic_store_explicit(&logger.async, true, memory_order_release);
+    if (!logger.registered) {
+        logger.registered = true;
+        atexit(pipe_log_stop);
+    }
+    pthread_mutex_unlock(&logger.lock);
+    return 0;
+}
+
+/**
+ * Flushes the ring, stops the flusher thread and returns to synchronous logging to the same descriptor.
+ */
+void pipe_log_stop(void) {
+    pthread_mutex_lock(&logger.lock);
+    if (!atomic_load(&logger.async)) {
+        pthread_mutex_unlock(&logger.lock);
+        return;
+    }
+    atomic_store(&logger.async, false);
+    pthread_mutex_unlock(&logger.lock);
+
+    // producers that saw the ring before the switch finish their message first
+    while (atomic_load(&logger.writers) > 0) {
+        sched_yield();
+    }
+    pthread_mutex_lock(&logger.lock);
+    logger.stop = true;
+    pthread_cond_signal(&logger.cond);
+    pthread_mutex_unlock(&logger.lock);
+
+    pthread_join(logger.thread, NULL);
+    free(logger.slots);
+    logger.slots = NULL;
+}
+
+/**
+ * Returns how many messages were dropped because the ring was full.
+ *
+ * @return The number of dropped messages since the process started.
+ */
+uint64_t pipe_log_dropped(void) {
+    return atomic_load_explicit(&logger.dropped, memory_order_relaxed);
+}
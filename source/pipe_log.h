@@ -0,0 +1,58 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PIPE_LOG_H
+#define PIPE_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum pipe_log_level {
+    PIPE_LOG_OFF,
+    PIPE_LOG_ERROR,
+    PIPE_LOG_WARN,
+    PIPE_LOG_INFO,
+    PIPE_LOG_DEBUG,
+};
+
+extern int pipe_log_threshold;  // only accessed through __atomic builtins
+
+/**
+ * Logs a printf-style message if `level` is enabled. A disabled level costs one relaxed load and
+ * does not even evaluate the arguments.
+ */
+#define pipe_log(level, ...)                                                                   \
+    do {                                                                                       \
+        if ((int)(level) <= __atomic_load_n(&pipe_log_threshold, __ATOMIC_RELAXED)) {          \
+            pipe_log_write((level), __VA_ARGS__);                                              \
+        }                                                                                      \
+    } while (0)
+
+void pipe_log_write(enum pipe_log_level level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void pipe_log_set_level(enum pipe_log_level level);
+int pipe_log_start(int fd, size_t size);
+void pipe_log_stop(void);
+uint64_t pipe_log_dropped(void);
+
+#endif
@@ -0,0 +1,387 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "pipe_lz.h"
+#include "pipe_frame.h"
+#include "pipe_log.h"
+
+// LZ4 block format limits: the last 5 bytes are always literals and the last match starts at
+// least 12 bytes before the end, which lets the decoder copy without checking every byte
+#define MINMATCH 4
+#define LASTLITERALS 5
+#define MFLIMIT 12
+#define MAX_OFFSET 65535
+#define ML_MASK 15
+#define RUN_MASK 15
+#define MAX_BACKOFF 64
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t hash32(uint32_t v) {
+    return (v * 2654435761u) >> (32 - PIPE_LZ_HASH_LOG);
+}
+
+static inline uint64_t read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// compares a word at a time, the first differing byte is found from the lowest set bit
+static inline size_t match_length(const uint8_t *p, const uint8_t *ref, const uint8_t *limit) {
+    const uint8_t *start = p;
+
+    while (p + sizeof(uint64_t) <= limit) {
+        uint64_t diff = read64(p) ^ read64(ref);
+        if (diff != 0) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            return (size_t)(p - start) + (__builtin_ctzll(diff) >> 3);
+#else
+            return (size_t)(p - start) + (__builtin_clzll(diff) >> 3);
+#endif
+        }
+        p += sizeof(uint64_t);
+        ref += sizeof(uint64_t);
+    }
+    while (p < limit && *p == *ref) {
+        p++;
+        ref++;
+    }
+    return (size_t)(p - start);
+}
+
+static uint8_t *put_length(uint8_t *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+/**
+ * Returns the worst case compressed size of `len` bytes.
+ *
+ * @param len The input length.
+ * @return The largest block pipe_lz_compress() can produce for it.
+ */
+size_t pipe_lz_compress_bound(size_t len) {
+    return len + len / 255 + 16;
+}
+
+/**
+ * Compresses a buffer into an LZ4 compatible block with a greedy single probe matcher.
+ *
+ * @param ctx The context whose match table is used.
+ * @param src The data to compress, at most PIPE_FRAME_MAX_LEN bytes.
+ * @param len The length of the data.
+ * @param dst The output buffer.
+ * @param cap The size of `dst`; compression gives up once the block would not fit.
+ * @return The size of the block, or 0 if it does not fit in `cap`.
+ */
+size_t pipe_lz_compress(pipe_lz_ctx_t *ctx, const void *src, size_t len, void *dst, size_t cap) {
+    const uint8_t *base = src, *ip = base, *anchor = base, *end = base + len;
+    uint8_t *op = dst, *oend = op + cap;
+    size_t lit;
+
+    if (len > PIPE_FRAME_MAX_LEN) {
+        return 0;
+    }
+
+    if (len > MFLIMIT) {
+        const uint8_t *mflimit = end - MFLIMIT, *matchlimit = end - LASTLITERALS;
+
+        ip++;
+        while (ip < mflimit) {
+            uint32_t seq = read32(ip), h = hash32(seq), pos = (uint32_t)(ip - base), cand = ctx->table[h];
+            const uint8_t *ref, *mp, *rp;
+            size_t mlen;
+
+            ctx->table[h] = pos;
+            // entries left over from earlier messages are only hints, check before trusting them
+            if (cand >= pos || pos - cand > MAX_OFFSET || read32(base + cand) != seq) {
+                // step faster the longer nothing matched, incompressible input is skipped quickly
+                size_t step = 1 + ((size_t)(ip - anchor) >> 6);
+                if (step >= (size_t)(mflimit - ip)) {
+                    break;
+                }
+                ip += step;
+                continue;
+            }
+
+            ref = base + cand;
+            while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            mp = ip + MINMATCH;
+            rp = ref + MINMATCH;
+            mp += match_length(mp, rp, matchlimit);
+
+            lit = (size_t)(ip - anchor);
+            mlen = (size_t)(mp - ip) - MINMATCH;
+            if ((size_t)(oend - op) < 1 + lit / 255 + 1 + lit + 2 + mlen / 255 + 1) {
+                return 0;
+            }
+
+            uint8_t *token = op++;
+            *token = (uint8_t)((lit >= RUN_MASK ? RUN_MASK : lit) << 4);
+            if (lit >= RUN_MASK) {
+                op = put_length(op, lit - RUN_MASK);
+            }
+            memcpy(op, anchor, lit);
+            op += lit;
+
+            uint16_t offset = (uint16_t)(ip - ref);
+            *op++ = (uint8_t)offset;
+            *op++ = (uint8_t)(offset >> 8);
+
+            *token |= (uint8_t)(mlen >= ML_MASK ? ML_MASK : mlen);
+            if (mlen >= ML_MASK) {
+                op = put_length(op, mlen - ML_MASK);
+            }
+
+            ip = anchor = mp;
+            if (ip < mflimit) {
+                // remember the tail of the match, the next repetition usually starts there
+                ctx->table[hash32(read32(ip - 2))] = (uint32_t)(ip - 2 - base);
+            }
+        }
+    }
+
+    lit = (size_t)(end - anchor);
+    if ((size_t)(oend - op) < 1 + lit / 255 + 1 + lit) {
+        return 0;
+    }
+    *op++ = (uint8_t)((lit >= RUN_MASK ? RUN_MASK : lit) << 4);
+    if (lit >= RUN_MASK) {
+        op = put_length(op, lit - RUN_MASK);
+    }
+    memcpy(op, anchor, lit);
+    op += lit;
+    return (size_t)(op - (uint8_t *)dst);
+}
+
+static int read_length(const uint8_t **ip, const uint8_t *iend, size_t *len) {
+    uint8_t b;
+
+    do {
+        if (*ip >= iend) {
+            return -1;
+        }
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+/**
+ * Decompresses an LZ4 block. Every length and offset is checked, so corrupt or hostile input
+ * fails instead of reading or writing out of bounds.
+ *
+ * @param src The block.
+ * @param len The size of the block.
+ * @param dst The output buffer.
+ * @param cap The size of `dst`.
+ * @return The decompressed size, or -1 if the block is malformed or does not fit (errno EBADMSG).
+ */
+ssize_t pipe_lz_decompress(const void *src, size_t len, void *dst, size_t cap) {
+    const uint8_t *ip = src, *iend = ip + len;
+    uint8_t *op = dst, *oend = op + cap;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+        size_t lit = token >> 4, mlen = token & ML_MASK, offset;
+
+        if (lit == RUN_MASK && read_length(&ip, iend, &lit) == -1) {
+            goto bad;
+        }
+        if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op)) {
+            goto bad;
+        }
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+        if (ip == iend) {
+            // the last sequence has no match
+            return op - (uint8_t *)dst;
+        }
+
+        if (iend - ip < 2) {
+            goto bad;
+        }
+        offset = ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - (uint8_t *)dst)) {
+            goto bad;
+        }
+        if (mlen == ML_MASK && read_length(&ip, iend, &mlen) == -1) {
+            goto bad;
+        }
+        mlen += MINMATCH;
+        if (mlen > (size_t)(oend - op)) {
+            goto bad;
+        }
+
+        // an overlapping match repeats the last `offset` bytes, copied in doubling chunks
+        for (size_t dist = offset; mlen > 0; dist *= 2) {
+            size_t n = mlen < dist ? mlen : dist;
+            memcpy(op, op - dist, n);
+            op += n;
+            mlen -= n;
+        }
+    }
+
+bad:
+    errno = EBADMSG;
+    return -1;
+}
+
+/**
+ * Allocates a compression context.
+ *
+ * @param threshold The smallest message worth compressing.
+ * @return The context, or NULL on error.
+ * @throws If the context cannot be allocated, an appropriate error message will be printed to stderr.
+ */
+pipe_lz_ctx_t *pipe_lz_new(size_t threshold) {
+    pipe_lz_ctx_t *ctx = calloc(1, sizeof(*ctx));
+
+    if (ctx == NULL) {
+        pipe_log(PIPE_LOG_ERROR, "Error allocating compression context: %s\n", strerror(errno));
+        return NULL;
+    }
+    ctx->threshold = threshold;
+    return ctx;
+}
+
+/**
+ * Releases a compression context and its buffers.
+ *
+ * @param ctx The context, may be NULL.
+ */
+void pipe_lz_free(pipe_lz_ctx_t *ctx) {
+    if (ctx != NULL) {
+        free(ctx->out);
+        free(ctx->in);
+        free(ctx);
+    }
+}
+
+static int reserve(char **buf, size_t *cap, size_t want) {
+    char *p;
+
+    if (want <= *cap) {
+        return 0;
+    }
+    p = realloc(*buf, want);
+    if (p == NULL) {
+        pipe_log(PIPE_LOG_ERROR, "Error allocating compression buffer: %s\n", strerror(errno));
+        return -1;
+    }
+    *buf = p;
+    *cap = want;
+    return 0;
+}
+
+/**
+ * Compresses a message for the wire if it is large enough and compresses well enough. The packed
+ * form is the raw length as a native uint32_t followed by the block.
+ *
+ * @param ctx The sender's context.
+ * @param src The message.
+ * @param len The length of the message.
+ * @param out Receives a pointer to the packed message, valid until the next pack on `ctx`.
+ * @return The packed length, 0 if the message should be sent uncompressed, or -1 on error.
+ */
+ssize_t pipe_lz_pack(pipe_lz_ctx_t *ctx, const void *src, size_t len, const char **out) {
+    size_t cap, n;
+    uint32_t raw = (uint32_t)len;
+
+    if (len < ctx->threshold || len > PIPE_FRAME_MAX_LEN) {
+        return 0;
+    }
+    if (ctx->skip > 0) {
+        ctx->skip--;
+        return 0;
+    }
+
+    // anything that saves less than an eighth is not worth the receiver's time
+    cap = PIPE_LZ_PREFIX_SIZE + len - len / 8;
+    if (reserve(&ctx->out, &ctx->out_cap, cap) == -1) {
+        return -1;
+    }
+    n = pipe_lz_compress(ctx, src, len, ctx->out + PIPE_LZ_PREFIX_SIZE, cap - PIPE_LZ_PREFIX_SIZE);
+    if (n == 0) {
+        ctx->backoff = ctx->backoff ? (ctx->backoff < MAX_BACKOFF ? ctx->backoff * 2 : MAX_BACKOFF) : 1;
+        ctx->skip = ctx->backoff;
+        return 0;
+    }
+    ctx->backoff = 0;
+    memcpy(ctx->out, &raw, sizeof(raw));
+    *out = ctx->out;
+    return (ssize_t)(PIPE_LZ_PREFIX_SIZE + n);
+}
+
+/**
+ * Restores a message packed by pipe_lz_pack().
+ *
+ * @param ctx The receiver's context.
+ * @param src The packed message.
+ * @param len The packed length.
+ * @param out Receives a pointer to the message, valid until the next unpack on `ctx`.
+ * @return The message length, or -1 if the packed message is malformed (errno EBADMSG) or on error.
+ */
+ssize_t pipe_lz_unpack(pipe_lz_ctx_t *ctx, const void *src, size_t len, char **out) {
+    uint32_t raw;
+
+    if (len < PIPE_LZ_PREFIX_SIZE) {
+        errno = EBADMSG;
+        return -1;
+    }
+    memcpy(&raw, src, sizeof(raw));
+    if (raw > PIPE_FRAME_MAX_LEN) {
+        errno = EBADMSG;
+        return -1;
+    }
+    if (reserve(&ctx->in, &ctx->in_cap, raw ? raw : 1) == -1) {
+        return -1;
+    }
+    if (pipe_lz_decompress((const char *)src + PIPE_LZ_PREFIX_SIZE, len - PIPE_LZ_PREFIX_SIZE, ctx->in, raw) != (ssize_t)raw) {
+        errno = EBADMSG;
+        return -1;
+    }
+    *out = ctx->in;
+    return raw;
+}
@@ -0,0 +1,65 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PIPE_LZ_H
+#define PIPE_LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define PIPE_LZ_HASH_LOG 12
+#define PIPE_LZ_HASH_SIZE (1u << PIPE_LZ_HASH_LOG)
+#define PIPE_LZ_PREFIX_SIZE sizeof(uint32_t)  // a packed payload starts with its raw length
+
+/**
+ * Reusable state for compressing and decompressing the messages of one connection. The match
+ * table is never cleared between messages, every candidate is verified against the input, and
+ * both buffers only ever grow, so steady state traffic does not allocate.
+ *
+ * Messages shorter than `threshold` are sent as they are. A message that does not shrink by at
+ * least an eighth turns compression off for the next `skip` messages, a window that doubles with
+ * every further miss, so incompressible streams stop paying for the attempt.
+ */
+typedef struct pipe_lz_ctx {
+    uint32_t table[PIPE_LZ_HASH_SIZE];
+    size_t threshold;
+    uint32_t skip;
+    uint32_t backoff;
+    char *out;
+    size_t out_cap;
+    char *in;
+    size_t in_cap;
+} pipe_lz_ctx_t;
+
+size_t pipe_lz_compress_bound(size_t len);
+size_t pipe_lz_compress(pipe_lz_ctx_t *ctx, const void *src, size_t len, void *dst, size_t cap);
+ssize_t pipe_lz_decompress(const void *src, size_t len, void *dst, size_t cap);
+
+pipe_lz_ctx_t *pipe_lz_new(size_t threshold);
+void pipe_lz_free(pipe_lz_ctx_t *ctx);
+ssize_t pipe_lz_pack(pipe_lz_ctx_t *ctx, const void *src, size_t len, const char **out);
+ssize_t pipe_lz_unpack(pipe_lz_ctx_t *ctx, const void *src, size_t len, char **out);
+
+#endif
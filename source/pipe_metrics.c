@@ -0,0 +1,515 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/stat.h>
+
+#include "pipe_log.h"
+#include "pipe_metrics.h"
+#include "pipe_time.h"
+
+/**
+ * Counters of one thread. Only the owning thread writes them, so an update is a plain relaxed
+ * load and store without a locked instruction; readers sum all slots. Slots of exited threads are
+ * handed to the next new thread instead of being freed, so their counts stay in the totals.
+ */
+struct metrics_slot {
+    struct metrics_slot *next;
+    atomic_bool in_use;
+    atomic_uint_least64_t counters[PIPE_METRICS_MAX_PIPES][PIPE_METRIC_COUNT];
+    atomic_uint_least64_t latency[PIPE_METRICS_MAX_PIPES][PIPE_METRICS_BUCKETS];
+    atomic_uint_least64_t latency_sum[PIPE_METRICS_MAX_PIPES];
+};
+
+static const struct {
+    const char *name;
+    const char *help;
+} metric_info[PIPE_METRIC_COUNT] = {
+    [PIPE_METRIC_MSGS_SENT] = { "pipe_messages_sent_total", "Messages written to the pipe." },
+    [PIPE_METRIC_BYTES_SENT] = { "pipe_bytes_sent_total", "Bytes written to the pipe." },
+    [PIPE_METRIC_MSGS_RECV] = { "pipe_messages_received_total", "Messages read from the pipe." },
+    [PIPE_METRIC_BYTES_RECV] = { "pipe_bytes_received_total", "Bytes read from the pipe." },
+    [PIPE_METRIC_WRITE_CALLS] = { "pipe_write_calls_total", "write() and writev() system calls." },
+    [PIPE_METRIC_READ_CALLS] = { "pipe_read_calls_total", "read() system calls." },
+    [PIPE_METRIC_EAGAIN] = { "pipe_eagain_total", "Reads and writes that found the pipe empty or full." },
+    [PIPE_METRIC_PARTIAL_WRITES] = { "pipe_partial_writes_total", "Writes that transferred only part of the data." },
+    [PIPE_METRIC_OPEN_RETRIES] = { "pipe_open_retries_total", "Opens retried while waiting for a reader." },
+    [PIPE_METRIC_TIMEOUTS] = { "pipe_timeouts_total", "Operations that gave up at their deadline." },
+    [PIPE_METRIC_CORRUPT_BYTES] = { "pipe_corrupt_bytes_total", "Bytes discarded after a corrupt frame header." },
+};
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static char pipe_names[PIPE_METRICS_MAX_PIPES][PIPE_METRICS_NAME_MAX];
+static atomic_int npipes = 1;  // id 0 collects descriptors that were never bound to a name
+static atomic_uchar fd_ids[PIPE_METRICS_MAX_FDS];
+
+static _Atomic(struct metrics_slot *) slots;
+static __thread struct metrics_slot *local_slot;
+static pthread_key_t slot_key;
+static pthread_once_t slot_once = PTHREAD_ONCE_INIT;
+
+static struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool running;
+    bool stop;
+    uint64_t interval_ns;
+    char path[PIPE_METRICS_NAME_MAX];
+} exporter = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static void dump_at_exit(void) {
+    pipe_metrics_dump(getenv("PIPE_METRICS_PATH"));
+}
+
+/**
+ * Short-lived tools such as write_ack never run an exporter. Setting PIPE_METRICS_PATH makes any
+ * program dump one final snapshot there when it exits.
+ */
+__attribute__((constructor)) static void read_path_from_env(void) {
+    const char *env = getenv("PIPE_METRICS_PATH");
+
+    if (env != NULL && env[0] != '\0') {
+        atexit(dump_at_exit);
+    }
+}
+
+static void release_slot(void *slot) {
+    atomic_store_explicit(&((struct metrics_slot *)slot)->in_use, false, memory_order_release);
+}
+
+static void create_slot_key(void) {
+    pthread_key_create(&slot_key, release_slot);
+}
+
+static struct metrics_slot *acquire_slot(void) {
+    struct metrics_slot *s;
+    int saved_errno = errno;  // callers count right after a failed syscall and still check errno
+
+    pthread_once(&slot_once, create_slot_key);
+    for (s = atomic_load_explicit(&slots, memory_order_acquire); s != NULL; s = s->next) {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&s->in_use, &expected, true)) {
+            break;
+        }
+    }
+    if (s == NULL) {
+        s = calloc(1, sizeof(*s));
+        if (s == NULL) {
+            errno = saved_errno;
+            return NULL;
+        }
+        atomic_init(&s->in_use, true);
+        s->next = atomic_load_explicit(&slots, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(&slots, &s->next, s, memory_order_release,
+                                                      memory_order_relaxed)) {
+        }
+    }
+    pthread_setspecific(slot_key, s);
+    local_slot = s;
+    errno = saved_errno;
+    return s;
+}
+
+static inline void bump(atomic_uint_least64_t *c, uint64_t value) {
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+static inline int fd_id(int fd) {
+    return fd >= 0 && fd < PIPE_METRICS_MAX_FDS ? atomic_load_explicit(&fd_ids[fd], memory_order_relaxed) : 0;
+}
+
+/**
+ * Returns the metrics id of a pipe name, registering it on first use. Names are taken as they are;
+ * pipes that are private to one peer, such as reply pipes carrying a pid, should be bound to the
+ * role they play instead of their own name, or every client uses up an id of its own.
+ *
+ * @param name The name of the named pipe.
+ * @return The id, or 0 (the shared unnamed bucket) once PIPE_METRICS_MAX_PIPES names are in use.
+ */
+int pipe_metrics_register(const char *name) {
+    int id, n;
+
+    pthread_mutex_lock(&registry_lock);
+    n = atomic_load(&npipes);
+    for (id = 1; id < n; id++) {
+        if (strncmp(pipe_names[id], name, PIPE_METRICS_NAME_MAX) == 0) {
+            break;
+        }
+    }
+    if (id == n) {
+        if (n == PIPE_METRICS_MAX_PIPES) {
+            id = 0;
+        } else {
+            snprintf(pipe_names[id], PIPE_METRICS_NAME_MAX, "%s", name);
+            atomic_store(&npipes, n + 1);
+        }
+    }
+    pthread_mutex_unlock(&registry_lock);
+    return id;
+}
+
+/**
+ * Attributes everything counted on `fd` from now on to the pipe with metrics id `id`.
+ *
+ * @param fd The file descriptor.
+ * @param id An id returned by pipe_metrics_register(), or 0 to unbind.
+ */
+void pipe_metrics_bind(int fd, int id) {
+    if (fd >= 0 && fd < PIPE_METRICS_MAX_FDS) {
+        atomic_store_explicit(&fd_ids[fd], (unsigned char)id, memory_order_relaxed);
+    }
+}
+
+/**
+ * Registers `name` and binds `fd` to it.
+ *
+ * @param fd The file descriptor.
+ * @param name The name of the named pipe.
+ */
+void pipe_metrics_bind_name(int fd, const char *name) {
+    pipe_metrics_bind(fd, pipe_metrics_register(name));
+}
+
+/**
+ * Adds `value` to a counter of the pipe with metrics id `id`. Wait-free and safe from any thread.
+ *
+ * @param id An id returned by pipe_metrics_register().
+ * @param metric The counter.
+ * @param value The amount to add.
+ */
+void pipe_metrics_count(int id, enum pipe_metric metric, uint64_t value) {
+    struct metrics_slot *s = local_slot != NULL ? local_slot : acquire_slot();
+
+    if (s != NULL && id >= 0 && id < PIPE_METRICS_MAX_PIPES) {
+        bump(&s->counters[id][metric], value);
+    }
+}
+
+/**
+ * Adds `value` to a counter of the pipe bound to `fd`.
+ *
+ * @param fd The file descriptor the operation was performed on.
+ * @param metric The counter.
+ * @param value The amount to add.
+ */
+void pipe_metrics_add(int fd, enum pipe_metric metric, uint64_t value) {
+    pipe_metrics_count(fd_id(fd), metric, value);
+}
+
+/**
+ * Records one send-to-ACK round trip in the latency histogram of the pipe bound to `fd`.
+ *
+ * @param fd The file descriptor the request was sent on.
+ * @param latency_ns The round-trip time in nanoseconds.
+ */
+void pipe_metrics_observe(int fd, uint64_t latency_ns) {
+    struct metrics_slot *s = local_slot != NULL ? local_slot : acquire_slot();
+    int id = fd_id(fd);
+    int bucket;
+
+    if (s == NULL) {
+        return;
+    }
+    bucket = latency_ns ? 64 - __builtin_clzll(latency_ns) - PIPE_METRICS_BUCKET_SHIFT : 0;
+    bucket = bucket < 0 ? 0 : bucket >= PIPE_METRICS_BUCKETS ? PIPE_METRICS_BUCKETS - 1 : bucket;
+    bump(&s->latency[id][bucket], 1);
+    bump(&s->latency_sum[id], latency_ns);
+}
+
+/**
+ * Sums the per-thread counters of every registered pipe.
+ *
+ * @param out Receives one entry per pipe; entry 0 is the unnamed bucket with an empty name.
+ * @param max The number of entries in `out`.
+ * @return The number of entries filled in.
+ */
+int pipe_metrics_snapshot(pipe_metrics_snapshot_t *out, int max) {
+    int n = atomic_load(&npipes);
+
+    n = n < max ? n : max;
+    memset(out, 0, n * sizeof(*out));
+    pthread_mutex_lock(&registry_lock);
+    for (int id = 0; id < n; id++) {
+        memcpy(out[id].name, pipe_names[id], PIPE_METRICS_NAME_MAX);
+    }
+    pthread_mutex_unlock(&registry_lock);
+
+    for (struct metrics_slot *s = atomic_load_explicit(&slots, memory_order_acquire); s != NULL; s = s->next) {
+        for (int id = 0; id < n; id++) {
+            for (int m = 0; m < PIPE_METRIC_COUNT; m++) {
+                out[id].counters[m] += atomic_load_explicit(&s->counters[id][m], memory_order_relaxed);
+            }
+            for (int b = 0; b < PIPE_METRICS_BUCKETS; b++) {
+                uint64_t count = atomic_load_explicit(&s->latency[id][b], memory_order_relaxed);
+                out[id].latency[b] += count;
+                out[id].latency_count += count;
+            }
+            out[id].latency_sum_ns += atomic_load_explicit(&s->latency_sum[id], memory_order_relaxed);
+        }
+    }
+    return n;
+}
+
+static void print_label(FILE *f, const char *name) {
+    fputs("{pipe=\"", f);
+    for (const char *p = name; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            fputc('\\', f);
+        }
+        fputc(*p, f);
+    }
+    fputc('"', f);
+}
+
+static int write_all(int fd, const char *buf, size_t len, uint64_t deadline) {
+    struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                int ms = pipe_ms_until(deadline);
+                int ready = ms == 0 ? 0 : poll(&pfd, 1, ms);
+                if (ready > 0 || (ready == -1 && errno == EINTR)) {
+                    continue;
+                }
+                if (ready == 0) {
+                    pipe_log(PIPE_LOG_WARN, "Giving up on a stalled metrics reader\n");
+                    errno = ETIMEDOUT;
+                    return -1;
+                }
+            }
+            pipe_log(PIPE_LOG_ERROR, "Error writing metrics: %s\n", strerror(errno));
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int write_prometheus(int fd, uint64_t deadline);
+
+/**
+ * Writes a snapshot of all pipes in the Prometheus text exposition format.
+ *
+ * @param fd The file descriptor to write to; the snapshot is written with as few write() calls as possible.
+ * @return 0 on success, or -1 on error.
+ * @throws If an error occurs while writing, an appropriate error message will be printed to stderr.
+ */
+int pipe_metrics_write_prometheus(int fd) {
+    return write_prometheus(fd, PIPE_DEADLINE_NEVER);
+}
+
+static int write_prometheus(int fd, uint64_t deadline) {
+    pipe_metrics_snapshot_t *snap = calloc(PIPE_METRICS_MAX_PIPES, sizeof(*snap));
+    char *text = NULL;
+    size_t len = 0;
+    FILE *f;
+    int n, ret;
+
+    if (snap == NULL || (f = open_memstream(&text, &len)) == NULL) {
+        pipe_log(PIPE_LOG_ERROR, "Error allocating metrics snapshot: %s\n", strerror(errno));
+        free(snap);
+        return -1;
+    }
+    n = pipe_metrics_snapshot(snap, PIPE_METRICS_MAX_PIPES);
+
+    for (int m = 0; m < PIPE_METRIC_COUNT; m++) {
+        fprintf(f, "# HELP %s %s\n# TYPE %s counter\n", metric_info[m].name, metric_info[m].help, metric_info[m].name);
+        for (int id = 0; id < n; id++) {
+            fputs(metric_info[m].name, f);
+            print_label(f, snap[id].name);
+            fprintf(f, "} %" PRIu64 "\n", snap[id].counters[m]);
+        }
+    }
+
+    fputs("# HELP pipe_ack_latency_seconds Time from sending a message to receiving its ACK.\n"
+          "# TYPE pipe_ack_latency_seconds histogram\n", f);
+    for (int id = 0; id < n; id++) {
+        uint64_t cumulative = 0;
+        if (snap[id].latency_count == 0) {
+            continue;
+        }
+        for (int b = 0; b < PIPE_METRICS_BUCKETS - 1; b++) {
+            cumulative += snap[id].latency[b];
+            fputs("pipe_ack_latency_seconds_bucket", f);
+            print_label(f, snap[id].name);
+            fprintf(f, ",le=\"%g\"} %" PRIu64 "\n", (double)(1ULL << (b + PIPE_METRICS_BUCKET_SHIFT)) / PIPE_NSEC_PER_SEC,
+                    cumulative);
+        }
+        fputs("pipe_ack_latency_seconds_bucket", f);
+        print_label(f, snap[id].name);
+        fprintf(f, ",le=\"+Inf\"} %" PRIu64 "\n", snap[id].latency_count);
+        fputs("pipe_ack_latency_seconds_sum", f);
+        print_label(f, snap[id].name);
+        fprintf(f, "} %.9f\n", (double)snap[id].latency_sum_ns / PIPE_NSEC_PER_SEC);
+        fputs("pipe_ack_latency_seconds_count", f);
+        print_label(f, snap[id].name);
+        fprintf(f, "} %" PRIu64 "\n", snap[id].latency_count);
+    }
+    fclose(f);
+
+    ret = write_all(fd, text, len, deadline);
+    free(text);
+    free(snap);
+    return ret;
+}
+
+/**
+ * Writes a Prometheus snapshot to `path`. A named pipe receives the snapshot only if a reader is
+ * attached, and the write is abandoned if that reader does not drain it within
+ * PIPE_METRICS_DUMP_TIMEOUT seconds; anything else is replaced atomically through a temporary file, so a scraper never
+ * sees a half-written file.
+ *
+ * @param path A named pipe or a regular file.
+ * @return 0 on success or if nobody reads the pipe, or -1 on error.
+ * @throws If an error occurs while opening or writing, an appropriate error message will be printed to stderr.
+ */
+int pipe_metrics_dump(const char *path) {
+    char tmp[PIPE_METRICS_NAME_MAX + 32];
+    struct stat st;
+    int fd, ret;
+
+    if (stat(path, &st) == 0 && S_ISFIFO(st.st_mode)) {
+        if ((fd = open(path, O_WRONLY | O_NONBLOCK | O_CLOEXEC)) == -1) {
+            if (errno == ENXIO) {
+                return 0;
+            }
+            pipe_log(PIPE_LOG_ERROR, "Error opening stats pipe: %s\n", strerror(errno));
+            return -1;
+        }
+        // a reader is attached: let it pace us, but a stalled one must not hang the exporter
+        ret = write_prometheus(fd, pipe_deadline_from_timeout(PIPE_METRICS_DUMP_TIMEOUT));
+        close(fd);
+        return ret;
+    }
+
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1) {
+        pipe_log(PIPE_LOG_ERROR, "Error opening stats file: %s\n", strerror(errno));
+        return -1;
+    }
+    ret = pipe_metrics_write_prometheus(fd);
+    close(fd);
+    if (ret == 0 && rename(tmp, path) == -1) {
+        pipe_log(PIPE_LOG_ERROR, "Error renaming stats file: %s\n", strerror(errno));
+        ret = -1;
+    }
+    if (ret == -1) {
+        unlink(tmp);
+    }
+    return ret;
+}
+
+static void *export_thread(void *arg) {
+    struct timespec ts;
+    uint64_t next;
+
+    (void)arg;
+    pthread_mutex_lock(&exporter.lock);
+    next = pipe_now_ns();
+    while (!exporter.stop) {
+        pthread_mutex_unlock(&exporter.lock);
+        pipe_metrics_dump(exporter.path);
+        pthread_mutex_lock(&exporter.lock);
+
+        next += exporter.interval_ns;
+        ts.tv_sec = next / PIPE_NSEC_PER_SEC;
+        ts.tv_nsec = next % PIPE_NSEC_PER_SEC;
+        while (!exporter.stop && pthread_cond_timedwait(&exporter.cond, &exporter.lock, &ts) != ETIMEDOUT) {
+        }
+    }
+    pthread_mutex_unlock(&exporter.lock);
+    return NULL;
+}
+
+/**
+ * Starts a background thread that dumps a snapshot to `path` every `interval` seconds.
+ *
+ * @param path A named pipe or a regular file, see pipe_metrics_dump().
+ * @param interval The number of seconds between snapshots.
+ * @return 0 on success, or -1 on error or if an exporter is already running.
+ */
+int pipe_metrics_export_start(const char *path, double interval) {
+    pthread_condattr_t attr;
+
+    pthread_mutex_lock(&exporter.lock);
+    if (exporter.running) {
+        pthread_mutex_unlock(&exporter.lock);
+        pipe_log(PIPE_LOG_ERROR, "Error starting metrics exporter: already running\n");
+        return -1;
+    }
+    snprintf(exporter.path, PIPE_METRICS_NAME_MAX, "%s", path);
+    exporter.interval_ns = (uint64_t)(interval * PIPE_NSEC_PER_SEC);
+    exporter.stop = false;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&exporter.cond, &attr);
+    pthread_condattr_destroy(&attr);
+    if ((errno = pthread_create(&exporter.thread, NULL, export_thread, NULL)) != 0) {
+        pthread_cond_destroy(&exporter.cond);
+        pthread_mutex_unlock(&exporter.lock);
+        pipe_log(PIPE_LOG_ERROR, "Error starting metrics exporter: %s\n", strerror(errno));
+        return -1;
+    }
+    exporter.running = true;
+    pthread_mutex_unlock(&exporter.lock);
+    return 0;
+}
+
+/**
+ * Stops the exporter started by pipe_metrics_export_start() after one final snapshot.
+ */
+void pipe_metrics_export_stop(void) {
+    pthread_mutex_lock(&exporter.lock);
+    if (!exporter.running) {
+        pthread_mutex_unlock(&exporter.lock);
+        return;
+    }
+    exporter.stop = true;
+    pthread_cond_signal(&exporter.cond);
+    pthread_mutex_unlock(&exporter.lock);
+
+    pthread_join(exporter.thread, NULL);
+    pthread_cond_destroy(&exporter.cond);
+    exporter.running = false;
+    pipe_metrics_dump(exporter.path);
+}
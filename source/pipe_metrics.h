@@ -0,0 +1,77 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PIPE_METRICS_H
+#define PIPE_METRICS_H
+
+#include <stdint.h>
+
+#define PIPE_METRICS_MAX_PIPES 64
+#define PIPE_METRICS_MAX_FDS 4096
+#define PIPE_METRICS_NAME_MAX 256
+#define PIPE_METRICS_BUCKETS 32
+#define PIPE_METRICS_BUCKET_SHIFT 10  // the first bucket holds everything below 2^10 ns
+#define PIPE_METRICS_DUMP_TIMEOUT 1.0  // seconds a stats pipe reader gets to drain one snapshot
+
+enum pipe_metric {
+    PIPE_METRIC_MSGS_SENT,
+    PIPE_METRIC_BYTES_SENT,
+    PIPE_METRIC_MSGS_RECV,
+    PIPE_METRIC_BYTES_RECV,
+    PIPE_METRIC_WRITE_CALLS,
+    PIPE_METRIC_READ_CALLS,
+    PIPE_METRIC_EAGAIN,
+    PIPE_METRIC_PARTIAL_WRITES,
+    PIPE_METRIC_OPEN_RETRIES,
+    PIPE_METRIC_TIMEOUTS,
+    PIPE_METRIC_CORRUPT_BYTES,
+    PIPE_METRIC_COUNT
+};
+
+/**
+ * Totals for one pipe, summed over all threads at the time of the snapshot. `latency` is the
+ * send-to-ACK histogram: bucket k counts round trips below 2^(k + PIPE_METRICS_BUCKET_SHIFT) ns,
+ * the last bucket also holds everything above.
+ */
+typedef struct pipe_metrics_snapshot {
+    char name[PIPE_METRICS_NAME_MAX];
+    uint64_t counters[PIPE_METRIC_COUNT];
+    uint64_t latency[PIPE_METRICS_BUCKETS];
+    uint64_t latency_sum_ns;
+    uint64_t latency_count;
+} pipe_metrics_snapshot_t;
+
+int pipe_metrics_register(const char *name);
+void pipe_metrics_bind(int fd, int id);
+void pipe_metrics_bind_name(int fd, const char *name);
+void pipe_metrics_count(int id, enum pipe_metric metric, uint64_t value);
+void pipe_metrics_add(int fd, enum pipe_metric metric, uint64_t value);
+void pipe_metrics_observe(int fd, uint64_t latency_ns);
+int pipe_metrics_snapshot(pipe_metrics_snapshot_t *out, int max);
+int pipe_metrics_write_prometheus(int fd);
+int pipe_metrics_dump(const char *path);
+int pipe_metrics_export_start(const char *path, double interval);
+void pipe_metrics_export_stop(void);
+
+#endif
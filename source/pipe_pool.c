@@ -0,0 +1,346 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "pipe_pool.h"
+#include "pipe_log.h"
+
+#define POOL_LARGE -1
+#define CACHE_BYTES (256 * 1024)          // per thread and size class
+#define DEPOT_BYTES (8 * 1024 * 1024)     // shared, per size class
+
+/*
+ * Every buffer carries its header in front of the data the caller sees. While a buffer is free,
+ * `next` links it into a thread cache or a depot.
+ */
+struct pool_buf {
+    atomic_uint refs;
+    int cls;
+    size_t cap;
+    struct pool_buf *next;
+    char data[] __attribute__((aligned(16)));
+};
+
+struct pool_list {
+    struct pool_buf *head;
+    unsigned count;
+};
+
+struct pool_depot {
+    pthread_mutex_t lock;
+    struct pool_list list;
+};
+
+static struct pool_depot depots[PIPE_POOL_CLASSES] = {
+    [0 ... PIPE_POOL_CLASSES - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER },
+};
+static __thread struct pool_list caches[PIPE_POOL_CLASSES];
+static __thread bool cache_registered = false;
+
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+static atomic_bool pool_enabled = true;
+static atomic_uint_fast64_t pool_mallocs, pool_frees;
+
+static inline struct pool_buf *buf_of(const void *data) {
+    return (struct pool_buf *)((char *)data - offsetof(struct pool_buf, data));
+}
+
+static int size_class(size_t len) {
+    if (len <= (size_t)1 << PIPE_POOL_MIN_SHIFT) {
+        return 0;
+    }
+    int cls = 64 - __builtin_clzll(len - 1) - PIPE_POOL_MIN_SHIFT;
+    return cls < PIPE_POOL_CLASSES ? cls : POOL_LARGE;
+}
+
+static unsigned cache_limit(int cls) {
+    unsigned n = CACHE_BYTES >> (cls + PIPE_POOL_MIN_SHIFT);
+    return n < 2 ? 2 : n > 256 ? 256 : n;
+}
+
+static unsigned depot_limit(int cls) {
+    unsigned n = DEPOT_BYTES >> (cls + PIPE_POOL_MIN_SHIFT);
+    return n < 8 ? 8 : n;
+}
+
+static void release_to_system(struct pool_buf *b) {
+    while (b != NULL) {
+        struct pool_buf *next = b->next;
+        free(b);
+        atomic_fetch_add_explicit(&pool_frees, 1, memory_order_relaxed);
+        b = next;
+    }
+}
+
+/**
+ * Moves all but `keep` buffers of a thread cache to the depot, in one critical section. What the
+ * depot cannot hold goes back to the system.
+ */
+static void spill(int cls, unsigned keep) {
+    struct pool_list *c = &caches[cls];
+    struct pool_depot *d = &depots[cls];
+    struct pool_buf *excess = NULL;
+
+    pthread_mutex_lock(&d->lock);
+    while (c->count > keep) {
+        struct pool_buf *b = c->head;
+        c->head = b->next;
+        c->count--;
+        if (d->list.count < depot_limit(cls)) {
+            b->next = d->list.head;
+            d->list.head = b;
+            d->list.count++;
+        } else {
+            b->next = excess;
+            excess = b;
+        }
+    }
+    pthread_mutex_unlock(&d->lock);
+    release_to_system(excess);
+}
+
+static void flush_caches(void *arg) {
+    (void)arg;
+    cache_registered = false;
+    for (int cls = 0; cls < PIPE_POOL_CLASSES; cls++) {
+        spill(cls, 0);
+    }
+}
+
+static void create_cache_key(void) {
+    pthread_key_create(&cache_key, flush_caches);
+}
+
+/**
+ * Arranges for the caches of the calling thread to be handed to the depots when it exits.
+ */
+static void register_cache(void) {
+    pthread_once(&cache_key_once, create_cache_key);
+    pthread_setspecific(cache_key, caches);
+    cache_registered = true;
+}
+
+/**
+ * Takes a buffer from the thread cache, refilling the cache with up to half its limit from the
+ * depot when it is empty, so a thread that only allocates takes the depot lock once per batch.
+ */
+static struct pool_buf *cache_pop(int cls) {
+    struct pool_list *c = &caches[cls];
+    struct pool_buf *b;
+
+    if (c->head == NULL) {
+        struct pool_depot *d = &depots[cls];
+        unsigned want = cache_limit(cls) / 2;
+
+        if (!cache_registered) {
+            register_cache();
+        }
+        pthread_mutex_lock(&d->lock);
+        while (c->count < want && d->list.head != NULL) {
+            b = d->list.head;
+            d->list.head = b->next;
+            d->list.count--;
+            b->next = c->head;
+            c->head = b;
+            c->count++;
+        }
+        pthread_mutex_unlock(&d->lock);
+        if (c->head == NULL) {
+            return NULL;
+        }
+    }
+    b = c->head;
+    c->head = b->next;
+    c->count--;
+    return b;
+}
+
+/**
+ * Returns a free buffer to the thread cache, handing half of the cache to the depot once it is
+ * over its limit. A buffer freed on another thread than the one that allocated it, the common
+ * case of a request passed from the reader to a worker, flows back to the reader through the
+ * depot.
+ */
+static void cache_push(struct pool_buf *b) {
+    struct pool_list *c = &caches[b->cls];
+
+    if (!cache_registered) {
+        register_cache();
+    }
+    b->next = c->head;
+    c->head = b;
+    if (++c->count > cache_limit(b->cls)) {
+        spill(b->cls, cache_limit(b->cls) / 2);
+    }
+}
+
+/**
+ * Allocates a reference counted message buffer. Sizes up to 1 MiB are rounded up to a power of two
+ * and served from a per-thread cache of released buffers, so steady state traffic does not reach
+ * malloc() at all. The buffer starts with one reference and is released with pipe_pool_put().
+ *
+ * @param len The number of bytes needed.
+ * @return The buffer, 16 byte aligned and at least `len` bytes long, or NULL on error.
+ * @throws If the allocation fails, an appropriate error message will be printed to stderr.
+ */
+void *pipe_pool_alloc(size_t len) {
+    int cls = size_class(len);
+    struct pool_buf *b = NULL;
+
+    if (cls != POOL_LARGE && atomic_load_explicit(&pool_enabled, memory_order_relaxed)) {
+        b = cache_pop(cls);
+    }
+    if (b == NULL) {
+        size_t cap = cls == POOL_LARGE ? len : (size_t)1 << (cls + PIPE_POOL_MIN_SHIFT);
+
+        b = malloc(sizeof(*b) + cap);
+        if (b == NULL) {
+            pipe_log(PIPE_LOG_ERROR, "Error allocating message buffer: %s\n", strerror(errno));
+            return NULL;
+        }
+        atomic_fetch_add_explicit(&pool_mallocs, 1, memory_order_relaxed);
+        b->cls = cls;
+        b->cap = cap;
+    }
+    atomic_store_explicit(&b->refs, 1, memory_order_relaxed);
+    return b->data;
+}
+
+/**
+ * Takes another reference to a buffer, e.g. to hand it to a worker while keeping it.
+ *
+ * @param buf A buffer returned by pipe_pool_alloc().
+ * @return `buf`.
+ */
+void *pipe_pool_ref(void *buf) {
+    atomic_fetch_add_explicit(&buf_of(buf)->refs, 1, memory_order_relaxed);
+    return buf;
+}
+
+/**
+ * Drops a reference to a buffer. The last one returns it to the calling thread's cache.
+ *
+ * @param buf A buffer returned by pipe_pool_alloc(), or NULL.
+ */
+void pipe_pool_put(void *buf) {
+    struct pool_buf *b;
+
+    if (buf == NULL) {
+        return;
+    }
+    b = buf_of(buf);
+    if (atomic_fetch_sub_explicit(&b->refs, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+    if (b->cls == POOL_LARGE || !atomic_load_explicit(&pool_enabled, memory_order_relaxed)) {
+        b->next = NULL;
+        release_to_system(b);
+        return;
+    }
+    cache_push(b);
+}
+
+/**
+ * Makes a buffer at least `len` bytes long, like realloc() but copying only the first `keep`
+ * bytes. A buffer that is already large enough is returned as it is.
+ *
+ * @param buf A buffer returned by pipe_pool_alloc(), or NULL.
+ * @param keep The number of leading bytes to preserve.
+ * @param len The number of bytes needed.
+ * @return The buffer, or NULL on error, in which case `buf` is left untouched.
+ */
+void *pipe_pool_grow(void *buf, size_t keep, size_t len) {
+    char *grown;
+
+    if (buf != NULL && buf_of(buf)->cap >= len) {
+        return buf;
+    }
+    if ((grown = pipe_pool_alloc(len)) == NULL) {
+        return NULL;
+    }
+    if (buf != NULL) {
+        memcpy(grown, buf, keep);
+        pipe_pool_put(buf);
+    }
+    return grown;
+}
+
+/**
+ * Returns the usable size of a buffer, which may exceed what was asked for.
+ */
+size_t pipe_pool_cap(const void *buf) {
+    return buf_of(buf)->cap;
+}
+
+/**
+ * Tells whether references other than the caller's exist, in which case the bytes they may look
+ * at must not be overwritten.
+ */
+bool pipe_pool_shared(const void *buf) {
+    return atomic_load_explicit(&buf_of(buf)->refs, memory_order_acquire) > 1;
+}
+
+__attribute__((constructor)) static void read_pool_from_env(void) {
+    const char *env = getenv("PIPE_POOL");
+
+    if (env != NULL && strcmp(env, "off") == 0) {
+        atomic_store(&pool_enabled, false);
+    }
+}
+
+/**
+ * Turns caching on or off. With caching off every buffer comes from malloc() and goes back with
+ * free(), which is what the pool is measured against. The PIPE_POOL environment variable (on or
+ * off) sets the initial state.
+ *
+ * @param enabled Whether released buffers are kept for reuse.
+ */
+void pipe_pool_set_enabled(bool enabled) {
+    atomic_store(&pool_enabled, enabled);
+}
+
+/**
+ * Reads the pool counters.
+ *
+ * @param stats Receives the counters.
+ */
+void pipe_pool_get_stats(struct pipe_pool_stats *stats) {
+    stats->mallocs = atomic_load_explicit(&pool_mallocs, memory_order_relaxed);
+    stats->frees = atomic_load_explicit(&pool_frees, memory_order_relaxed);
+    stats->cached = 0;
+    for (int cls = 0; cls < PIPE_POOL_CLASSES; cls++) {
+        pthread_mutex_lock(&depots[cls].lock);
+        stats->cached += depots[cls].list.count;
+        pthread_mutex_unlock(&depots[cls].lock);
+    }
+}
@@ -0,0 +1,55 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PIPE_POOL_H
+#define PIPE_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PIPE_POOL_MIN_SHIFT 6
+#define PIPE_POOL_CLASSES 15   // 64 bytes to 1 MiB in powers of two, larger buffers bypass the pool
+
+/**
+ * Counters of the pool as a whole. `mallocs` and `frees` count the buffers obtained from and
+ * returned to the system allocator, so under steady load both stop growing.
+ */
+struct pipe_pool_stats {
+    uint64_t mallocs;
+    uint64_t frees;
+    uint64_t cached;     // buffers parked in the shared depots, not counting per-thread caches
+};
+
+void *pipe_pool_alloc(size_t len);
+void *pipe_pool_ref(void *buf);
+void pipe_pool_put(void *buf);
+void *pipe_pool_grow(void *buf, size_t keep, size_t len);
+size_t pipe_pool_cap(const void *buf);
+bool pipe_pool_shared(const void *buf);
+
+void pipe_pool_set_enabled(bool enabled);
+void pipe_pool_get_stats(struct pipe_pool_stats *stats);
+
+#endif
@@ -0,0 +1,971 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#include "pipe_handler.h"
+#include "pipe_pubsub.h"
+#include "pipe_log.h"
+#include "pipe_metrics.h"
+#include "pipe_messages.h"
+#include "pipe_time.h"
+
+#define SCRATCH_SIZE (64 * 1024)
+#define DEFAULT_MAX_QUEUE (1 << 20)
+#define CONTROL_MSG_MAX (2 * PIPE_NAME_MAX + 64)
+
+/**
+ * A subscriber FIFO. Bytes the FIFO had no room for wait in `queue[qhead, qhead + qlen)` and are
+ * written out when the FIFO becomes writable; while anything is queued every later byte is
+ * queued behind it.
+ */
+struct pubsub_sub {
+    struct pubsub_sub *next;
+    struct pubsub_topic *topic;
+    pipe_broker_t *broker;
+    int fd;
+    int policy;
+    size_t max_queue;
+    bool skip;      // not taking part in the message in flight
+    bool dead;
+    size_t took;    // bytes of the current chunk passed on by tee()
+    char *queue;
+    size_t qhead;
+    size_t qlen;
+    size_t qcap;
+    uint64_t delivered;
+    uint64_t dropped;
+    char name[PIPE_NAME_MAX];
+};
+
+/**
+ * A publisher FIFO. `hdr` is the header of the message being fanned out, `remaining` the
+ * payload bytes of it still in the FIFO. A paused publisher is not registered with the reactor.
+ */
+struct pubsub_pub {
+    struct pubsub_pub *next;
+    struct pubsub_topic *topic;
+    pipe_broker_t *broker;
+    int fd;
+    bool paused;
+    bool started;
+    struct pipe_frame_hdr hdr;
+    size_t hdr_got;
+    size_t remaining;
+    char name[PIPE_NAME_MAX];
+};
+
+/**
+ * Messages of one topic are fanned out one at a time, `active` is the publisher whose message
+ * is in flight.
+ */
+struct pubsub_topic {
+    struct pubsub_topic *next;
+    struct pubsub_sub *subs;
+    struct pubsub_pub *pubs;
+    struct pubsub_pub *active;
+    char name[PIPE_NAME_MAX];
+};
+
+static void on_pub_event(int fd, uint32_t events, void *arg);
+
+static int copy_name(char *out, struct pipe_bytes b) {
+    if (b.len == 0 || b.len >= PIPE_NAME_MAX || memchr(b.ptr, '\0', b.len) != NULL) {
+        return -1;
+    }
+    memcpy(out, b.ptr, b.len);
+    out[b.len] = '\0';
+    return 0;
+}
+
+static struct pubsub_topic *find_topic(pipe_broker_t *b, const char *name, bool create) {
+    struct pubsub_topic *t;
+
+    for (t = b->topics; t != NULL; t = t->next) {
+        if (strcmp(t->name, name) == 0) {
+            return t;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+    t = calloc(1, sizeof(*t));
+    if (t == NULL) {
+        pipe_log(PIPE_LOG_ERROR, "Error allocating topic: %s\n", strerror(errno));
+        return NULL;
+    }
+    snprintf(t->name, PIPE_NAME_MAX, "%s", name);
+    t->next = b->topics;
+    b->topics = t;
+    return t;
+}
+
+static void pub_pause(struct pubsub_pub *pub) {
+    if (!pub->paused) {
+        pipe_reactor_del(&pub->broker->reactor, pub->fd);
+        pub->paused = true;
+    }
+}
+
+static void pub_resume(struct pubsub_pub *pub) {
+    if (pub->paused && pipe_reactor_add(&pub->broker->reactor, pub->fd, PIPE_EV_IN, on_pub_event, pub) == 0) {
+        pub->paused = false;
+    }
+}
+
+static void topic_resume(struct pubsub_topic *t) {
+    for (struct pubsub_pub *pub = t->pubs; pub != NULL; pub = pub->next) {
+        pub_resume(pub);
+    }
+}
+
+/**
+ * Appends to a subscriber's queue, compacting or growing it as needed.
+ */
+static int sub_enqueue(struct pubsub_sub *sub, const void *data, size_t len) {
+    if (sub->qhead + sub->qlen + len > sub->qcap) {
+        if (sub->qhead > 0) {
+            memmove(sub->queue, sub->queue + sub->qhead, sub->qlen);
+            sub->qhead = 0;
+        }
+        if (sub->qlen + len > sub->qcap) {
+            size_t cap = sub->qcap ? sub->qcap : SCRATCH_SIZE;
+            while (cap < sub->qlen + len) {
+                cap *= 2;
+            }
+            char *queue = realloc(sub->queue, cap);
+            if (queue == NULL) {
+                pipe_log(PIPE_LOG_ERROR, "Error growing subscriber queue: %s\n", strerror(errno));
+                return -1;
+            }
+            sub->queue = queue;
+            sub->qcap = cap;
+        }
+    }
+    if (sub->qlen == 0 && pipe_reactor_mod(&sub->broker->reactor, sub->fd, PIPE_EV_OUT) == -1) {
+        return -1;
+    }
+    memcpy(sub->queue + sub->qhead + sub->qlen, data, len);
+    sub->qlen += len;
+    return 0;
+}
+
+/**
+ * Writes to a subscriber FIFO, queueing whatever does not fit.
+ */
+static void sub_write(struct pubsub_sub *sub, const char *data, size_t len) {
+    if (sub->qlen == 0) {
+        ssize_t n = write(sub->fd, data, len);
+        if (n == -1 && errno != EAGAIN) {
+            sub->dead = true;
+            return;
+        }
+        if (n > 0) {
+            data += n;
+            len -= n;
+        }
+    }
+    if (len > 0 && sub_enqueue(sub, data, len) == -1) {
+        sub->dead = true;
+    }
+}
+
+static void sub_free(struct pubsub_sub *sub) {
+    pipe_log(PIPE_LOG_INFO, "Unsubscribed %s from %s after %" PRIu64 " messages, %" PRIu64 " dropped\n", sub->name, sub->topic->name,
+             sub->delivered, sub->dropped);
+    pipe_reactor_del(&sub->broker->reactor, sub->fd);
+    close(sub->fd);
+    free(sub->queue);
+    free(sub);
+}
+
+/**
+ * Removes the subscribers that went away or were unsubscribed, and lets publishers held back
+ * by them continue.
+ */
+static void topic_reap(struct pubsub_topic *t) {
+    struct pubsub_sub **link = &t->subs;
+    bool removed = false;
+
+    while (*link != NULL) {
+        struct pubsub_sub *sub = *link;
+        if (sub->dead) {
+            *link = sub->next;
+            sub_free(sub);
+            removed = true;
+        } else {
+            link = &sub->next;
+        }
+    }
+    if (removed) {
+        topic_resume(t);
+    }
+}
+
+static void on_sub_event(int fd, uint32_t events, void *arg) {
+    struct pubsub_sub *sub = arg;
+    struct pubsub_topic *t = sub->topic;
+
+    if (events & (PIPE_EV_ERR | PIPE_EV_HUP)) {
+        sub->dead = true;
+    }
+    while (!sub->dead && sub->qlen > 0) {
+        ssize_t n = write(fd, sub->queue + sub->qhead, sub->qlen);
+        if (n > 0) {
+            sub->qhead += n;
+            sub->qlen -= n;
+        } else if (errno == EAGAIN) {
+            break;
+        } else if (errno != EINTR) {
+            sub->dead = true;
+        }
+    }
+    if (!sub->dead && sub->qlen == 0) {
+        sub->qhead = 0;
+        pipe_reactor_mod(&sub->broker->reactor, fd, 0);
+        topic_resume(t);
+    }
+    topic_reap(t);
+}
+
+static bool sub_over_limit(const struct pubsub_sub *sub, size_t size) {
+    return sub->qlen > 0 && sub->qlen + size > sub->max_queue;
+}
+
+/**
+ * Starts fanning out the message whose header was just read, or pauses the publisher when a
+ * blocking subscriber has no room for it.
+ *
+ * @return true if the message was started.
+ */
+static bool pub_begin(struct pubsub_pub *pub) {
+    pipe_broker_t *b = pub->broker;
+    size_t size = PIPE_FRAME_HDR_SIZE + pub->hdr.len;
+
+    for (struct pubsub_sub *sub = pub->topic->subs; sub != NULL; sub = sub->next) {
+        if (!sub->dead && sub->policy == PIPE_PUBSUB_BLOCK && sub_over_limit(sub, size)) {
+            pub_pause(pub);
+            return false;
+        }
+    }
+
+    for (struct pubsub_sub *sub = pub->topic->subs; sub != NULL; sub = sub->next) {
+        sub->skip = sub->dead || sub_over_limit(sub, size);
+        if (sub->skip) {
+            sub->dropped += !sub->dead;
+            b->dropped += !sub->dead;
+            continue;
+        }
+        sub_write(sub, (const char *)&pub->hdr, PIPE_FRAME_HDR_SIZE);
+        sub->delivered++;
+        b->delivered++;
+        pipe_metrics_add(sub->fd, PIPE_METRIC_MSGS_SENT, 1);
+        pipe_metrics_add(sub->fd, PIPE_METRIC_BYTES_SENT, size);
+    }
+    pipe_metrics_add(pub->fd, PIPE_METRIC_MSGS_RECV, 1);
+    b->published++;
+    pub->started = true;
+    pub->remaining = pub->hdr.len;
+    return true;
+}
+
+/**
+ * Passes the next `chunk` bytes of the publisher FIFO to every subscriber taking part in the
+ * message. Subscribers with an empty queue get them with tee(); if any of them is short, the
+ * chunk is read once and the missing tails are written or queued, otherwise it is discarded
+ * into /dev/null without being copied.
+ */
+static int pub_fan_out(struct pubsub_pub *pub, size_t chunk) {
+    pipe_broker_t *b = pub->broker;
+    bool need_copy = false;
+    ssize_t n;
+
+    for (struct pubsub_sub *sub = pub->topic->subs; sub != NULL; sub = sub->next) {
+        if (sub->skip || sub->dead) {
+            continue;
+        }
+        sub->took = 0;
+        if (!b->cfg.copy && sub->qlen == 0) {
+            n = tee(pub->fd, sub->fd, chunk, SPLICE_F_NONBLOCK);
+            if (n > 0) {
+                sub->took = n;
+            } else if (n == -1 && errno == EPIPE) {
+                sub->dead = true;
+                continue;
+            } else if (n == -1 && (errno == EINVAL || errno == ENOSYS)) {
+                pipe_log(PIPE_LOG_INFO, "tee() is not supported, copying messages instead\n");
+                b->cfg.copy = true;
+            }
+        }
+        need_copy |= sub->took < chunk;
+    }
+
+    if (!need_copy) {
+        n = splice(pub->fd, NULL, b->null_fd, NULL, chunk, SPLICE_F_NONBLOCK);
+        if (n == (ssize_t)chunk) {
+            pub->remaining -= chunk;
+            return 0;
+        }
+        if (n > 0) {
+            // cannot happen with the data already buffered, but the stream must stay in step
+            pub->remaining -= n;
+            chunk -= n;
+        }
+    }
+
+    n = read(pub->fd, b->scratch, chunk);
+    if (n != (ssize_t)chunk) {
+        pipe_log(PIPE_LOG_ERROR, "Error reading from publisher %s: %s\n", pub->name,
+                 n == -1 ? strerror(errno) : "short read");
+        return -1;
+    }
+    for (struct pubsub_sub *sub = pub->topic->subs; sub != NULL; sub = sub->next) {
+        if (!sub->skip && !sub->dead && sub->took < chunk) {
+            sub_write(sub, b->scratch + sub->took, chunk - sub->took);
+        }
+    }
+    pub->remaining -= chunk;
+    return 0;
+}
+
+static void pub_end(struct pubsub_pub *pub) {
+    pub->started = false;
+    pub->hdr_got = 0;
+    pub->topic->active = NULL;
+    topic_resume(pub->topic);
+}
+
+static void pub_remove(struct pubsub_pub *pub) {
+    struct pubsub_topic *t = pub->topic;
+    struct pubsub_pub **link = &t->pubs;
+
+    if (pub->started) {
+        // the subscribers already have the header, pad the message so their streams stay framed
+        pipe_log(PIPE_LOG_WARN, "Publisher %s went away in the middle of a message\n", pub->name);
+        memset(pub->broker->scratch, 0, SCRATCH_SIZE);
+        while (pub->remaining > 0) {
+            size_t chunk = pub->remaining < SCRATCH_SIZE ? pub->remaining : SCRATCH_SIZE;
+            for (struct pubsub_sub *sub = t->subs; sub != NULL; sub = sub->next) {
+                if (!sub->skip && !sub->dead) {
+                    sub_write(sub, pub->broker->scratch, chunk);
+                }
+            }
+            pub->remaining -= chunk;
+        }
+    }
+    if (t->active == pub) {
+        pub_end(pub);
+    }
+    while (*link != pub) {
+        link = &(*link)->next;
+    }
+    *link = pub->next;
+
+    pipe_log(PIPE_LOG_INFO, "Publisher %s on %s closed\n", pub->name, t->name);
+    if (!pub->paused) {
+        pipe_reactor_del(&pub->broker->reactor, pub->fd);
+    }
+    close(pub->fd);
+    free(pub);
+    topic_reap(t);
+}
+
+static void on_pub_event(int fd, uint32_t events, void *arg) {
+    struct pubsub_pub *pub = arg;
+    struct pubsub_topic *t = pub->topic;
+    ssize_t n;
+
+    while (!pipe_reactor_stopped(&pub->broker->reactor)) {
+        if (!pub->started) {
+            // another publisher of the topic is half way through a message
+            if (t->active != NULL && t->active != pub) {
+                pub_pause(pub);
+                return;
+            }
+            if (pub->hdr_got < PIPE_FRAME_HDR_SIZE) {
+                n = read(fd, (char *)&pub->hdr + pub->hdr_got, PIPE_FRAME_HDR_SIZE - pub->hdr_got);
+                if (n == 0 || (n == -1 && errno != EAGAIN && errno != EINTR)) {
+                    pub_remove(pub);
+                    return;
+                }
+                if (n == -1) {
+                    if (errno == EAGAIN) {
+                        return;
+                    }
+                    continue;
+                }
+                pub->hdr_got += n;
+                t->active = pub;
+                if (pub->hdr_got < PIPE_FRAME_HDR_SIZE) {
+                    continue;
+                }
+                if (pub->hdr.len > PIPE_FRAME_MAX_LEN) {
+                    pipe_log(PIPE_LOG_ERROR, "Invalid frame length %u from publisher %s\n", pub->hdr.len, pub->name);
+                    pub_remove(pub);
+                    return;
+                }
+            }
+            if (!pub_begin(pub)) {
+                return;
+            }
+        }
+
+        if (pub->remaining > 0) {
+            int avail = 0;
+            ioctl(fd, FIONREAD, &avail);
+            if (avail <= 0) {
+                if (events & PIPE_EV_HUP) {
+                    pub_remove(pub);
+                }
+                return;
+            }
+            size_t chunk = pub->remaining;
+            if (chunk > (size_t)avail) {
+                chunk = avail;
+            }
+            if (chunk > SCRATCH_SIZE) {
+                chunk = SCRATCH_SIZE;
+            }
+            if (pub_fan_out(pub, chunk) == -1) {
+                pub_remove(pub);
+                return;
+            }
+            topic_reap(t);
+            continue;
+        }
+        pub_end(pub);
+    }
+}
+
+/**
+ * Binds a private FIFO to the metrics of its role, e.g. "<broker>.sub", so that the FIFOs of all
+ * processes and connections are counted together instead of one id per pid.
+ */
+static void bind_role(int fd, const char *broker_name, const char *role) {
+    char name[PIPE_NAME_MAX];
+
+    snprintf(name, sizeof(name), "%s.%s", broker_name, role);
+    pipe_metrics_bind_name(fd, name);
+}
+
+static void add_subscriber(pipe_broker_t *b, const struct pipe_msg_subscribe_view *req) {
+    char topic_name[PIPE_NAME_MAX], fifo[PIPE_NAME_MAX];
+    struct pipe_frame_hdr ack;
+    struct pubsub_topic *t;
+    struct pubsub_sub *sub;
+    int fd;
+
+    if (copy_name(topic_name, req->topic) == -1 || copy_name(fifo, req->fifo) == -1) {
+        pipe_log(PIPE_LOG_WARN, "Ignoring subscription with an invalid topic or pipe name\n");
+        return;
+    }
+    for (t = b->topics; t != NULL; t = t->next) {
+        for (sub = t->subs; sub != NULL; sub = sub->next) {
+            if (strcmp(sub->name, fifo) == 0) {
+                pipe_log(PIPE_LOG_WARN, "%s is already subscribed to %s\n", fifo, t->name);
+                return;
+            }
+        }
+    }
+    t = find_topic(b, topic_name, true);
+    if (t == NULL) {
+        return;
+    }
+
+    // the subscriber created the FIFO and is reading it; the name is the subscriber's choice, so
+    // only a FIFO of the broker's own user is accepted
+    fd = open_peer_pipe(fifo);
+    if (fd == -1) {
+        pipe_log(PIPE_LOG_WARN, "Not subscribing %s to %s: %s\n", fifo, topic_name, strerror(errno));
+        return;
+    }
+    bind_role(fd, b->cfg.name, "sub");
+    if (b->cfg.capacity > 0) {
+        set_pipe_capacity(fd, b->cfg.capacity);
+    }
+
+    sub = calloc(1, sizeof(*sub));
+    if (sub == NULL) {
+        pipe_log(PIPE_LOG_ERROR, "Error allocating subscriber: %s\n", strerror(errno));
+        close(fd);
+        return;
+    }
+    sub->topic = t;
+    sub->broker = b;
+    sub->fd = fd;
+    sub->policy = (req->present & PIPE_MSG_SUBSCRIBE_HAS_POLICY) ? req->policy : b->cfg.policy;
+    sub->max_queue = (req->present & PIPE_MSG_SUBSCRIBE_HAS_MAX_QUEUE) && req->max_queue > 0 ? req->max_queue
+                                                                                              : b->cfg.max_queue;
+    // joining half way through a message, start with the next one
+    sub->skip = t->active != NULL && t->active->started;
+    snprintf(sub->name, PIPE_NAME_MAX, "%s", fifo);
+    if (pipe_reactor_add(&b->reactor, fd, 0, on_sub_event, sub) == -1) {
+        close(fd);
+        free(sub);
+        return;
+    }
+    sub->next = t->subs;
+    t->subs = sub;
+
+    // the ACK tells pipe_subscriber_open() that every later message will be delivered
+    memset(&ack, 0, sizeof(ack));
+    ack.type = PIPE_MSG_ACK;
+    sub_write(sub, (const char *)&ack, sizeof(ack));
+    pipe_log(PIPE_LOG_INFO, "Subscribed %s to %s\n", fifo, topic_name);
+    topic_reap(t);
+}
+
+static void remove_subscriber(pipe_broker_t *b, const struct pipe_msg_unsubscribe_view *req) {
+    char topic_name[PIPE_NAME_MAX], fifo[PIPE_NAME_MAX];
+    struct pubsub_topic *t;
+
+    if (copy_name(topic_name, req->topic) == -1 || copy_name(fifo, req->fifo) == -1 ||
+        (t = find_topic(b, topic_name, false)) == NULL) {
+        return;
+    }
+    for (struct pubsub_sub *sub = t->subs; sub != NULL; sub = sub->next) {
+        if (strcmp(sub->name, fifo) == 0) {
+            sub->dead = true;
+        }
+    }
+    topic_reap(t);
+}
+
+static void add_publisher(pipe_broker_t *b, const struct pipe_msg_advertise_view *req) {
+    char topic_name[PIPE_NAME_MAX], fifo[PIPE_NAME_MAX];
+    struct pubsub_topic *t;
+    struct pubsub_pub *pub;
+    int fd;
+
+    if (copy_name(topic_name, req->topic) == -1 || copy_name(fifo, req->fifo) == -1) {
+        pipe_log(PIPE_LOG_WARN, "Ignoring publisher with an invalid topic or pipe name\n");
+        return;
+    }
+    t = find_topic(b, topic_name, true);
+    if (t == NULL) {
+        return;
+    }
+    fd = open(fifo, O_RDONLY | O_NONBLOCK);
+    if (fd == -1) {
+        pipe_log(PIPE_LOG_WARN, "Error opening publisher pipe %s: %s\n", fifo, strerror(errno));
+        return;
+    }
+    bind_role(fd, b->cfg.name, "pub");
+
+    pub = calloc(1, sizeof(*pub));
+    if (pub == NULL) {
+        pipe_log(PIPE_LOG_ERROR, "Error allocating publisher: %s\n", strerror(errno));
+        close(fd);
+        return;
+    }
+    pub->topic = t;
+    pub->broker = b;
+    pub->fd = fd;
+    snprintf(pub->name, PIPE_NAME_MAX, "%s", fifo);
+    if (pipe_reactor_add(&b->reactor, fd, PIPE_EV_IN, on_pub_event, pub) == -1) {
+        close(fd);
+        free(pub);
+        return;
+    }
+    pub->next = t->pubs;
+    t->pubs = pub;
+    pipe_log(PIPE_LOG_INFO, "Publisher %s on %s\n", fifo, topic_name);
+}
+
+static void on_control_frame(pipe_broker_t *b, const struct pipe_frame *frame) {
+    union {
+        struct pipe_msg_subscribe_view subscribe;
+        struct pipe_msg_unsubscribe_view unsubscribe;
+        struct pipe_msg_advertise_view advertise;
+    } v;
+
+    if (frame->hdr.type != PIPE_MSG_TYPED) {
+        pipe_log(PIPE_LOG_WARN, "Ignoring message of type %u on the broker pipe\n", frame->hdr.type);
+        return;
+    }
+    switch (pipe_codec_msg_id(frame->payload, frame->hdr.len)) {
+    case PIPE_MSG_SUBSCRIBE_ID:
+        if (pipe_msg_subscribe_decode(&v.subscribe, frame->payload, frame->hdr.len) == 0) {
+            add_subscriber(b, &v.subscribe);
+            return;
+        }
+        break;
+    case PIPE_MSG_UNSUBSCRIBE_ID:
+        if (pipe_msg_unsubscribe_decode(&v.unsubscribe, frame->payload, frame->hdr.len) == 0) {
+            remove_subscriber(b, &v.unsubscribe);
+            return;
+        }
+        break;
+    case PIPE_MSG_ADVERTISE_ID:
+        if (pipe_msg_advertise_decode(&v.advertise, frame->payload, frame->hdr.len) == 0) {
+            add_publisher(b, &v.advertise);
+            return;
+        }
+        break;
+    }
+    pipe_log(PIPE_LOG_WARN, "Ignoring malformed request on the broker pipe\n");
+}
+
+static void on_control(int fd, uint32_t events, void *arg) {
+    pipe_broker_t *b = arg;
+    struct pipe_frame frame;
+    int ret;
+
+    (void)events;
+    while (!pipe_reactor_stopped(&b->reactor)) {
+        ssize_t num_read = pipe_frame_reader_fill(&b->reader, fd);
+        if (num_read <= 0) {
+            if (num_read == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                pipe_reactor_stop(&b->reactor);
+            }
+            break;
+        }
+        while ((ret = pipe_frame_next(&b->reader, &frame)) == 1) {
+            pipe_metrics_add(fd, PIPE_METRIC_MSGS_RECV, 1);
+            on_control_frame(b, &frame);
+        }
+        if (ret == -1) {
+            pipe_reactor_stop(&b->reactor);
+            break;
+        }
+    }
+}
+
+/**
+ * Initializes a broker and opens its control pipe. A subscriber that goes away shows up as EPIPE
+ * on its FIFO, callers should ignore SIGPIPE instead of being terminated.
+ *
+ * @param b The broker to initialize.
+ * @param cfg The configuration, copied into the broker. `name` must outlive the broker.
+ * @return 0 on success, or -1 on error.
+ * @throws If the pipe, the reactor or the buffers cannot be set up, an appropriate error message will be printed to stderr.
+ */
+int pipe_broker_init(pipe_broker_t *b, const pipe_broker_config_t *cfg) {
+    memset(b, 0, sizeof(*b));
+    b->cfg = *cfg;
+    b->fd = b->keepalive_fd = b->null_fd = -1;
+    if (b->cfg.max_queue == 0) {
+        b->cfg.max_queue = DEFAULT_MAX_QUEUE;
+    }
+    if (b->cfg.policy != PIPE_PUBSUB_BLOCK) {
+        b->cfg.policy = PIPE_PUBSUB_DROP;
+    }
+
+    if (pipe_reactor_init(&b->reactor) == -1) {
+        return -1;
+    }
+    b->scratch = malloc(SCRATCH_SIZE);
+    if (b->scratch == NULL || pipe_frame_reader_init(&b->reader, 0) == -1) {
+        pipe_log(PIPE_LOG_ERROR, "Error allocating broker buffers: %s\n", strerror(errno));
+        pipe_broker_destroy(b);
+        return -1;
+    }
+    b->null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (b->null_fd == -1) {
+        pipe_log(PIPE_LOG_ERROR, "Error opening /dev/null: %s\n", strerror(errno));
+        pipe_broker_destroy(b);
+        return -1;
+    }
+    b->fd = open_pipe_persistent(b->cfg.name, &b->keepalive_fd);
+    if (b->fd == -1) {
+        pipe_broker_destroy(b);
+        return -1;
+    }
+    return pipe_reactor_add(&b->reactor, b->fd, PIPE_EV_IN, on_control, b);
+}
+
+/**
+ * Runs the broker on the calling thread until `pipe_broker_stop()` is called.
+ *
+ * @param b The broker.
+ * @return 0 when stopped, or -1 on error.
+ */
+int pipe_broker_run(pipe_broker_t *b) {
+    return pipe_reactor_run(&b->reactor);
+}
+
+/**
+ * Asks a running broker to stop. Safe to call from another thread or a signal handler.
+ *
+ * @param b The broker.
+ */
+void pipe_broker_stop(pipe_broker_t *b) {
+    pipe_reactor_stop(&b->reactor);
+}
+
+/**
+ * Releases a broker that is not running, closing every publisher and subscriber pipe. Queued
+ * data that subscribers have not taken yet is lost.
+ *
+ * @param b The broker.
+ */
+void pipe_broker_destroy(pipe_broker_t *b) {
+    while (b->topics != NULL) {
+        struct pubsub_topic *t = b->topics;
+        b->topics = t->next;
+        while (t->pubs != NULL) {
+            struct pubsub_pub *pub = t->pubs;
+            t->pubs = pub->next;
+            close(pub->fd);
+            free(pub);
+        }
+        while (t->subs != NULL) {
+            struct pubsub_sub *sub = t->subs;
+            t->subs = sub->next;
+            close(sub->fd);
+            free(sub->queue);
+            free(sub);
+        }
+        free(t);
+    }
+    if (b->published > 0) {
+        pipe_log(PIPE_LOG_INFO, "Broker fanned out %" PRIu64 " messages into %" PRIu64 " deliveries, %" PRIu64 " dropped\n", b->published,
+                 b->delivered, b->dropped);
+    }
+    if (b->fd >= 0) {
+        close(b->fd);
+    }
+    if (b->keepalive_fd >= 0) {
+        close(b->keepalive_fd);
+    }
+    if (b->null_fd >= 0) {
+        close(b->null_fd);
+    }
+    b->fd = b->keepalive_fd = b->null_fd = -1;
+    free(b->scratch);
+    b->scratch = NULL;
+    pipe_frame_reader_free(&b->reader);
+    pipe_reactor_destroy(&b->reactor);
+}
+
+static int send_control(const char *broker_name, const void *buf, size_t len, uint64_t deadline) {
+    struct pipe_frame_hdr hdr;
+    int fd, ret;
+
+    fd = open_pipe_wait(broker_name, deadline);
+    if (fd == -1) {
+        return -1;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.len = (uint32_t)len;
+    hdr.type = PIPE_MSG_TYPED;
+    ret = pipe_frame_write(fd, &hdr, buf, deadline) == -1 ? -1 : 0;
+    close(fd);
+    return ret;
+}
+
+static void private_name(char *out, const char *broker_name, const char *role) {
+    static uint32_t next_id = 0;
+
+    snprintf(out, PIPE_NAME_MAX, "%s.%s.%d.%u", broker_name, role, (int)getpid(),
+             __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED));
+}
+
+/**
+ * Registers a publisher for `topic` with the broker. A private FIFO is created for it and
+ * removed again by `pipe_publisher_close()`.
+ *
+ * @param pub The publisher to initialize.
+ * @param broker_name The broker's control pipe, e.g. PIPE_BROKER_NAME.
+ * @param topic The topic to publish on.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds for the broker.
+ * @return 0 on success, or -1 on error or timeout.
+ * @throws If the pipe cannot be created or the broker does not answer, an appropriate error message will be printed to stderr.
+ */
+int pipe_publisher_open(pipe_publisher_t *pub, const char *broker_name, const char *topic, uint64_t deadline) {
+    char buf[CONTROL_MSG_MAX];
+    struct pipe_msg_advertise req;
+    ssize_t len;
+
+    memset(pub, 0, sizeof(*pub));
+    pub->fd = -1;
+    private_name(pub->name, broker_name, "pub");
+    req.topic = pipe_bytes_str(topic);
+    req.fifo = pipe_bytes_str(pub->name);
+    req.present = 0;
+    if (req.topic.len >= PIPE_NAME_MAX || (len = pipe_msg_advertise_encode(&req, buf, sizeof(buf))) == -1) {
+        pipe_log(PIPE_LOG_ERROR, "Topic name is too long: %s\n", topic);
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    if (mkfifo(pub->name, 0666) == -1 && errno != EEXIST) {
+        pipe_log(PIPE_LOG_ERROR, "Error creating named pipe: %s\n", strerror(errno));
+        return -1;
+    }
+    if (send_control(broker_name, buf, len, deadline) == 0) {
+        // the broker opens the read end once it has handled the request
+        pub->fd = open_pipe_wait(pub->name, deadline);
+    }
+    if (pub->fd == -1) {
+        unlink(pub->name);
+        return -1;
+    }
+    bind_role(pub->fd, broker_name, "pub");
+    return 0;
+}
+
+/**
+ * Publishes one message. The publisher FIFO has no other writer, so messages of any size are
+ * sent as a single frame.
+ *
+ * @param pub The publisher.
+ * @param buf The payload.
+ * @param len The payload length.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds for pipe capacity.
+ * @return The payload length, or -1 on error or timeout.
+ */
+int pipe_publisher_send(pipe_publisher_t *pub, const void *buf, size_t len, uint64_t deadline) {
+    struct pipe_frame_hdr hdr;
+
+    if (len > PIPE_FRAME_MAX_LEN) {
+        pipe_log(PIPE_LOG_ERROR, "Message of %zu bytes exceeds the frame limit\n", len);
+        errno = EMSGSIZE;
+        return -1;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.len = (uint32_t)len;
+    hdr.type = PIPE_MSG_DATA;
+    hdr.seq = pub->seq++;
+    if (pipe_frame_write(pub->fd, &hdr, buf, deadline) == -1) {
+        return -1;
+    }
+    return (int)len;
+}
+
+/**
+ * Closes a publisher and removes its FIFO. The broker finishes the messages already sent.
+ *
+ * @param pub The publisher.
+ */
+void pipe_publisher_close(pipe_publisher_t *pub) {
+    if (pub->fd >= 0) {
+        close(pub->fd);
+        pub->fd = -1;
+    }
+    unlink(pub->name);
+}
+
+/**
+ * Subscribes to `topic` and waits until the broker confirms; every message published after
+ * that is delivered in order, unless dropped under PIPE_PUBSUB_DROP.
+ *
+ * @param sub The subscriber to initialize.
+ * @param broker_name The broker's control pipe, e.g. PIPE_BROKER_NAME.
+ * @param topic The topic to subscribe to.
+ * @param policy PIPE_PUBSUB_DROP, PIPE_PUBSUB_BLOCK or PIPE_PUBSUB_DEFAULT for the broker's.
+ * @param max_queue The bytes the broker may hold back for this subscriber, 0 for the broker's default.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds for the broker.
+ * @return 0 on success, or -1 on error or timeout.
+ */
+int pipe_subscriber_open(pipe_subscriber_t *sub, const char *broker_name, const char *topic, int policy,
+                         size_t max_queue, uint64_t deadline) {
+    char name[PIPE_NAME_MAX], buf[CONTROL_MSG_MAX];
+    struct pipe_msg_subscribe req;
+    struct pipe_frame ack;
+    ssize_t len;
+
+    private_name(name, broker_name, "sub");
+    snprintf(sub->topic, PIPE_NAME_MAX, "%s", topic);
+    memset(&req, 0, sizeof(req));
+    req.topic = pipe_bytes_str(topic);
+    req.fifo = pipe_bytes_str(name);
+    if (policy != PIPE_PUBSUB_DEFAULT) {
+        req.present |= PIPE_MSG_SUBSCRIBE_HAS_POLICY;
+        req.policy = (uint8_t)policy;
+    }
+    if (max_queue > 0) {
+        req.present |= PIPE_MSG_SUBSCRIBE_HAS_MAX_QUEUE;
+        req.max_queue = max_queue > UINT32_MAX ? UINT32_MAX : (uint32_t)max_queue;
+    }
+    if (req.topic.len >= PIPE_NAME_MAX || (len = pipe_msg_subscribe_encode(&req, buf, sizeof(buf))) == -1) {
+        pipe_log(PIPE_LOG_ERROR, "Topic name is too long: %s\n", topic);
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    if (pipe_conn_open(&sub->conn, broker_name, name) == -1) {
+        return -1;
+    }
+    bind_role(sub->conn.rx_fd, broker_name, "sub");
+    if (pipe_conn_send_msg(&sub->conn, PIPE_MSG_TYPED, buf, len, deadline) == -1 ||
+        pipe_conn_recv_msg(&sub->conn, &ack, deadline) == -1) {
+        pipe_conn_close(&sub->conn);
+        unlink(name);
+        return -1;
+    }
+    if (ack.hdr.type != PIPE_MSG_ACK) {
+        pipe_log(PIPE_LOG_ERROR, "Unexpected message of type %u while subscribing\n", ack.hdr.type);
+        pipe_conn_close(&sub->conn);
+        unlink(name);
+        errno = EPROTO;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Receives the next message of the topic without copying it.
+ *
+ * @param sub The subscriber.
+ * @param msg Receives the message; its payload stays valid until the next receive.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds.
+ * @return The payload length, or -1 on error or timeout.
+ */
+int pipe_subscriber_recv(pipe_subscriber_t *sub, struct pipe_frame *msg, uint64_t deadline) {
+    return pipe_conn_recv_msg(&sub->conn, msg, deadline);
+}
+
+/**
+ * Unsubscribes, closes the connection and removes the subscriber's FIFO.
+ *
+ * @param sub The subscriber.
+ */
+void pipe_subscriber_close(pipe_subscriber_t *sub) {
+    char buf[CONTROL_MSG_MAX];
+    struct pipe_msg_unsubscribe req;
+    ssize_t len;
+
+    req.topic = pipe_bytes_str(sub->topic);
+    req.fifo = pipe_bytes_str(sub->conn.rx_name);
+    req.present = 0;
+    len = pipe_msg_unsubscribe_encode(&req, buf, sizeof(buf));
+    if (len > 0) {
+        pipe_conn_send_msg(&sub->conn, PIPE_MSG_TYPED, buf, len, pipe_deadline_from_timeout(0.1));
+    }
+    pipe_conn_close(&sub->conn);
+    unlink(sub->conn.rx_name);
+}
@@ -0,0 +1,110 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PIPE_PUBSUB_H
+#define PIPE_PUBSUB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pipe_conn.h"
+#include "pipe_frame.h"
+#include "pipe_reactor.h"
+
+#define PIPE_BROKER_NAME "/tmp/my_pipe_broker"
+
+// what the broker does with a message for a subscriber whose queue is full
+#define PIPE_PUBSUB_DEFAULT -1  // use the broker's policy
+#define PIPE_PUBSUB_DROP    0   // skip the message for that subscriber only
+#define PIPE_PUBSUB_BLOCK   1   // stop reading the publisher until the subscriber catches up
+
+struct pubsub_topic;
+
+typedef struct pipe_broker_config {
+    const char *name;   // the control pipe subscriptions and publishers are registered on
+    int policy;         // for subscribers that do not ask for one
+    size_t max_queue;   // bytes held back for a slow subscriber, for those that do not ask; 0 for 1 MiB
+    int capacity;       // FIFO capacity to ask for on subscriber pipes, 0 keeps the kernel default
+    bool copy;          // fan out with read()/write() instead of tee()/splice()
+} pipe_broker_config_t;
+
+/**
+ * Topic based fan-out broker. Subscribers and publishers register their own FIFOs on the control
+ * pipe and the broker holds them open. Each publisher FIFO is bound to one topic; every message
+ * read from it is duplicated into the subscriber FIFOs of that topic with tee(), so the payload
+ * stays in kernel pipe buffers, and then discarded with splice() into /dev/null.
+ *
+ * A subscriber whose FIFO is full gets the rest of the message copied into a queue that is
+ * drained as the FIFO empties. A message that would push a non-empty queue past its bound is
+ * either dropped for that subscriber or, under PIPE_PUBSUB_BLOCK, holds back the publisher until
+ * the queue drains; a single message larger than the bound still goes through an empty queue.
+ */
+typedef struct pipe_broker {
+    pipe_broker_config_t cfg;
+    pipe_reactor_t reactor;
+    pipe_frame_reader_t reader;
+    int fd;
+    int keepalive_fd;
+    int null_fd;
+    char *scratch;
+    struct pubsub_topic *topics;
+    uint64_t published;
+    uint64_t delivered;
+    uint64_t dropped;
+} pipe_broker_t;
+
+/**
+ * The producer side of a topic, a private FIFO into the broker.
+ */
+typedef struct pipe_publisher {
+    int fd;
+    uint32_t seq;
+    char name[PIPE_NAME_MAX];
+} pipe_publisher_t;
+
+/**
+ * A subscription, a connection that sends control requests to the broker and receives the
+ * topic's messages on a private FIFO.
+ */
+typedef struct pipe_subscriber {
+    pipe_conn_t conn;
+    char topic[PIPE_NAME_MAX];
+} pipe_subscriber_t;
+
+int pipe_broker_init(pipe_broker_t *b, const pipe_broker_config_t *cfg);
+int pipe_broker_run(pipe_broker_t *b);
+void pipe_broker_stop(pipe_broker_t *b);
+void pipe_broker_destroy(pipe_broker_t *b);
+
+int pipe_publisher_open(pipe_publisher_t *pub, const char *broker_name, const char *topic, uint64_t deadline);
+int pipe_publisher_send(pipe_publisher_t *pub, const void *buf, size_t len, uint64_t deadline);
+void pipe_publisher_close(pipe_publisher_t *pub);
+
+int pipe_subscriber_open(pipe_subscriber_t *sub, const char *broker_name, const char *topic, int policy,
+                         size_t max_queue, uint64_t deadline);
+int pipe_subscriber_recv(pipe_subscriber_t *sub, struct pipe_frame *msg, uint64_t deadline);
+void pipe_subscriber_close(pipe_subscriber_t *sub);
+
+#endif
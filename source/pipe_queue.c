@@ -0,0 +1,186 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <semaphore.h>
+
+#include "pipe_queue.h"
+#include "pipe_log.h"
+#include "pipe_time.h"
+
+/**
+ * Initializes a queue.
+ *
+ * @param q The queue to initialize.
+ * @param size The capacity, rounded up to a power of two.
+ * @return 0 on success, or -1 on error.
+ * @throws If the ring cannot be allocated, an appropriate error message will be printed to stderr.
+ */
+int pipe_queue_init(pipe_queue_t *q, size_t size) {
+    size_t n = 2;
+
+    while (n < size) {
+        n *= 2;
+    }
+    memset(q, 0, sizeof(*q));
+    q->cells = calloc(n, sizeof(*q->cells));
+    if (q->cells == NULL) {
+        pipe_log(PIPE_LOG_ERROR, "Error allocating queue: %s\n", strerror(errno));
+        return -1;
+    }
+    for (size_t i = 0; i < n; i++) {
+        q->cells[i].seq = i;
+    }
+    q->mask = n - 1;
+    sem_init(&q->items, 0, 0);
+    sem_init(&q->slots, 0, n);
+    return 0;
+}
+
+/**
+ * Releases a queue. Items still queued are not freed.
+ *
+ * @param q The queue.
+ */
+void pipe_queue_destroy(pipe_queue_t *q) {
+    sem_destroy(&q->items);
+    sem_destroy(&q->slots);
+    free(q->cells);
+    q->cells = NULL;
+}
+
+/**
+ * Appends an item without blocking. Only use this when not mixing with the blocking calls, or
+ * after having acquired a slot.
+ *
+ * @return true if the item was queued, false if the queue is full.
+ */
+bool pipe_queue_try_push(pipe_queue_t *q, void *item) {
+    size_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+
+    while (1) {
+        struct pipe_queue_cell *cell = &q->cells[pos & q->mask];
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, true, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                cell->item = item;
+                __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/**
+ * Removes the oldest item without blocking.
+ *
+ * @return true if an item was removed, false if the queue is empty.
+ */
+bool pipe_queue_try_pop(pipe_queue_t *q, void **item) {
+    size_t pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+
+    while (1) {
+        struct pipe_queue_cell *cell = &q->cells[pos & q->mask];
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1, true, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                *item = cell->item;
+                __atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/**
+ * Appends an item, waiting until `deadline` for a free slot.
+ *
+ * @param q The queue.
+ * @param item The item.
+ * @param deadline When to give up (see pipe_deadline_from_timeout()), PIPE_DEADLINE_NEVER to wait forever.
+ * @return 0 on success, or -1 with errno ETIMEDOUT if the queue stayed full.
+ */
+int pipe_queue_push(pipe_queue_t *q, void *item, uint64_t deadline) {
+    int ret;
+
+    if (deadline == PIPE_DEADLINE_NEVER) {
+        while ((ret = sem_wait(&q->slots)) == -1 && errno == EINTR) {
+        }
+    } else {
+        struct timespec ts = {
+            .tv_sec = (time_t)(deadline / PIPE_NSEC_PER_SEC),
+            .tv_nsec = (long)(deadline % PIPE_NSEC_PER_SEC),
+        };
+        while ((ret = sem_clockwait(&q->slots, CLOCK_MONOTONIC, &ts)) == -1 && errno == EINTR) {
+        }
+    }
+    if (ret == -1) {
+        return -1;
+    }
+
+    // holding a slot guarantees the ring has room
+    while (!pipe_queue_try_push(q, item)) {
+    }
+    sem_post(&q->items);
+    return 0;
+}
+
+/**
+ * Removes the oldest item, sleeping while the queue is empty.
+ *
+ * @param q The queue.
+ * @return The item.
+ */
+void *pipe_queue_pop(pipe_queue_t *q) {
+    void *item;
+
+    while (sem_wait(&q->items) == -1) {
+    }
+    while (!pipe_queue_try_pop(q, &item)) {
+    }
+    sem_post(&q->slots);
+    return item;
+}
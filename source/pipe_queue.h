@@ -0,0 +1,66 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PIPE_QUEUE_H
+#define PIPE_QUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <semaphore.h>
+
+#define PIPE_CACHELINE 64
+
+// seq, head and tail are only accessed through the __atomic builtins in pipe_queue.c, which keeps
+// this header free of <stdatomic.h> for C++ users
+struct pipe_queue_cell {
+    size_t seq;
+    void *item;
+};
+
+/**
+ * Bounded multi-producer multi-consumer queue of pointers.
+ *
+ * The ring itself is lock-free (one CAS per push or pop on a per-cell sequence number). The
+ * blocking calls layer two semaphores on top, `items` and `slots`, which only enter the kernel
+ * when a consumer has to sleep on an empty queue or a producer on a full one; that is how
+ * backpressure reaches the producer.
+ */
+typedef struct pipe_queue {
+    struct pipe_queue_cell *cells;
+    size_t mask;
+    _Alignas(PIPE_CACHELINE) size_t head;
+    _Alignas(PIPE_CACHELINE) size_t tail;
+    _Alignas(PIPE_CACHELINE) sem_t items;
+    sem_t slots;
+} pipe_queue_t;
+
+int pipe_queue_init(pipe_queue_t *q, size_t size);
+void pipe_queue_destroy(pipe_queue_t *q);
+bool pipe_queue_try_push(pipe_queue_t *q, void *item);
+bool pipe_queue_try_pop(pipe_queue_t *q, void **item);
+int pipe_queue_push(pipe_queue_t *q, void *item, uint64_t deadline);
+void *pipe_queue_pop(pipe_queue_t *q);
+
+#endif
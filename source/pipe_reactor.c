@@ -0,0 +1,297 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "pipe_reactor.h"
+#include "pipe_log.h"
+#include "pipe_time.h"
+
+/**
+ * Initializes an epoll based reactor.
+ *
+ * The reactor owns an eventfd that is registered alongside the user descriptors, so that
+ * `pipe_reactor_stop()` can interrupt a blocked `epoll_wait()` from another thread or a signal handler.
+ *
+ * @param r The reactor to initialize.
+ * @return 0 on success, or -1 on error.
+ * @throws If the epoll instance or the eventfd cannot be created, an appropriate error message will be printed to stderr.
+ */
+int pipe_reactor_init(pipe_reactor_t *r) {
+    struct epoll_event ev;
+
+    memset(r, 0, sizeof(*r));
+    pipe_timer_wheel_init(&r->timers);
+    r->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (r->epfd == -1) {
+        pipe_log(PIPE_LOG_ERROR, "Error creating epoll instance: %s\n", strerror(errno));
+        return -1;
+    }
+
+    r->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (r->wakefd == -1) {
+        pipe_log(PIPE_LOG_ERROR, "Error creating eventfd: %s\n", strerror(errno));
+        close(r->epfd);
+        return -1;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = r->wakefd;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->wakefd, &ev) == -1) {
+        pipe_log(PIPE_LOG_ERROR, "Error registering eventfd: %s\n", strerror(errno));
+        close(r->wakefd);
+        close(r->epfd);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Releases the resources held by a reactor. Registered descriptors are not closed.
+ *
+ * @param r The reactor to destroy.
+ */
+void pipe_reactor_destroy(pipe_reactor_t *r) {
+    if (r->wakefd >= 0) {
+        close(r->wakefd);
+    }
+    if (r->epfd >= 0) {
+        close(r->epfd);
+    }
+    free(r->watches);
+    r->watches = NULL;
+    r->nwatches = 0;
+    r->wakefd = r->epfd = -1;
+}
+
+static int reserve_watch(pipe_reactor_t *r, int fd) {
+    if (fd < r->nwatches) {
+        return 0;
+    }
+    int n = r->nwatches ? r->nwatches : 64;
+    while (n <= fd) {
+        n *= 2;
+    }
+    struct pipe_watch *w = realloc(r->watches, n * sizeof(*w));
+    if (w == NULL) {
+        pipe_log(PIPE_LOG_ERROR, "Error allocating reactor watch table: %s\n", strerror(errno));
+        return -1;
+    }
+    memset(w + r->nwatches, 0, (n - r->nwatches) * sizeof(*w));
+    r->watches = w;
+    r->nwatches = n;
+    return 0;
+}
+
+/**
+ * Registers a file descriptor with the reactor.
+ *
+ * @param r The reactor.
+ * @param fd The file descriptor to watch.
+ * @param events The events of interest (PIPE_EV_IN and/or PIPE_EV_OUT).
+ * @param cb The callback invoked when any of the events fire.
+ * @param arg An opaque pointer passed back to the callback.
+ * @return 0 on success, or -1 on error.
+ * @throws If the descriptor cannot be registered, an appropriate error message will be printed to stderr.
+ */
+int pipe_reactor_add(pipe_reactor_t *r, int fd, uint32_t events, pipe_event_cb cb, void *arg) {
+    struct epoll_event ev;
+
+    if (reserve_watch(r, fd) == -1) {
+        return -1;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        pipe_log(PIPE_LOG_ERROR, "Error adding fd %d to epoll: %s\n", fd, strerror(errno));
+        return -1;
+    }
+
+    r->watches[fd].cb = cb;
+    r->watches[fd].arg = arg;
+    return 0;
+}
+
+/**
+ * Changes the events of interest for a registered file descriptor.
+ *
+ * @param r The reactor.
+ * @param fd The registered file descriptor.
+ * @param events The new set of events.
+ * @return 0 on success, or -1 on error.
+ */
+int pipe_reactor_mod(pipe_reactor_t *r, int fd, uint32_t events) {
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_MOD, fd, &ev) == -1) {
+        pipe_log(PIPE_LOG_ERROR, "Error modifying fd %d in epoll: %s\n", fd, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Removes a file descriptor from the reactor. It is safe to call this from inside a callback,
+ * pending events for `fd` in the current batch are discarded.
+ *
+ * @param r The reactor.
+ * @param fd The registered file descriptor.
+ * @return 0 on success, or -1 on error.
+ */
+int pipe_reactor_del(pipe_reactor_t *r, int fd) {
+    if (fd >= 0 && fd < r->nwatches) {
+        r->watches[fd].cb = NULL;
+        r->watches[fd].arg = NULL;
+    }
+    if (epoll_ctl(r->epfd, EPOLL_CTL_DEL, fd, NULL) == -1) {
+        pipe_log(PIPE_LOG_ERROR, "Error removing fd %d from epoll: %s\n", fd, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Arms a timer that runs `fn` from the reactor loop once `deadline` has passed, see
+ * pipe_timer_arm(). Must be called from the thread that runs the reactor.
+ *
+ * @param r The reactor.
+ * @param t The timer, owned by the caller until it fires or is cancelled.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds.
+ * @param fn The callback.
+ * @param arg An opaque pointer passed back to the callback.
+ */
+void pipe_reactor_timer_arm(pipe_reactor_t *r, struct pipe_timer *t, uint64_t deadline, pipe_timer_fn fn, void *arg) {
+    pipe_timer_arm(&r->timers, t, deadline, fn, arg);
+}
+
+/**
+ * Disarms a timer armed with pipe_reactor_timer_arm().
+ *
+ * @param r The reactor.
+ * @param t The timer.
+ */
+void pipe_reactor_timer_cancel(pipe_reactor_t *r, struct pipe_timer *t) {
+    pipe_timer_cancel(&r->timers, t);
+}
+
+/**
+ * Waits up to `timeout_ms` milliseconds for events and dispatches them to their callbacks. The
+ * wait is cut short by the next armed timer, and due timers run after the events.
+ *
+ * @param r The reactor.
+ * @param timeout_ms The maximum time to block, -1 to block indefinitely.
+ * @return The number of events and timers dispatched, 0 on timeout or stop, or -1 on error.
+ * @throws If epoll_wait() fails for a reason other than EINTR, an appropriate error message will be printed to stderr.
+ */
+int pipe_reactor_run_once(pipe_reactor_t *r, int timeout_ms) {
+    struct epoll_event events[PIPE_REACTOR_MAX_EVENTS];
+    int n, i, dispatched = 0;
+    int timer_ms = pipe_ms_until(pipe_timer_next(&r->timers));
+
+    if (timer_ms != -1 && (timeout_ms == -1 || timer_ms < timeout_ms)) {
+        timeout_ms = timer_ms;
+    }
+    n = epoll_wait(r->epfd, events, PIPE_REACTOR_MAX_EVENTS, timeout_ms);
+    if (n == -1) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        pipe_log(PIPE_LOG_ERROR, "Error in epoll_wait(): %s\n", strerror(errno));
+        return -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        int fd = events[i].data.fd;
+        if (fd == r->wakefd) {
+            uint64_t value;
+            while (read(r->wakefd, &value, sizeof(value)) > 0) {
+            }
+            continue;
+        }
+        if (fd < r->nwatches && r->watches[fd].cb != NULL) {
+            r->watches[fd].cb(fd, events[i].events, r->watches[fd].arg);
+            dispatched++;
+        }
+    }
+
+    if (r->timers.count > 0) {
+        dispatched += pipe_timer_expire(&r->timers, pipe_now_ns());
+    }
+    return dispatched;
+}
+
+/**
+ * Dispatches events until `pipe_reactor_stop()` is called.
+ *
+ * @param r The reactor.
+ * @return 0 when stopped, or -1 on error.
+ */
+int pipe_reactor_run(pipe_reactor_t *r) {
+    while (!pipe_reactor_stopped(r)) {
+        if (pipe_reactor_run_once(r, -1) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Asks the reactor to return from `pipe_reactor_run()`. This only sets a flag and writes to an
+ * eventfd, so it is async-signal-safe and may be called from a signal handler or another thread.
+ *
+ * @param r The reactor.
+ */
+void pipe_reactor_stop(pipe_reactor_t *r) {
+    uint64_t one = 1;
+    ssize_t ret;
+
+    __atomic_store_n(&r->stopped, true, __ATOMIC_SEQ_CST);
+    ret = write(r->wakefd, &one, sizeof(one));
+    (void)ret;
+}
+
+/**
+ * Tells whether `pipe_reactor_stop()` has been called. Safe from any thread.
+ *
+ * @param r The reactor.
+ * @return true once the reactor was asked to stop.
+ */
+bool pipe_reactor_stopped(const pipe_reactor_t *r) {
+    return __atomic_load_n(&r->stopped, __ATOMIC_SEQ_CST);
+}
@@ -0,0 +1,70 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PIPE_REACTOR_H
+#define PIPE_REACTOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+
+#include "pipe_timer.h"
+
+#define PIPE_EV_IN  EPOLLIN
+#define PIPE_EV_OUT EPOLLOUT
+#define PIPE_EV_HUP EPOLLHUP
+#define PIPE_EV_ERR EPOLLERR
+#define PIPE_EV_ET  EPOLLET   // report each readiness change once instead of while it lasts
+
+#define PIPE_REACTOR_MAX_EVENTS 64
+
+typedef void (*pipe_event_cb)(int fd, uint32_t events, void *arg);
+
+struct pipe_watch {
+    pipe_event_cb cb;
+    void *arg;
+};
+
+typedef struct pipe_reactor {
+    int epfd;
+    int wakefd;
+    bool stopped;  // set by pipe_reactor_stop(), read through pipe_reactor_stopped()
+    struct pipe_watch *watches;
+    int nwatches;
+    pipe_timer_wheel_t timers;
+} pipe_reactor_t;
+
+int pipe_reactor_init(pipe_reactor_t *r);
+void pipe_reactor_destroy(pipe_reactor_t *r);
+int pipe_reactor_add(pipe_reactor_t *r, int fd, uint32_t events, pipe_event_cb cb, void *arg);
+int pipe_reactor_mod(pipe_reactor_t *r, int fd, uint32_t events);
+int pipe_reactor_del(pipe_reactor_t *r, int fd);
+void pipe_reactor_timer_arm(pipe_reactor_t *r, struct pipe_timer *t, uint64_t deadline, pipe_timer_fn fn, void *arg);
+void pipe_reactor_timer_cancel(pipe_reactor_t *r, struct pipe_timer *t);
+int pipe_reactor_run_once(pipe_reactor_t *r, int timeout_ms);
+int pipe_reactor_run(pipe_reactor_t *r);
+void pipe_reactor_stop(pipe_reactor_t *r);
+bool pipe_reactor_stopped(const pipe_reactor_t *r);
+
+#endif
@@ -0,0 +1,400 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+
+#include "pipe_handler.h"
+#include "pipe_reliable.h"
+#include "pipe_log.h"
+#include "pipe_metrics.h"
+#include "pipe_time.h"
+
+#define DEFAULT_WINDOW 64
+#define RTO_NS 200000000ull        // first retransmit after 200 ms
+#define MAX_BACKOFF_SHIFT 4        // then doubling up to 3.2 s
+
+/**
+ * Empties a duplicate filter and makes `base` the first seq it expects.
+ *
+ * @param w The filter.
+ * @param base The oldest seq the sender has not had acknowledged.
+ */
+void pipe_rel_window_reset(pipe_rel_window_t *w, uint32_t base) {
+    w->base = base;
+    memset(w->bits, 0, sizeof(w->bits));
+}
+
+static inline bool window_test(const pipe_rel_window_t *w, uint32_t seq) {
+    uint32_t i = seq % PIPE_REL_WINDOW;
+    return (w->bits[i / 64] >> (i % 64)) & 1;
+}
+
+/**
+ * Records the arrival of a message.
+ *
+ * @param w The filter.
+ * @param seq The seq of the message.
+ * @return 1 if it is new, 0 if it is a duplicate, or -1 if it lies beyond the window.
+ */
+int pipe_rel_window_accept(pipe_rel_window_t *w, uint32_t seq) {
+    uint32_t d = seq - w->base, i = seq % PIPE_REL_WINDOW;
+
+    if ((int32_t)d < 0 || window_test(w, seq)) {
+        return 0;
+    }
+    if (d >= PIPE_REL_WINDOW) {
+        return -1;
+    }
+    w->bits[i / 64] |= 1ull << (i % 64);
+
+    // slide past the prefix that is complete, reusing its bits for the seqs ahead
+    while (window_test(w, w->base)) {
+        i = w->base % PIPE_REL_WINDOW;
+        w->bits[i / 64] &= ~(1ull << (i % 64));
+        w->base++;
+    }
+    return 1;
+}
+
+/**
+ * Returns the selective part of an acknowledgement, which of the 64 seqs after `base` arrived.
+ *
+ * @param w The filter.
+ * @return Bit i is set if seq base + 1 + i arrived.
+ */
+uint64_t pipe_rel_window_sack(const pipe_rel_window_t *w) {
+    uint64_t sack = 0;
+
+    for (uint32_t i = 0; i < 64; i++) {
+        if (window_test(w, w->base + 1 + i)) {
+            sack |= 1ull << i;
+        }
+    }
+    return sack;
+}
+
+/**
+ * Opens an at-least-once sender to a multi-client server, see pipe_conn_open_client().
+ *
+ * @param rel The sender to initialize.
+ * @param server_name The name of the server's shared request pipe.
+ * @param reply_name The name of this sender's private reply pipe.
+ * @param window The most messages unacknowledged at once, 64 if 0, at most PIPE_REL_WINDOW.
+ * @return 0 on success, or -1 on error.
+ * @throws If the connection or the window cannot be set up, an appropriate error message will be printed to stderr.
+ */
+int pipe_rel_open(pipe_rel_t *rel, const char *server_name, const char *reply_name, int window) {
+    uint32_t size = 1;
+
+    memset(rel, 0, sizeof(*rel));
+    rel->window = window > 0 ? (uint32_t)window : DEFAULT_WINDOW;
+    if (rel->window > PIPE_REL_WINDOW) {
+        rel->window = PIPE_REL_WINDOW;
+    }
+    while (size < rel->window) {
+        size *= 2;
+    }
+    rel->slots = calloc(size, sizeof(*rel->slots));
+    if (rel->slots == NULL) {
+        pipe_log(PIPE_LOG_ERROR, "Error allocating retransmit window: %s\n", strerror(errno));
+        return -1;
+    }
+    rel->mask = size - 1;
+    rel->rto_ns = RTO_NS;
+
+    if (pipe_conn_open_client(&rel->conn, server_name, reply_name) == -1) {
+        free(rel->slots);
+        rel->slots = NULL;
+        return -1;
+    }
+    rel->conn.reliable = true;
+    return 0;
+}
+
+static inline bool in_flight(const pipe_rel_t *rel, uint32_t seq) {
+    return seq - rel->base < rel->next_seq - rel->base;
+}
+
+/**
+ * Sends a slot again, allowing one retransmit timeout for room in the pipe.
+ *
+ * @return 0 on success, or -1 if the send failed; the slot is then retried on its next timeout.
+ */
+static int resend(pipe_rel_t *rel, struct pipe_rel_slot *slot, uint64_t now) {
+    slot->sent_ns = now;
+    slot->retries++;
+    rel->retransmits++;
+    pipe_log(PIPE_LOG_DEBUG, "Retransmitting message %u, attempt %u\n", slot->seq, slot->retries);
+    if (pipe_conn_send_seq(&rel->conn, slot->type, PIPE_FRAME_REL, slot->seq, slot->data, slot->len,
+                           now + rel->rto_ns) == -1) {
+        // the server may be restarting
+        pipe_log(PIPE_LOG_DEBUG, "Retransmit of message %u failed: %s\n", slot->seq, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static int on_sack(pipe_rel_t *rel, uint32_t next, const char *payload, uint32_t len) {
+    uint64_t sack = 0;
+    int acked = 0;
+
+    // a late acknowledgement from before an earlier one, or from a server that lost track
+    if (next - rel->base > rel->next_seq - rel->base) {
+        return 0;
+    }
+    while (rel->base != next) {
+        rel->slots[rel->base & rel->mask].active = false;
+        rel->base++;
+        acked++;
+    }
+    rel->conn.tx_unacked = rel->base;
+
+    if (len < sizeof(sack)) {
+        return acked;
+    }
+    memcpy(&sack, payload, sizeof(sack));
+    for (uint64_t bits = sack; bits != 0; bits &= bits - 1) {
+        uint32_t seq = next + 1 + __builtin_ctzll(bits);
+        if (in_flight(rel, seq) && !rel->slots[seq & rel->mask].acked) {
+            rel->slots[seq & rel->mask].acked = true;
+            acked++;
+        }
+    }
+
+    // a FIFO keeps one sender's frames in order, so a gap below an acknowledged seq is a loss
+    if (sack != 0) {
+        uint32_t top = next + 64 - __builtin_clzll(sack);
+        uint64_t now = pipe_now_ns();
+        for (uint32_t seq = next; seq != top && in_flight(rel, seq); seq++) {
+            struct pipe_rel_slot *slot = &rel->slots[seq & rel->mask];
+            if (!slot->acked && !slot->fast_retransmitted) {
+                slot->fast_retransmitted = true;
+                if (resend(rel, slot, now) == -1) {
+                    break;
+                }
+            }
+        }
+    }
+    return acked;
+}
+
+/**
+ * Processes every acknowledgement that is buffered or readable right now, without blocking.
+ */
+static int drain(pipe_rel_t *rel) {
+    struct pipe_frame frame, msg;
+    int n = 0, ret;
+
+    while (1) {
+        while ((ret = pipe_frame_next(&rel->conn.rx, &frame)) == 1) {
+            ret = pipe_conn_assemble(&rel->conn, &frame, &msg);
+            if (ret == 1 && msg.hdr.type == PIPE_MSG_SACK) {
+                n += on_sack(rel, msg.hdr.seq, msg.payload, msg.hdr.len);
+            } else if (ret == -1) {
+                return -1;
+            }
+        }
+        if (ret == -1) {
+            return -1;
+        }
+        if (pipe_frame_reader_fill(&rel->conn.rx, rel->conn.rx_fd) > 0) {
+            continue;
+        }
+        return errno == EAGAIN || errno == EWOULDBLOCK ? n : -1;
+    }
+}
+
+/**
+ * Resends the messages whose retransmit timeout has passed, oldest first.
+ *
+ * @return The time the next timeout is due, UINT64_MAX if none is pending.
+ */
+static uint64_t retransmit_due(pipe_rel_t *rel) {
+    uint64_t now = pipe_now_ns(), next = UINT64_MAX;
+    bool announced = false;
+
+    for (uint32_t seq = rel->base; seq != rel->next_seq; seq++) {
+        struct pipe_rel_slot *slot = &rel->slots[seq & rel->mask];
+        uint32_t shift = slot->retries < MAX_BACKOFF_SHIFT ? slot->retries : MAX_BACKOFF_SHIFT;
+        uint64_t due;
+
+        if (slot->acked) {
+            continue;
+        }
+        due = slot->sent_ns + (rel->rto_ns << shift);
+        if (due <= now) {
+            // a server restarted while we were idle reads our old descriptor without knowing us
+            // and never acknowledges; a second timeout reconnects, which announces us again
+            if (slot->retries > 0 && !announced && rel->conn.tx_fd >= 0) {
+                close(rel->conn.tx_fd);
+                rel->conn.tx_fd = -1;
+                announced = true;
+            }
+            int failed = resend(rel, slot, now);
+            now = pipe_now_ns();
+            due = slot->sent_ns + (rel->rto_ns << (shift < MAX_BACKOFF_SHIFT ? shift + 1 : shift));
+            // the later slots would meet the same full pipe or missing reader
+            if (failed) {
+                return due < next ? due : next;
+            }
+        }
+        if (due < next) {
+            next = due;
+        }
+    }
+    return next;
+}
+
+/**
+ * Processes acknowledgements and retransmits, sleeping until at least one message is acknowledged
+ * or `deadline` passes.
+ */
+static int poll_until(pipe_rel_t *rel, uint64_t deadline) {
+    while (1) {
+        int n = drain(rel);
+        uint64_t next;
+
+        if (n == -1) {
+            return -1;
+        }
+        next = retransmit_due(rel);
+        if (n > 0 || rel->base == rel->next_seq || pipe_now_ns() >= deadline) {
+            return n;
+        }
+        if (wait_pipe(rel->conn.rx_fd, POLLIN, deadline < next ? deadline : next) == -1) {
+            return -1;
+        }
+    }
+}
+
+/**
+ * Sends a message with at-least-once delivery. The message is copied into the retransmit window,
+ * so once this returns it is delivered eventually even if this send or the server fails; when
+ * `window` messages are unacknowledged this first waits for acknowledgements.
+ *
+ * @param rel The sender.
+ * @param type The message type, e.g. PIPE_MSG_DATA.
+ * @param buf A pointer to the payload.
+ * @param buflen The length of the payload.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds for room in the window.
+ * @return The number of payload bytes queued, or -1 on error or if the window stayed full.
+ * @throws If the payload cannot be copied, an appropriate error message will be printed to stderr.
+ */
+int pipe_rel_send(pipe_rel_t *rel, uint16_t type, const void *buf, size_t buflen, uint64_t deadline) {
+    struct pipe_rel_slot *slot;
+
+    if (buflen > PIPE_FRAME_MAX_LEN) {
+        pipe_log(PIPE_LOG_ERROR, "Message of %zu bytes exceeds the frame limit\n", buflen);
+        errno = EMSGSIZE;
+        return -1;
+    }
+    while (rel->next_seq - rel->base >= rel->window) {
+        if (poll_until(rel, deadline) == -1) {
+            return -1;
+        }
+        if (rel->next_seq - rel->base >= rel->window && pipe_now_ns() >= deadline) {
+            pipe_log(PIPE_LOG_WARN, "Timeout waiting for acknowledgements\n");
+            pipe_metrics_add(rel->conn.rx_fd, PIPE_METRIC_TIMEOUTS, 1);
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+
+    // slot buffers only grow, a steady stream reuses them without allocating
+    slot = &rel->slots[rel->next_seq & rel->mask];
+    if (buflen > slot->cap) {
+        char *data = realloc(slot->data, buflen);
+        if (data == NULL) {
+            pipe_log(PIPE_LOG_ERROR, "Error allocating retransmit copy: %s\n", strerror(errno));
+            return -1;
+        }
+        slot->data = data;
+        slot->cap = buflen;
+    }
+    memcpy(slot->data, buf, buflen);
+    slot->len = buflen;
+    slot->type = type;
+    slot->seq = rel->next_seq++;
+    slot->retries = 0;
+    slot->acked = slot->fast_retransmitted = false;
+    slot->active = true;
+    slot->sent_ns = pipe_now_ns();
+
+    pipe_conn_send_seq(&rel->conn, type, PIPE_FRAME_REL, slot->seq, buf, buflen, deadline);
+    return (int)buflen;
+}
+
+/**
+ * Processes the acknowledgements that have arrived and makes the retransmits that are due,
+ * waiting until `deadline` for the first acknowledgement.
+ *
+ * @param rel The sender.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds, 0 to only collect what is already there.
+ * @return The number of messages acknowledged, or -1 on error.
+ */
+int pipe_rel_poll(pipe_rel_t *rel, uint64_t deadline) {
+    return poll_until(rel, deadline);
+}
+
+/**
+ * Waits until every message sent so far is acknowledged, retransmitting as needed.
+ *
+ * @param rel The sender.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds.
+ * @return 0 on success, or -1 on error or timeout.
+ */
+int pipe_rel_flush(pipe_rel_t *rel, uint64_t deadline) {
+    while (rel->base != rel->next_seq) {
+        if (poll_until(rel, deadline) == -1) {
+            return -1;
+        }
+        if (rel->base != rel->next_seq && pipe_now_ns() >= deadline) {
+            pipe_log(PIPE_LOG_WARN, "Timeout with %u messages unacknowledged\n", rel->next_seq - rel->base);
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Closes the sender. Messages not yet acknowledged are dropped; call pipe_rel_flush() first.
+ *
+ * @param rel The sender.
+ */
+void pipe_rel_close(pipe_rel_t *rel) {
+    for (uint32_t i = 0; rel->slots != NULL && i <= rel->mask; i++) {
+        free(rel->slots[i].data);
+    }
+    free(rel->slots);
+    rel->slots = NULL;
+    pipe_conn_close(&rel->conn);
+}
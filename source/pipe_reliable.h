@@ -0,0 +1,96 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PIPE_RELIABLE_H
+#define PIPE_RELIABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pipe_conn.h"
+#include "pipe_frame.h"
+
+// selective acknowledgement: `seq` is the next seq the server is missing, everything before has
+// arrived; the payload is a uint64_t whose bit i reports seq + 1 + i
+#define PIPE_MSG_SACK 7
+
+// the most messages a sender may have unacknowledged, and the span of the receiver's bitmap
+#define PIPE_REL_WINDOW 1024
+
+/**
+ * Receiver side duplicate filter: which of the PIPE_REL_WINDOW seqs from `base` on have arrived.
+ * Bit `seq % PIPE_REL_WINDOW` stands for seq, and `base` moves up past every seq that arrived.
+ */
+typedef struct pipe_rel_window {
+    uint32_t base;
+    uint64_t bits[PIPE_REL_WINDOW / 64];
+} pipe_rel_window_t;
+
+void pipe_rel_window_reset(pipe_rel_window_t *w, uint32_t base);
+int pipe_rel_window_accept(pipe_rel_window_t *w, uint32_t seq);
+uint64_t pipe_rel_window_sack(const pipe_rel_window_t *w);
+
+struct pipe_rel_slot {
+    bool active;
+    bool acked;
+    bool fast_retransmitted;
+    uint16_t type;
+    uint32_t seq;
+    uint32_t retries;
+    uint64_t sent_ns;
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+/**
+ * At-least-once sender on top of a client pipe_conn. Every message keeps a copy in a bounded
+ * window until the server acknowledges it with PIPE_MSG_SACK; messages that stay unacknowledged
+ * for the retransmit timeout, or that a SACK shows missing, are sent again under their original
+ * seq. Up to `window` messages are in flight at once. The server drops the duplicates this
+ * causes, so a message is handled once unless the server restarts between handling and
+ * acknowledging it.
+ *
+ * Acknowledgements are processed, and retransmits made, from the calls below on the calling
+ * thread; a pipe_rel is not thread-safe. Replies other than SACKs are discarded.
+ */
+typedef struct pipe_rel {
+    pipe_conn_t conn;
+    struct pipe_rel_slot *slots;
+    uint32_t mask;
+    uint32_t window;
+    uint32_t base;
+    uint32_t next_seq;
+    uint64_t rto_ns;
+    uint64_t retransmits;
+} pipe_rel_t;
+
+int pipe_rel_open(pipe_rel_t *rel, const char *server_name, const char *reply_name, int window);
+int pipe_rel_send(pipe_rel_t *rel, uint16_t type, const void *buf, size_t buflen, uint64_t deadline);
+int pipe_rel_poll(pipe_rel_t *rel, uint64_t deadline);
+int pipe_rel_flush(pipe_rel_t *rel, uint64_t deadline);
+void pipe_rel_close(pipe_rel_t *rel);
+
+#endif
@@ -0,0 +1,303 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+
+#include "pipe_handler.h"
+#include "pipe_rpc.h"
+#include "pipe_log.h"
+#include "pipe_metrics.h"
+#include "pipe_pool.h"
+#include "pipe_time.h"
+
+#define DEFAULT_MAX_INFLIGHT 64
+
+/**
+ * Opens a pipelining client to a multi-client server, see pipe_conn_open_client().
+ *
+ * @param rpc The client to initialize.
+ * @param server_name The name of the server's shared request pipe.
+ * @param reply_name The name of this client's private reply pipe.
+ * @param max_inflight The most requests outstanding at once, 64 if 0.
+ * @return 0 on success, or -1 on error.
+ * @throws If the connection or the call table cannot be set up, an appropriate error message will be printed to stderr.
+ */
+int pipe_rpc_open(pipe_rpc_t *rpc, const char *server_name, const char *reply_name, int max_inflight) {
+    uint32_t size = 2;
+
+    memset(rpc, 0, sizeof(*rpc));
+    rpc->max_inflight = max_inflight > 0 ? max_inflight : DEFAULT_MAX_INFLIGHT;
+    // twice the window, so a single slow request rarely blocks the slot of a newer one
+    while (size < 2 * (uint32_t)rpc->max_inflight) {
+        size *= 2;
+    }
+    rpc->calls = calloc(size, sizeof(*rpc->calls));
+    if (rpc->calls == NULL) {
+        pipe_log(PIPE_LOG_ERROR, "Error allocating call table: %s\n", strerror(errno));
+        return -1;
+    }
+    rpc->mask = size - 1;
+    pipe_timer_wheel_init(&rpc->timers);
+
+    if (pipe_conn_open_client(&rpc->conn, server_name, reply_name) == -1) {
+        free(rpc->calls);
+        rpc->calls = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static void complete(pipe_rpc_t *rpc, struct pipe_rpc_call *call, int status, const struct pipe_frame *reply) {
+    pipe_rpc_cb cb = call->cb;
+    void *arg = call->arg;
+
+    // free the slot first, the callback may issue the next request
+    pipe_timer_cancel(&rpc->timers, &call->timer);
+    call->active = false;
+    rpc->inflight--;
+    if (cb != NULL) {
+        cb(rpc, status, reply, arg);
+    }
+}
+
+static int dispatch_reply(pipe_rpc_t *rpc, const struct pipe_frame *msg) {
+    struct pipe_rpc_call *call = &rpc->calls[msg->hdr.seq & rpc->mask];
+
+    if (!call->active || call->seq != msg->hdr.seq) {
+        // the late reply of a request that already timed out
+        return 0;
+    }
+    pipe_metrics_observe(rpc->conn.tx_fd, pipe_now_ns() - call->sent_ns);
+    complete(rpc, call, 0, msg);
+    return 1;
+}
+
+static void on_timeout(struct pipe_timer *t, void *arg) {
+    pipe_rpc_t *rpc = arg;
+    struct pipe_rpc_call *call = (struct pipe_rpc_call *)((char *)t - offsetof(struct pipe_rpc_call, timer));
+
+    pipe_metrics_add(rpc->conn.rx_fd, PIPE_METRIC_TIMEOUTS, 1);
+    complete(rpc, call, ETIMEDOUT, NULL);
+}
+
+/**
+ * Fails every request whose deadline has passed. Each request has a timer on the client's wheel,
+ * so this costs nothing while no deadline is due however many requests are in flight.
+ */
+static int expire(pipe_rpc_t *rpc) {
+    return pipe_timer_expire(&rpc->timers, pipe_now_ns());
+}
+
+/**
+ * Dispatches every reply that is buffered or readable right now, without blocking.
+ */
+static int drain(pipe_rpc_t *rpc) {
+    struct pipe_frame frame, msg;
+    int n = 0, ret;
+
+    while (1) {
+        while ((ret = pipe_frame_next(&rpc->conn.rx, &frame)) == 1) {
+            ret = pipe_conn_assemble(&rpc->conn, &frame, &msg);
+            if (ret == 1) {
+                n += dispatch_reply(rpc, &msg);
+            } else if (ret == -1) {
+                return -1;
+            }
+        }
+        if (ret == -1) {
+            return -1;
+        }
+        if (pipe_frame_reader_fill(&rpc->conn.rx, rpc->conn.rx_fd) > 0) {
+            continue;
+        }
+        return errno == EAGAIN || errno == EWOULDBLOCK ? n : -1;
+    }
+}
+
+/**
+ * Completes requests, sleeping until at least one completes or `deadline` passes.
+ */
+static int poll_until(pipe_rpc_t *rpc, uint64_t deadline) {
+    while (1) {
+        int n = drain(rpc);
+        if (n == -1) {
+            return -1;
+        }
+        n += expire(rpc);
+        if (n > 0 || rpc->inflight == 0 || pipe_now_ns() >= deadline) {
+            return n;
+        }
+        uint64_t wake = pipe_timer_next(&rpc->timers);
+        if (wait_pipe(rpc->conn.rx_fd, POLLIN, deadline < wake ? deadline : wake) == -1) {
+            return -1;
+        }
+    }
+}
+
+/**
+ * Sends a request without waiting for its reply. `cb` runs once, with the reply or with an error
+ * if none arrives by `deadline`. When `max_inflight` requests are outstanding this first
+ * completes older ones, so the window also applies backpressure.
+ *
+ * @param rpc The client.
+ * @param type The message type, e.g. PIPE_MSG_DATA.
+ * @param buf A pointer to the payload.
+ * @param buflen The length of the payload.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds for a free slot, for the send and for the reply.
+ * @param cb The completion callback, may be NULL.
+ * @param arg An opaque pointer passed back to the callback.
+ * @return The correlation id of the request, or -1 on error or if no slot freed up in time.
+ * @throws If an error occurs while sending, an appropriate error message will be printed to stderr.
+ */
+int pipe_rpc_call(pipe_rpc_t *rpc, uint16_t type, const void *buf, size_t buflen, uint64_t deadline, pipe_rpc_cb cb, void *arg) {
+    struct pipe_rpc_call *call;
+    uint32_t seq;
+
+    while (rpc->inflight >= rpc->max_inflight || rpc->calls[rpc->conn.tx_seq & rpc->mask].active) {
+        if (poll_until(rpc, deadline) == -1) {
+            return -1;
+        }
+        if (pipe_now_ns() >= deadline) {
+            pipe_log(PIPE_LOG_WARN, "Timeout waiting for a free request slot\n");
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+
+    seq = rpc->conn.tx_seq;
+    if (pipe_conn_send_msg(&rpc->conn, type, buf, buflen, deadline) == -1) {
+        return -1;
+    }
+
+    call = &rpc->calls[seq & rpc->mask];
+    call->active = true;
+    call->seq = seq;
+    call->sent_ns = pipe_now_ns();
+    call->cb = cb;
+    call->arg = arg;
+    pipe_timer_arm(&rpc->timers, &call->timer, deadline, on_timeout, rpc);
+    rpc->inflight++;
+    return (int)(seq & INT32_MAX);
+}
+
+static void complete_future(pipe_rpc_t *rpc, int status, const struct pipe_frame *reply, void *arg) {
+    pipe_rpc_future_t *fut = arg;
+
+    (void)rpc;
+    fut->status = status;
+    if (reply != NULL) {
+        fut->type = reply->hdr.type;
+        fut->data = pipe_pool_alloc(reply->hdr.len);
+        if (fut->data == NULL) {
+            fut->status = ENOMEM;
+        } else {
+            memcpy(fut->data, reply->payload, reply->hdr.len);
+            fut->len = reply->hdr.len;
+        }
+    }
+    fut->done = true;
+}
+
+/**
+ * Sends a request whose reply is collected in a future, see pipe_rpc_call(). The future is
+ * resolved by pipe_rpc_poll() or pipe_rpc_wait() and must stay in place until then.
+ *
+ * @param rpc The client.
+ * @param type The message type, e.g. PIPE_MSG_DATA.
+ * @param buf A pointer to the payload.
+ * @param buflen The length of the payload.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds for the reply.
+ * @param fut The future to resolve; release it with pipe_rpc_future_free().
+ * @return The correlation id of the request, or -1 on error.
+ */
+int pipe_rpc_call_future(pipe_rpc_t *rpc, uint16_t type, const void *buf, size_t buflen, uint64_t deadline, pipe_rpc_future_t *fut) {
+    memset(fut, 0, sizeof(*fut));
+    return pipe_rpc_call(rpc, type, buf, buflen, deadline, complete_future, fut);
+}
+
+/**
+ * Dispatches the replies that have arrived, waiting until `deadline` for the first one.
+ *
+ * @param rpc The client.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds, 0 to only collect what is already there.
+ * @return The number of requests completed (including timed out ones), or -1 on error.
+ */
+int pipe_rpc_poll(pipe_rpc_t *rpc, uint64_t deadline) {
+    return poll_until(rpc, deadline);
+}
+
+/**
+ * Dispatches replies until `fut` is resolved, or until no request is in flight if `fut` is NULL.
+ *
+ * @param rpc The client.
+ * @param fut The future to wait for, or NULL to wait for every request.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds.
+ * @return 0 on success, or -1 on error or timeout.
+ */
+int pipe_rpc_wait(pipe_rpc_t *rpc, pipe_rpc_future_t *fut, uint64_t deadline) {
+    while (fut != NULL ? !fut->done : rpc->inflight > 0) {
+        if (poll_until(rpc, deadline) == -1) {
+            return -1;
+        }
+        if (pipe_now_ns() >= deadline && (fut != NULL ? !fut->done : rpc->inflight > 0)) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Releases the reply copy held by a resolved future.
+ *
+ * @param fut The future.
+ */
+void pipe_rpc_future_free(pipe_rpc_future_t *fut) {
+    pipe_pool_put(fut->data);
+    fut->data = NULL;
+    fut->len = 0;
+}
+
+/**
+ * Fails every outstanding request with ECANCELED and closes the connection.
+ *
+ * @param rpc The client.
+ */
+void pipe_rpc_close(pipe_rpc_t *rpc) {
+    for (uint32_t i = 0; rpc->calls != NULL && i <= rpc->mask; i++) {
+        if (rpc->calls[i].active) {
+            complete(rpc, &rpc->calls[i], ECANCELED, NULL);
+        }
+    }
+    free(rpc->calls);
+    rpc->calls = NULL;
+    pipe_conn_close(&rpc->conn);
+}
@@ -0,0 +1,89 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PIPE_RPC_H
+#define PIPE_RPC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pipe_conn.h"
+#include "pipe_frame.h"
+#include "pipe_timer.h"
+
+typedef struct pipe_rpc pipe_rpc_t;
+
+/**
+ * Completion of one request. `status` is 0 with the reply in `reply`, or an errno value
+ * (ETIMEDOUT, ECANCELED) with `reply` NULL. The reply payload is only valid until the callback
+ * returns or calls back into the client, e.g. to issue the next request.
+ */
+typedef void (*pipe_rpc_cb)(pipe_rpc_t *rpc, int status, const struct pipe_frame *reply, void *arg);
+
+struct pipe_rpc_call {
+    bool active;
+    uint32_t seq;
+    uint64_t sent_ns;
+    struct pipe_timer timer;    // fails the request at its deadline
+    pipe_rpc_cb cb;
+    void *arg;
+};
+
+/**
+ * A reply delivered to a future. The payload is copied, so it stays valid until pipe_rpc_future_free().
+ */
+typedef struct pipe_rpc_future {
+    bool done;
+    int status;
+    uint16_t type;
+    char *data;
+    size_t len;
+} pipe_rpc_future_t;
+
+/**
+ * Pipelining request/response client on top of a client pipe_conn. Up to `max_inflight` requests
+ * are outstanding at once; the frame `seq` is the correlation id, which the server echoes in its
+ * reply, so replies are matched to their request in whatever order they arrive. Completions run
+ * from pipe_rpc_poll() (and from the calls that poll internally) on the calling thread; a pipe_rpc
+ * is not thread-safe.
+ */
+struct pipe_rpc {
+    pipe_conn_t conn;
+    struct pipe_rpc_call *calls;
+    uint32_t mask;
+    int max_inflight;
+    int inflight;
+    pipe_timer_wheel_t timers;
+};
+
+int pipe_rpc_open(pipe_rpc_t *rpc, const char *server_name, const char *reply_name, int max_inflight);
+int pipe_rpc_call(pipe_rpc_t *rpc, uint16_t type, const void *buf, size_t buflen, uint64_t deadline, pipe_rpc_cb cb, void *arg);
+int pipe_rpc_call_future(pipe_rpc_t *rpc, uint16_t type, const void *buf, size_t buflen, uint64_t deadline, pipe_rpc_future_t *fut);
+int pipe_rpc_poll(pipe_rpc_t *rpc, uint64_t deadline);
+int pipe_rpc_wait(pipe_rpc_t *rpc, pipe_rpc_future_t *fut, uint64_t deadline);
+void pipe_rpc_future_free(pipe_rpc_future_t *fut);
+void pipe_rpc_close(pipe_rpc_t *rpc);
+
+#endif
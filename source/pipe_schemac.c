@@ -0,0 +1,569 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Message schema compiler. Reads a schema of the form
+ *
+ *   message <name> <id> {
+ *       [optional] <type> <field>;
+ *       ...
+ *   }
+ *
+ * and writes a header and source with one packed wire struct, one encode struct and one view
+ * struct per message plus their encode/decode functions. Types are u8 u16 u32 u64 i8 i16 i32
+ * i64 f32 f64 string bytes; `#` starts a comment.
+ *
+ * Encoded layout: the packed fixed-width required fields led by the u16 schema id, then the
+ * required string/bytes fields as varint length + data, then a varint presence bitmap and the
+ * present optional fields in declaration order (integers as varints, signed ones zigzagged).
+ *
+ * usage - pipe_schemac <schema> <header out> <source out>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#define MAX_MESSAGES 64
+#define MAX_FIELDS 64
+#define MAX_OPTIONAL 32
+#define MAX_IDENT 64
+
+enum field_kind {
+    KIND_UINT,
+    KIND_INT,
+    KIND_FLOAT,
+    KIND_BYTES,
+};
+
+struct field_type {
+    const char *name;
+    const char *ctype;
+    enum field_kind kind;
+    const char *min;  // range checks for varint-decoded optionals narrower than 64 bits
+    const char *max;
+};
+
+static const struct field_type field_types[] = {
+    { "u8", "uint8_t", KIND_UINT, NULL, "UINT8_MAX" },
+    { "u16", "uint16_t", KIND_UINT, NULL, "UINT16_MAX" },
+    { "u32", "uint32_t", KIND_UINT, NULL, "UINT32_MAX" },
+    { "u64", "uint64_t", KIND_UINT, NULL, NULL },
+    { "i8", "int8_t", KIND_INT, "INT8_MIN", "INT8_MAX" },
+    { "i16", "int16_t", KIND_INT, "INT16_MIN", "INT16_MAX" },
+    { "i32", "int32_t", KIND_INT, "INT32_MIN", "INT32_MAX" },
+    { "i64", "int64_t", KIND_INT, NULL, NULL },
+    { "f32", "float", KIND_FLOAT, NULL, NULL },
+    { "f64", "double", KIND_FLOAT, NULL, NULL },
+    { "string", "struct pipe_bytes", KIND_BYTES, NULL, NULL },
+    { "bytes", "struct pipe_bytes", KIND_BYTES, NULL, NULL },
+};
+
+struct field {
+    char name[MAX_IDENT];
+    char upper[MAX_IDENT];
+    const struct field_type *type;
+    bool optional;
+};
+
+struct message {
+    char name[MAX_IDENT];
+    char upper[MAX_IDENT];
+    unsigned id;
+    struct field fields[MAX_FIELDS];
+    int nfields;
+    int noptional;
+};
+
+struct parser {
+    const char *path;
+    const char *p;
+    int line;
+    char tok[MAX_IDENT];
+};
+
+static struct message messages[MAX_MESSAGES];
+static int nmessages;
+
+static void fail(struct parser *ps, const char *fmt, ...) {
+    va_list ap;
+
+    fprintf(stderr, "%s:%d: ", ps->path, ps->line);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * Reads the next token into ps->tok, an identifier, a number or one punctuation character.
+ *
+ * @return false at the end of the schema.
+ */
+static bool next_token(struct parser *ps) {
+    for (;;) {
+        while (isspace((unsigned char)*ps->p)) {
+            if (*ps->p++ == '\n') {
+                ps->line++;
+            }
+        }
+        if (*ps->p != '#') {
+            break;
+        }
+        while (*ps->p != '\0' && *ps->p != '\n') {
+            ps->p++;
+        }
+    }
+    if (*ps->p == '\0') {
+        ps->tok[0] = '\0';
+        return false;
+    }
+    if (isalnum((unsigned char)*ps->p) || *ps->p == '_') {
+        size_t n = 0;
+        while (isalnum((unsigned char)*ps->p) || *ps->p == '_') {
+            if (n == MAX_IDENT - 1) {
+                fail(ps, "identifier too long");
+            }
+            ps->tok[n++] = *ps->p++;
+        }
+        ps->tok[n] = '\0';
+    } else {
+        ps->tok[0] = *ps->p++;
+        ps->tok[1] = '\0';
+    }
+    return true;
+}
+
+static void expect(struct parser *ps, const char *tok) {
+    if (!next_token(ps) || strcmp(ps->tok, tok) != 0) {
+        fail(ps, "expected '%s' but found '%s'", tok, ps->tok);
+    }
+}
+
+static void expect_ident(struct parser *ps, char *out, const char *what) {
+    if (!next_token(ps) || !(isalpha((unsigned char)ps->tok[0]) || ps->tok[0] == '_')) {
+        fail(ps, "expected %s but found '%s'", what, ps->tok);
+    }
+    strcpy(out, ps->tok);
+}
+
+static const struct field_type *lookup_type(const char *name) {
+    for (size_t i = 0; i < sizeof(field_types) / sizeof(field_types[0]); i++) {
+        if (strcmp(field_types[i].name, name) == 0) {
+            return &field_types[i];
+        }
+    }
+    return NULL;
+}
+
+static void parse_field(struct parser *ps, struct message *m) {
+    struct field *f;
+    char type[MAX_IDENT];
+
+    if (m->nfields == MAX_FIELDS) {
+        fail(ps, "message %s has more than %d fields", m->name, MAX_FIELDS);
+    }
+    f = &m->fields[m->nfields];
+    f->optional = strcmp(ps->tok, "optional") == 0;
+    if (f->optional) {
+        expect_ident(ps, type, "a field type");
+        if (++m->noptional > MAX_OPTIONAL) {
+            fail(ps, "message %s has more than %d optional fields", m->name, MAX_OPTIONAL);
+        }
+    } else {
+        strcpy(type, ps->tok);
+    }
+    f->type = lookup_type(type);
+    if (f->type == NULL) {
+        fail(ps, "unknown type '%s'", type);
+    }
+    expect_ident(ps, f->name, "a field name");
+    for (size_t i = 0; f->name[i] != '\0'; i++) {
+        f->upper[i] = toupper((unsigned char)f->name[i]);
+    }
+    // `msg_id` leads the wire struct and `present` holds the optional bitmap
+    if (strcmp(f->name, "msg_id") == 0 || strcmp(f->name, "present") == 0 || strcmp(f->name, "fixed") == 0) {
+        fail(ps, "field name '%s' is reserved", f->name);
+    }
+    for (int i = 0; i < m->nfields; i++) {
+        if (strcmp(m->fields[i].name, f->name) == 0) {
+            fail(ps, "duplicate field '%s' in message %s", f->name, m->name);
+        }
+    }
+    expect(ps, ";");
+    m->nfields++;
+}
+
+static void parse_schema(struct parser *ps) {
+    while (next_token(ps)) {
+        struct message *m;
+        char *endp;
+
+        if (strcmp(ps->tok, "message") != 0) {
+            fail(ps, "expected 'message' but found '%s'", ps->tok);
+        }
+        if (nmessages == MAX_MESSAGES) {
+            fail(ps, "more than %d messages", MAX_MESSAGES);
+        }
+        m = &messages[nmessages];
+        expect_ident(ps, m->name, "a message name");
+        for (size_t i = 0; m->name[i] != '\0'; i++) {
+            m->upper[i] = toupper((unsigned char)m->name[i]);
+        }
+        if (!next_token(ps)) {
+            fail(ps, "expected a message id");
+        }
+        m->id = strtoul(ps->tok, &endp, 10);
+        if (*endp != '\0' || m->id == 0 || m->id > 0xffff) {
+            fail(ps, "message id must be between 1 and 65535, found '%s'", ps->tok);
+        }
+        for (int i = 0; i < nmessages; i++) {
+            if (strcmp(messages[i].name, m->name) == 0 || messages[i].id == m->id) {
+                fail(ps, "message %s %u clashes with %s %u", m->name, m->id, messages[i].name, messages[i].id);
+            }
+        }
+        expect(ps, "{");
+        while (next_token(ps) && strcmp(ps->tok, "}") != 0) {
+            parse_field(ps, m);
+        }
+        if (strcmp(ps->tok, "}") != 0) {
+            fail(ps, "message %s is not closed", m->name);
+        }
+        nmessages++;
+    }
+}
+
+static bool is_fixed(const struct field *f) {
+    return !f->optional && f->type->kind != KIND_BYTES;
+}
+
+static void write_header(FILE *out, const char *schema, const char *guard) {
+    fprintf(out, "/* Generated by pipe_schemac from %s, do not edit. */\n\n", schema);
+    fprintf(out, "#ifndef %s\n#define %s\n\n", guard, guard);
+    fprintf(out, "#include <stdint.h>\n#include <stddef.h>\n#include <sys/types.h>\n\n#include \"pipe_codec.h\"\n");
+
+    for (int i = 0; i < nmessages; i++) {
+        const struct message *m = &messages[i];
+        int bit = 0;
+
+        fprintf(out, "\n#define PIPE_MSG_%s_ID %u\n", m->upper, m->id);
+        for (int j = 0; j < m->nfields; j++) {
+            if (m->fields[j].optional) {
+                fprintf(out, "#define PIPE_MSG_%s_HAS_%s (1u << %d)\n", m->upper, m->fields[j].upper, bit++);
+            }
+        }
+        fprintf(out, "#define PIPE_MSG_%s_OPTIONAL %#xu\n", m->upper,
+                m->noptional == MAX_OPTIONAL ? 0xffffffffu : (1u << m->noptional) - 1);
+
+        fprintf(out, "\n/**\n * Wire layout of the fixed-width required fields of %s, read in place on decode.\n */\n",
+                m->name);
+        fprintf(out, "struct pipe_msg_%s_fixed {\n    uint16_t msg_id;\n", m->name);
+        for (int j = 0; j < m->nfields; j++) {
+            if (is_fixed(&m->fields[j])) {
+                fprintf(out, "    %s %s;\n", m->fields[j].type->ctype, m->fields[j].name);
+            }
+        }
+        fprintf(out, "} __attribute__((packed));\n");
+
+        if (m->noptional > 0) {
+            fprintf(out, "\n/**\n * A %s to encode. Optional fields are sent when their PIPE_MSG_%s_HAS_ bit is set "
+                         "in `present`.\n */\n", m->name, m->upper);
+        } else {
+            fprintf(out, "\n/**\n * A %s to encode.\n */\n", m->name);
+        }
+        fprintf(out, "struct pipe_msg_%s {\n", m->name);
+        for (int j = 0; j < m->nfields; j++) {
+            if (!m->fields[j].optional) {
+                fprintf(out, "    %s %s;\n", m->fields[j].type->ctype, m->fields[j].name);
+            }
+        }
+        fprintf(out, "    uint32_t present;\n");
+        for (int j = 0; j < m->nfields; j++) {
+            if (m->fields[j].optional) {
+                fprintf(out, "    %s %s;\n", m->fields[j].type->ctype, m->fields[j].name);
+            }
+        }
+        fprintf(out, "};\n");
+
+        fprintf(out, "\n/**\n * A decoded %s. `fixed` and the string fields point into the receive buffer.\n */\n",
+                m->name);
+        fprintf(out, "struct pipe_msg_%s_view {\n    const struct pipe_msg_%s_fixed *fixed;\n", m->name, m->name);
+        for (int j = 0; j < m->nfields; j++) {
+            if (!m->fields[j].optional && m->fields[j].type->kind == KIND_BYTES) {
+                fprintf(out, "    struct pipe_bytes %s;\n", m->fields[j].name);
+            }
+        }
+        fprintf(out, "    uint32_t present;\n");
+        for (int j = 0; j < m->nfields; j++) {
+            if (m->fields[j].optional) {
+                fprintf(out, "    %s %s;\n", m->fields[j].type->ctype, m->fields[j].name);
+            }
+        }
+        fprintf(out, "};\n\n");
+
+        fprintf(out, "size_t pipe_msg_%s_size(const struct pipe_msg_%s *msg);\n", m->name, m->name);
+        fprintf(out, "ssize_t pipe_msg_%s_encode(const struct pipe_msg_%s *msg, void *buf, size_t cap);\n", m->name,
+                m->name);
+        fprintf(out, "int pipe_msg_%s_decode(struct pipe_msg_%s_view *view, const void *buf, size_t len);\n", m->name,
+                m->name);
+    }
+    fprintf(out, "\n#endif\n");
+}
+
+static void write_size(FILE *out, const struct message *m) {
+    fprintf(out, "\n/**\n * Returns the encoded size of a %s.\n */\n", m->name);
+    fprintf(out, "size_t pipe_msg_%s_size(const struct pipe_msg_%s *msg) {\n", m->name, m->name);
+    fprintf(out, "    size_t len = sizeof(struct pipe_msg_%s_fixed);\n\n", m->name);
+    fprintf(out, "    len += pipe_varint_size(msg->present & PIPE_MSG_%s_OPTIONAL);\n", m->upper);
+    for (int j = 0; j < m->nfields; j++) {
+        const struct field *f = &m->fields[j];
+        const char *indent = "    ";
+
+        if (is_fixed(f)) {
+            continue;
+        }
+        if (f->optional) {
+            fprintf(out, "    if (msg->present & PIPE_MSG_%s_HAS_%s) {\n", m->upper, f->upper);
+            indent = "        ";
+        }
+        switch (f->type->kind) {
+        case KIND_UINT:
+            fprintf(out, "%slen += pipe_varint_size(msg->%s);\n", indent, f->name);
+            break;
+        case KIND_INT:
+            fprintf(out, "%slen += pipe_varint_size(pipe_zigzag_encode(msg->%s));\n", indent, f->name);
+            break;
+        case KIND_FLOAT:
+            fprintf(out, "%slen += sizeof(msg->%s);\n", indent, f->name);
+            break;
+        case KIND_BYTES:
+            fprintf(out, "%slen += pipe_varint_size(msg->%s.len) + msg->%s.len;\n", indent, f->name, f->name);
+            break;
+        }
+        if (f->optional) {
+            fprintf(out, "    }\n");
+        }
+    }
+    fprintf(out, "    return len;\n}\n");
+}
+
+static void write_encode(FILE *out, const struct message *m) {
+    fprintf(out, "\n/**\n * Encodes a %s into `buf`.\n *\n", m->name);
+    fprintf(out, " * @return The encoded length, or -1 with errno ENOBUFS if it does not fit in `cap` bytes.\n */\n");
+    fprintf(out, "ssize_t pipe_msg_%s_encode(const struct pipe_msg_%s *msg, void *buf, size_t cap) {\n", m->name,
+            m->name);
+    fprintf(out, "    struct pipe_msg_%s_fixed fixed;\n    uint8_t *p = buf;\n\n", m->name);
+    fprintf(out, "    if (pipe_msg_%s_size(msg) > cap) {\n        errno = ENOBUFS;\n        return -1;\n    }\n",
+            m->name);
+    fprintf(out, "    fixed.msg_id = PIPE_MSG_%s_ID;\n", m->upper);
+    for (int j = 0; j < m->nfields; j++) {
+        if (is_fixed(&m->fields[j])) {
+            fprintf(out, "    fixed.%s = msg->%s;\n", m->fields[j].name, m->fields[j].name);
+        }
+    }
+    fprintf(out, "    memcpy(p, &fixed, sizeof(fixed));\n    p += sizeof(fixed);\n");
+    for (int j = 0; j < m->nfields; j++) {
+        if (!m->fields[j].optional && m->fields[j].type->kind == KIND_BYTES) {
+            fprintf(out, "    p = pipe_codec_put_bytes(p, msg->%s);\n", m->fields[j].name);
+        }
+    }
+    fprintf(out, "    p += pipe_varint_put(p, msg->present & PIPE_MSG_%s_OPTIONAL);\n", m->upper);
+    for (int j = 0; j < m->nfields; j++) {
+        const struct field *f = &m->fields[j];
+
+        if (!f->optional) {
+            continue;
+        }
+        fprintf(out, "    if (msg->present & PIPE_MSG_%s_HAS_%s) {\n", m->upper, f->upper);
+        switch (f->type->kind) {
+        case KIND_UINT:
+            fprintf(out, "        p += pipe_varint_put(p, msg->%s);\n", f->name);
+            break;
+        case KIND_INT:
+            fprintf(out, "        p += pipe_varint_put(p, pipe_zigzag_encode(msg->%s));\n", f->name);
+            break;
+        case KIND_FLOAT:
+            fprintf(out, "        memcpy(p, &msg->%s, sizeof(msg->%s));\n        p += sizeof(msg->%s);\n", f->name,
+                    f->name, f->name);
+            break;
+        case KIND_BYTES:
+            fprintf(out, "        p = pipe_codec_put_bytes(p, msg->%s);\n", f->name);
+            break;
+        }
+        fprintf(out, "    }\n");
+    }
+    fprintf(out, "    return p - (uint8_t *)buf;\n}\n");
+}
+
+static void write_decode(FILE *out, const struct message *m) {
+    fprintf(out, "\n/**\n * Decodes a %s in place. Optional fields this schema does not know about are ignored.\n *\n",
+            m->name);
+    fprintf(out, " * @return 0 on success, or -1 with errno EBADMSG if `buf` does not hold a valid %s.\n */\n",
+            m->name);
+    fprintf(out, "int pipe_msg_%s_decode(struct pipe_msg_%s_view *view, const void *buf, size_t len) {\n", m->name,
+            m->name);
+    fprintf(out, "    const uint8_t *p = buf, *end = p + len;\n");
+    for (int j = 0; j < m->nfields; j++) {
+        if (m->fields[j].optional && (m->fields[j].type->kind == KIND_UINT || m->fields[j].type->kind == KIND_INT)) {
+            fprintf(out, "    uint64_t v;\n");
+            break;
+        }
+    }
+    fprintf(out, "    uint64_t present;\n\n");
+    fprintf(out, "    if (len < sizeof(*view->fixed) || pipe_codec_msg_id(buf, len) != PIPE_MSG_%s_ID) {\n"
+                 "        goto bad;\n    }\n", m->upper);
+    fprintf(out, "    view->fixed = buf;\n    p += sizeof(*view->fixed);\n");
+    for (int j = 0; j < m->nfields; j++) {
+        if (!m->fields[j].optional && m->fields[j].type->kind == KIND_BYTES) {
+            fprintf(out, "    if (pipe_codec_get_bytes(&p, end, &view->%s) == -1) {\n        goto bad;\n    }\n",
+                    m->fields[j].name);
+        }
+    }
+    fprintf(out, "    if (pipe_varint_get(&p, end, &present) == -1) {\n        goto bad;\n    }\n");
+    fprintf(out, "    view->present = present & PIPE_MSG_%s_OPTIONAL;\n", m->upper);
+    for (int j = 0; j < m->nfields; j++) {
+        const struct field *f = &m->fields[j];
+        const struct field_type *t = f->type;
+
+        if (!f->optional) {
+            continue;
+        }
+        fprintf(out, "    if (view->present & PIPE_MSG_%s_HAS_%s) {\n", m->upper, f->upper);
+        switch (t->kind) {
+        case KIND_UINT:
+            fprintf(out, "        if (pipe_varint_get(&p, end, &v) == -1%s%s) {\n            goto bad;\n        }\n",
+                    t->max ? " || v > " : "", t->max ? t->max : "");
+            fprintf(out, "        view->%s = (%s)v;\n", f->name, t->ctype);
+            break;
+        case KIND_INT:
+            fprintf(out, "        if (pipe_varint_get(&p, end, &v) == -1) {\n            goto bad;\n        }\n");
+            if (t->min != NULL) {
+                fprintf(out, "        int64_t s = pipe_zigzag_decode(v);\n");
+                fprintf(out, "        if (s < %s || s > %s) {\n            goto bad;\n        }\n", t->min, t->max);
+                fprintf(out, "        view->%s = (%s)s;\n", f->name, t->ctype);
+            } else {
+                fprintf(out, "        view->%s = pipe_zigzag_decode(v);\n", f->name);
+            }
+            break;
+        case KIND_FLOAT:
+            fprintf(out, "        if ((size_t)(end - p) < sizeof(view->%s)) {\n            goto bad;\n        }\n",
+                    f->name);
+            fprintf(out, "        memcpy(&view->%s, p, sizeof(view->%s));\n        p += sizeof(view->%s);\n",
+                    f->name, f->name, f->name);
+            break;
+        case KIND_BYTES:
+            fprintf(out, "        if (pipe_codec_get_bytes(&p, end, &view->%s) == -1) {\n            goto bad;\n"
+                         "        }\n", f->name);
+            break;
+        }
+        fprintf(out, "    }\n");
+    }
+    fprintf(out, "    return 0;\n\nbad:\n    errno = EBADMSG;\n    return -1;\n}\n");
+}
+
+static void write_source(FILE *out, const char *schema, const char *header) {
+    fprintf(out, "/* Generated by pipe_schemac from %s, do not edit. */\n\n", schema);
+    fprintf(out, "#include <stdint.h>\n#include <string.h>\n#include <errno.h>\n\n#include \"%s\"\n", header);
+    for (int i = 0; i < nmessages; i++) {
+        write_size(out, &messages[i]);
+        write_encode(out, &messages[i]);
+        write_decode(out, &messages[i]);
+    }
+}
+
+static const char *base_name(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash != NULL ? slash + 1 : path;
+}
+
+static char *read_file(const char *path) {
+    FILE *f = fopen(path, "r");
+    char *buf = NULL;
+    size_t len = 0, cap = 0, n;
+
+    if (f == NULL) {
+        fprintf(stderr, "Error opening %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    do {
+        if (cap - len < BUFSIZ + 1) {
+            cap = cap ? cap * 2 : BUFSIZ * 4;
+            buf = realloc(buf, cap);
+            if (buf == NULL) {
+                fprintf(stderr, "Error reading %s: %s\n", path, strerror(errno));
+                fclose(f);
+                return NULL;
+            }
+        }
+        n = fread(buf + len, 1, cap - len - 1, f);
+        len += n;
+    } while (n > 0);
+    buf[len] = '\0';
+    fclose(f);
+    return buf;
+}
+
+int main(int argc, char *argv[]) {
+    struct parser ps = { .line = 1 };
+    char guard[MAX_IDENT * 4];
+    const char *header;
+    FILE *hout, *cout;
+    size_t k = 0;
+
+    if (argc != 4) {
+        fprintf(stderr, "usage - %s <schema> <header out> <source out>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    ps.path = argv[1];
+    ps.p = read_file(argv[1]);
+    if (ps.p == NULL) {
+        return EXIT_FAILURE;
+    }
+    parse_schema(&ps);
+
+    header = base_name(argv[2]);
+    for (const char *c = header; *c != '\0' && k < sizeof(guard) - 1; c++) {
+        guard[k++] = isalnum((unsigned char)*c) ? toupper((unsigned char)*c) : '_';
+    }
+    guard[k] = '\0';
+
+    hout = fopen(argv[2], "w");
+    cout = fopen(argv[3], "w");
+    if (hout == NULL || cout == NULL) {
+        fprintf(stderr, "Error creating output: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    write_header(hout, base_name(argv[1]), guard);
+    write_source(cout, base_name(argv[1]), header);
+    if (fclose(hout) != 0 || fclose(cout) != 0) {
+        fprintf(stderr, "Error writing output: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
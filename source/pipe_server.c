@@ -0,0 +1,864 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <semaphore.h>
+
+#include "pipe_handler.h"
+#include "pipe_server.h"
+#include "pipe_conn.h"
+#include "pipe_lz.h"
+#include "pipe_pool.h"
+#include "pipe_reliable.h"
+#include "pipe_log.h"
+#include "pipe_metrics.h"
+#include "pipe_time.h"
+
+#ifndef PIPE_BUF
+#define PIPE_BUF 4096
+#endif
+
+#define FLUSH_LIST_SIZE 64
+#define REPLY_TIMEOUT 0.1
+
+/**
+ * A client that announced a private reply pipe. The I/O thread owns the table entry and the
+ * fragment assembler; the reply side is shared with the workers and guarded by `lock`. Small
+ * replies are staged in `out` and written together, at most PIPE_BUF bytes at a time.
+ *
+ * `lock` is never held while waiting for room in the pipe. A writer takes a turn from `turns`
+ * together with its bytes and waits on `turn` until `served` reaches it, so writes that went
+ * out of the lock still reach the pipe in the order they were taken.
+ *
+ * `lz` exists when compression was negotiated: its input side restores requests on the I/O
+ * thread, its output side packs replies under `lock`. `window` filters the duplicates of a
+ * `reliable` client and is written by the I/O thread; `done` records which of its messages the
+ * handler has finished and is what the SACKs report. Both are guarded by `lock`.
+ *
+ * `fd` is -1 and `opening` is set while the reply pipe has no reader yet; replies fail with
+ * ENOTCONN until the I/O thread manages to open it.
+ */
+struct pipe_client {
+    uint32_t src;
+    int fd;
+    struct pending_open *opening;
+    atomic_int refs;
+    atomic_bool dead;
+    pthread_mutex_t lock;
+    pthread_cond_t turn;
+    unsigned int turns;
+    unsigned int served;
+    pipe_frame_assembler_t assembler;
+    pipe_lz_ctx_t *lz;
+    bool reliable;
+    pipe_rel_window_t window;
+    pipe_rel_window_t done;
+    size_t out_len;
+    char out[PIPE_BUF];
+};
+
+/**
+ * A client whose reply pipe could not be opened when its HELLO arrived. The I/O thread retries
+ * whenever inotify reports an open of the pipe and drops the client after REPLY_TIMEOUT.
+ */
+struct pending_open {
+    pipe_server_t *srv;
+    struct pipe_client *client;
+    int watch_fd;
+    uint16_t flags;             // the flags of the HELLO
+    struct pipe_timer timer;
+    char name[PIPE_NAME_MAX];
+};
+
+/**
+ * Clients with staged replies, flushed by the thread that staged them once it runs out of work.
+ */
+struct flush_list {
+    struct pipe_client *items[FLUSH_LIST_SIZE];
+    int n;
+};
+
+struct queued_request {
+    struct pipe_request req;
+    char *owner;        // the pooled buffer holding the payload, NULL when it is in `data`
+    char data[];
+};
+
+static __thread struct flush_list *current_flush = NULL;
+static __thread struct flush_list *current_acks = NULL;
+
+static void client_put(struct pipe_client *c) {
+    if (atomic_fetch_sub(&c->refs, 1) == 1) {
+        if (c->fd >= 0) {
+            close(c->fd);
+        }
+        pthread_cond_destroy(&c->turn);
+        pthread_mutex_destroy(&c->lock);
+        pipe_frame_assembler_free(&c->assembler);
+        pipe_lz_free(c->lz);
+        free(c);
+    }
+}
+
+/**
+ * Writes `len` bytes of staged replies and then, if `hdr` is set, one frame. Called with `c->lock`
+ * held; the lock is dropped for the write itself, so a slow client holds up neither the I/O
+ * thread nor the workers staging replies for it. `out` and `data` must not be owned by `c`.
+ */
+static void client_write_locked(struct pipe_client *c, const char *out, size_t len, const struct pipe_frame_hdr *hdr, const void *data) {
+    unsigned int turn = c->turns++;
+    struct iovec iov = { .iov_base = (void *)out, .iov_len = len };
+    uint64_t deadline = pipe_deadline_from_timeout(REPLY_TIMEOUT);
+    int ret = 0;
+
+    while (c->served != turn) {
+        pthread_cond_wait(&c->turn, &c->lock);
+    }
+    pthread_mutex_unlock(&c->lock);
+    if (len > 0) {
+        ret = (int)writev_to_pipe(c->fd, &iov, 1, deadline);
+    }
+    if (ret != -1 && hdr != NULL) {
+        ret = pipe_frame_write(c->fd, hdr, data, deadline);
+    }
+    if (ret == -1) {
+        // the client went away without saying goodbye, the I/O thread drops it
+        atomic_store(&c->dead, true);
+    }
+    pthread_mutex_lock(&c->lock);
+    c->served++;
+    pthread_cond_broadcast(&c->turn);
+}
+
+static void client_flush_locked(struct pipe_client *c) {
+    char out[PIPE_BUF];
+    size_t len = c->out_len;
+
+    c->out_len = 0;
+    if (len == 0 || c->fd == -1) {
+        return;
+    }
+    memcpy(out, c->out, len);
+    client_write_locked(c, out, len, NULL, NULL);
+}
+
+static void flush_list_run(struct flush_list *fl) {
+    for (int i = 0; i < fl->n; i++) {
+        pthread_mutex_lock(&fl->items[i]->lock);
+        client_flush_locked(fl->items[i]);
+        pthread_mutex_unlock(&fl->items[i]->lock);
+        client_put(fl->items[i]);
+    }
+    fl->n = 0;
+}
+
+static void flush_list_add(struct flush_list *fl, struct pipe_client *c) {
+    for (int i = 0; i < fl->n; i++) {
+        if (fl->items[i] == c) {
+            return;
+        }
+    }
+    if (fl->n == FLUSH_LIST_SIZE) {
+        flush_list_run(fl);
+    }
+    atomic_fetch_add(&c->refs, 1);
+    fl->items[fl->n++] = c;
+}
+
+/**
+ * Sends a reply to the client that issued `req`. May be called from the handler on any thread,
+ * any number of times. Replies made from inside a handler are staged and written in batches once
+ * the calling thread runs out of requests; other replies, and those larger than PIPE_BUF, are
+ * written immediately.
+ *
+ * @param srv The server.
+ * @param req The request being answered.
+ * @param type The message type of the reply, e.g. PIPE_MSG_ACK.
+ * @param data The reply payload.
+ * @param len The payload length.
+ * @return 0 on success, or -1 if the request has no reply pipe or the client is gone.
+ */
+int pipe_server_reply(pipe_server_t *srv, const struct pipe_request *req, uint16_t type, const void *data, size_t len) {
+    struct pipe_client *c = req->client;
+    struct pipe_frame_hdr hdr;
+    size_t size;
+    bool staged = false;
+
+    (void)srv;
+    if (c == NULL) {
+        errno = ENOTCONN;
+        return -1;
+    }
+    if (len > PIPE_FRAME_MAX_LEN) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.len = (uint32_t)len;
+    hdr.type = type;
+    hdr.seq = req->hdr.seq;
+    hdr.src = req->hdr.src;
+
+    pthread_mutex_lock(&c->lock);
+    if (c->fd == -1) {
+        pthread_mutex_unlock(&c->lock);
+        errno = ENOTCONN;
+        return -1;
+    }
+    if (c->lz != NULL) {
+        const char *packed;
+        ssize_t n = pipe_lz_pack(c->lz, data, len, &packed);
+        if (n > 0) {
+            data = packed;
+            hdr.len = (uint32_t)n;
+            hdr.flags = PIPE_FRAME_LZ;
+        }
+    }
+    size = PIPE_FRAME_HDR_SIZE + hdr.len;
+    if (current_flush != NULL && size <= PIPE_BUF) {
+        char full[PIPE_BUF];
+        size_t full_len = 0;
+
+        // the full batch is taken before this reply is staged, so it keeps the earlier turn
+        if (c->out_len + size > PIPE_BUF) {
+            full_len = c->out_len;
+            memcpy(full, c->out, full_len);
+            c->out_len = 0;
+        }
+        c->out_len += pipe_frame_encode(c->out + c->out_len, PIPE_BUF - c->out_len, &hdr, data);
+        pipe_metrics_add(c->fd, PIPE_METRIC_MSGS_SENT, 1);
+        staged = true;
+        if (full_len > 0) {
+            client_write_locked(c, full, full_len, NULL, NULL);
+        }
+    } else {
+        char out[PIPE_BUF], small[PIPE_BUF];
+        size_t out_len = c->out_len;
+        char *copy = NULL;
+
+        // a packed payload lives in `lz`, which the next reply reuses once the lock is dropped
+        if (hdr.flags & PIPE_FRAME_LZ) {
+            copy = hdr.len <= sizeof(small) ? small : malloc(hdr.len);
+            if (copy == NULL) {
+                pthread_mutex_unlock(&c->lock);
+                return -1;
+            }
+            data = memcpy(copy, data, hdr.len);
+        }
+        memcpy(out, c->out, out_len);
+        c->out_len = 0;
+        client_write_locked(c, out, out_len, &hdr, data);
+        if (copy != small) {
+            free(copy);
+        }
+    }
+    pthread_mutex_unlock(&c->lock);
+
+    // registered after unlocking, a full list flushes other clients and must not nest their locks
+    if (staged) {
+        flush_list_add(current_flush, c);
+    }
+    if (atomic_load(&c->dead)) {
+        errno = EPIPE;
+        return -1;
+    }
+    return 0;
+}
+
+static size_t client_slot(const pipe_server_t *srv, uint32_t src) {
+    size_t mask = srv->capacity - 1;
+    size_t i = (src * 2654435761u) & mask;
+
+    while (srv->clients[i] != NULL && srv->clients[i]->src != src) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static int grow_clients(pipe_server_t *srv) {
+    struct pipe_client **old = srv->clients;
+    size_t old_capacity = srv->capacity;
+    size_t capacity = old_capacity ? old_capacity * 2 : 64;
+    struct pipe_client **clients = calloc(capacity, sizeof(*clients));
+
+    if (clients == NULL) {
+        pipe_log(PIPE_LOG_ERROR, "Error allocating client table: %s\n", strerror(errno));
+        return -1;
+    }
+    srv->clients = clients;
+    srv->capacity = capacity;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i] != NULL) {
+            srv->clients[client_slot(srv, old[i]->src)] = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+static void cancel_open(pipe_server_t *srv, struct pipe_client *c) {
+    struct pending_open *p = c->opening;
+
+    if (p == NULL) {
+        return;
+    }
+    pipe_reactor_del(&srv->reactor, p->watch_fd);
+    close(p->watch_fd);
+    pipe_reactor_timer_cancel(&srv->reactor, &p->timer);
+    free(p);
+    c->opening = NULL;
+}
+
+static void remove_client(pipe_server_t *srv, uint32_t src) {
+    size_t mask = srv->capacity - 1;
+    size_t i = client_slot(srv, src), j;
+    struct pipe_client *c = srv->clients[i];
+
+    if (c == NULL) {
+        return;
+    }
+
+    // backward shift deletion keeps the probe sequences intact without tombstones
+    srv->clients[i] = NULL;
+    for (j = (i + 1) & mask; srv->clients[j] != NULL; j = (j + 1) & mask) {
+        size_t home = (srv->clients[j]->src * 2654435761u) & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            srv->clients[i] = srv->clients[j];
+            srv->clients[j] = NULL;
+            i = j;
+        }
+    }
+    srv->nclients--;
+
+    cancel_open(srv, c);
+    atomic_store(&c->dead, true);
+    client_put(c);
+}
+
+/**
+ * Attaches the opened reply pipe to a client and answers its offer of compression, a client that
+ * made none gets no reply and sees no change.
+ */
+static void client_connected(pipe_server_t *srv, struct pipe_client *c, int fd, uint16_t flags) {
+    char role[PIPE_NAME_MAX];
+
+    // every client has a reply pipe of its own, their metrics are kept together
+    snprintf(role, sizeof(role), "%s.reply", srv->cfg.name);
+    pipe_metrics_bind_name(fd, role);
+
+    pthread_mutex_lock(&c->lock);
+    c->fd = fd;
+    if (flags & PIPE_FRAME_LZ) {
+        struct pipe_frame_hdr answer = { .type = PIPE_MSG_HELLO, .src = c->src };
+        if (srv->cfg.compress_threshold > 0 && (c->lz = pipe_lz_new(srv->cfg.compress_threshold)) != NULL) {
+            answer.flags = PIPE_FRAME_LZ;
+        }
+        // a reply pipe that was just opened has room, the I/O thread must not wait here
+        pipe_frame_write(c->fd, &answer, NULL, pipe_deadline_from_timeout(0));
+    }
+    pthread_mutex_unlock(&c->lock);
+}
+
+static void retry_open(struct pending_open *p) {
+    pipe_server_t *srv = p->srv;
+    struct pipe_client *c = p->client;
+    uint16_t flags = p->flags;
+    int fd = open_peer_pipe(p->name);
+
+    if (fd == -1 && errno == ENXIO) {
+        return;
+    }
+    cancel_open(srv, c);
+    if (fd == -1) {
+        remove_client(srv, c->src);
+    } else {
+        client_connected(srv, c, fd, flags);
+    }
+}
+
+static void on_reply_open(int fd, uint32_t events, void *arg) {
+    (void)events;
+    pipe_watch_drain(fd);
+    retry_open(arg);
+}
+
+static void on_open_timeout(struct pipe_timer *t, void *arg) {
+    struct pending_open *p = arg;
+
+    (void)t;
+    pipe_log(PIPE_LOG_WARN, "Client %u did not open its reply pipe %s in time\n", p->client->src, p->name);
+    remove_client(p->srv, p->client->src);
+}
+
+/**
+ * Keeps retrying the open of a reply pipe from the reactor, without blocking the I/O thread.
+ */
+static int wait_for_reader(pipe_server_t *srv, struct pipe_client *c, const char *name, uint16_t flags) {
+    struct pending_open *p = calloc(1, sizeof(*p));
+
+    if (p == NULL) {
+        pipe_log(PIPE_LOG_ERROR, "Error allocating client: %s\n", strerror(errno));
+        return -1;
+    }
+    p->srv = srv;
+    p->client = c;
+    p->flags = flags;
+    snprintf(p->name, sizeof(p->name), "%s", name);
+    p->watch_fd = pipe_watch_open(name);
+    if (p->watch_fd == -1) {
+        free(p);
+        return -1;
+    }
+    if (pipe_reactor_add(&srv->reactor, p->watch_fd, PIPE_EV_IN, on_reply_open, p) == -1) {
+        close(p->watch_fd);
+        free(p);
+        return -1;
+    }
+    c->opening = p;
+    pipe_reactor_timer_arm(&srv->reactor, &p->timer, pipe_deadline_from_timeout(REPLY_TIMEOUT), on_open_timeout, p);
+    // a reader that arrived before the watch was armed raised no event
+    retry_open(p);
+    return 0;
+}
+
+static void add_client(pipe_server_t *srv, const struct pipe_frame *hello) {
+    const struct pipe_frame_hdr *hdr = &hello->hdr;
+    const char *reply_name = hello->payload;
+    size_t name_len = strlen(reply_name) + 1;
+    uint32_t src = hdr->src;
+    struct pipe_client *c;
+    int fd;
+
+    if (name_len > PIPE_NAME_MAX) {
+        pipe_log(PIPE_LOG_WARN, "Ignoring client %u with a reply pipe name of %zu bytes\n", src, name_len);
+        return;
+    }
+    // a client that reconnects announces itself again
+    remove_client(srv, src);
+
+    if ((srv->nclients + 1) * 2 > srv->capacity && grow_clients(srv) == -1) {
+        return;
+    }
+    c = calloc(1, sizeof(*c));
+    if (c == NULL) {
+        pipe_log(PIPE_LOG_ERROR, "Error allocating client: %s\n", strerror(errno));
+        return;
+    }
+    c->src = src;
+    c->fd = -1;
+    atomic_init(&c->refs, 1);
+    atomic_init(&c->dead, false);
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->turn, NULL);
+
+    // a reliable client says where its unacknowledged messages start, older seqs are duplicates
+    if ((hdr->flags & PIPE_FRAME_REL) && hdr->len >= name_len + sizeof(uint32_t)) {
+        uint32_t base;
+        memcpy(&base, reply_name + name_len, sizeof(base));
+        pipe_rel_window_reset(&c->window, base);
+        pipe_rel_window_reset(&c->done, base);
+        c->reliable = true;
+    }
+
+    srv->clients[client_slot(srv, src)] = c;
+    srv->nclients++;
+
+    // the name comes from the client, so it must be its own FIFO and is never created for it
+    fd = open_peer_pipe(reply_name);
+    if (fd >= 0) {
+        client_connected(srv, c, fd, hdr->flags);
+    } else if (errno != ENXIO || wait_for_reader(srv, c, reply_name, hdr->flags) == -1) {
+        remove_client(srv, src);
+    }
+}
+
+static void send_acks(pipe_server_t *srv, struct flush_list *acks) {
+    for (int i = 0; i < acks->n; i++) {
+        struct pipe_client *c = acks->items[i];
+        struct pipe_request req = { .hdr = { .src = c->src }, .client = c };
+        uint64_t sack;
+
+        pthread_mutex_lock(&c->lock);
+        req.hdr.seq = c->done.base;
+        // the sender reads a gap below a selective ack as a loss, but with workers a gap may only
+        // be a message still being handled, so selective acks wait until no such gap is left
+        sack = c->done.base == c->window.base ? pipe_rel_window_sack(&c->done) : 0;
+        pthread_mutex_unlock(&c->lock);
+
+        pipe_server_reply(srv, &req, PIPE_MSG_SACK, &sack, sizeof(sack));
+        client_put(c);
+    }
+    acks->n = 0;
+}
+
+/**
+ * Schedules an acknowledgement for a reliable client. One SACK per client covers everything the
+ * calling thread finished before it runs out of work.
+ */
+static void ack_later(pipe_server_t *srv, struct pipe_client *c) {
+    struct flush_list *acks = current_acks;
+
+    for (int i = 0; i < acks->n; i++) {
+        if (acks->items[i] == c) {
+            return;
+        }
+    }
+    if (acks->n == FLUSH_LIST_SIZE) {
+        send_acks(srv, acks);
+    }
+    atomic_fetch_add(&c->refs, 1);
+    acks->items[acks->n++] = c;
+}
+
+/**
+ * Decides whether a reliable message is new. Duplicates are acknowledged again, since the
+ * sender only resends when it missed the earlier acknowledgement; one that is still being
+ * handled is acknowledged when the handler finishes.
+ */
+static bool accept_reliable(pipe_server_t *srv, struct pipe_client *c, const struct pipe_frame *msg) {
+    int ret;
+
+    if (!c->reliable) {
+        return true;
+    }
+    pthread_mutex_lock(&c->lock);
+    ret = pipe_rel_window_accept(&c->window, msg->hdr.seq);
+    pthread_mutex_unlock(&c->lock);
+    if (ret == 0) {
+        ack_later(srv, c);
+    } else if (ret == -1) {
+        pipe_log(PIPE_LOG_WARN, "Dropping message %u from %u beyond the acknowledgement window\n", msg->hdr.seq, c->src);
+    }
+    return ret == 1;
+}
+
+/**
+ * Acknowledges a reliable request once its handler has returned, so a crash or restart can only
+ * lose messages that the sender still holds for retransmission.
+ */
+static void request_done(pipe_server_t *srv, const struct pipe_request *req) {
+    struct pipe_client *c = req->client;
+
+    if (c == NULL || !c->reliable || !(req->hdr.flags & PIPE_FRAME_REL)) {
+        return;
+    }
+    pthread_mutex_lock(&c->lock);
+    pipe_rel_window_accept(&c->done, req->hdr.seq);
+    pthread_mutex_unlock(&c->lock);
+    ack_later(srv, c);
+}
+
+static void dispatch(pipe_server_t *srv, struct pipe_client *c, const struct pipe_frame *msg) {
+    struct queued_request *qr;
+    char *owner = NULL;
+
+    if (srv->cfg.workers == 0) {
+        struct pipe_request req = { .hdr = msg->hdr, .payload = msg->payload, .client = c };
+        srv->cfg.handler(srv, &req, srv->cfg.arg);
+        request_done(srv, &req);
+        return;
+    }
+
+    // payloads in the reader's or the assembler's buffer are kept alive by a reference, only
+    // decompressed ones need a copy
+    if (msg->payload >= srv->reader.buf && msg->payload < srv->reader.buf + srv->reader.cap) {
+        owner = srv->reader.buf;
+    } else if (c != NULL && msg->payload == c->assembler.buf) {
+        owner = c->assembler.buf;
+    }
+    qr = pipe_pool_alloc(sizeof(*qr) + (owner != NULL ? 0 : msg->hdr.len));
+    if (qr == NULL) {
+        return;
+    }
+    qr->req.hdr = msg->hdr;
+    qr->req.client = c;
+    if (owner != NULL) {
+        qr->owner = pipe_pool_ref(owner);
+        qr->req.payload = msg->payload;
+    } else {
+        qr->owner = NULL;
+        qr->req.payload = qr->data;
+        memcpy(qr->data, msg->payload, msg->hdr.len);
+    }
+    if (c != NULL) {
+        atomic_fetch_add(&c->refs, 1);
+    }
+
+    // backpressure: while the workers are saturated we stop draining the FIFO
+    while (pipe_queue_push(&srv->queue, qr, pipe_deadline_from_timeout(0.1)) == -1) {
+        if (pipe_reactor_stopped(&srv->reactor)) {
+            if (c != NULL) {
+                client_put(c);
+            }
+            pipe_pool_put(qr->owner);
+            pipe_pool_put(qr);
+            return;
+        }
+    }
+}
+
+static void on_frame(pipe_server_t *srv, const struct pipe_frame *frame) {
+    struct pipe_client *c = srv->clients[client_slot(srv, frame->hdr.src)];
+    struct pipe_frame msg;
+
+    if (c != NULL && atomic_load(&c->dead)) {
+        remove_client(srv, frame->hdr.src);
+        c = NULL;
+    }
+
+    switch (frame->hdr.type) {
+    case PIPE_MSG_HELLO:
+        if (frame->hdr.len > 0 && memchr(frame->payload, '\0', frame->hdr.len) != NULL) {
+            add_client(srv, frame);
+        }
+        break;
+    case PIPE_MSG_BYE:
+        remove_client(srv, frame->hdr.src);
+        break;
+    default:
+        if (c == NULL) {
+            // legacy writers have no reply pipe, never fragment and never compress
+            if (!(frame->hdr.flags & PIPE_FRAME_LZ)) {
+                dispatch(srv, NULL, frame);
+            }
+        } else if (pipe_frame_assemble(&c->assembler, frame, &msg) == 1) {
+            // restored before it is accepted, a message that cannot be restored stays unacknowledged
+            if (msg.hdr.flags & PIPE_FRAME_LZ) {
+                ssize_t len = c->lz != NULL ? pipe_lz_unpack(c->lz, msg.payload, msg.hdr.len, &msg.payload) : -1;
+                if (len == -1) {
+                    pipe_log(PIPE_LOG_WARN, "Dropping compressed request %u that cannot be restored\n", msg.hdr.seq);
+                    break;
+                }
+                msg.hdr.len = (uint32_t)len;
+                msg.hdr.flags &= ~PIPE_FRAME_LZ;
+            }
+            if ((msg.hdr.flags & PIPE_FRAME_REL) && !accept_reliable(srv, c, &msg)) {
+                break;
+            }
+            dispatch(srv, c, &msg);
+        }
+        break;
+    }
+}
+
+static void on_readable(int fd, uint32_t events, void *arg) {
+    pipe_server_t *srv = arg;
+    struct flush_list fl = { .n = 0 }, acks = { .n = 0 };
+    struct pipe_frame frame;
+    ssize_t num_read;
+    int ret = 0;
+
+    (void)events;
+    current_flush = &fl;
+    current_acks = &acks;
+    // drain everything that is buffered, then go back to sleep in epoll_wait()
+    while (!pipe_reactor_stopped(&srv->reactor)) {
+        num_read = pipe_frame_reader_fill(&srv->reader, fd);
+        if (num_read == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                pipe_reactor_stop(&srv->reactor);
+            }
+            break;
+        } else if (num_read == 0) {
+            // cannot happen while we hold the keepalive write end
+            break;
+        }
+
+        while (!pipe_reactor_stopped(&srv->reactor) && (ret = pipe_frame_next(&srv->reader, &frame)) == 1) {
+            pipe_metrics_add(fd, PIPE_METRIC_MSGS_RECV, 1);
+            on_frame(srv, &frame);
+        }
+        if (ret == -1) {
+            // one client wrote garbage, drop what is buffered rather than stopping every client
+            size_t n = pipe_frame_reader_discard(&srv->reader);
+            pipe_log(PIPE_LOG_WARN, "Discarded %zu bytes after a corrupt frame\n", n);
+            pipe_metrics_add(fd, PIPE_METRIC_CORRUPT_BYTES, n);
+        }
+    }
+
+    send_acks(srv, &acks);
+    current_acks = NULL;
+    flush_list_run(&fl);
+    current_flush = NULL;
+}
+
+static void *worker_main(void *arg) {
+    pipe_server_t *srv = arg;
+    struct flush_list fl = { .n = 0 }, acks = { .n = 0 };
+    struct queued_request *qr;
+    int pending;
+
+    current_flush = &fl;
+    current_acks = &acks;
+    while ((qr = pipe_queue_pop(&srv->queue)) != NULL) {
+        srv->cfg.handler(srv, &qr->req, srv->cfg.arg);
+        request_done(srv, &qr->req);
+        if (qr->req.client != NULL) {
+            client_put(qr->req.client);
+        }
+        pipe_pool_put(qr->owner);
+        pipe_pool_put(qr);
+
+        // keep staging replies while more requests are waiting, flush once we would go idle
+        if (sem_getvalue(&srv->queue.items, &pending) == 0 && pending == 0) {
+            send_acks(srv, &acks);
+            flush_list_run(&fl);
+        }
+    }
+    send_acks(srv, &acks);
+    current_acks = NULL;
+    flush_list_run(&fl);
+    current_flush = NULL;
+    return NULL;
+}
+
+/**
+ * Initializes a server and opens its request pipe.
+ *
+ * @param srv The server to initialize.
+ * @param cfg The configuration, copied into the server. `name` must outlive the server.
+ * @return 0 on success, or -1 on error.
+ * @throws If the pipe, the reactor or the queue cannot be set up, an appropriate error message will be printed to stderr.
+ */
+int pipe_server_init(pipe_server_t *srv, const pipe_server_config_t *cfg) {
+    memset(srv, 0, sizeof(*srv));
+    srv->cfg = *cfg;
+    srv->fd = srv->keepalive_fd = -1;
+    if (srv->cfg.queue_size == 0) {
+        srv->cfg.queue_size = 1024;
+    }
+
+    if (pipe_reactor_init(&srv->reactor) == -1) {
+        return -1;
+    }
+    if (pipe_frame_reader_init(&srv->reader, 0) == -1 || grow_clients(srv) == -1) {
+        pipe_server_destroy(srv);
+        return -1;
+    }
+    if (srv->cfg.workers > 0 && pipe_queue_init(&srv->queue, srv->cfg.queue_size) == -1) {
+        pipe_server_destroy(srv);
+        return -1;
+    }
+
+    srv->fd = open_pipe_persistent(srv->cfg.name, &srv->keepalive_fd);
+    if (srv->fd == -1) {
+        pipe_server_destroy(srv);
+        return -1;
+    }
+    if (srv->cfg.capacity > 0) {
+        set_pipe_capacity(srv->fd, srv->cfg.capacity);
+    }
+    if (pipe_reactor_add(&srv->reactor, srv->fd, PIPE_EV_IN, on_readable, srv) == -1) {
+        pipe_server_destroy(srv);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Runs the server on the calling thread until `pipe_server_stop()` is called. Worker threads
+ * are started here and joined before returning.
+ *
+ * @param srv The server.
+ * @return 0 when stopped, or -1 on error.
+ */
+int pipe_server_run(pipe_server_t *srv) {
+    int i, started = 0, ret;
+
+    if (srv->cfg.workers > 0) {
+        srv->threads = calloc(srv->cfg.workers, sizeof(pthread_t));
+        if (srv->threads == NULL) {
+            pipe_log(PIPE_LOG_ERROR, "Error allocating worker threads: %s\n", strerror(errno));
+            return -1;
+        }
+        for (i = 0; i < srv->cfg.workers; i++) {
+            if (pthread_create(&srv->threads[i], NULL, worker_main, srv) != 0) {
+                pipe_log(PIPE_LOG_ERROR, "Error starting worker thread\n");
+                break;
+            }
+            started++;
+        }
+    }
+
+    ret = started == srv->cfg.workers ? pipe_reactor_run(&srv->reactor) : -1;
+
+    // one sentinel per worker, queued behind the requests that are still pending
+    for (i = 0; i < started; i++) {
+        pipe_queue_push(&srv->queue, NULL, PIPE_DEADLINE_NEVER);
+    }
+    for (i = 0; i < started; i++) {
+        pthread_join(srv->threads[i], NULL);
+    }
+    free(srv->threads);
+    srv->threads = NULL;
+    return ret;
+}
+
+/**
+ * Asks a running server to stop. Safe to call from a handler, another thread or a signal handler.
+ *
+ * @param srv The server.
+ */
+void pipe_server_stop(pipe_server_t *srv) {
+    pipe_reactor_stop(&srv->reactor);
+}
+
+/**
+ * Releases a server that is not running, closing its pipes and every client reply pipe.
+ *
+ * @param srv The server.
+ */
+void pipe_server_destroy(pipe_server_t *srv) {
+    for (size_t i = 0; i < srv->capacity; i++) {
+        if (srv->clients[i] != NULL) {
+            cancel_open(srv, srv->clients[i]);
+            client_put(srv->clients[i]);
+        }
+    }
+    free(srv->clients);
+    srv->clients = NULL;
+    srv->capacity = srv->nclients = 0;
+    if (srv->cfg.workers > 0 && srv->queue.cells != NULL) {
+        pipe_queue_destroy(&srv->queue);
+    }
+    if (srv->fd >= 0) {
+        close(srv->fd);
+    }
+    if (srv->keepalive_fd >= 0) {
+        close(srv->keepalive_fd);
+    }
+    srv->fd = srv->keepalive_fd = -1;
+    pipe_frame_reader_free(&srv->reader);
+    pipe_reactor_destroy(&srv->reactor);
+}
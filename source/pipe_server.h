@@ -0,0 +1,93 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PIPE_SERVER_H
+#define PIPE_SERVER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "pipe_frame.h"
+#include "pipe_reactor.h"
+#include "pipe_queue.h"
+
+struct pipe_client;
+typedef struct pipe_server pipe_server_t;
+
+/**
+ * A request handed to the handler. `client` is NULL for writers that did not announce a reply
+ * pipe. The payload is only valid for the duration of the handler call.
+ */
+struct pipe_request {
+    struct pipe_frame_hdr hdr;
+    char *payload;
+    struct pipe_client *client;
+};
+
+typedef void (*pipe_handler_fn)(pipe_server_t *srv, const struct pipe_request *req, void *arg);
+
+typedef struct pipe_server_config {
+    const char *name;          // the shared request pipe
+    int workers;               // worker threads, 0 runs the handler on the I/O thread
+    size_t queue_size;         // bound on requests waiting for a worker
+    int capacity;              // FIFO capacity to ask for, 0 keeps the kernel default
+    size_t compress_threshold; // smallest reply to compress for clients that offer it, 0 declines
+    pipe_handler_fn handler;
+    void *arg;
+} pipe_server_config_t;
+
+/**
+ * Multi-client request server. One I/O thread reads and parses frames from the shared request
+ * pipe and tracks the clients that announced a reply pipe with PIPE_MSG_HELLO; requests are run
+ * by the handler either inline or on a pool of workers fed through a bounded pipe_queue. When the
+ * queue is full the I/O thread stops reading, the FIFO fills up and writers block.
+ *
+ * A reply pipe must be an existing FIFO owned by the server's user, see open_peer_pipe(). When it
+ * has no reader yet the open is retried from the reactor for REPLY_TIMEOUT.
+ *
+ * Messages from a pipe_rel sender are deduplicated and acknowledged with PIPE_MSG_SACK once the
+ * handler has returned, one SACK per client whenever the I/O thread or a worker runs out of work.
+ */
+struct pipe_server {
+    pipe_server_config_t cfg;
+    pipe_reactor_t reactor;
+    pipe_frame_reader_t reader;
+    int fd;
+    int keepalive_fd;
+    struct pipe_client **clients;
+    size_t nclients;
+    size_t capacity;
+    pipe_queue_t queue;
+    pthread_t *threads;
+};
+
+int pipe_server_init(pipe_server_t *srv, const pipe_server_config_t *cfg);
+int pipe_server_run(pipe_server_t *srv);
+void pipe_server_stop(pipe_server_t *srv);
+void pipe_server_destroy(pipe_server_t *srv);
+int pipe_server_reply(pipe_server_t *srv, const struct pipe_request *req, uint16_t type, const void *data, size_t len);
+
+#endif
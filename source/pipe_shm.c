@@ -0,0 +1,377 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pipe_handler.h"
+#include "pipe_shm.h"
+#include "pipe_log.h"
+#include "pipe_time.h"
+
+#define SHM_MAGIC 0x70736d31u
+#define RECORD_HDR_SIZE 8
+#define RECORD_PAD UINT32_MAX
+#define RECORD_ALIGN(len) (((len) + 7u) & ~(size_t)7u)
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() atomic_signal_fence(memory_order_seq_cst)
+#endif
+
+struct record_hdr {
+    uint32_t len;
+    uint32_t reserved;
+};
+
+static int map_ring(pipe_shm_t *shm, int fd, size_t len) {
+    shm->ring = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shm->ring == MAP_FAILED) {
+        pipe_log(PIPE_LOG_ERROR, "Error mapping shared memory: %s\n", strerror(errno));
+        shm->ring = NULL;
+        return -1;
+    }
+    shm->map_len = len;
+    return 0;
+}
+
+/**
+ * Creates the ring as the consumer and opens the doorbell pipe for reading.
+ *
+ * @param shm The transport to initialize.
+ * @param shm_name The POSIX shared memory object name, e.g. PIPE_SHM_NAME.
+ * @param bell_name The named pipe used for wakeups, e.g. PIPE_SET_NAME.
+ * @param size The ring capacity in bytes, rounded up to a power of two; the largest message is half of it.
+ * @return 0 on success, or -1 on error.
+ * @throws If the shared memory or the pipe cannot be set up, an appropriate error message will be printed to stderr.
+ */
+int pipe_shm_listen(pipe_shm_t *shm, const char *shm_name, const char *bell_name, size_t size) {
+    size_t n = 4096;
+    int fd;
+
+    while (n < size) {
+        n *= 2;
+    }
+    memset(shm, 0, sizeof(*shm));
+    shm->bell_fd = shm->bell_keepalive_fd = -1;
+    snprintf(shm->shm_name, PIPE_NAME_MAX, "%s", shm_name);
+
+    // a ring left behind by a crashed consumer must not be attached to by new producers
+    shm_unlink(shm_name);
+    fd = shm_open(shm_name, O_CREAT | O_EXCL | O_RDWR, 0666);
+    if (fd == -1) {
+        pipe_log(PIPE_LOG_ERROR, "Error creating shared memory: %s\n", strerror(errno));
+        return -1;
+    }
+    if (ftruncate(fd, sizeof(struct pipe_shm_ring) + n) == -1) {
+        pipe_log(PIPE_LOG_ERROR, "Error sizing shared memory: %s\n", strerror(errno));
+        close(fd);
+        shm_unlink(shm_name);
+        return -1;
+    }
+    if (map_ring(shm, fd, sizeof(struct pipe_shm_ring) + n) == -1) {
+        close(fd);
+        shm_unlink(shm_name);
+        return -1;
+    }
+    close(fd);
+
+    shm->ring->size = (uint32_t)n;
+    atomic_init(&shm->ring->head, 0);
+    atomic_init(&shm->ring->tail, 0);
+    atomic_init(&shm->ring->sleeping, 0);
+
+    shm->bell_fd = open_pipe_persistent(bell_name, &shm->bell_keepalive_fd);
+    if (shm->bell_fd == -1) {
+        pipe_shm_close(shm);
+        return -1;
+    }
+
+    // publish the ring only once it is fully initialized
+    __atomic_store_n(&shm->ring->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ * Attaches to a ring as the producer, waiting until `deadline` for the consumer to create it.
+ *
+ * @param shm The transport to initialize.
+ * @param shm_name The POSIX shared memory object name.
+ * @param bell_name The named pipe used for wakeups.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds for the consumer.
+ * @return 0 on success, or -1 on error or timeout.
+ */
+int pipe_shm_connect(pipe_shm_t *shm, const char *shm_name, const char *bell_name, uint64_t deadline) {
+    struct stat st;
+    int fd;
+
+    memset(shm, 0, sizeof(*shm));
+    shm->bell_fd = shm->bell_keepalive_fd = -1;
+    shm->producer = true;
+    snprintf(shm->shm_name, PIPE_NAME_MAX, "%s", shm_name);
+
+    while (1) {
+        fd = shm_open(shm_name, O_RDWR, 0);
+        if (fd >= 0 && fstat(fd, &st) == 0 && (size_t)st.st_size > sizeof(struct pipe_shm_ring)) {
+            break;
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (pipe_now_ns() >= deadline) {
+            pipe_log(PIPE_LOG_WARN, "Timeout waiting for shared memory ring\n");
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        usleep(1000);
+    }
+    if (map_ring(shm, fd, st.st_size) == -1) {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    while (__atomic_load_n(&shm->ring->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC) {
+        if (pipe_now_ns() >= deadline) {
+            pipe_log(PIPE_LOG_WARN, "Timeout waiting for shared memory ring\n");
+            pipe_shm_close(shm);
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        usleep(1000);
+    }
+
+    shm->bell_fd = open_pipe_wait(bell_name, deadline);
+    if (shm->bell_fd == -1) {
+        pipe_shm_close(shm);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Backs off while the ring is full: spin first, then yield, then sleep up to 1 ms. Only the
+ * consumer has a doorbell, a full ring is the slow path.
+ */
+static int backoff(unsigned int *round, uint64_t deadline) {
+    if (pipe_now_ns() >= deadline) {
+        pipe_log(PIPE_LOG_WARN, "Timeout waiting for space in shared memory ring\n");
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    if (*round < 64) {
+        cpu_relax();
+    } else if (*round < 128) {
+        sched_yield();
+    } else {
+        unsigned int shift = *round - 128 < 5 ? *round - 128 : 5;
+        struct timespec ts = { 0, 32000L << shift };
+        nanosleep(&ts, NULL);
+    }
+    (*round)++;
+    return 0;
+}
+
+/**
+ * Sends one message through the ring, waiting until `deadline` for space.
+ *
+ * @param shm The producer end.
+ * @param buf A pointer to the data to be sent.
+ * @param buflen The length of the data, at most half the ring size.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds.
+ * @return The number of bytes sent, or -1 on error or timeout.
+ */
+int pipe_shm_send(pipe_shm_t *shm, const char *buf, size_t buflen, uint64_t deadline) {
+    struct pipe_shm_ring *ring = shm->ring;
+    size_t size = ring->size;
+    size_t need = RECORD_HDR_SIZE + RECORD_ALIGN(buflen);
+    unsigned int round = 0;
+    uint64_t head, tail;
+    size_t off, contig;
+    struct record_hdr hdr;
+
+    if (need > size / 2) {
+        pipe_log(PIPE_LOG_ERROR, "Message of %zu bytes does not fit in the shared memory ring\n", buflen);
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    off = head & (size - 1);
+    contig = size - off;
+    // a record never wraps, the rest of the ring is skipped with a padding record instead
+    size_t total = need > contig ? need + contig : need;
+    while (1) {
+        tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (size - (head - tail) >= total) {
+            break;
+        }
+        if (backoff(&round, deadline) == -1) {
+            return -1;
+        }
+    }
+
+    if (need > contig) {
+        hdr.len = RECORD_PAD;
+        memcpy(ring->data + off, &hdr, sizeof(hdr));
+        head += contig;
+        off = 0;
+    }
+    hdr.len = (uint32_t)buflen;
+    hdr.reserved = 0;
+    memcpy(ring->data + off, &hdr, sizeof(hdr));
+    memcpy(ring->data + off + RECORD_HDR_SIZE, buf, buflen);
+
+    // seq_cst store and load pair with the consumer's sleeping/head check, one side always sees the other
+    atomic_store(&ring->head, head + need);
+    if (atomic_load(&ring->sleeping) && atomic_exchange(&ring->sleeping, 0)) {
+        char bell = 1;
+        if (write(shm->bell_fd, &bell, 1) == -1 && errno != EAGAIN) {
+            pipe_log(PIPE_LOG_ERROR, "Error ringing doorbell: %s\n", strerror(errno));
+        }
+    }
+    return (int)buflen;
+}
+
+/**
+ * Receives one message from the ring without copying it, waiting until `deadline`. The
+ * consumer only sleeps on the doorbell pipe once the ring is empty.
+ *
+ * @param shm The consumer end.
+ * @param msg Receives the message; its payload points into the ring and stays valid until the next receive.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds.
+ * @return The payload length, or -1 on error or timeout.
+ */
+int pipe_shm_recv_msg(pipe_shm_t *shm, struct pipe_frame *msg, uint64_t deadline) {
+    struct pipe_shm_ring *ring = shm->ring;
+    size_t size = ring->size;
+    uint64_t head, tail;
+    struct record_hdr hdr;
+
+    // the previous message is handed back to the producer only now
+    if (shm->release) {
+        atomic_store_explicit(&ring->tail, shm->release, memory_order_release);
+        shm->release = 0;
+    }
+
+    while (1) {
+        tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (head != tail) {
+            size_t off = tail & (size - 1);
+            memcpy(&hdr, ring->data + off, sizeof(hdr));
+            if (hdr.len == RECORD_PAD) {
+                atomic_store_explicit(&ring->tail, tail + (size - off), memory_order_release);
+                continue;
+            }
+            memset(&msg->hdr, 0, sizeof(msg->hdr));
+            msg->hdr.len = hdr.len;
+            msg->hdr.type = PIPE_MSG_DATA;
+            msg->payload = ring->data + off + RECORD_HDR_SIZE;
+            shm->release = tail + RECORD_HDR_SIZE + RECORD_ALIGN(hdr.len);
+            return (int)hdr.len;
+        }
+
+        atomic_store(&ring->sleeping, 1);
+        if (atomic_load(&ring->head) != tail) {
+            atomic_store(&ring->sleeping, 0);
+            continue;
+        }
+
+        int ret = wait_pipe(shm->bell_fd, POLLIN, deadline);
+        if (ret > 0) {
+            char bells[64];
+            while (read(shm->bell_fd, bells, sizeof(bells)) > 0) {
+            }
+        }
+        atomic_store(&ring->sleeping, 0);
+        if (ret == 0) {
+            pipe_log(PIPE_LOG_WARN, "Timeout waiting for data in shared memory ring\n");
+            errno = ETIMEDOUT;
+        }
+        if (ret <= 0) {
+            return -1;
+        }
+    }
+}
+
+/**
+ * Receives one message from the ring into a caller supplied buffer.
+ *
+ * @param shm The consumer end.
+ * @param buf A buffer to store the message.
+ * @param buflen The size of `buf`.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds.
+ * @return The message length, or -1 on error, on timeout, or if the message does not fit (errno EMSGSIZE).
+ */
+int pipe_shm_recv(pipe_shm_t *shm, char *buf, size_t buflen, uint64_t deadline) {
+    struct pipe_frame msg;
+    int len = pipe_shm_recv_msg(shm, &msg, deadline);
+
+    if (len < 0) {
+        return -1;
+    }
+    if ((size_t)len > buflen) {
+        pipe_log(PIPE_LOG_ERROR, "Message of %d bytes does not fit in %zu byte buffer\n", len, buflen);
+        errno = EMSGSIZE;
+        return -1;
+    }
+    memcpy(buf, msg.payload, len);
+    return len;
+}
+
+/**
+ * Detaches from the ring. The consumer also removes the shared memory object.
+ *
+ * @param shm The transport.
+ */
+void pipe_shm_close(pipe_shm_t *shm) {
+    if (shm->ring != NULL) {
+        munmap(shm->ring, shm->map_len);
+        shm->ring = NULL;
+    }
+    if (shm->bell_fd >= 0) {
+        close(shm->bell_fd);
+    }
+    if (shm->bell_keepalive_fd >= 0) {
+        close(shm->bell_keepalive_fd);
+    }
+    if (!shm->producer) {
+        shm_unlink(shm->shm_name);
+    }
+    shm->bell_fd = shm->bell_keepalive_fd = -1;
+}
@@ -0,0 +1,73 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PIPE_SHM_H
+#define PIPE_SHM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "pipe_conn.h"
+#include "pipe_queue.h"
+
+#define PIPE_SHM_NAME "/my_pipe_shm"
+
+/**
+ * Shared header of a single-producer single-consumer ring. `head` is only written by the
+ * producer and `tail` only by the consumer, each on its own cache line so the two sides never
+ * bounce a line they both write. `sleeping` is set by the consumer before it blocks on the doorbell.
+ */
+struct pipe_shm_ring {
+    uint32_t magic;
+    uint32_t size;
+    _Alignas(PIPE_CACHELINE) atomic_uint_fast64_t head;
+    _Alignas(PIPE_CACHELINE) atomic_uint_fast64_t tail;
+    _Alignas(PIPE_CACHELINE) atomic_int sleeping;
+    _Alignas(PIPE_CACHELINE) char data[];
+};
+
+/**
+ * One end of a shared memory transport. Payloads go through a `shm_open()`/`mmap()` ring, the
+ * named pipe only carries 1-byte doorbells, and only when the consumer is actually asleep.
+ */
+typedef struct pipe_shm {
+    struct pipe_shm_ring *ring;
+    size_t map_len;
+    int bell_fd;
+    int bell_keepalive_fd;
+    bool producer;
+    uint64_t release;
+    char shm_name[PIPE_NAME_MAX];
+} pipe_shm_t;
+
+int pipe_shm_listen(pipe_shm_t *shm, const char *shm_name, const char *bell_name, size_t size);
+int pipe_shm_connect(pipe_shm_t *shm, const char *shm_name, const char *bell_name, uint64_t deadline);
+int pipe_shm_send(pipe_shm_t *shm, const char *buf, size_t buflen, uint64_t deadline);
+int pipe_shm_recv(pipe_shm_t *shm, char *buf, size_t buflen, uint64_t deadline);
+int pipe_shm_recv_msg(pipe_shm_t *shm, struct pipe_frame *msg, uint64_t deadline);
+void pipe_shm_close(pipe_shm_t *shm);
+
+#endif
@@ -0,0 +1,718 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "pipe_handler.h"
+#include "pipe_spool.h"
+#include "pipe_log.h"
+#include "pipe_metrics.h"
+#include "pipe_time.h"
+
+#ifndef PIPE_BUF
+#define PIPE_BUF 4096
+#endif
+
+#define REC_DELIVERED 1
+#define SEGMENT_SUFFIX ".seg"
+#define RETRY_NS 20000000ull      // how often to look for a reader while one is missing
+#define MAX_WAIT_NS 100000000ull  // longest sleep on a full FIFO before checking for stop
+#define BATCH_RECORDS 64
+
+/**
+ * Header of a spooled message, followed by the payload padded to 8 bytes. `len` is written last,
+ * so a scan ends at the first zero length; `sum` catches records torn by a crash.
+ */
+struct spool_rec {
+    uint32_t len;
+    uint32_t sum;
+    uint32_t state;
+    uint32_t reserved;
+};
+
+static inline size_t rec_size(size_t len) {
+    return sizeof(struct spool_rec) + ((len + 7) & ~(size_t)7);
+}
+
+static inline struct spool_rec *rec_at(const struct pipe_spool_segment *seg, size_t off) {
+    return (struct spool_rec *)(seg->base + off);
+}
+
+static uint32_t checksum(const char *p, size_t len) {
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ len, v;
+    size_t i = 0;
+
+    for (; i + sizeof(v) <= len; i += sizeof(v)) {
+        memcpy(&v, p + i, sizeof(v));
+        h = (h ^ v) * 0x100000001b3ull;
+        h ^= h >> 29;
+    }
+    for (; i < len; i++) {
+        h = (h ^ (uint8_t)p[i]) * 0x100000001b3ull;
+    }
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+static void segment_path(const pipe_spool_t *sp, uint64_t id, char *path, size_t len) {
+    snprintf(path, len, "%s/%016" PRIx64 SEGMENT_SUFFIX, sp->dir, id);
+}
+
+static struct pipe_spool_segment *map_segment(pipe_spool_t *sp, uint64_t id, bool create) {
+    char path[PIPE_SPOOL_PATH_MAX + 32];
+    struct pipe_spool_segment *seg;
+    struct stat st;
+    void *base;
+    int fd, err;
+
+    segment_path(sp, id, path, sizeof(path));
+    fd = open(path, O_RDWR | (create ? O_CREAT | O_EXCL : 0), 0644);
+    if (fd == -1) {
+        pipe_log(PIPE_LOG_ERROR, "Error opening spool segment %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    // blocks are reserved up front: a store into a hole of a full disk would raise SIGBUS
+    if (create && (err = posix_fallocate(fd, 0, sp->cfg.segment_size)) != 0) {
+        pipe_log(PIPE_LOG_ERROR, "Error allocating spool segment %s: %s\n", path, strerror(err));
+        close(fd);
+        unlink(path);
+        errno = err;
+        return NULL;
+    }
+    if (!create && fstat(fd, &st) == -1) {
+        pipe_log(PIPE_LOG_ERROR, "Error sizing spool segment %s: %s\n", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    st.st_size = create ? (off_t)sp->cfg.segment_size : st.st_size;
+    if ((size_t)st.st_size < sizeof(struct spool_rec)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        pipe_log(PIPE_LOG_ERROR, "Error mapping spool segment %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    seg = calloc(1, sizeof(*seg));
+    if (seg == NULL) {
+        munmap(base, st.st_size);
+        return NULL;
+    }
+    seg->id = id;
+    seg->base = base;
+    seg->size = st.st_size;
+    seg->dirty = SIZE_MAX;
+    if (create) {
+        sp->dir_dirty = true;
+    }
+    return seg;
+}
+
+static void unmap_segment(pipe_spool_t *sp, struct pipe_spool_segment *seg, bool remove) {
+    char path[PIPE_SPOOL_PATH_MAX + 32];
+
+    munmap(seg->base, seg->size);
+    if (remove) {
+        segment_path(sp, seg->id, path, sizeof(path));
+        unlink(path);
+    }
+    free(seg);
+}
+
+/**
+ * Walks the records of a recovered segment, counting those not yet delivered, and cuts off a
+ * record torn by a crash so that appends continue behind the last intact one.
+ */
+static uint64_t scan_segment(struct pipe_spool_segment *seg) {
+    size_t off = 0;
+    uint64_t pending = 0;
+
+    while (off + sizeof(struct spool_rec) <= seg->size) {
+        struct spool_rec *r = rec_at(seg, off);
+        if (r->len == 0 || rec_size(r->len) > seg->size - off || checksum((char *)(r + 1), r->len) != r->sum) {
+            break;
+        }
+        if (r->state != REC_DELIVERED) {
+            pending++;
+        }
+        off += rec_size(r->len);
+    }
+    seg->tail = off;
+    if (off + sizeof(struct spool_rec) <= seg->size && rec_at(seg, off)->len != 0) {
+        pipe_log(PIPE_LOG_WARN, "Discarding a torn record at offset %zu of spool segment %" PRIx64 "\n", off, seg->id);
+        memset(rec_at(seg, off), 0, sizeof(struct spool_rec));
+        seg->dirty = off;
+    }
+    return pending;
+}
+
+static int compare_ids(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int recover(pipe_spool_t *sp) {
+    uint64_t *ids = NULL;
+    struct dirent *ent;
+    size_t n = 0, cap = 0;
+    DIR *dir = opendir(sp->dir);
+
+    if (dir == NULL) {
+        pipe_log(PIPE_LOG_ERROR, "Error reading spool directory %s: %s\n", sp->dir, strerror(errno));
+        return -1;
+    }
+    while ((ent = readdir(dir)) != NULL) {
+        char *end;
+        uint64_t id = strtoull(ent->d_name, &end, 16);
+        if (end != ent->d_name + 16 || strcmp(end, SEGMENT_SUFFIX) != 0) {
+            continue;
+        }
+        if (n == cap) {
+            uint64_t *grown = realloc(ids, (cap ? cap * 2 : 64) * sizeof(*ids));
+            if (grown == NULL) {
+                pipe_log(PIPE_LOG_ERROR, "Error listing spool directory %s: %s\n", sp->dir, strerror(errno));
+                closedir(dir);
+                free(ids);
+                return -1;
+            }
+            ids = grown;
+            cap = cap ? cap * 2 : 64;
+        }
+        ids[n++] = id;
+    }
+    closedir(dir);
+    qsort(ids, n, sizeof(ids[0]), compare_ids);
+
+    for (size_t i = 0; i < n; i++) {
+        struct pipe_spool_segment *seg = map_segment(sp, ids[i], false);
+        // new segments must not collide with one that was left behind
+        sp->next_id = ids[i] + 1;
+        if (seg == NULL) {
+            pipe_log(PIPE_LOG_WARN, "Skipping spool segment %016" PRIx64 " that cannot be mapped\n", ids[i]);
+            continue;
+        }
+        sp->pending += scan_segment(seg);
+        if (sp->tail != NULL) {
+            sp->tail->next = seg;
+        } else {
+            sp->head = seg;
+        }
+        sp->tail = seg;
+    }
+    free(ids);
+    if (sp->pending > 0) {
+        pipe_log(PIPE_LOG_INFO, "Recovered %" PRIu64 " spooled messages from %s\n", sp->pending, sp->dir);
+    }
+    return 0;
+}
+
+static int append(pipe_spool_t *sp, const char *p, size_t len) {
+    struct pipe_spool_segment *seg = sp->tail;
+    struct spool_rec *r;
+
+    if (seg == NULL || seg->size - seg->tail < rec_size(len)) {
+        struct pipe_spool_segment *next = map_segment(sp, sp->next_id, true);
+        if (next == NULL) {
+            return -1;
+        }
+        sp->next_id++;
+        if (seg != NULL) {
+            seg->next = next;
+        } else {
+            sp->head = next;
+        }
+        sp->tail = seg = next;
+    }
+
+    r = rec_at(seg, seg->tail);
+    memcpy(r + 1, p, len);
+    r->sum = checksum(p, len);
+    r->state = 0;
+    r->reserved = 0;
+    r->len = (uint32_t)len;
+    if (seg->dirty > seg->tail) {
+        seg->dirty = seg->tail;
+    }
+    seg->tail += rec_size(len);
+    return 0;
+}
+
+/**
+ * Collects the next undelivered records of the head segment, at most PIPE_BUF bytes of them so
+ * that the write stays atomic, or a single larger one. Segments delivered entirely are unlinked
+ * from the list on the way and handed back in `retired`, except the tail, which producers are
+ * still appending to.
+ */
+static int gather(pipe_spool_t *sp, struct iovec *iov, size_t *offs, struct pipe_spool_segment **retired) {
+    struct pipe_spool_segment *seg;
+    size_t total = 0;
+    int n = 0;
+
+    while ((seg = sp->head) != NULL) {
+        while (sp->read_off < seg->tail && rec_at(seg, sp->read_off)->state == REC_DELIVERED) {
+            sp->read_off += rec_size(rec_at(seg, sp->read_off)->len);
+        }
+        if (sp->read_off < seg->tail || seg == sp->tail) {
+            break;
+        }
+        sp->head = seg->next;
+        sp->read_off = 0;
+        seg->next = *retired;
+        *retired = seg;
+    }
+    if (seg == NULL) {
+        return 0;
+    }
+
+    for (size_t off = sp->read_off; off < seg->tail && n < BATCH_RECORDS; off += rec_size(rec_at(seg, off)->len)) {
+        struct spool_rec *r = rec_at(seg, off);
+        size_t skip = seg == sp->partial && off == sp->partial_off ? sp->write_off : 0;
+
+        if (r->state == REC_DELIVERED) {
+            continue;
+        }
+        if (n > 0 && total + r->len > PIPE_BUF) {
+            break;
+        }
+        iov[n].iov_base = (char *)(r + 1) + skip;
+        iov[n].iov_len = r->len - skip;
+        offs[n++] = off;
+        total += r->len;
+    }
+    return n;
+}
+
+static void account(pipe_spool_t *sp, const struct iovec *iov, const size_t *offs, int n, size_t written) {
+    struct pipe_spool_segment *seg = sp->head;
+
+    for (int i = 0; i < n; i++) {
+        if (written < iov[i].iov_len) {
+            sp->read_off = offs[i];
+            if (sp->partial != seg || sp->partial_off != offs[i]) {
+                sp->partial = seg;
+                sp->partial_off = offs[i];
+                sp->write_off = 0;
+            }
+            sp->write_off += written;
+            return;
+        }
+        written -= iov[i].iov_len;
+        if (sp->partial == seg && sp->partial_off == offs[i]) {
+            sp->partial = NULL;
+            sp->write_off = 0;
+        }
+        rec_at(seg, offs[i])->state = REC_DELIVERED;
+        if (seg->dirty > offs[i]) {
+            seg->dirty = offs[i];
+        }
+        sp->read_off = offs[i] + rec_size(rec_at(seg, offs[i])->len);
+        sp->replayed++;
+        if (--sp->pending == 0) {
+            pthread_cond_broadcast(&sp->done);
+        }
+    }
+}
+
+/**
+ * Group commit: flushes every range changed since the last commit with one msync() per segment.
+ * Runs on the drainer only, which is also the only thread that deletes segments.
+ */
+static void commit(pipe_spool_t *sp) {
+    long page = sysconf(_SC_PAGESIZE);
+    uint64_t seq = ++sp->commit_seq;
+    bool dir_dirty = sp->dir_dirty;
+    int err = 0;
+
+    sp->dir_dirty = false;
+    sp->commit_requested = false;
+    for (struct pipe_spool_segment *seg = sp->head; seg != NULL; seg = seg->next) {
+        size_t lo, hi = seg->tail;
+        if (seg->dirty >= hi) {
+            continue;
+        }
+        lo = seg->dirty & ~(size_t)(page - 1);
+        seg->dirty = SIZE_MAX;
+        // producers keep appending behind `hi` while the range is written back
+        pthread_mutex_unlock(&sp->lock);
+        if (msync(seg->base + lo, hi - lo, MS_SYNC) == -1) {
+            err = errno;
+        }
+        pthread_mutex_lock(&sp->lock);
+    }
+    if (dir_dirty && fsync(sp->dir_fd) == -1) {
+        err = errno;
+    }
+    if (err != 0) {
+        pipe_log(PIPE_LOG_ERROR, "Error committing spool %s: %s\n", sp->dir, strerror(err));
+    }
+    sp->commit_error = err;
+    sp->commit_done = seq;
+    pthread_cond_broadcast(&sp->done);
+}
+
+static bool is_dirty(const pipe_spool_t *sp) {
+    if (sp->dir_dirty) {
+        return true;
+    }
+    for (struct pipe_spool_segment *seg = sp->head; seg != NULL; seg = seg->next) {
+        if (seg->dirty < seg->tail) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void wait_until(pipe_spool_t *sp, pthread_cond_t *cond, uint64_t deadline) {
+    struct timespec ts;
+
+    if (deadline == UINT64_MAX) {
+        pthread_cond_wait(cond, &sp->lock);
+        return;
+    }
+    ts.tv_sec = deadline / PIPE_NSEC_PER_SEC;
+    ts.tv_nsec = deadline % PIPE_NSEC_PER_SEC;
+    pthread_cond_timedwait(cond, &sp->lock, &ts);
+}
+
+static void *drain_thread(void *arg) {
+    pipe_spool_t *sp = arg;
+    uint64_t interval = (uint64_t)(sp->cfg.commit_interval * PIPE_NSEC_PER_SEC);
+    uint64_t next_commit = pipe_now_ns() + interval;
+    struct iovec iov[BATCH_RECORDS];
+    size_t offs[BATCH_RECORDS];
+    struct pipe_spool_segment *retired = NULL;
+
+    pthread_mutex_lock(&sp->lock);
+    while (!sp->stop) {
+        uint64_t now = pipe_now_ns();
+        ssize_t n;
+        int fd, cnt, err;
+
+        if (sp->commit_requested || (now >= next_commit && is_dirty(sp))) {
+            commit(sp);
+            next_commit = pipe_now_ns() + interval;
+            continue;
+        }
+        if (sp->pending == 0) {
+            wait_until(sp, &sp->wake, is_dirty(sp) ? next_commit : UINT64_MAX);
+            continue;
+        }
+
+        if (sp->drain_fd < 0) {
+            // FIFOs report no event when a reader arrives, so look for one now and then
+            pthread_mutex_unlock(&sp->lock);
+            fd = open_pipe(sp->cfg.name, false);
+            pthread_mutex_lock(&sp->lock);
+            if (fd < 0) {
+                wait_until(sp, &sp->wake, now + RETRY_NS < next_commit ? now + RETRY_NS : next_commit);
+                continue;
+            }
+            sp->drain_fd = fd;
+        }
+
+        cnt = gather(sp, iov, offs, &retired);
+        if (retired != NULL) {
+            // deleting a large mapping takes a while, producers need not wait for it
+            pthread_mutex_unlock(&sp->lock);
+            while (retired != NULL) {
+                struct pipe_spool_segment *next = retired->next;
+                unmap_segment(sp, retired, true);
+                retired = next;
+            }
+            pthread_mutex_lock(&sp->lock);
+        }
+        if (cnt == 0) {
+            wait_until(sp, &sp->wake, next_commit);
+            continue;
+        }
+        fd = sp->drain_fd;
+        pthread_mutex_unlock(&sp->lock);
+        n = writev(fd, iov, cnt);
+        err = errno;
+        pthread_mutex_lock(&sp->lock);
+
+        if (n > 0) {
+            pipe_metrics_add(fd, PIPE_METRIC_WRITE_CALLS, 1);
+            pipe_metrics_add(fd, PIPE_METRIC_BYTES_SENT, n);
+            account(sp, iov, offs, cnt, n);
+        } else if (err == EAGAIN || err == EWOULDBLOCK) {
+            uint64_t until = now + MAX_WAIT_NS < next_commit ? now + MAX_WAIT_NS : next_commit;
+            pipe_metrics_add(fd, PIPE_METRIC_EAGAIN, 1);
+            pthread_mutex_unlock(&sp->lock);
+            wait_pipe(fd, POLLOUT, until);
+            pthread_mutex_lock(&sp->lock);
+        } else {
+            // the reader went away, keep the rest until the next one arrives; the head of a record it
+            // took with it is useless to the next reader, which gets the whole record again
+            pipe_log(PIPE_LOG_DEBUG, "Spool reader of %s went away: %s\n", sp->cfg.name, strerror(err));
+            close(sp->drain_fd);
+            sp->drain_fd = -1;
+            sp->partial = NULL;
+            sp->write_off = 0;
+        }
+    }
+    commit(sp);
+    pthread_mutex_unlock(&sp->lock);
+    return NULL;
+}
+
+/**
+ * Opens a spool for a FIFO, replays whatever an earlier run left in its directory and starts the
+ * drainer. Callers should ignore SIGPIPE, a reader that goes away then shows up as EPIPE.
+ *
+ * @param sp The spool to initialize.
+ * @param cfg The configuration, copied into the spool. `name` must outlive the spool.
+ * @return 0 on success, or -1 on error or if another process has the directory open.
+ * @throws If the directory or a segment cannot be set up, an appropriate error message will be printed to stderr.
+ */
+int pipe_spool_open(pipe_spool_t *sp, const pipe_spool_config_t *cfg) {
+    pthread_condattr_t attr;
+
+    memset(sp, 0, sizeof(*sp));
+    sp->cfg = *cfg;
+    sp->fd = sp->drain_fd = sp->dir_fd = -1;
+    if (sp->cfg.segment_size == 0) {
+        sp->cfg.segment_size = PIPE_SPOOL_SEGMENT_SIZE;
+    }
+    if (sp->cfg.commit_interval <= 0) {
+        sp->cfg.commit_interval = PIPE_SPOOL_COMMIT_INTERVAL;
+    }
+    if (cfg->dir != NULL) {
+        snprintf(sp->dir, sizeof(sp->dir), "%s", cfg->dir);
+    } else {
+        snprintf(sp->dir, sizeof(sp->dir), "%s.spool", cfg->name);
+    }
+
+    if (mkdir(sp->dir, 0755) == -1 && errno != EEXIST) {
+        pipe_log(PIPE_LOG_ERROR, "Error creating spool directory %s: %s\n", sp->dir, strerror(errno));
+        return -1;
+    }
+    sp->dir_fd = open(sp->dir, O_RDONLY | O_DIRECTORY);
+    if (sp->dir_fd == -1) {
+        pipe_log(PIPE_LOG_ERROR, "Error opening spool directory %s: %s\n", sp->dir, strerror(errno));
+        return -1;
+    }
+    if (flock(sp->dir_fd, LOCK_EX | LOCK_NB) == -1) {
+        pipe_log(PIPE_LOG_ERROR, "Spool directory %s is in use: %s\n", sp->dir, strerror(errno));
+        close(sp->dir_fd);
+        return -1;
+    }
+    if (recover(sp) == -1) {
+        pipe_spool_close(sp);
+        return -1;
+    }
+
+    pthread_mutex_init(&sp->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sp->wake, &attr);
+    pthread_cond_init(&sp->done, &attr);
+    pthread_condattr_destroy(&attr);
+    if ((errno = pthread_create(&sp->thread, NULL, drain_thread, sp)) != 0) {
+        pipe_log(PIPE_LOG_ERROR, "Error starting spool drainer: %s\n", strerror(errno));
+        pipe_spool_close(sp);
+        return -1;
+    }
+    sp->running = true;
+    return 0;
+}
+
+/**
+ * Sends a message without waiting for the reader. It is written to the FIFO right away if
+ * nothing is spooled and it fits, otherwise it is appended to the spool and delivered later in
+ * order. A message the FIFO only took part of is spooled whole: the drainer completes it for the
+ * current reader, and a new reader or a replay after a crash gets all of it.
+ *
+ * @param sp The spool.
+ * @param buf A pointer to the message.
+ * @param len The length of the message.
+ * @return `len` once the message is written or spooled, or -1 on error.
+ * @throws If the message cannot be spooled, an appropriate error message will be printed to stderr.
+ */
+ssize_t pipe_spool_send(pipe_spool_t *sp, const void *buf, size_t len) {
+    size_t written = 0;
+
+    if (len == 0) {
+        return 0;
+    }
+    if (len > UINT32_MAX || rec_size(len) > sp->cfg.segment_size) {
+        pipe_log(PIPE_LOG_ERROR, "Message of %zu bytes exceeds the spool segment size\n", len);
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    pthread_mutex_lock(&sp->lock);
+    // direct writes would overtake spooled messages, so they wait until the spool is empty
+    if (sp->pending == 0) {
+        if (sp->fd < 0) {
+            sp->fd = open_pipe(sp->cfg.name, false);
+        }
+        if (sp->fd >= 0) {
+            ssize_t n = write(sp->fd, buf, len);
+            if (n == (ssize_t)len) {
+                sp->direct++;
+                pipe_metrics_add(sp->fd, PIPE_METRIC_MSGS_SENT, 1);
+                pthread_mutex_unlock(&sp->lock);
+                return (ssize_t)len;
+            }
+            if (n > 0) {
+                written = n;
+            } else if (errno == EPIPE) {
+                close(sp->fd);
+                sp->fd = -1;
+            }
+        }
+    }
+
+    if (append(sp, buf, len) == -1) {
+        pthread_mutex_unlock(&sp->lock);
+        return -1;
+    }
+    if (written > 0) {
+        // the reader holds the head of the record, the drainer sends it the rest on the same descriptor
+        sp->partial = sp->tail;
+        sp->partial_off = sp->tail->tail - rec_size(len);
+        sp->write_off = written;
+        if (sp->drain_fd < 0) {
+            sp->drain_fd = sp->fd;
+            sp->fd = -1;
+        }
+    }
+    sp->spooled++;
+    if (sp->pending++ == 0) {
+        pthread_cond_signal(&sp->wake);
+    }
+    pthread_mutex_unlock(&sp->lock);
+    return (ssize_t)len;
+}
+
+/**
+ * Waits until every spooled message has been delivered to the FIFO.
+ *
+ * @param sp The spool.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds.
+ * @return 0 on success, or -1 on timeout.
+ */
+int pipe_spool_flush(pipe_spool_t *sp, uint64_t deadline) {
+    int ret = 0;
+
+    pthread_mutex_lock(&sp->lock);
+    while (sp->pending > 0) {
+        if (pipe_now_ns() >= deadline) {
+            errno = ETIMEDOUT;
+            ret = -1;
+            break;
+        }
+        wait_until(sp, &sp->done, deadline);
+    }
+    pthread_mutex_unlock(&sp->lock);
+    return ret;
+}
+
+/**
+ * Makes every message spooled so far durable without waiting for the next group commit.
+ *
+ * @param sp The spool.
+ * @return 0 on success, or -1 if writing back failed (errno is set).
+ */
+int pipe_spool_commit(pipe_spool_t *sp) {
+    uint64_t want;
+    int err;
+
+    pthread_mutex_lock(&sp->lock);
+    // a commit that is already running may have missed the latest appends, wait for the next one
+    want = sp->commit_seq + 1;
+    sp->commit_requested = true;
+    pthread_cond_signal(&sp->wake);
+    while (sp->commit_done < want && sp->running) {
+        pthread_cond_wait(&sp->done, &sp->lock);
+    }
+    err = sp->commit_error;
+    pthread_mutex_unlock(&sp->lock);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Stops the drainer after a final commit and closes the spool. Messages not yet delivered stay
+ * on disk and are replayed by the next pipe_spool_open() of the same directory; if everything
+ * was delivered the segment files are removed.
+ *
+ * @param sp The spool.
+ */
+void pipe_spool_close(pipe_spool_t *sp) {
+    struct pipe_spool_segment *seg, *next;
+
+    if (sp->running) {
+        pthread_mutex_lock(&sp->lock);
+        sp->stop = true;
+        pthread_cond_signal(&sp->wake);
+        pthread_mutex_unlock(&sp->lock);
+        pthread_join(sp->thread, NULL);
+        sp->running = false;
+        pthread_cond_destroy(&sp->wake);
+        pthread_cond_destroy(&sp->done);
+        pthread_mutex_destroy(&sp->lock);
+    }
+    if (sp->pending > 0) {
+        pipe_log(PIPE_LOG_INFO, "%" PRIu64 " messages stay spooled in %s\n", sp->pending, sp->dir);
+    }
+    for (seg = sp->head; seg != NULL; seg = next) {
+        next = seg->next;
+        unmap_segment(sp, seg, sp->pending == 0);
+    }
+    sp->head = sp->tail = NULL;
+    if (sp->fd >= 0) {
+        close(sp->fd);
+    }
+    if (sp->drain_fd >= 0) {
+        close(sp->drain_fd);
+    }
+    if (sp->dir_fd >= 0) {
+        // also releases the lock on the directory
+        close(sp->dir_fd);
+    }
+    sp->fd = sp->drain_fd = sp->dir_fd = -1;
+}
@@ -0,0 +1,106 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PIPE_SPOOL_H
+#define PIPE_SPOOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#define PIPE_SPOOL_PATH_MAX 256
+#define PIPE_SPOOL_SEGMENT_SIZE (16u << 20)
+#define PIPE_SPOOL_COMMIT_INTERVAL 0.01
+
+typedef struct pipe_spool_config {
+    const char *name;          // the FIFO messages are delivered to
+    const char *dir;           // where segments are kept, NULL for "<name>.spool"
+    size_t segment_size;       // bytes per segment file, 0 for PIPE_SPOOL_SEGMENT_SIZE
+    double commit_interval;    // seconds between group commits, 0 for PIPE_SPOOL_COMMIT_INTERVAL
+} pipe_spool_config_t;
+
+/**
+ * One memory-mapped segment file. Producers append at `tail`; `dirty` is the lowest offset
+ * changed since the last commit, SIZE_MAX when the segment is clean.
+ */
+struct pipe_spool_segment {
+    uint64_t id;
+    char *base;
+    size_t size;
+    size_t tail;
+    size_t dirty;
+    struct pipe_spool_segment *next;
+};
+
+/**
+ * Store-and-forward writer for a FIFO whose reader may be absent or slow. While nothing is
+ * spooled a message is written straight into the FIFO without blocking; when the reader is
+ * missing, the FIFO is full, or older messages are still spooled, the message is appended to a
+ * log of memory-mapped segment files instead. A background drainer replays the log into the FIFO
+ * in order as soon as a reader attaches and deletes each segment once it is delivered.
+ *
+ * Appends never wait for the disk: the drainer commits all segments with msync() every
+ * `commit_interval` seconds, so a crash loses at most that window, and every record carries a
+ * checksum so a torn tail is detected on the next open. Delivery is at least once; a record
+ * delivered just before a crash may be replayed. Only one process may open a spool directory.
+ */
+typedef struct pipe_spool {
+    pipe_spool_config_t cfg;
+    char dir[PIPE_SPOOL_PATH_MAX];
+    int dir_fd;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    pthread_t thread;
+    bool running;
+    bool stop;
+    bool dir_dirty;
+    bool commit_requested;
+    int commit_error;
+    uint64_t commit_seq;
+    uint64_t commit_done;
+    int fd;
+    int drain_fd;
+    struct pipe_spool_segment *head;
+    struct pipe_spool_segment *tail;
+    size_t read_off;
+    struct pipe_spool_segment *partial;     // the record the reader has only part of, if any
+    size_t partial_off;
+    size_t write_off;                       // how much of `partial` the reader has
+    uint64_t next_id;
+    uint64_t pending;
+    uint64_t direct;
+    uint64_t spooled;
+    uint64_t replayed;
+} pipe_spool_t;
+
+int pipe_spool_open(pipe_spool_t *sp, const pipe_spool_config_t *cfg);
+ssize_t pipe_spool_send(pipe_spool_t *sp, const void *buf, size_t len);
+int pipe_spool_flush(pipe_spool_t *sp, uint64_t deadline);
+int pipe_spool_commit(pipe_spool_t *sp);
+void pipe_spool_close(pipe_spool_t *sp);
+
+#endif
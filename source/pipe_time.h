@@ -0,0 +1,72 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PIPE_TIME_H
+#define PIPE_TIME_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define PIPE_NSEC_PER_SEC 1000000000ULL
+#define PIPE_NSEC_PER_MSEC 1000000ULL
+#define PIPE_DEADLINE_NEVER UINT64_MAX   // a deadline that never passes
+
+/**
+ * Returns the current CLOCK_MONOTONIC time in nanoseconds.
+ */
+static inline uint64_t pipe_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * PIPE_NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Converts a relative timeout in seconds into an absolute CLOCK_MONOTONIC deadline in nanoseconds,
+ * the form every call that can block takes its limit in. Compute it once per operation and pass
+ * it down, so that time spent in earlier steps counts against the same limit.
+ */
+static inline uint64_t pipe_deadline_from_timeout(double timeout) {
+    if (timeout <= 0) {
+        return pipe_now_ns();
+    }
+    return pipe_now_ns() + (uint64_t)(timeout * PIPE_NSEC_PER_SEC);
+}
+
+/**
+ * Returns the number of milliseconds left until `deadline`, rounded up, 0 if it has passed, or -1
+ * for PIPE_DEADLINE_NEVER. The result is suitable as a poll()/epoll_wait() timeout.
+ */
+static inline int pipe_ms_until(uint64_t deadline) {
+    uint64_t now = pipe_now_ns();
+    if (deadline == PIPE_DEADLINE_NEVER) {
+        return -1;
+    }
+    if (deadline <= now) {
+        return 0;
+    }
+    uint64_t ms = (deadline - now + PIPE_NSEC_PER_MSEC - 1) / PIPE_NSEC_PER_MSEC;
+    return ms > INT32_MAX ? INT32_MAX : (int)ms;
+}
+
+#endif
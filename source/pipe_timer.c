@@ -0,0 +1,198 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "pipe_timer.h"
+#include "pipe_time.h"
+
+#define SLOT_MASK (PIPE_TIMER_SLOTS - 1)
+
+static inline void mark_used(pipe_timer_wheel_t *w, size_t slot) {
+    w->used[slot / 64] |= 1ULL << (slot % 64);
+}
+
+static inline void mark_free(pipe_timer_wheel_t *w, size_t slot) {
+    w->used[slot / 64] &= ~(1ULL << (slot % 64));
+}
+
+static void link_timer(struct pipe_timer **head, struct pipe_timer *t) {
+    t->next = *head;
+    if (t->next != NULL) {
+        t->next->pprev = &t->next;
+    }
+    t->pprev = head;
+    *head = t;
+}
+
+static void unlink_timer(struct pipe_timer *t) {
+    *t->pprev = t->next;
+    if (t->next != NULL) {
+        t->next->pprev = t->pprev;
+    }
+    t->next = NULL;
+    t->pprev = NULL;
+}
+
+static void insert(pipe_timer_wheel_t *w, struct pipe_timer *t) {
+    size_t slot = t->tick & SLOT_MASK;
+
+    link_timer(&w->slots[slot], t);
+    mark_used(w, slot);
+}
+
+/**
+ * Initializes an empty wheel whose clock starts now.
+ *
+ * @param w The wheel.
+ */
+void pipe_timer_wheel_init(pipe_timer_wheel_t *w) {
+    memset(w, 0, sizeof(*w));
+    w->tick = pipe_now_ns() / PIPE_TIMER_TICK_NS;
+}
+
+/**
+ * Arms a timer to call `fn` once `deadline` has passed, rearming it if it is already armed.
+ * A deadline of PIPE_DEADLINE_NEVER leaves the timer disarmed.
+ *
+ * @param w The wheel.
+ * @param t The timer, owned by the caller until it fires or is cancelled.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds.
+ * @param fn The callback, run from pipe_timer_expire().
+ * @param arg An opaque pointer passed back to the callback.
+ */
+void pipe_timer_arm(pipe_timer_wheel_t *w, struct pipe_timer *t, uint64_t deadline, pipe_timer_fn fn, void *arg) {
+    if (pipe_timer_armed(t)) {
+        pipe_timer_cancel(w, t);
+    }
+    t->fn = fn;
+    t->arg = arg;
+    if (deadline == PIPE_DEADLINE_NEVER) {
+        return;
+    }
+    // round up, a timer never fires before its deadline; one already due fires on the next tick
+    t->tick = (deadline + PIPE_TIMER_TICK_NS - 1) / PIPE_TIMER_TICK_NS;
+    if (t->tick <= w->tick) {
+        t->tick = w->tick + 1;
+    }
+    insert(w, t);
+    w->count++;
+}
+
+/**
+ * Disarms a timer. Cancelling a timer that is not armed does nothing.
+ *
+ * @param w The wheel.
+ * @param t The timer.
+ */
+void pipe_timer_cancel(pipe_timer_wheel_t *w, struct pipe_timer *t) {
+    size_t slot;
+
+    if (!pipe_timer_armed(t)) {
+        return;
+    }
+    slot = t->tick & SLOT_MASK;
+    unlink_timer(t);
+    if (w->slots[slot] == NULL) {
+        mark_free(w, slot);
+    }
+    w->count--;
+}
+
+/**
+ * Advances the wheel to `now` and runs the callback of every timer that came due. Callbacks may
+ * arm and cancel timers, including their own.
+ *
+ * @param w The wheel.
+ * @param now The current CLOCK_MONOTONIC time in nanoseconds, see pipe_now_ns().
+ * @return The number of timers that fired.
+ */
+int pipe_timer_expire(pipe_timer_wheel_t *w, uint64_t now) {
+    uint64_t target = now / PIPE_TIMER_TICK_NS;
+    uint64_t steps = target > w->tick ? target - w->tick : 0;
+    int fired = 0;
+
+    // after a long sleep every slot is visited once
+    if (steps > PIPE_TIMER_SLOTS) {
+        w->tick = target - PIPE_TIMER_SLOTS;
+        steps = PIPE_TIMER_SLOTS;
+    }
+    while (steps-- > 0 && w->count > 0) {
+        size_t slot = ++w->tick & SLOT_MASK;
+        struct pipe_timer *pending = w->slots[slot];
+
+        if (pending == NULL) {
+            continue;
+        }
+        // detach the slot, so callbacks that arm timers do not disturb the walk
+        w->slots[slot] = NULL;
+        mark_free(w, slot);
+        pending->pprev = &pending;
+        while (pending != NULL) {
+            struct pipe_timer *t = pending;
+
+            unlink_timer(t);
+            if (t->tick > target) {
+                insert(w, t);
+                continue;
+            }
+            w->count--;
+            t->fn(t, t->arg);
+            fired++;
+        }
+    }
+    w->tick = target > w->tick ? target : w->tick;
+    return fired;
+}
+
+/**
+ * Returns a time no later than the next expiry, for use as the wake-up time of an event loop: the
+ * start of the next tick whose slot holds a timer. Timers of a later revolution make it early,
+ * never late.
+ *
+ * @param w The wheel.
+ * @return The CLOCK_MONOTONIC time in nanoseconds, or PIPE_DEADLINE_NEVER if no timer is armed.
+ */
+uint64_t pipe_timer_next(const pipe_timer_wheel_t *w) {
+    if (w->count == 0) {
+        return PIPE_DEADLINE_NEVER;
+    }
+    for (uint64_t d = 1; d <= PIPE_TIMER_SLOTS; d++) {
+        size_t slot = (w->tick + d) & SLOT_MASK;
+        uint64_t word = w->used[slot / 64] >> (slot % 64);
+
+        if (word == 0) {
+            // skip the rest of this bitmap word
+            d += 63 - slot % 64;
+            continue;
+        }
+        d += __builtin_ctzll(word);
+        return (w->tick + d) * PIPE_TIMER_TICK_NS;
+    }
+    return PIPE_DEADLINE_NEVER;
+}
@@ -0,0 +1,78 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PIPE_TIMER_H
+#define PIPE_TIMER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PIPE_TIMER_SLOTS 512                    // one revolution of the wheel is 512 ticks
+#define PIPE_TIMER_TICK_NS 1000000ULL           // 1 ms, timers fire up to one tick late
+
+struct pipe_timer;
+
+typedef void (*pipe_timer_fn)(struct pipe_timer *t, void *arg);
+
+/**
+ * A timer embedded in the object it times out, e.g. an in-flight request. It belongs to no wheel
+ * until armed, and is disarmed before its callback runs.
+ */
+struct pipe_timer {
+    struct pipe_timer *next;
+    struct pipe_timer **pprev;      // NULL while not armed
+    uint64_t tick;                  // the tick at which it fires
+    pipe_timer_fn fn;
+    void *arg;
+};
+
+/**
+ * Hashed timer wheel on CLOCK_MONOTONIC. A timer lives in the slot of its expiry tick modulo the
+ * number of slots, so arming and cancelling are O(1) however many timers are pending; timers more
+ * than one revolution away share slots with nearer ones and are skipped until their revolution
+ * comes. A bitmap of non-empty slots tells the event loop how long it may sleep. Not thread-safe:
+ * a wheel is driven by the thread that owns it.
+ */
+typedef struct pipe_timer_wheel {
+    struct pipe_timer *slots[PIPE_TIMER_SLOTS];
+    uint64_t used[PIPE_TIMER_SLOTS / 64];
+    uint64_t tick;                  // every tick up to this one has been processed
+    size_t count;
+} pipe_timer_wheel_t;
+
+/**
+ * Tells whether a timer is armed.
+ */
+static inline bool pipe_timer_armed(const struct pipe_timer *t) {
+    return t->pprev != NULL;
+}
+
+void pipe_timer_wheel_init(pipe_timer_wheel_t *w);
+void pipe_timer_arm(pipe_timer_wheel_t *w, struct pipe_timer *t, uint64_t deadline, pipe_timer_fn fn, void *arg);
+void pipe_timer_cancel(pipe_timer_wheel_t *w, struct pipe_timer *t);
+int pipe_timer_expire(pipe_timer_wheel_t *w, uint64_t now);
+uint64_t pipe_timer_next(const pipe_timer_wheel_t *w);
+
+#endif
@@ -0,0 +1,569 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#undef BLOCK_SIZE  // the one from <linux/fs.h>, pipe_handler.h defines ours
+#include "pipe_handler.h"
+#include "pipe_uring.h"
+#include "pipe_log.h"
+#include "pipe_metrics.h"
+#include "pipe_time.h"
+
+#define PROBE_OPS 64
+
+static atomic_int uring_state;  // 0 not probed yet, 1 usable, -1 unavailable
+static pthread_key_t local_key;
+static pthread_once_t local_once = PTHREAD_ONCE_INIT;
+static __thread pipe_uring_t *local_ring;
+static __thread bool local_failed;
+
+static int uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(pipe_uring_t *u, unsigned submit, unsigned wait) {
+    u->enters++;
+    return (int)syscall(__NR_io_uring_enter, u->fd, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+/**
+ * Reports whether the kernel lets this process use io_uring with the operations we need. Seccomp
+ * profiles of many container runtimes reject io_uring_setup(), so this is probed once at runtime.
+ *
+ * @return true if io_uring can be used.
+ */
+bool pipe_uring_available(void) {
+    static const int needed[] = { IORING_OP_READ, IORING_OP_WRITE, IORING_OP_READ_FIXED, IORING_OP_POLL_ADD,
+                                  IORING_OP_LINK_TIMEOUT };
+    struct {
+        struct io_uring_probe probe;
+        struct io_uring_probe_op ops[PROBE_OPS];
+    } probe;
+    struct io_uring_params p;
+    int state = atomic_load(&uring_state), fd;
+
+    if (state != 0) {
+        return state > 0;
+    }
+
+    state = -1;
+    memset(&p, 0, sizeof(p));
+    if ((fd = uring_setup(2, &p)) >= 0) {
+        memset(&probe, 0, sizeof(probe));
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, &probe, PROBE_OPS) == 0) {
+            state = 1;
+            for (size_t i = 0; i < sizeof(needed) / sizeof(needed[0]); i++) {
+                if (needed[i] > probe.probe.last_op || !(probe.ops[needed[i]].flags & IO_URING_OP_SUPPORTED)) {
+                    state = -1;
+                }
+            }
+        }
+        close(fd);
+    }
+    atomic_store(&uring_state, state);
+    return state > 0;
+}
+
+/**
+ * Sets up a ring and maps its queues.
+ *
+ * @param u The ring to initialize.
+ * @param entries The submission queue size, PIPE_URING_ENTRIES if 0 and at least 2 * PIPE_URING_MAX_WRITES.
+ * @return 0 on success, or -1 on error.
+ * @throws If io_uring_setup() or mmap() fails, an appropriate error message will be printed to stderr.
+ */
+int pipe_uring_init(pipe_uring_t *u, unsigned entries) {
+    struct io_uring_params p;
+    char *sq, *cq;
+
+    memset(u, 0, sizeof(*u));
+    memset(&p, 0, sizeof(p));
+    u->sq_map = u->cq_map = u->sqes = MAP_FAILED;
+    // a full write batch takes two SQEs per write
+    if (entries < 2 * PIPE_URING_MAX_WRITES) {
+        entries = entries ? 2 * PIPE_URING_MAX_WRITES : PIPE_URING_ENTRIES;
+    }
+    u->fd = uring_setup(entries, &p);
+    if (u->fd == -1) {
+        pipe_log(PIPE_LOG_ERROR, "Error in io_uring_setup(): %s\n", strerror(errno));
+        return -1;
+    }
+
+    u->sq_entries = p.sq_entries;
+    u->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        u->sq_map_len = u->cq_map_len = u->sq_map_len > u->cq_map_len ? u->sq_map_len : u->cq_map_len;
+    }
+    u->sq_map = mmap(NULL, u->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_map != MAP_FAILED) {
+        u->cq_map = (p.features & IORING_FEAT_SINGLE_MMAP) ? u->sq_map :
+                    mmap(NULL, u->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+    }
+    u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    if (u->cq_map != MAP_FAILED) {
+        u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    }
+    if (u->sqes == MAP_FAILED) {
+        pipe_log(PIPE_LOG_ERROR, "Error mapping io_uring queues: %s\n", strerror(errno));
+        pipe_uring_destroy(u);
+        return -1;
+    }
+
+    sq = u->sq_map;
+    cq = u->cq_map;
+    u->sq_head = (_Atomic unsigned *)(sq + p.sq_off.head);
+    u->sq_tail = (_Atomic unsigned *)(sq + p.sq_off.tail);
+    u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)(sq + p.sq_off.array);
+    u->cq_head = (_Atomic unsigned *)(cq + p.cq_off.head);
+    u->cq_tail = (_Atomic unsigned *)(cq + p.cq_off.tail);
+    u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+/**
+ * Unmaps and closes a ring, releasing its registered buffers.
+ *
+ * @param u The ring.
+ */
+void pipe_uring_destroy(pipe_uring_t *u) {
+    if (u->sqes != MAP_FAILED && u->sqes != NULL) {
+        munmap(u->sqes, u->sqes_len);
+    }
+    if (u->cq_map != MAP_FAILED && u->cq_map != NULL && u->cq_map != u->sq_map) {
+        munmap(u->cq_map, u->cq_map_len);
+    }
+    if (u->sq_map != MAP_FAILED && u->sq_map != NULL) {
+        munmap(u->sq_map, u->sq_map_len);
+    }
+    if (u->fd >= 0) {
+        close(u->fd);
+    }
+    free(u->bufs);
+    memset(u, 0, sizeof(*u));
+    u->fd = -1;
+}
+
+static void free_local(void *arg) {
+    pipe_uring_destroy(arg);
+    free(arg);
+}
+
+static void create_local_key(void) {
+    pthread_key_create(&local_key, free_local);
+}
+
+/**
+ * Returns the calling thread's ring, setting it up on first use. The ring is released when the thread exits.
+ *
+ * @return The ring, or NULL if io_uring is not available.
+ */
+pipe_uring_t *pipe_uring_local(void) {
+    pipe_uring_t *u;
+
+    if (local_ring != NULL || local_failed) {
+        return local_ring;
+    }
+    local_failed = true;
+    if (!pipe_uring_available()) {
+        return NULL;
+    }
+    pthread_once(&local_once, create_local_key);
+    if ((u = malloc(sizeof(*u))) == NULL) {
+        return NULL;
+    }
+    if (pipe_uring_init(u, 0) == -1) {
+        free(u);
+        return NULL;
+    }
+    pthread_setspecific(local_key, u);
+    local_failed = false;
+    local_ring = u;
+    return u;
+}
+
+/**
+ * Allocates `nbufs` page aligned buffers of `buf_size` bytes and registers them with the ring, so
+ * the kernel pins them once instead of mapping the user pages on every read.
+ *
+ * @param u The ring.
+ * @param nbufs The number of buffers, at most half the submission queue.
+ * @param buf_size The size of each buffer, rounded up to whole pages.
+ * @return 0 on success, or -1 on error.
+ * @throws If the buffers cannot be allocated or registered, an appropriate error message will be printed to stderr.
+ */
+int pipe_uring_register_buffers(pipe_uring_t *u, int nbufs, size_t buf_size) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    struct iovec *iov;
+    void *bufs;
+    int ret;
+
+    if (u->bufs != NULL || nbufs <= 0 || (unsigned)nbufs > u->sq_entries / 2) {
+        pipe_log(PIPE_LOG_ERROR, "Error registering %d io_uring buffers: %s\n", nbufs, strerror(EINVAL));
+        errno = EINVAL;
+        return -1;
+    }
+    buf_size = (buf_size + page - 1) & ~(page - 1);
+    if ((ret = posix_memalign(&bufs, page, nbufs * buf_size)) != 0) {
+        pipe_log(PIPE_LOG_ERROR, "Error allocating io_uring buffers: %s\n", strerror(ret));
+        errno = ret;
+        return -1;
+    }
+    if ((iov = calloc(nbufs, sizeof(*iov))) == NULL) {
+        free(bufs);
+        return -1;
+    }
+    for (int i = 0; i < nbufs; i++) {
+        iov[i].iov_base = (char *)bufs + i * buf_size;
+        iov[i].iov_len = buf_size;
+    }
+    ret = (int)syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_BUFFERS, iov, nbufs);
+    free(iov);
+    if (ret == -1) {
+        pipe_log(PIPE_LOG_ERROR, "Error registering io_uring buffers: %s\n", strerror(errno));
+        free(bufs);
+        return -1;
+    }
+    u->bufs = bufs;
+    u->buf_size = buf_size;
+    u->nbufs = nbufs;
+    return 0;
+}
+
+/**
+ * Returns registered buffer `idx`, see pipe_uring_register_buffers().
+ */
+char *pipe_uring_buf(pipe_uring_t *u, int idx) {
+    return u->bufs + (size_t)idx * u->buf_size;
+}
+
+static struct io_uring_sqe *get_sqe(pipe_uring_t *u) {
+    unsigned tail = atomic_load_explicit(u->sq_tail, memory_order_relaxed) + u->queued;
+    unsigned idx = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[idx];
+
+    // callers never queue more than the ring holds, the previous batch was consumed by the kernel
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_array[idx] = idx;
+    u->queued++;
+    return sqe;
+}
+
+static void prep_rw(struct io_uring_sqe *sqe, int op, int fd, const void *addr, size_t len, uint64_t tag, bool link) {
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)addr;
+    sqe->len = (uint32_t)len;
+    sqe->user_data = tag;
+    sqe->flags = link ? IOSQE_IO_LINK : 0;
+}
+
+static void prep_link_timeout(struct io_uring_sqe *sqe, struct __kernel_timespec *ts, uint64_t tag, bool link) {
+    sqe->opcode = IORING_OP_LINK_TIMEOUT;
+    sqe->addr = (uintptr_t)ts;
+    sqe->len = 1;
+    sqe->timeout_flags = IORING_TIMEOUT_ABS;
+    sqe->user_data = tag;
+    sqe->flags = link ? IOSQE_IO_LINK : 0;
+}
+
+static void to_timespec(uint64_t ns, struct __kernel_timespec *ts) {
+    ts->tv_sec = ns / PIPE_NSEC_PER_SEC;
+    ts->tv_nsec = ns % PIPE_NSEC_PER_SEC;
+}
+
+/**
+ * Submits everything queued and waits for `want` completions. The result of the completion
+ * tagged n (1-based) lands in res[n - 1]; completions tagged 0 are dropped.
+ */
+static int submit_wait(pipe_uring_t *u, unsigned want, int *res, int nres) {
+    unsigned tail = atomic_load_explicit(u->sq_tail, memory_order_relaxed) + u->queued;
+    unsigned reaped = 0;
+
+    atomic_store_explicit(u->sq_tail, tail, memory_order_release);
+    u->queued = 0;
+
+    while (1) {
+        unsigned head = atomic_load_explicit(u->cq_head, memory_order_relaxed);
+        unsigned ctail = atomic_load_explicit(u->cq_tail, memory_order_acquire);
+
+        for (; head != ctail; head++) {
+            struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+            if (cqe->user_data > 0 && cqe->user_data <= (uint64_t)nres) {
+                res[cqe->user_data - 1] = cqe->res;
+            }
+            reaped++;
+        }
+        atomic_store_explicit(u->cq_head, head, memory_order_release);
+
+        // the kernel may consume fewer SQEs than offered if it was interrupted
+        unsigned pending = tail - atomic_load_explicit(u->sq_head, memory_order_acquire);
+        if (reaped >= want && pending == 0) {
+            return 0;
+        }
+        if (uring_enter(u, pending, reaped < want ? 1 : 0) == -1 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            pipe_log(PIPE_LOG_ERROR, "Error in io_uring_enter(): %s\n", strerror(errno));
+            return -1;
+        }
+    }
+}
+
+/**
+ * Reads up to `len` bytes from a pipe, waiting until `deadline` for data to arrive. The wait and
+ * the read are one linked chain, submitted and reaped with a single io_uring_enter(). Kernels
+ * that still honour O_NONBLOCK inside io_uring get a POLL_ADD in front of the read.
+ *
+ * @param u The ring of the calling thread.
+ * @param fd The file descriptor of the named pipe.
+ * @param buf The destination buffer.
+ * @param len The size of `buf`.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds.
+ * @return The number of bytes read, 0 on end of file, or -1 with errno ETIMEDOUT on timeout or another value on error.
+ * @throws If an error other than a timeout occurs, an appropriate error message will be printed to stderr.
+ */
+ssize_t pipe_uring_read(pipe_uring_t *u, int fd, void *buf, size_t len, uint64_t deadline) {
+    struct __kernel_timespec ts;
+    bool poll_first = false;
+
+    to_timespec(deadline, &ts);
+    while (1) {
+        int res[3] = { -ECANCELED, -ECANCELED, 0 };
+
+        if (poll_first) {
+            struct io_uring_sqe *sqe = get_sqe(u);
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = fd;
+            sqe->poll32_events = POLLIN;
+            sqe->user_data = 2;
+            sqe->flags = IOSQE_IO_LINK;
+            prep_link_timeout(get_sqe(u), &ts, 3, true);
+            prep_rw(get_sqe(u), IORING_OP_READ, fd, buf, len, 1, false);
+        } else {
+            prep_rw(get_sqe(u), IORING_OP_READ, fd, buf, len, 1, true);
+            prep_link_timeout(get_sqe(u), &ts, 3, false);
+        }
+        if (submit_wait(u, poll_first ? 3 : 2, res, 3) == -1) {
+            return -1;
+        }
+
+        if (res[0] >= 0) {
+            return res[0];
+        }
+        if (res[0] == -EAGAIN && !poll_first) {
+            poll_first = true;
+            continue;
+        }
+        if (res[2] == -ETIME || (res[0] == -ECANCELED && pipe_now_ns() >= deadline)) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        if (res[0] == -EINTR || res[0] == -EAGAIN || res[0] == -ECANCELED) {
+            continue;
+        }
+        errno = -res[0];
+        pipe_log(PIPE_LOG_ERROR, "Error reading from named pipe: %s\n", strerror(errno));
+        return -1;
+    }
+}
+
+/**
+ * Drains a pipe into the registered buffers with one chain of linked READ_FIXED requests. The
+ * first read waits until `deadline`; each following one only runs if the previous buffer was
+ * filled completely and only takes what is already buffered, so a busy pipe is emptied into up
+ * to `nbufs` buffers with a single io_uring_enter().
+ *
+ * @param u The ring, with buffers registered by pipe_uring_register_buffers().
+ * @param fd The file descriptor of the named pipe.
+ * @param lens Receives the number of bytes in each registered buffer, `u->nbufs` entries.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds.
+ * @return The total number of bytes read, 0 on end of file, or -1 on error or timeout.
+ * @throws If an error other than a timeout occurs, an appropriate error message will be printed to stderr.
+ */
+ssize_t pipe_uring_read_fixed(pipe_uring_t *u, int fd, size_t *lens, uint64_t deadline) {
+    struct __kernel_timespec first, rest;
+    int res[PIPE_URING_ENTRIES / 2];
+    int nbufs = u->nbufs < PIPE_URING_ENTRIES / 2 ? u->nbufs : PIPE_URING_ENTRIES / 2;
+    ssize_t total = 0;
+
+    if (u->bufs == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    to_timespec(deadline, &first);
+    while (1) {
+        to_timespec(pipe_now_ns(), &rest);
+        for (int i = 0; i < nbufs; i++) {
+            struct io_uring_sqe *sqe = get_sqe(u);
+            prep_rw(sqe, IORING_OP_READ_FIXED, fd, pipe_uring_buf(u, i), u->buf_size, i + 1, true);
+            sqe->buf_index = i;
+            prep_link_timeout(get_sqe(u), i == 0 ? &first : &rest, 0, i + 1 < nbufs);
+            res[i] = -ECANCELED;
+        }
+        if (submit_wait(u, 2 * nbufs, res, nbufs) == -1) {
+            return -1;
+        }
+
+        if (res[0] == -EAGAIN || res[0] == -EINTR) {
+            // the file is non-blocking to this kernel's io_uring, wait for it the classic way
+            if (res[0] == -EAGAIN && wait_pipe(fd, POLLIN, deadline) == 0) {
+                errno = ETIMEDOUT;
+                return -1;
+            }
+            continue;
+        }
+        if (res[0] == -ECANCELED) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        if (res[0] < 0) {
+            errno = -res[0];
+            pipe_log(PIPE_LOG_ERROR, "Error reading from named pipe: %s\n", strerror(errno));
+            return -1;
+        }
+        break;
+    }
+
+    for (int i = 0; i < u->nbufs; i++) {
+        lens[i] = i < nbufs && res[i] > 0 ? (size_t)res[i] : 0;
+        total += lens[i];
+    }
+    return total;
+}
+
+/**
+ * Queues one write for pipe_uring_submit_writes(). The buffer is referenced, not copied, and must
+ * stay valid until the batch has been submitted.
+ *
+ * @param u The ring.
+ * @param fd The file descriptor of the named pipe.
+ * @param buf The data to write.
+ * @param len The number of bytes.
+ * @return 0 on success, or -1 if the queue was full and flushing it failed.
+ */
+int pipe_uring_queue_write(pipe_uring_t *u, int fd, const void *buf, size_t len) {
+    if (u->nwrites == PIPE_URING_MAX_WRITES && pipe_uring_submit_writes(u, pipe_deadline_from_timeout(1)) == -1) {
+        return -1;
+    }
+    u->writes[u->nwrites].fd = fd;
+    u->writes[u->nwrites].buf = buf;
+    u->writes[u->nwrites].len = len;
+    u->writes[u->nwrites].done = 0;
+    u->nwrites++;
+    return 0;
+}
+
+/**
+ * Submits every queued write in one linked chain, so they reach their pipes in queue order with
+ * a single io_uring_enter(). Each write waits for pipe capacity until `deadline`; a short write
+ * ends the chain and the rest is resubmitted from where it stopped.
+ *
+ * @param u The ring.
+ * @param deadline The absolute CLOCK_MONOTONIC deadline in nanoseconds.
+ * @return The number of bytes written, or -1 on error or timeout. The queue is empty afterwards either way.
+ * @throws If an error other than EPIPE or a timeout occurs, an appropriate error message will be printed to stderr.
+ */
+ssize_t pipe_uring_submit_writes(pipe_uring_t *u, uint64_t deadline) {
+    struct __kernel_timespec ts;
+    int res[PIPE_URING_MAX_WRITES];
+    ssize_t total = 0;
+    int start = 0;
+
+    to_timespec(deadline, &ts);
+    while (1) {
+        while (start < u->nwrites && u->writes[start].done == u->writes[start].len) {
+            start++;
+        }
+        if (start == u->nwrites) {
+            break;
+        }
+
+        for (int i = start; i < u->nwrites; i++) {
+            struct pipe_uring_write *w = &u->writes[i];
+            prep_rw(get_sqe(u), IORING_OP_WRITE, w->fd, w->buf + w->done, w->len - w->done, i + 1, true);
+            prep_link_timeout(get_sqe(u), &ts, 0, i + 1 < u->nwrites);
+            res[i] = -ECANCELED;
+        }
+        if (submit_wait(u, 2 * (u->nwrites - start), res, u->nwrites) == -1) {
+            total = -1;
+            break;
+        }
+
+        for (int i = start; i < u->nwrites && res[i] != -ECANCELED; i++) {
+            struct pipe_uring_write *w = &u->writes[i];
+            pipe_metrics_add(w->fd, PIPE_METRIC_WRITE_CALLS, 1);
+            if (res[i] >= 0) {
+                w->done += res[i];
+                total += res[i];
+                pipe_metrics_add(w->fd, PIPE_METRIC_BYTES_SENT, res[i]);
+                if (w->done < w->len) {
+                    pipe_metrics_add(w->fd, PIPE_METRIC_PARTIAL_WRITES, 1);
+                }
+            } else if (res[i] == -EAGAIN) {
+                pipe_metrics_add(w->fd, PIPE_METRIC_EAGAIN, 1);
+                if (wait_pipe(w->fd, POLLOUT, deadline) == -1) {
+                    total = -1;
+                }
+                break;
+            } else if (res[i] != -EINTR) {
+                errno = -res[i];
+                if (errno != EPIPE) {
+                    pipe_log(PIPE_LOG_ERROR, "Error writing to named pipe: %s\n", strerror(errno));
+                }
+                total = -1;
+                break;
+            }
+        }
+        if (total == -1) {
+            break;
+        }
+        if (pipe_now_ns() >= deadline && u->writes[start].done < u->writes[start].len) {
+            pipe_log(PIPE_LOG_WARN, "Timeout waiting for named pipe to drain\n");
+            pipe_metrics_add(u->writes[start].fd, PIPE_METRIC_TIMEOUTS, 1);
+            errno = ETIMEDOUT;
+            total = -1;
+            break;
+        }
+    }
+
+    u->nwrites = 0;
+    return total;
+}
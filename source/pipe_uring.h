@@ -0,0 +1,93 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PIPE_URING_H
+#define PIPE_URING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define PIPE_URING_ENTRIES 256
+#define PIPE_URING_MAX_WRITES 64
+
+// <linux/io_uring.h> drags in a BLOCK_SIZE of its own, so it stays out of this header
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+struct pipe_uring_write {
+    int fd;
+    const char *buf;
+    size_t len;
+    size_t done;
+};
+
+/**
+ * An io_uring instance driven with the raw syscalls, so no liburing is needed. One ring belongs
+ * to one thread; pipe_uring_local() hands out a lazily created ring per thread.
+ *
+ * Every wait is expressed as a chain of linked SQEs ending in the operation itself with an
+ * IORING_OP_LINK_TIMEOUT on the absolute CLOCK_MONOTONIC deadline, so waiting for a pipe and
+ * moving its data is a single io_uring_enter() instead of a poll() plus a read() or write().
+ * `enters` counts those calls for benchmarks.
+ */
+typedef struct pipe_uring {
+    int fd;
+    unsigned sq_entries;
+    _Atomic unsigned *sq_head;
+    _Atomic unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    _Atomic unsigned *cq_head;
+    _Atomic unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_map;
+    void *cq_map;
+    size_t sq_map_len;
+    size_t cq_map_len;
+    size_t sqes_len;
+    unsigned queued;
+    uint64_t enters;
+    char *bufs;
+    size_t buf_size;
+    int nbufs;
+    int nwrites;
+    struct pipe_uring_write writes[PIPE_URING_MAX_WRITES];
+} pipe_uring_t;
+
+bool pipe_uring_available(void);
+int pipe_uring_init(pipe_uring_t *u, unsigned entries);
+void pipe_uring_destroy(pipe_uring_t *u);
+pipe_uring_t *pipe_uring_local(void);
+int pipe_uring_register_buffers(pipe_uring_t *u, int nbufs, size_t buf_size);
+char *pipe_uring_buf(pipe_uring_t *u, int idx);
+ssize_t pipe_uring_read(pipe_uring_t *u, int fd, void *buf, size_t len, uint64_t deadline);
+ssize_t pipe_uring_read_fixed(pipe_uring_t *u, int fd, size_t *lens, uint64_t deadline);
+int pipe_uring_queue_write(pipe_uring_t *u, int fd, const void *buf, size_t len);
+ssize_t pipe_uring_submit_writes(pipe_uring_t *u, uint64_t deadline);
+
+#endif
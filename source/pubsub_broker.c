@@ -0,0 +1,90 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <getopt.h>
+
+#include "pipe_pubsub.h"
+#include "pipe_log.h"
+#include "pipe_metrics.h"
+
+#define STATS_INTERVAL 1.0
+
+static pipe_broker_t broker = { .reactor = { .epfd = -1, .wakefd = -1 } };
+
+void sigint_handler(int signum) {
+    (void)signum;
+    pipe_broker_stop(&broker);
+}
+
+// usage - pubsub_broker [-p drop|block] [-q queue bytes] [-s pipe capacity] [-c] [stats file or FIFO]
+// PIPE_LOG_LEVEL=info prints subscriptions and per-subscriber drop counts
+int main(int argc, char *argv[]) {
+    pipe_broker_config_t cfg = {
+        .name = PIPE_BROKER_NAME,
+        .policy = PIPE_PUBSUB_DROP,
+    };
+    const char *stats_path = NULL;
+    int opt, ret;
+
+    while ((opt = getopt(argc, argv, "p:q:s:c")) != -1) {
+        switch (opt) {
+        case 'p':
+            cfg.policy = strcmp(optarg, "block") == 0 ? PIPE_PUBSUB_BLOCK : PIPE_PUBSUB_DROP;
+            break;
+        case 'q':
+            cfg.max_queue = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            cfg.capacity = atoi(optarg);
+            break;
+        case 'c':
+            cfg.copy = true;
+            break;
+        default:
+            printf("usage - %s [-p drop|block] [-q queue bytes] [-s pipe capacity] [-c] [stats file or FIFO]\n",
+                   argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind < argc) {
+        stats_path = argv[optind];
+    }
+
+    signal(SIGINT, sigint_handler);  // setup signal handler for SIGINT
+    signal(SIGPIPE, SIG_IGN);        // a vanished subscriber shows up as EPIPE instead
+    pipe_log_start(STDOUT_FILENO, 0);
+    if (stats_path != NULL) {
+        pipe_metrics_export_start(stats_path, STATS_INTERVAL);
+    }
+    ret = pipe_broker_init(&broker, &cfg) == 0 ? pipe_broker_run(&broker) : -1;
+    pipe_broker_destroy(&broker);
+    pipe_metrics_export_stop();
+    pipe_log_stop();
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
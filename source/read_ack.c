@@ -29,29 +29,53 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <time.h>
+#include <signal.h>
 
 #include "pipe_handler.h"
+#include "pipe_conn.h"
+#include "pipe_time.h"
 
-int main(int argc, char *argv[]) {
-    char buf[BLOCK_SIZE];
-    int buflen;
+int main(void) {
+    struct pipe_frame msg;
+    int buflen, ret = EXIT_FAILURE;
+    pipe_conn_t conn;
 
-    buflen = read_data(PIPE_SET_NAME, buf, 10);
+    signal(SIGPIPE, SIG_IGN);
+    if (pipe_conn_open(&conn, PIPE_GET_NAME, PIPE_SET_NAME) == -1) {
+        return EXIT_FAILURE;
+    }
+
+    // clients announce their private reply pipe before the request
+    while ((buflen = pipe_conn_recv_msg(&conn, &msg, pipe_deadline_from_timeout(10))) >= 0 && msg.hdr.type != PIPE_MSG_DATA) {
+        if (msg.hdr.type == PIPE_MSG_HELLO && buflen > 0) {
+            msg.payload[buflen - 1] = '\0';
+            // anybody may write the name, so only a FIFO of our own user is opened, never created
+            int fd = open_peer_pipe(msg.payload);
+            if (fd == -1 || pipe_conn_set_peer(&conn, msg.payload) == -1) {
+                if (fd >= 0) {
+                    close(fd);
+                }
+                fprintf(stderr, "Ignoring reply pipe %s\n", msg.payload);
+                continue;
+            }
+            if (conn.tx_fd >= 0) {
+                close(fd);
+            } else {
+                conn.tx_fd = fd;
+            }
+        }
+    }
     if (buflen > 0) {
-        fprintf(stdout, "Received : %.*s\n", buflen, buf);
+        fprintf(stdout, "Received : %.*s\n", buflen, msg.payload);
         fprintf(stdout, "Sending ACK\n");
         char ack[] = "ACK";
-        buflen = send_data(PIPE_GET_NAME, ack, strlen(ack), 0.1);
-        if (buflen == strlen(ack)) {
+        buflen = pipe_conn_send_msg(&conn, PIPE_MSG_ACK, ack, strlen(ack), pipe_deadline_from_timeout(0.1));
+        if (buflen == (int)strlen(ack)) {
             fprintf(stdout, "Successfully written %d bytes\n", buflen);
+            ret = EXIT_SUCCESS;
         }
-        else {
-            return EXIT_FAILURE;
-        }
-    }
-    else {
-        return EXIT_FAILURE;
     }
 
-    return EXIT_SUCCESS;
-}
\ No newline at end of file
+    pipe_conn_close(&conn);
+    return ret;
+}
@@ -26,72 +26,105 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <sys/select.h>
 #include <unistd.h>
-#include <errno.h>
-#include <fcntl.h>
 #include <signal.h>
 
 #include "pipe_handler.h"
+#include "pipe_server.h"
+#include "pipe_channel.h"
+#include "pipe_log.h"
+#include "pipe_metrics.h"
+#include "pipe_messages.h"
 
-// Signal
-volatile sig_atomic_t stop = 0;
+// bursty writers stall on a full pipe long before we fall behind, so ask for a deeper FIFO
+#define PIPE_SERVER_CAPACITY (1 << 20)
+#define DEFAULT_WORKERS 4
+#define STATS_INTERVAL 1.0
+// replies here are tiny, accepting lets clients compress their requests
+#define COMPRESS_THRESHOLD 1024
+
+static pipe_server_t server = { .reactor = { .epfd = -1, .wakefd = -1 } };
+static pipe_channel_t channel;
 
 void sigint_handler(int signum) {
-    stop = 1;
+    (void)signum;
+    pipe_server_stop(&server);
+    pipe_channel_stop(&channel);
 }
 
-static void sleep_ms(int timeout) {
-    usleep(timeout * 1000);
-}
+static void handle_request(pipe_server_t *srv, const struct pipe_request *req, void *arg) {
+    struct pipe_bytes body = { req->payload, req->hdr.len };
 
-int read_loop() {
-    int fd, buflen;
-    char buf[BLOCK_SIZE];
-    ssize_t num_read;
+    // typed text carries the same line as a raw payload, decoded in place
+    if (req->hdr.type == PIPE_MSG_TYPED) {
+        struct pipe_msg_text_view text;
+        if (pipe_msg_text_decode(&text, req->payload, req->hdr.len) == -1) {
+            pipe_log(PIPE_LOG_WARN, "Dropping malformed typed message from %u\n", req->hdr.src);
+            return;
+        }
+        body = text.body;
+    }
+    printf("Received data from %u: %.*s\n", req->hdr.src, (int) body.len, body.ptr);
 
-    fd = open_pipe(PIPE_SET_NAME, true);
-    if (fd == -1) {
-        return -1;
+    // a reliable sender is acknowledged by the server itself
+    if (req->client != NULL && !(req->hdr.flags & PIPE_FRAME_REL)) {
+        pipe_server_reply(srv, req, PIPE_MSG_ACK, "ACK", 3);
     }
 
-    while(!stop) {
-        num_read = read(fd, buf, BLOCK_SIZE);
-        if (num_read == -1) {
-            if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                fprintf(stderr, "Error reading from named pipe: %s\n", strerror(errno));
-                close(fd);
-                return -1;
-            }
-        } else if (num_read == 0) {
-            // printf("Nothing to read, sleeping...\n");
-            sleep_ms(10);
+    if (body.len == 4 && memcmp(body.ptr, "quit", 4) == 0) {
+        if (arg != NULL) {
+            pipe_channel_stop(arg);
         } else {
-            printf("Received data: %.*s\n", (int) num_read, buf);
-            fprintf(stdout, "Sending ACK\n");
-            char ack[] = "ACK";
-            buflen = send_data(PIPE_GET_NAME, ack, strlen(ack), 0.1);
-            if (buflen == strlen(ack)) {
-                fprintf(stdout, "Successfully written %d bytes\n", buflen);
-            }
+            pipe_server_stop(srv);
+        }
+    }
+}
+
+int read_loop(int workers, int shards) {
+    pipe_server_config_t cfg = {
+        .name = PIPE_SET_NAME,
+        .workers = workers,
+        .queue_size = 1024,
+        .capacity = PIPE_SERVER_CAPACITY,
+        .compress_threshold = COMPRESS_THRESHOLD,
+        .handler = handle_request,
+    };
+    int ret;
 
-            if (strcmp(buf, "quit") == 0) {
-                break;
-            }
-            // Clean the buffer
-            memset(buf, 0, BLOCK_SIZE);
+    // serve PIPE_SET_NAME.0 .. PIPE_SET_NAME.<shards - 1> with one pinned reader each
+    if (shards > 1) {
+        pipe_channel_config_t ch_cfg = { .name = PIPE_SET_NAME, .shards = shards, .pin = true, .server = cfg };
+        ch_cfg.server.arg = &channel;
+        if (pipe_channel_init(&channel, &ch_cfg) == -1) {
+            return -1;
         }
+        ret = pipe_channel_run(&channel);
+        pipe_channel_destroy(&channel);
+        return ret;
     }
 
-    if (fd) {
-        close(fd);
+    if (pipe_server_init(&server, &cfg) == -1) {
+        return -1;
     }
+    ret = pipe_server_run(&server);
+    pipe_server_destroy(&server);
+    return ret;
 }
 
+// usage - read_loop [workers] [stats file or FIFO, - for none] [shards]
 int main(int argc, char *argv[]) {
+    int workers = argc > 1 ? atoi(argv[1]) : DEFAULT_WORKERS;
+    const char *stats_path = argc > 2 && strcmp(argv[2], "-") != 0 ? argv[2] : NULL;
+    int shards = argc > 3 ? atoi(argv[3]) : 1;
+
     signal(SIGINT, sigint_handler);  // setup signal handler for SIGINT
-    read_loop();
+    signal(SIGPIPE, SIG_IGN);        // a vanished client shows up as EPIPE instead
+    pipe_log_start(STDERR_FILENO, 0);  // diagnostics only, requests are printed on stdout
+    if (stats_path != NULL) {
+        pipe_metrics_export_start(stats_path, STATS_INTERVAL);
+    }
+    read_loop(workers, shards);
+    pipe_metrics_export_stop();
+    pipe_log_stop();
     return EXIT_SUCCESS;
 }
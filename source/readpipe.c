@@ -27,69 +27,219 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <sys/select.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <signal.h>
+#include <getopt.h>
 
-#define PIPE_SET_NAME "/tmp/my_pipe_set"
-#define PIPE_GET_NAME "/tmp/my_pipe_get"
-
-#define BLOCK_SIZE 4096
+#include "pipe_handler.h"
+#include "pipe_bulk.h"
+#include "pipe_frame.h"
+#include "pipe_lines.h"
+#include "pipe_time.h"
 
 // Signal
 volatile sig_atomic_t stop = 0;
 
 void sigint_handler(int signum) {
+    (void)signum;
     stop = 1;
 }
 
-int read_from_pipe() {
-    int fd;
-    char buf[BLOCK_SIZE];
+int read_messages() {
+    int fd, keepalive_fd, ret = 0;
+    pipe_frame_reader_t reader;
+    struct pipe_frame msg;
     ssize_t num_read;
 
-    while (!stop) {
-        if (access(PIPE_SET_NAME, F_OK) == -1) {
-            // The named pipe doesn't exist yet.
-            sleep(1);
-            continue;
-        }
+    fd = open_pipe_persistent(PIPE_SET_NAME, &keepalive_fd);
+    if (fd == -1) {
+        return -1;
+    }
+    if (pipe_frame_reader_init(&reader, 0) == -1) {
+        close(fd);
+        close(keepalive_fd);
+        return -1;
+    }
 
-        // The named pipe exists, so try to open it for reading.
-        fd = open(PIPE_SET_NAME, O_RDONLY | O_NONBLOCK);
-        if (fd == -1) {
-            fprintf(stderr, "Error opening named pipe for reading: %s\n", strerror(errno));
-            sleep(1);
+    while (!stop) {
+        num_read = pipe_frame_reader_fill(&reader, fd);
+        if (num_read == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                ret = -1;
+                break;
+            }
+            // wake up once a second to notice SIGINT
+            if (wait_pipe(fd, POLLIN, pipe_deadline_from_timeout(1)) == -1) {
+                ret = -1;
+                break;
+            }
             continue;
         }
 
-        num_read = read(fd, buf, BLOCK_SIZE);
-        if (num_read == -1) {
-            if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                fprintf(stderr, "Error reading from named pipe: %s\n", strerror(errno));
-                close(fd);
-                return -1;
+        while ((ret = pipe_frame_next(&reader, &msg)) == 1) {
+            if (msg.hdr.type == PIPE_MSG_BYE) {
+                continue;
             }
-        } else if (num_read == 0) {
-            printf("Nothing to read, sleeping...\n");
-            sleep(1);
-        } else {
-            printf("Received data: %.*s\n", (int) num_read, buf);
-            if (memcmp(buf, "quit", (int) num_read) == 0) {
+            printf("Received data: %.*s\n", (int) msg.hdr.len, msg.payload);
+            if (msg.hdr.len == 4 && memcmp(msg.payload, "quit", 4) == 0) {
+                stop = 1;
                 break;
             }
-            // Clean the buffer
-            memset(buf, 0, BLOCK_SIZE);
+        }
+        if (ret == -1) {
+            break;
+        }
+        ret = 0;
+    }
+
+    pipe_frame_reader_free(&reader);
+    close(fd);
+    close(keepalive_fd);
+    return ret;
+}
+
+static void print_lines(const struct pipe_bytes *records, size_t count, void *arg) {
+    (void)arg;
+    for (size_t i = 0; i < count && !stop; i++) {
+        printf("Received data: %.*s\n", (int) records[i].len, records[i].ptr);
+        if (records[i].len == 4 && memcmp(records[i].ptr, "quit", 4) == 0) {
+            stop = 1;
+        }
+    }
+}
+
+/**
+ * Reads newline-terminated records written by tools that do not frame their output, such as
+ * `printf 'a\nb\n' > /tmp/my_pipe_set`.
+ */
+int read_lines() {
+    int fd, keepalive_fd, ret = 0;
+    pipe_line_reader_t reader;
+
+    fd = open_pipe_persistent(PIPE_SET_NAME, &keepalive_fd);
+    if (fd == -1) {
+        return -1;
+    }
+    if (pipe_line_reader_init(&reader, 64 * 1024, '\n', print_lines, NULL) == -1) {
+        close(fd);
+        close(keepalive_fd);
+        return -1;
+    }
+
+    while (!stop) {
+        if (pipe_line_reader_fill(&reader, fd) != -1) {
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            ret = -1;
+            break;
+        }
+        // wake up once a second to notice SIGINT
+        if (wait_pipe(fd, POLLIN, pipe_deadline_from_timeout(1)) == -1) {
+            ret = -1;
+            break;
         }
     }
+
+    pipe_line_reader_free(&reader);
     close(fd);
-    return 0;
+    close(keepalive_fd);
+    return ret;
+}
+
+/**
+ * Writes the payload of every frame to `path` ("-" for stdout) until a writer ends its stream
+ * with PIPE_MSG_BYE, as `writepipe -f` does. Payloads are spliced from the pipe into the output
+ * without passing through user space.
+ */
+int read_to_file(const char *path) {
+    struct pipe_frame_hdr hdr;
+    uint64_t frames = 0, bytes = 0, t0 = 0;
+    int fd, keepalive_fd, out, ret = 0;
+
+    out = strcmp(path, "-") == 0 ? STDOUT_FILENO : open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out == -1) {
+        fprintf(stderr, "Error opening %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    fd = open_pipe_persistent(PIPE_SET_NAME, &keepalive_fd);
+    if (fd == -1) {
+        if (out != STDOUT_FILENO) {
+            close(out);
+        }
+        return -1;
+    }
+
+    while (!stop) {
+        // wake up once a second to notice SIGINT while no writer is active
+        int ready = wait_pipe(fd, POLLIN, pipe_deadline_from_timeout(1));
+        if (ready == -1) {
+            ret = -1;
+            break;
+        }
+        if (ready == 0) {
+            continue;
+        }
+        if (pipe_bulk_recv_frame(fd, out, &hdr, 0, pipe_deadline_from_timeout(10)) == -1) {
+            ret = -1;
+            break;
+        }
+        if (frames++ == 0) {
+            t0 = pipe_now_ns();
+        }
+        bytes += hdr.len;
+        if (hdr.type == PIPE_MSG_BYE) {
+            break;
+        }
+    }
+    if (ret == 0 && frames > 0) {
+        double secs = (pipe_now_ns() - t0) / 1e9;
+        fprintf(stderr, "Received %llu frames (%llu bytes) in %.3f s (%.1f MB/s)\n",
+                (unsigned long long)frames, (unsigned long long)bytes, secs, secs > 0 ? bytes / secs / 1e6 : 0);
+    }
+
+    close(fd);
+    close(keepalive_fd);
+    if (out != STDOUT_FILENO) {
+        close(out);
+    }
+    return ret;
 }
 
 int main(int argc, char *argv[]) {
+    const char *path = NULL;
+    bool lines = false;
+    int opt, ret;
+
+    while ((opt = getopt(argc, argv, "lo:")) != -1) {
+        switch (opt) {
+        case 'l':
+            lines = true;
+            break;
+        case 'o':
+            path = optarg;
+            break;
+        default:
+            optind = argc + 1;
+            break;
+        }
+    }
+    if (optind != argc || (lines && path != NULL)) {
+        printf("usage - %s [-l | -o file|-]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
     signal(SIGINT, sigint_handler);  // setup signal handler for SIGINT
-    read_from_pipe();
+    if (path != NULL) {
+        ret = read_to_file(path);
+        return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (lines) {
+        read_lines();
+    } else {
+        read_messages();
+    }
     return EXIT_SUCCESS;
 }
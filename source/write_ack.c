@@ -24,36 +24,260 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <time.h>
+#include <signal.h>
+#include <getopt.h>
 
 #include "pipe_handler.h"
+#include "pipe_ingest.h"
+#include "pipe_rpc.h"
+#include "pipe_reliable.h"
+#include "pipe_time.h"
+#include "pipe_messages.h"
+
+#define ACK_TIMEOUT 10
+
+struct ack_stats {
+    long acked;
+    long failed;
+};
+
+static void on_ack(pipe_rpc_t *rpc, int status, const struct pipe_frame *reply, void *arg) {
+    struct ack_stats *stats = arg;
+
+    (void)rpc;
+    if (status == 0 && reply->hdr.type == PIPE_MSG_ACK && reply->hdr.len == 3 && memcmp(reply->payload, "ACK", 3) == 0) {
+        stats->acked++;
+    } else {
+        stats->failed++;
+    }
+}
+
+/**
+ * The requests to send: `count` copies of the command line argument, or with -f one request per
+ * record of a file, paced to `-R` requests per second.
+ */
+struct ack_source {
+    pipe_ingest_t in;
+    bool file;
+    long left;
+    uint16_t type;
+    const char *data;
+    int len;
+    char *encoded;              // -t encoding of the current record
+    size_t encoded_cap;
+    pipe_rate_t rate;
+    long sent;
+    uint64_t bytes;
+};
+
+/**
+ * Produces the next request payload, valid until the next call.
+ *
+ * @return 1 with `data` and `len` set, 0 when the source is exhausted, or -1 on error.
+ */
+static int source_next(struct ack_source *src, const char **data, int *len) {
+    const char *rec;
+    size_t records;
+    ssize_t n;
+
+    if (!src->file) {
+        if (src->left == 0) {
+            return 0;
+        }
+        src->left--;
+        *data = src->data;
+        *len = src->len;
+    } else {
+        if ((n = pipe_ingest_next(&src->in, 1, &rec, &records)) <= 0) {
+            return (int)n;
+        }
+        // the last record of a file may lack its newline
+        if (rec[n - 1] == '\n') {
+            n--;
+        }
+        *data = rec;
+        *len = (int)n;
+        if (src->type == PIPE_MSG_TYPED) {
+            struct pipe_msg_text text = { .body = { rec, (uint32_t)n } };
+            size_t size = pipe_msg_text_size(&text);
+            if (size > src->encoded_cap) {
+                char *buf = realloc(src->encoded, size);
+                if (buf == NULL) {
+                    return -1;
+                }
+                src->encoded = buf;
+                src->encoded_cap = size;
+            }
+            if ((*len = pipe_msg_text_encode(&text, src->encoded, size)) == -1) {
+                return -1;
+            }
+            *data = src->encoded;
+        }
+    }
+    pipe_rate_wait(&src->rate, 1);
+    src->sent++;
+    src->bytes += *len;
+    return 1;
+}
+
+/**
+ * Sends every request of `src` at least once, keeping up to `window` unacknowledged and
+ * retransmitting what the server misses, e.g. across a restart of read_loop.
+ */
+static int send_reliable(const char *reply_name, struct ack_source *src, int window, size_t compress) {
+    const char *data;
+    pipe_rel_t rel;
+    uint64_t t0;
+    int buflen, next, ret;
+
+    if (pipe_rel_open(&rel, PIPE_SET_NAME, reply_name, window) == -1) {
+        return EXIT_FAILURE;
+    }
+    if (compress > 0 && pipe_conn_set_compression(&rel.conn, compress) == -1) {
+        pipe_rel_close(&rel);
+        return EXIT_FAILURE;
+    }
+    t0 = pipe_now_ns();
+    while ((next = source_next(src, &data, &buflen)) == 1) {
+        if (pipe_rel_send(&rel, src->type, data, buflen, pipe_deadline_from_timeout(ACK_TIMEOUT)) == -1) {
+            break;
+        }
+    }
+    // seqs start at 0, so the first unacknowledged one counts the delivered messages
+    ret = next == 0 && pipe_rel_flush(&rel, pipe_deadline_from_timeout(ACK_TIMEOUT)) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    double secs = (pipe_now_ns() - t0) / 1e9;
+    fprintf(stdout, "Delivered %ld of %ld messages (%llu bytes) in %.3f s (%.0f messages/s, %.1f MB/s, %d in flight, %llu retransmits)\n",
+            (long)rel.base, src->sent, (unsigned long long)src->bytes, secs, src->sent / secs, src->bytes / secs / 1e6,
+            window, (unsigned long long)rel.retransmits);
+    pipe_rel_close(&rel);
+    return ret;
+}
 
 int main(int argc, char *argv[]) {
-    char buf[BLOCK_SIZE];
-    int fd = -1, buflen;
+    char reply_name[PIPE_NAME_MAX];
+    struct ack_stats stats = { 0, 0 };
+    struct ack_source src = { .left = 1, .type = PIPE_MSG_DATA };
+    const char *path = NULL;
+    size_t compress = 0;
+    double rate = 0;
+    bool reliable = false;
+    int inflight = 1, opt, buflen, next, ret = EXIT_FAILURE;
+    const char *data;
+    char *encoded = NULL;
+    pipe_rpc_t rpc;
 
-    if (argc != 2) {
-        printf("usage - %s [stuff to write]\n", argv[0]);
+    while ((opt = getopt(argc, argv, "f:n:p:R:rtz:")) != -1) {
+        switch (opt) {
+        case 'f':
+            path = optarg;
+            break;
+        case 'n':
+            src.left = atol(optarg);
+            break;
+        case 'p':
+            inflight = atoi(optarg);
+            break;
+        case 'R':
+            rate = atof(optarg);
+            break;
+        case 'r':
+            reliable = true;
+            break;
+        case 't':
+            src.type = PIPE_MSG_TYPED;
+            break;
+        case 'z':
+            compress = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            optind = argc + 1;
+            break;
+        }
+    }
+    if (optind != argc - (path == NULL) || src.left < 1 || inflight < 1) {
+        printf("usage - %s [-n count] [-p requests in flight] [-r] [-t] [-z compress threshold] [-R requests/s] [stuff to write]\n", argv[0]);
+        printf("        %s -f file|- [-p requests in flight] [-r] [-t] [-z compress threshold] [-R requests/s]\n", argv[0]);
         return -1;
     }
-    printf("writing: \"%s\"\n", argv[1]);
-
-    snprintf(buf, BLOCK_SIZE, "%s", argv[1]);
-    buflen = send_data(PIPE_SET_NAME, buf, strlen(buf), 0.1);
-    if (buflen == strlen(buf)) {
-        fprintf(stdout, "Successfully written %d bytes\n", buflen);
-        buflen = read_data(PIPE_GET_NAME, buf, 10);
-        if ((buflen > 0) && (memcmp(buf, "ACK", buflen) == 0)) {
-            fprintf(stdout, "Received : %.*s\n", buflen, buf);
-        } else {
+    pipe_rate_init(&src.rate, rate);
+    if (path != NULL) {
+        // one request per line of the file
+        if (pipe_ingest_open(&src.in, path, '\n', PIPE_INGEST_CHUNK) == -1) {
             return EXIT_FAILURE;
         }
+        src.file = true;
     } else {
-        return EXIT_FAILURE;
+        src.data = argv[optind];
+        src.len = strlen(src.data);
+        printf("writing: \"%s\"\n", src.data);
+
+        // -t sends the line as a typed text message instead of a raw payload
+        if (src.type == PIPE_MSG_TYPED) {
+            struct pipe_msg_text text = { .body = pipe_bytes_str(src.data) };
+            encoded = malloc(pipe_msg_text_size(&text));
+            if (encoded == NULL || (src.len = pipe_msg_text_encode(&text, encoded, pipe_msg_text_size(&text))) == -1) {
+                perror("encode");
+                free(encoded);
+                return EXIT_FAILURE;
+            }
+            src.data = encoded;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    // a private reply pipe, opened before sending so the ACK always has a reader
+    snprintf(reply_name, sizeof(reply_name), "%s.%d", PIPE_GET_NAME, (int)getpid());
+    if (reliable) {
+        ret = send_reliable(reply_name, &src, inflight, compress);
+        goto out;
+    }
+    if (pipe_rpc_open(&rpc, PIPE_SET_NAME, reply_name, inflight) == -1) {
+        goto out;
+    }
+    if (compress > 0 && pipe_conn_set_compression(&rpc.conn, compress) == -1) {
+        pipe_rpc_close(&rpc);
+        goto out;
     }
 
-    return EXIT_SUCCESS;
+    if (!src.file && src.left == 1) {
+        pipe_rpc_future_t fut;
+        source_next(&src, &data, &buflen);
+        if (pipe_rpc_call_future(&rpc, src.type, data, buflen, pipe_deadline_from_timeout(ACK_TIMEOUT), &fut) >= 0) {
+            fprintf(stdout, "Successfully written %d bytes\n", buflen);
+            if (pipe_rpc_wait(&rpc, &fut, pipe_deadline_from_timeout(ACK_TIMEOUT)) == 0 && fut.status == 0 && fut.type == PIPE_MSG_ACK &&
+                fut.len == 3 && memcmp(fut.data, "ACK", 3) == 0) {
+                fprintf(stdout, "Received : %.*s\n", (int)fut.len, fut.data);
+                ret = EXIT_SUCCESS;
+            }
+            pipe_rpc_future_free(&fut);
+        }
+    } else {
+        // keep `inflight` requests outstanding, pipe_rpc_call() completes older ones as needed
+        uint64_t t0 = pipe_now_ns();
+        while ((next = source_next(&src, &data, &buflen)) == 1) {
+            if (pipe_rpc_call(&rpc, src.type, data, buflen, pipe_deadline_from_timeout(ACK_TIMEOUT), on_ack, &stats) == -1) {
+                break;
+            }
+        }
+        pipe_rpc_wait(&rpc, NULL, pipe_deadline_from_timeout(ACK_TIMEOUT));
+        double secs = (pipe_now_ns() - t0) / 1e9;
+        fprintf(stdout, "Received %ld of %ld ACKs (%llu bytes) in %.3f s (%.0f requests/s, %.1f MB/s, %d in flight)\n",
+                stats.acked, src.sent, (unsigned long long)src.bytes, secs, stats.acked / secs, src.bytes / secs / 1e6,
+                inflight);
+        ret = next == 0 && stats.acked == src.sent ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    pipe_rpc_close(&rpc);
+out:
+    if (src.file) {
+        pipe_ingest_close(&src.in);
+    }
+    free(src.encoded);
+    free(encoded);
+    return ret;
 }
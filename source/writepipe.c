@@ -24,53 +24,191 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <getopt.h>
 
 #include "pipe_handler.h"
+#include "pipe_batch.h"
+#include "pipe_frame.h"
+#include "pipe_ingest.h"
+#include "pipe_spool.h"
+#include "pipe_time.h"
 
-int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        printf("usage - %s [stuff to write]\n", argv[0]);
+// how long -s waits for a reader before leaving the message to the next run
+#define SPOOL_FLUSH_TIMEOUT 1.0
+// how long -f waits for a reader to appear and for the pipe to drain
+#define INGEST_TIMEOUT 10
+// pending bytes that make -f write out its queued frames
+#define INGEST_BATCH_BYTES (256 * 1024)
+
+/**
+ * Hands the frame to the spool of PIPE_SET_NAME. Without a reader it stays on disk, and the next
+ * spooling run delivers it ahead of its own message.
+ */
+static int write_spooled(const struct pipe_frame_hdr *hdr, const char *payload) {
+    pipe_spool_config_t cfg = { .name = PIPE_SET_NAME };
+    size_t len = PIPE_FRAME_HDR_SIZE + hdr->len;
+    char *frame = malloc(len);
+    pipe_spool_t spool;
+    int ret = -1;
+
+    signal(SIGPIPE, SIG_IGN);
+    if (frame == NULL || pipe_spool_open(&spool, &cfg) == -1) {
+        free(frame);
         return -1;
     }
-    printf("writing: \"%s\"\n", argv[1]);
+    pipe_frame_encode(frame, len, hdr, payload);
+    if (pipe_spool_send(&spool, frame, len) == (ssize_t)len) {
+        ret = 0;
+        if (pipe_spool_flush(&spool, pipe_deadline_from_timeout(SPOOL_FLUSH_TIMEOUT)) == -1) {
+            printf("no reader, spooled in %s\n", spool.dir);
+        }
+    }
+    pipe_spool_close(&spool);
+    free(frame);
+    return ret;
+}
 
-    char buf[BLOCK_SIZE];
-    int buflen;
-    int fd;
+/**
+ * Streams the records of `path` into PIPE_SET_NAME over one open pipe. Whole records are packed
+ * into frames of up to `chunk` bytes, delimiters included, and queued frames are written with one
+ * writev() per INGEST_BATCH_BYTES. A mapped file is framed in place without copying. A final
+ * PIPE_MSG_BYE tells `readpipe -o` that the stream is complete.
+ */
+static int write_records(const char *path, size_t chunk, double rate_limit) {
+    struct pipe_frame_hdr hdr;
+    pipe_ingest_t in;
+    pipe_batch_t batch;
+    pipe_rate_t rate;
+    const char *data;
+    size_t records;
+    ssize_t len;
+    uint64_t t0;
+    int fd, ret = 0;
 
-    snprintf(buf, BLOCK_SIZE, "%s", argv[1]);
-    buflen = strlen(buf);
+    if (pipe_ingest_open(&in, path, '\n', chunk) == -1) {
+        return -1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    fd = open_pipe_wait(PIPE_SET_NAME, pipe_deadline_from_timeout(INGEST_TIMEOUT));
+    if (fd == -1) {
+        pipe_ingest_close(&in);
+        return -1;
+    }
+    // a deeper pipe lets the reader drain more per wakeup
+    set_pipe_capacity(fd, get_pipe_max_capacity());
+    pipe_batch_init(&batch, fd, false, INGEST_BATCH_BYTES, UINT64_MAX);
+    pipe_rate_init(&rate, rate_limit);
 
-    if (access(PIPE_SET_NAME, F_OK) == -1) {
-        if (mkfifo(PIPE_SET_NAME, 0666) == -1) {
-            fprintf(stderr, "Error creating named pipe: %s\n", strerror(errno));
-            return -1;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.type = PIPE_MSG_DATA;
+    t0 = pipe_now_ns();
+    while ((len = pipe_ingest_next(&in, pipe_rate_burst(&rate), &data, &records)) > 0) {
+        pipe_rate_wait(&rate, records);
+        hdr.len = (uint32_t)len;
+        batch.deadline = pipe_deadline_from_timeout(INGEST_TIMEOUT);
+        if (pipe_batch_add(&batch, &hdr, data) == -1) {
+            ret = -1;
+            break;
         }
+        hdr.seq++;
+        // a paced stream goes out as it is paced, and streamed input is only valid until the next read
+        if ((rate.per_sec > 0 || !in.mapped) && pipe_batch_flush(&batch) == -1) {
+            ret = -1;
+            break;
+        }
+    }
+    if (len == -1) {
+        ret = -1;
     }
+    hdr.type = PIPE_MSG_BYE;
+    hdr.len = 0;
+    batch.deadline = pipe_deadline_from_timeout(INGEST_TIMEOUT);
+    if (ret == 0 && (pipe_batch_add(&batch, &hdr, NULL) == -1 || pipe_batch_flush(&batch) == -1)) {
+        ret = -1;
+    }
+
+    double secs = (pipe_now_ns() - t0) / 1e9;
+    printf("Sent %llu records (%llu bytes) in %u frames in %.3f s (%.0f records/s, %.1f MB/s)\n",
+           (unsigned long long)in.records, (unsigned long long)in.bytes, hdr.seq, secs, in.records / secs,
+           in.bytes / secs / 1e6);
+    close(fd);
+    pipe_ingest_close(&in);
+    return ret;
+}
 
-    if ((fd = open(PIPE_SET_NAME, O_WRONLY | O_NONBLOCK)) == -1) {
-        if (errno != EAGAIN && errno != EWOULDBLOCK) {
-            fprintf(stderr, "Error opening named pipe for writing: %s\n", strerror(errno));
-            return -1;
+int main(int argc, char *argv[]) {
+    const char *path = NULL;
+    size_t chunk = PIPE_INGEST_CHUNK;
+    double rate = 0;
+    bool spool = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:f:R:s")) != -1) {
+        switch (opt) {
+        case 'c':
+            chunk = strtoul(optarg, NULL, 10);
+            break;
+        case 'f':
+            path = optarg;
+            break;
+        case 'R':
+            rate = atof(optarg);
+            break;
+        case 's':
+            spool = true;
+            break;
+        default:
+            optind = argc + 1;
+            break;
         }
     }
-    int bytes_written = write(fd, buf, buflen);
+    if (path != NULL ? optind != argc || spool || chunk == 0 : optind != argc - 1) {
+        printf("usage - %s [-s] [stuff to write]\n", argv[0]);
+        printf("        %s -f file|- [-c frame bytes] [-R records/s]\n", argv[0]);
+        return -1;
+    }
+    if (path != NULL) {
+        return write_records(path, chunk, rate) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    const char *data = argv[optind];
+    printf("writing: \"%s\"\n", data);
+
+    struct pipe_frame_hdr hdr;
+    ssize_t buflen;
+    int fd;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.len = strlen(data);
+    hdr.type = PIPE_MSG_DATA;
+    buflen = PIPE_FRAME_HDR_SIZE + hdr.len;
+
+    if (spool) {
+        return write_spooled(&hdr, data) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // wait for the reader like write_records() does instead of writing to a pipe nobody opened
+    if ((fd = open_pipe_wait(PIPE_SET_NAME, pipe_deadline_from_timeout(INGEST_TIMEOUT))) == -1) {
+        return -1;
+    }
+    // large messages do not fit in the pipe at once, give the reader time to drain it
+    ssize_t bytes_written = pipe_frame_write(fd, &hdr, data, pipe_deadline_from_timeout(10));
+    close(fd);
     if (bytes_written == -1) {
-        fprintf(stderr, "Error writing to named pipe: %s\n", strerror(errno));
         return -1;
     }
 
     if (bytes_written != buflen) {
-        fprintf(stderr, "Failed to write all data: %d != %d\n", bytes_written, buflen);
+        fprintf(stderr, "Failed to write all data: %zd != %zd\n", bytes_written, buflen);
         return -1;
     }
 
-    close(fd);
     return EXIT_SUCCESS;
 }
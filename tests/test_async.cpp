@@ -0,0 +1,321 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2023 Jatty Andriean
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Behaviour tests of the coroutine facade, run by CTest one case at a time.
+ *
+ *   round_trip   - a request reaches an echo conversation whose reader opens only after the
+ *                  sender started connecting, and the echo comes back intact
+ *   timeout      - a receive and a connect with nobody on the other end fail with ETIMEDOUT at
+ *                  their deadline
+ *   cancel       - closing a connection with close_conn() resumes a receive that waits forever
+ *                  with ECANCELED
+ *   many_clients - MANY_CLIENTS clients and their echo conversations share one scheduler, and
+ *                  every client gets back exactly the requests it sent
+ *
+ * usage - test_async <case>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include <vector>
+
+#include "pipe_async.hpp"
+#include "pipe_handler.h"
+
+#define TEST_PIPE_NAME "/tmp/my_pipe_test_async"
+#define TEST_TIMEOUT 5
+#define READER_DELAY_NS (50 * 1000 * 1000ULL)
+#define SHORT_DEADLINE_NS (50 * 1000 * 1000ULL)
+#define MANY_CLIENTS 100
+#define MANY_REQUESTS 50
+#define MSG_SIZE 64
+
+#define CHECK(cond)                                                                   \
+    do {                                                                              \
+        if (!(cond)) {                                                                \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);  \
+            failed = true;                                                            \
+        }                                                                             \
+    } while (0)
+
+static bool failed = false;
+static const char *case_name;
+
+struct peers {
+    pipe_conn_t client;     // sends on the up pipe, receives on the down pipe
+    pipe_conn_t echo;       // the other end
+};
+
+/**
+ * Names the FIFO pair of conversation `i`. The case name and pid keep cases that CTest runs in
+ * parallel off each other's pipes.
+ */
+static void fifo_names(int i, char *up, char *down) {
+    snprintf(up, PIPE_NAME_MAX, "%s.%s.%d.%d.up", TEST_PIPE_NAME, case_name, (int)getpid(), i);
+    snprintf(down, PIPE_NAME_MAX, "%s.%s.%d.%d.down", TEST_PIPE_NAME, case_name, (int)getpid(), i);
+}
+
+static int open_client(pipe_conn_t *conn, int i) {
+    char up[PIPE_NAME_MAX], down[PIPE_NAME_MAX];
+
+    fifo_names(i, up, down);
+    return pipe_conn_open(conn, up, down);
+}
+
+static int open_echo(pipe_conn_t *conn, int i) {
+    char up[PIPE_NAME_MAX], down[PIPE_NAME_MAX];
+
+    fifo_names(i, up, down);
+    return pipe_conn_open(conn, down, up);
+}
+
+static void unlink_pipes(int n) {
+    char up[PIPE_NAME_MAX], down[PIPE_NAME_MAX];
+
+    for (int i = 0; i < n; i++) {
+        fifo_names(i, up, down);
+        unlink(up);
+        unlink(down);
+    }
+}
+
+static cpipe::task<> echo_late(cpipe::scheduler &s, peers *p) {
+    struct pipe_frame msg;
+
+    // the client is already waiting in async_connect() for a reader on the up pipe
+    co_await s.sleep_until(pipe_now_ns() + READER_DELAY_NS);
+    if (open_echo(&p->echo, 0) == -1) {
+        CHECK(!"pipe_conn_open");
+        co_return;
+    }
+    int len = co_await cpipe::async_recv(s, &p->echo, &msg, pipe_deadline_from_timeout(TEST_TIMEOUT));
+    CHECK(len == 5);
+    if (len >= 0) {
+        CHECK(co_await cpipe::async_send(s, &p->echo, msg.hdr.type, msg.payload, msg.hdr.len,
+                                         pipe_deadline_from_timeout(TEST_TIMEOUT)) == len);
+    }
+}
+
+static cpipe::task<> client_request(cpipe::scheduler &s, peers *p) {
+    struct pipe_frame reply;
+    uint64_t t0 = pipe_now_ns();
+
+    int len = co_await cpipe::async_request(s, &p->client, PIPE_MSG_DATA, "hello", 5, &reply,
+                                            pipe_deadline_from_timeout(TEST_TIMEOUT));
+    CHECK(len == 5);
+    CHECK(len != 5 || memcmp(reply.payload, "hello", 5) == 0);
+    CHECK(pipe_now_ns() - t0 >= READER_DELAY_NS);
+}
+
+static int test_round_trip(void) {
+    cpipe::scheduler s;
+    peers p;
+
+    if (open_client(&p.client, 0) == -1) {
+        return -1;
+    }
+    memset(&p.echo, 0, sizeof(p.echo));
+    p.echo.tx_fd = p.echo.rx_fd = p.echo.rx_keepalive_fd = -1;
+    s.spawn(client_request(s, &p));
+    s.spawn(echo_late(s, &p));
+    CHECK(s.run() == 0);
+    cpipe::close_conn(s, &p.client);
+    cpipe::close_conn(s, &p.echo);
+    return 0;
+}
+
+static cpipe::task<> recv_expires(cpipe::scheduler &s, peers *p) {
+    struct pipe_frame msg;
+    uint64_t t0 = pipe_now_ns();
+
+    CHECK(co_await cpipe::async_recv(s, &p->client, &msg, t0 + SHORT_DEADLINE_NS) == -1);
+    CHECK(errno == ETIMEDOUT);
+    CHECK(pipe_now_ns() - t0 >= SHORT_DEADLINE_NS);
+    CHECK(pipe_now_ns() - t0 < (uint64_t)TEST_TIMEOUT * PIPE_NSEC_PER_SEC);
+}
+
+static cpipe::task<> connect_expires(cpipe::scheduler &s, peers *p) {
+    uint64_t t0 = pipe_now_ns();
+
+    CHECK(co_await cpipe::async_connect(s, &p->client, t0 + SHORT_DEADLINE_NS) == -1);
+    CHECK(errno == ETIMEDOUT);
+    CHECK(pipe_now_ns() - t0 >= SHORT_DEADLINE_NS);
+    CHECK(p->client.tx_fd == -1);
+}
+
+static int test_timeout(void) {
+    cpipe::scheduler s;
+    peers p;
+
+    if (open_client(&p.client, 0) == -1) {
+        return -1;
+    }
+    // both wait at once, so one expiring must not disturb the other
+    s.spawn(recv_expires(s, &p));
+    s.spawn(connect_expires(s, &p));
+    CHECK(s.run() == 0);
+    cpipe::close_conn(s, &p.client);
+    return 0;
+}
+
+static cpipe::task<> recv_forever(cpipe::scheduler &s, peers *p, bool *resumed) {
+    struct pipe_frame msg;
+
+    CHECK(co_await cpipe::async_recv(s, &p->client, &msg, PIPE_DEADLINE_NEVER) == -1);
+    CHECK(errno == ECANCELED);
+    *resumed = true;
+}
+
+static cpipe::task<> close_later(cpipe::scheduler &s, peers *p) {
+    co_await s.sleep_until(pipe_now_ns() + SHORT_DEADLINE_NS);
+    cpipe::close_conn(s, &p->client);
+}
+
+static int test_cancel(void) {
+    cpipe::scheduler s;
+    bool resumed = false;
+    peers p;
+
+    if (open_client(&p.client, 0) == -1) {
+        return -1;
+    }
+    s.spawn(recv_forever(s, &p, &resumed));
+    s.spawn(close_later(s, &p));
+    CHECK(s.run() == 0);
+    CHECK(resumed);
+    return 0;
+}
+
+struct echo_client {
+    peers p;
+    int id;
+    int echoed;
+};
+
+static cpipe::task<> echo_all(cpipe::scheduler &s, echo_client *c) {
+    struct pipe_frame msg;
+
+    while (co_await cpipe::async_recv(s, &c->p.echo, &msg, pipe_deadline_from_timeout(TEST_TIMEOUT)) >= 0 &&
+           msg.hdr.type != PIPE_MSG_BYE) {
+        if (co_await cpipe::async_send(s, &c->p.echo, msg.hdr.type, msg.payload, msg.hdr.len,
+                                       pipe_deadline_from_timeout(TEST_TIMEOUT)) == -1) {
+            CHECK(!"echo send");
+            break;
+        }
+    }
+}
+
+static cpipe::task<> request_all(cpipe::scheduler &s, echo_client *c) {
+    char msg[MSG_SIZE];
+    struct pipe_frame reply;
+
+    for (int i = 0; i < MANY_REQUESTS; i++) {
+        memset(msg, 'x', sizeof(msg));
+        snprintf(msg, sizeof(msg), "%d:%d", c->id, i);
+        int len = co_await cpipe::async_request(s, &c->p.client, PIPE_MSG_DATA, msg, sizeof(msg), &reply,
+                                                pipe_deadline_from_timeout(TEST_TIMEOUT));
+        if (len == -1) {
+            CHECK(!"request");
+            break;
+        }
+        c->echoed += len == MSG_SIZE && memcmp(reply.payload, msg, MSG_SIZE) == 0;
+    }
+    co_await cpipe::async_send(s, &c->p.client, PIPE_MSG_BYE, NULL, 0, pipe_deadline_from_timeout(TEST_TIMEOUT));
+}
+
+static int test_many_clients(void) {
+    cpipe::scheduler s;
+    std::vector<echo_client> clients(MANY_CLIENTS);
+    int opened, ret = 0;
+
+    for (opened = 0; opened < MANY_CLIENTS; opened++) {
+        echo_client &c = clients[opened];
+        c.id = opened;
+        c.echoed = 0;
+        if (open_client(&c.p.client, opened) == -1) {
+            ret = -1;
+            break;
+        }
+        if (open_echo(&c.p.echo, opened) == -1) {
+            pipe_conn_close(&c.p.client);
+            ret = -1;
+            break;
+        }
+    }
+    if (ret == 0) {
+        for (echo_client &c : clients) {
+            s.spawn(echo_all(s, &c));
+            s.spawn(request_all(s, &c));
+        }
+        CHECK(s.run() == 0);
+        for (const echo_client &c : clients) {
+            CHECK(c.echoed == MANY_REQUESTS);
+        }
+    }
+    for (int i = 0; i < opened; i++) {
+        cpipe::close_conn(s, &clients[i].p.client);
+        cpipe::close_conn(s, &clients[i].p.echo);
+    }
+    unlink_pipes(MANY_CLIENTS);
+    return ret;
+}
+
+int main(int argc, char *argv[]) {
+    static const struct {
+        const char *name;
+        int (*run)(void);
+    } cases[] = {
+        { "round_trip", test_round_trip },
+        { "timeout", test_timeout },
+        { "cancel", test_cancel },
+        { "many_clients", test_many_clients },
+    };
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <case>\n", argv[0]);
+        return 2;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    for (const auto &c : cases) {
+        if (strcmp(argv[1], c.name) == 0) {
+            case_name = c.name;
+            if (c.run() == -1) {
+                fprintf(stderr, "%s: setup failed: %s\n", c.name, strerror(errno));
+                failed = true;
+            }
+            unlink_pipes(1);
+            printf("test=%s %s\n", c.name, failed ? "FAIL" : "ok");
+            return failed ? 1 : 0;
+        }
+    }
+    fprintf(stderr, "unknown case %s\n", argv[1]);
+    return 2;
+}